@@ -0,0 +1,215 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_build.hpp"
+#include "cl_gemv.hpp"
+#include "philox.hpp"
+#include "mat_mult_cl.hpp"
+#include "mat_mult_transpose_cl.hpp"
+
+// Builds a set of programs for every device, first one after another with
+// h_build_program, then all at once with the build service. As soon as a device
+// has mat_mult it starts a matrix multiply, while the other builds carry on.
+// Each round has its own -D option so that neither is served from a driver's
+// build cache. Usage: build_async [number of worker threads]
+
+// Size of the square matrices each device multiplies
+#define NMAT 256
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    cl_int errcode;
+
+    cl_uint nworkers=(argc>1) ? (cl_uint)atoi(argv[1]) : 0;
+
+    // Get devices and contexts, one context per device
+    cl_uint num_platforms, num_devices;
+    cl_platform_id *platforms;
+    cl_device_id *devices;
+    cl_context *contexts;
+
+    h_acquire_devices(  CL_DEVICE_TYPE_ALL,
+                        &platforms, &num_platforms,
+                        &devices, &num_devices,
+                        &contexts);
+
+    // One in-order command queue per device
+    cl_uint num_command_queues=num_devices;
+    cl_command_queue* command_queues=h_create_command_queues(  devices,
+                                                                contexts,
+                                                                num_devices,
+                                                                num_command_queues,
+                                                                CL_FALSE,
+                                                                CL_FALSE);
+    for (cl_uint d=0; d<num_devices; d++) {
+        printf("Device %u:\n", d);
+        h_report_on_device(devices[d]);
+    }
+
+    // The programs every device needs
+    const char* names[]={ "mat_mult", "mat_mult_transpose", "gemm", "gemv" };
+    const char* sources[]={ mat_mult_cl.source, mat_mult_transpose_cl.source, gemm_kernel_source, gemv_kernel_source };
+    const size_t nprograms=sizeof(names)/sizeof(names[0]);
+
+    // One after another
+    high_resolution_clock::time_point sequential_start=high_resolution_clock::now();
+    for (cl_uint d=0; d<num_devices; d++) {
+        for (size_t p=0; p<nprograms; p++) {
+            cl_program program=h_build_program(sources[p], contexts[d], devices[d], "-DBUILD_ROUND=1");
+            h_errchk(clReleaseProgram(program), "Releasing a program");
+        }
+    }
+    cl_double time_sequential=h_ms_since(sequential_start);
+
+    // Inputs for the multiply on each device
+    size_t nelements=NMAT*NMAT;
+    float* array_A_1D=(float*)malloc(nelements*sizeof(float));
+    float* array_B_1D=(float*)malloc(nelements*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, NMAT, NMAT, NMAT, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, NMAT, NMAT, NMAT, SEED, 1, -1.0f, 1.0f);
+
+    std::vector<cl_mem> buffers_A(num_devices), buffers_B(num_devices), buffers_C(num_devices);
+    std::vector<cl_kernel> kernels(num_devices, (cl_kernel)NULL);
+    std::vector<cl_program> programs;
+
+    // All at once, timed from the service starting to the last build finishing,
+    // so the multiplies started in between don't count
+    high_resolution_clock::time_point async_start=high_resolution_clock::now();
+    h_build_service* service=h_create_build_service(nworkers);
+    for (cl_uint d=0; d<num_devices; d++) {
+        for (size_t p=0; p<nprograms; p++) {
+            h_submit_build(service, contexts[d], devices[d], sources[p], "-DBUILD_ROUND=2", names[p]);
+        }
+    }
+
+    // Start the multiply on each device as soon as its mat_mult is ready
+    h_build_job* job;
+    while ((job=h_wait_any_build(service))!=NULL) {
+        programs.push_back(job->program);
+        cl_uint d=0;
+        while (devices[d]!=job->device) d++;
+        printf("%10.3f ms: %s ready on device %u\n", h_ms_since(async_start), job->label.c_str(), d);
+        if (job->label!="mat_mult") continue;
+
+        buffers_A[d]=clCreateBuffer(contexts[d], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nelements*sizeof(float), array_A_1D, &errcode);
+        h_errchk(errcode, "Creating buffer_A");
+        buffers_B[d]=clCreateBuffer(contexts[d], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nelements*sizeof(float), array_B_1D, &errcode);
+        h_errchk(errcode, "Creating buffer_B");
+        buffers_C[d]=clCreateBuffer(contexts[d], CL_MEM_WRITE_ONLY, nelements*sizeof(float), NULL, &errcode);
+        h_errchk(errcode, "Creating buffer_C");
+
+        kernels[d]=clCreateKernel(job->program, "mat_mult", &errcode);
+        h_errchk(errcode, "Creating Kernel mat_mult");
+        cl_int nrows=NMAT;
+        h_errchk(clSetKernelArg(kernels[d], 0, sizeof(cl_mem), &buffers_A[d]), "setting mat_mult argument 0");
+        h_errchk(clSetKernelArg(kernels[d], 1, sizeof(cl_mem), &buffers_B[d]), "setting mat_mult argument 1");
+        h_errchk(clSetKernelArg(kernels[d], 2, sizeof(cl_mem), &buffers_C[d]), "setting mat_mult argument 2");
+        h_errchk(clSetKernelArg(kernels[d], 3, sizeof(cl_int), &nrows), "setting mat_mult argument 3");
+        h_errchk(clSetKernelArg(kernels[d], 4, sizeof(cl_int), &nrows), "setting mat_mult argument 4");
+        const size_t global_size[]={ NMAT, NMAT };
+        h_errchk(clEnqueueNDRangeKernel(command_queues[d], kernels[d], 2, NULL, global_size, NULL, 0, NULL, NULL),
+                "Running mat_mult");
+        h_errchk(clFlush(command_queues[d]), "Flushing the command queue");
+        printf("%10.3f ms: multiply started on device %u\n", h_ms_since(async_start), d);
+    }
+    cl_double time_async=h_build_span_ms(service);
+
+    printf("\n");
+    h_report_builds(service);
+    h_release_build_service(service);
+    printf("\nBuilt %zu programs on %u devices one after another in %.3f ms, all at once in %.3f ms\n",
+            nprograms, num_devices, time_sequential, time_async);
+
+    // Check the multiply from every device, relative to the largest magnitude in C.
+    // Errors usually grow as sqrt(NMAT)*epsilon, NMAT*epsilon bounds them
+    int nfailed=0;
+    float* array_C_1D=(float*)malloc(nelements*sizeof(float));
+    for (cl_uint d=0; d<num_devices; d++) {
+        h_errchk(clEnqueueReadBuffer(command_queues[d], buffers_C[d], CL_TRUE, 0, nelements*sizeof(float), array_C_1D,
+                                    0, NULL, NULL), "Reading buffer_C");
+        double max_diff=0.0, max_C=0.0;
+        for (size_t i1=0; i1<NMAT; i1++) {
+            for (size_t i0=0; i0<NMAT; i0++) {
+                double temp=0.0;
+                for (size_t n=0; n<NMAT; n++) {
+                    temp+=(double)array_A_1D[n*NMAT+i0]*(double)array_B_1D[i1*NMAT+n];
+                }
+                max_diff=fmax(max_diff, fabs(array_C_1D[i1*NMAT+i0]-temp));
+                max_C=fmax(max_C, fabs(temp));
+            }
+        }
+        if (max_C==0.0) max_C=1.0;
+        std::string name="Device "+std::to_string(d)+" relative difference in C";
+        if (!h_check_tolerance(name.c_str(), max_diff/max_C, NMAT*FLT_EPSILON)) nfailed++;
+
+        h_errchk(clReleaseKernel(kernels[d]), "Releasing the kernel");
+        h_errchk(clReleaseMemObject(buffers_A[d]), "Releasing buffer_A");
+        h_errchk(clReleaseMemObject(buffers_B[d]), "Releasing buffer_B");
+        h_errchk(clReleaseMemObject(buffers_C[d]), "Releasing buffer_C");
+    }
+    for (size_t k=0; k<programs.size(); k++) {
+        h_errchk(clReleaseProgram(programs[k]), "Releasing a program");
+    }
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_C_1D);
+
+    // Release command queues, contexts and devices
+    h_release_command_queues(command_queues, num_command_queues);
+    h_release_devices(devices, num_devices, contexts, platforms);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d devices FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
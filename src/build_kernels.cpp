@@ -0,0 +1,135 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_embed.hpp"
+
+// Programs in the kernel library, generated from kernels/ by the Makefile
+#include "mat_mult_cl.hpp"
+#include "mat_mult_transp_cl.hpp"
+#include "mat_transpose_cl.hpp"
+#include "mat_mult_transpose_cl.hpp"
+#include "mat_mult_padded_cl.hpp"
+#include "mat_mult_int8_cl.hpp"
+
+// Offline compilation of the kernel library. Builds every program from its embedded
+// source for one device and writes the binaries to <directory>/<name>.bin, which
+// "make binaries" then embeds in the programs so they skip compiling from source.
+// Usage: build_kernels <directory> [device index]
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    if (argc<2) {
+        printf("Usage: build_kernels <directory> [device index]\n");
+        exit(EXIT_FAILURE);
+    }
+    const char* directory=argv[1];
+    cl_uint device_index=(argc>2) ? (cl_uint)atoi(argv[2]) : 0;
+
+    const h_embedded_program* library[]={
+        &mat_mult_cl,
+        &mat_mult_transp_cl,
+        &mat_transpose_cl,
+        &mat_mult_transpose_cl,
+        &mat_mult_padded_cl,
+        &mat_mult_int8_cl
+    };
+    size_t nprograms=sizeof(library)/sizeof(library[0]);
+
+    // Get devices and contexts, one context per device
+    cl_uint num_platforms, num_devices;
+    cl_platform_id *platforms;
+    cl_device_id *devices;
+    cl_context *contexts;
+
+    h_acquire_devices(  CL_DEVICE_TYPE_ALL,
+                        &platforms, &num_platforms,
+                        &devices, &num_devices,
+                        &contexts);
+    assert(device_index<num_devices);
+
+    cl_context context=contexts[device_index];
+    cl_device_id device=devices[device_index];
+    printf("Building for device:\n");
+    h_report_on_device(device);
+
+    for (size_t k=0; k<nprograms; k++) {
+        // Always from source, so an old embedded binary is never written back
+        high_resolution_clock::time_point build_start=high_resolution_clock::now();
+        cl_program program=h_build_program(library[k]->source, context, device);
+        duration<double> build_time=duration_cast<duration<double>>(high_resolution_clock::now()-build_start);
+
+        size_t nbytes_binary;
+        h_errchk(clGetProgramInfo(  program,
+                                    CL_PROGRAM_BINARY_SIZES,
+                                    sizeof(size_t),
+                                    &nbytes_binary,
+                                    NULL), "Getting the binary size");
+        unsigned char* binary=(unsigned char*)malloc(nbytes_binary);
+        h_errchk(clGetProgramInfo(  program,
+                                    CL_PROGRAM_BINARIES,
+                                    sizeof(unsigned char*),
+                                    &binary,
+                                    NULL), "Getting the binary");
+
+        std::string filename=std::string(directory)+"/"+library[k]->name+".bin";
+        FILE* fp=fopen(filename.c_str(), "wb");
+        assert(fp!=NULL);
+        fwrite(binary, 1, nbytes_binary, fp);
+        fclose(fp);
+        printf("%24s built in %8.3f s, %zu bytes written to %s\n",
+                library[k]->name, build_time.count(), nbytes_binary, filename.c_str());
+
+        free(binary);
+        h_errchk(clReleaseProgram(program), "Releasing the program");
+    }
+
+    // Release contexts and devices
+    h_release_devices(devices, num_devices, contexts, platforms);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+}
@@ -0,0 +1,260 @@
+#ifndef CL_BUILD_HPP
+#define CL_BUILD_HPP
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "cl_helper.hpp"
+
+// Program builds for many devices and programs at once. h_submit_build queues a
+// build and returns straight away. Worker threads call clBuildProgram with a
+// pfn_notify callback, so implementations that build asynchronously return at
+// once, and those that block only hold up their own worker. h_wait_any_build
+// hands back builds in the order they finish, so work can start on the first
+// device that is ready while the others are still compiling.
+// Needs -pthread.
+
+struct h_build_service;
+
+// One program being built for one device
+typedef struct {
+    cl_program program;
+    cl_device_id device;
+    std::string build_opts;
+    std::string label;
+    h_build_service* service;
+    // Set under the service mutex when the build finishes
+    bool done;
+    // What clBuildProgram returned, CL_SUCCESS until a call fails
+    cl_int build_error;
+    // Milliseconds from the service starting to clBuildProgram being called,
+    // and from then until the build finished
+    cl_double start_ms;
+    cl_double compile_ms;
+} h_build_job;
+
+struct h_build_service {
+    std::mutex mutex;
+    // Signals waiters that a build finished
+    std::condition_variable changed;
+    // Signals workers that a job is pending or the service is stopping
+    std::condition_variable work;
+    std::vector<std::thread> workers;
+    // Every job, owned by the service
+    std::vector<h_build_job*> jobs;
+    // Jobs waiting for a worker
+    std::deque<h_build_job*> pending;
+    // Finished jobs not yet returned by h_wait_any_build
+    std::deque<h_build_job*> finished;
+    size_t nreturned;
+    bool stopping;
+    std::chrono::high_resolution_clock::time_point created;
+};
+
+// Function to get the milliseconds since a service was created
+cl_double h_build_service_ms(h_build_service* service) {
+    using namespace std::chrono;
+    return duration_cast<duration<cl_double, std::milli>>(high_resolution_clock::now()-service->created).count();
+}
+
+// Function to mark a job finished, only the first call for a job counts.
+// A failed clBuildProgram is recorded even if the callback came first
+void h_build_finished(h_build_job* job, cl_int build_error=CL_SUCCESS) {
+    h_build_service* service=job->service;
+    std::lock_guard<std::mutex> lock(service->mutex);
+    if (build_error!=CL_SUCCESS) job->build_error=build_error;
+    if (job->done) return;
+    job->done=true;
+    job->compile_ms=h_build_service_ms(service)-job->start_ms;
+    service->finished.push_back(job);
+    service->changed.notify_all();
+}
+
+// Build callback, which OpenCL may call from a thread of its own.
+// The job already knows its program
+void CL_CALLBACK h_build_notify(cl_program, void* user_data) {
+    h_build_finished((h_build_job*)user_data);
+}
+
+// Function run by each worker thread, building jobs until the service stops
+void h_build_worker(h_build_service* service) {
+    while (true) {
+        h_build_job* job;
+        {
+            std::unique_lock<std::mutex> lock(service->mutex);
+            service->work.wait(lock, [service] { return service->stopping || !service->pending.empty(); });
+            if (service->pending.empty()) return;
+            job=service->pending.front();
+            service->pending.pop_front();
+            job->start_ms=h_build_service_ms(service);
+        }
+
+        cl_int errcode=clBuildProgram(  job->program,
+                                        1,
+                                        &job->device,
+                                        job->build_opts.c_str(),
+                                        h_build_notify,
+                                        job);
+        // Not every implementation calls back when a build fails
+        if (errcode!=CL_SUCCESS) h_build_finished(job, errcode);
+    }
+}
+
+// Function to start a build service with nworkers threads, or one per core when nworkers is 0
+h_build_service* h_create_build_service(cl_uint nworkers=0) {
+    if (nworkers==0) nworkers=std::thread::hardware_concurrency();
+    if (nworkers==0) nworkers=1;
+
+    h_build_service* service=new h_build_service;
+    service->nreturned=0;
+    service->stopping=false;
+    service->created=std::chrono::high_resolution_clock::now();
+    for (cl_uint n=0; n<nworkers; n++) {
+        service->workers.push_back(std::thread(h_build_worker, service));
+    }
+    return service;
+}
+
+// Function to queue a build of source for a device. build_opts and label may be NULL
+h_build_job* h_submit_build(
+        h_build_service* service,
+        cl_context context,
+        cl_device_id device,
+        const char* source,
+        const char* build_opts=NULL,
+        const char* label=NULL) {
+
+    cl_int errcode;
+    h_build_job* job=new h_build_job;
+    job->program=clCreateProgramWithSource(context, 1, &source, NULL, &errcode);
+    h_errchk(errcode, "Creating a program to build");
+    job->device=device;
+    job->build_opts=(build_opts!=NULL) ? build_opts : "";
+    job->label=(label!=NULL) ? label : "";
+    job->service=service;
+    job->done=false;
+    job->build_error=CL_SUCCESS;
+    job->start_ms=0.0;
+    job->compile_ms=0.0;
+
+    std::lock_guard<std::mutex> lock(service->mutex);
+    service->jobs.push_back(job);
+    service->pending.push_back(job);
+    service->work.notify_one();
+    return job;
+}
+
+// Function to check a finished job, printing the error code from clBuildProgram
+// with the build log and exiting if it failed
+void h_check_build(h_build_job* job) {
+    cl_int build_error;
+    {
+        std::lock_guard<std::mutex> lock(job->service->mutex);
+        build_error=job->build_error;
+    }
+    cl_build_status status;
+    h_errchk(clGetProgramBuildInfo( job->program,
+                                    job->device,
+                                    CL_PROGRAM_BUILD_STATUS,
+                                    sizeof(cl_build_status),
+                                    &status,
+                                    NULL), "Getting the build status");
+    if (build_error!=CL_SUCCESS || status!=CL_BUILD_SUCCESS) {
+        std::string message="Building "+job->label+" failed";
+        if (build_error!=CL_SUCCESS) {
+            message+=" with error code ";
+            if (error_codes.count(build_error)>0) message+=error_codes[build_error]+" ";
+            message+="("+std::to_string(build_error)+")";
+        }
+        h_exit_with_program_log(job->program, job->device, message.c_str());
+    }
+}
+
+// Function to wait for the next build to finish, in the order they finish.
+// Returns NULL once every submitted job has been returned
+h_build_job* h_wait_any_build(h_build_service* service) {
+    h_build_job* job;
+    {
+        std::unique_lock<std::mutex> lock(service->mutex);
+        if (service->nreturned==service->jobs.size()) return NULL;
+        service->changed.wait(lock, [service] { return !service->finished.empty(); });
+        job=service->finished.front();
+        service->finished.pop_front();
+        service->nreturned++;
+    }
+    h_check_build(job);
+    return job;
+}
+
+// Function to wait for every submitted build to finish, and check them
+void h_wait_all_builds(h_build_service* service) {
+    std::vector<h_build_job*> jobs;
+    {
+        std::unique_lock<std::mutex> lock(service->mutex);
+        service->changed.wait(lock, [service] {
+            for (size_t k=0; k<service->jobs.size(); k++) {
+                if (!service->jobs[k]->done) return false;
+            }
+            return true;
+        });
+        jobs=service->jobs;
+    }
+    for (size_t k=0; k<jobs.size(); k++) h_check_build(jobs[k]);
+}
+
+// Function to print when each build started and how long it took, in order of submission
+void h_report_builds(h_build_service* service) {
+    std::lock_guard<std::mutex> lock(service->mutex);
+    printf("%24s %32s %12s %12s\n", "program", "device", "start (ms)", "compile (ms)");
+    for (size_t k=0; k<service->jobs.size(); k++) {
+        h_build_job* job=service->jobs[k];
+        char device_name[256]="";
+        h_errchk(clGetDeviceInfo(job->device, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL),
+                "Getting the device name");
+        if (job->done) {
+            printf("%24s %32.32s %12.3f %12.3f\n", job->label.c_str(), device_name, job->start_ms, job->compile_ms);
+        } else {
+            printf("%24s %32.32s %12s %12s\n", job->label.c_str(), device_name, "building", "");
+        }
+    }
+}
+
+// Function to get the milliseconds from the service starting until its last finished
+// build finished, which covers the builds alone and not what the caller did meanwhile
+cl_double h_build_span_ms(h_build_service* service) {
+    std::lock_guard<std::mutex> lock(service->mutex);
+    cl_double span=0.0;
+    for (size_t k=0; k<service->jobs.size(); k++) {
+        h_build_job* job=service->jobs[k];
+        if (job->done) span=fmax(span, job->start_ms+job->compile_ms);
+    }
+    return span;
+}
+
+// Function to wait for outstanding builds, stop the workers and free the jobs.
+// The programs belong to the caller and are not released
+void h_release_build_service(h_build_service* service) {
+    {
+        std::unique_lock<std::mutex> lock(service->mutex);
+        service->changed.wait(lock, [service] {
+            for (size_t k=0; k<service->jobs.size(); k++) {
+                if (!service->jobs[k]->done) return false;
+            }
+            return true;
+        });
+        service->stopping=true;
+        service->work.notify_all();
+    }
+    for (size_t n=0; n<service->workers.size(); n++) service->workers[n].join();
+    for (size_t k=0; k<service->jobs.size(); k++) delete service->jobs[k];
+    delete service;
+}
+
+#endif
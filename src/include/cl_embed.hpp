@@ -0,0 +1,56 @@
+#ifndef CL_EMBED_HPP
+#define CL_EMBED_HPP
+
+#include <string.h>
+
+#include "cl_helper.hpp"
+
+// Programs from the kernel library in kernels/, embedded into the executable at
+// build time. The Makefile turns each kernels/<name>.cl into gen/<name>_cl.hpp,
+// which defines h_embedded_program <name>_cl, so no kernel files are read at run time.
+// After "make binaries" the headers also hold a device binary, compiled without
+// build options for the first device on the machine that ran it.
+
+typedef struct {
+    const char* name;
+    // Device binary, nbytes_binary is 0 when there is none
+    const unsigned char* binary;
+    size_t nbytes_binary;
+    // Source with its includes expanded
+    const char* source;
+} h_embedded_program;
+
+// Function to build an embedded program for a device. The embedded binary is used
+// when there is one, build_opts are empty and the device accepts it, otherwise
+// the program is built from the embedded source
+cl_program h_build_embedded_program(
+        const h_embedded_program* embedded,
+        cl_context context,
+        cl_device_id device,
+        const char* build_opts=NULL) {
+
+    cl_bool default_opts=(build_opts==NULL || strlen(build_opts)==0) ? CL_TRUE : CL_FALSE;
+    if (embedded->nbytes_binary>0 && default_opts) {
+        cl_int binary_status, errcode;
+        const unsigned char* binary=embedded->binary;
+        cl_program program=clCreateProgramWithBinary(   context,
+                                                        1,
+                                                        &device,
+                                                        &embedded->nbytes_binary,
+                                                        &binary,
+                                                        &binary_status,
+                                                        &errcode);
+        // A binary from another device or driver is rejected here
+        if (errcode==CL_SUCCESS && binary_status==CL_SUCCESS) {
+            if (clBuildProgram(program, 1, &device, build_opts, NULL, NULL)==CL_SUCCESS) {
+                return program;
+            }
+        }
+        if (errcode==CL_SUCCESS) {
+            h_errchk(clReleaseProgram(program), "Releasing a rejected binary program");
+        }
+    }
+    return h_build_program(embedded->source, context, device, build_opts);
+}
+
+#endif
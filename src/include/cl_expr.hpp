@@ -0,0 +1,305 @@
+#ifndef CL_EXPR_HPP
+#define CL_EXPR_HPP
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cl_helper.hpp"
+
+// Element-wise expressions over float matrices on the device, fused into one kernel.
+// Writing A*2.0f+h_exp(B) only records the expression, and h_enqueue_eval turns it
+// into a kernel that computes it in a single pass over memory. Kernels are built
+// with h_build_program the first time an expression of a given shape is seen and
+// cached after that. Scalars are kernel arguments, so a new value needs no rebuild.
+
+// A float matrix in a device buffer, in Fortran ordering with no padding
+struct h_device_matrix;
+
+// What an expression needs at run time, the distinct buffers and scalars it reads,
+// in the order they appear as kernel arguments m0, m1, ... and s0, s1, ...
+typedef struct {
+    std::vector<cl_mem> buffers;
+    std::vector<cl_float> scalars;
+    size_t nrows;
+    size_t ncols;
+} h_expr_args;
+
+// Base of every expression, so the operators below only pick up expressions.
+// Each expression E has a member std::string source(h_expr_args* args) const,
+// which returns the OpenCL C for element i and records its buffers and scalars
+template<typename E>
+struct h_expr {
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+struct h_device_matrix : h_expr<h_device_matrix> {
+    cl_mem buffer;
+    size_t nrows;
+    size_t ncols;
+
+    std::string source(h_expr_args* args) const {
+        if (nrows!=args->nrows || ncols!=args->ncols) {
+            h_errchk(CL_INVALID_VALUE, "Checking matrix sizes in an expression");
+        }
+        // A matrix used more than once is passed once
+        size_t index=0;
+        while (index<args->buffers.size() && args->buffers[index]!=buffer) index++;
+        if (index==args->buffers.size()) args->buffers.push_back(buffer);
+        return "m"+std::to_string(index)+"[i]";
+    }
+};
+
+// A scalar, passed as a kernel argument
+struct h_expr_scalar : h_expr<h_expr_scalar> {
+    cl_float value;
+
+    std::string source(h_expr_args* args) const {
+        args->scalars.push_back(value);
+        return "s"+std::to_string(args->scalars.size()-1);
+    }
+};
+
+// An operation on two expressions, written as prefix, left, infix, right, suffix,
+// e.g. "(", "+", ")" for addition and "fmax(", ", ", ")" for the larger of two
+template<typename L, typename R>
+struct h_expr_binary : h_expr<h_expr_binary<L, R> > {
+    L left;
+    R right;
+    const char* prefix;
+    const char* infix;
+    const char* suffix;
+
+    std::string source(h_expr_args* args) const {
+        std::string left_source=left.source(args);
+        return prefix+left_source+infix+right.source(args)+suffix;
+    }
+};
+
+// A built-in function of one expression, such as exp
+template<typename E>
+struct h_expr_unary : h_expr<h_expr_unary<E> > {
+    E operand;
+    const char* function;
+
+    std::string source(h_expr_args* args) const {
+        return std::string(function)+"("+operand.source(args)+")";
+    }
+};
+
+// condition ? if_true : if_false, where any non-zero condition is true
+template<typename C, typename T, typename F>
+struct h_expr_select : h_expr<h_expr_select<C, T, F> > {
+    C condition;
+    T if_true;
+    F if_false;
+
+    std::string source(h_expr_args* args) const {
+        std::string condition_source=condition.source(args);
+        std::string true_source=if_true.source(args);
+        return "(("+condition_source+")!=0.0f ? "+true_source+" : "+if_false.source(args)+")";
+    }
+};
+
+// Functions to make the nodes of an expression
+template<typename L, typename R>
+h_expr_binary<L, R> h_make_binary(const L& left, const R& right, const char* prefix, const char* infix, const char* suffix) {
+    h_expr_binary<L, R> node;
+    node.left=left;
+    node.right=right;
+    node.prefix=prefix;
+    node.infix=infix;
+    node.suffix=suffix;
+    return node;
+}
+
+h_expr_scalar h_make_scalar(cl_float value) {
+    h_expr_scalar node;
+    node.value=value;
+    return node;
+}
+
+template<typename E>
+h_expr_unary<E> h_make_unary(const E& operand, const char* function) {
+    h_expr_unary<E> node;
+    node.operand=operand;
+    node.function=function;
+    return node;
+}
+
+// Arithmetic between two expressions, or an expression and a scalar on either side
+#define H_EXPR_OPERATOR(OP, INFIX) \
+template<typename L, typename R> \
+h_expr_binary<L, R> operator OP(const h_expr<L>& left, const h_expr<R>& right) { \
+    return h_make_binary(left.self(), right.self(), "(", INFIX, ")"); \
+} \
+template<typename L> \
+h_expr_binary<L, h_expr_scalar> operator OP(const h_expr<L>& left, cl_float right) { \
+    return h_make_binary(left.self(), h_make_scalar(right), "(", INFIX, ")"); \
+} \
+template<typename R> \
+h_expr_binary<h_expr_scalar, R> operator OP(cl_float left, const h_expr<R>& right) { \
+    return h_make_binary(h_make_scalar(left), right.self(), "(", INFIX, ")"); \
+}
+
+H_EXPR_OPERATOR(+, "+")
+H_EXPR_OPERATOR(-, "-")
+H_EXPR_OPERATOR(*, "*")
+H_EXPR_OPERATOR(/, "/")
+
+#undef H_EXPR_OPERATOR
+
+template<typename E>
+h_expr_unary<E> h_exp(const h_expr<E>& operand) { return h_make_unary(operand.self(), "exp"); }
+
+template<typename E>
+h_expr_unary<E> h_log(const h_expr<E>& operand) { return h_make_unary(operand.self(), "log"); }
+
+template<typename E>
+h_expr_unary<E> h_abs(const h_expr<E>& operand) { return h_make_unary(operand.self(), "fabs"); }
+
+template<typename E>
+h_expr_unary<E> h_sqrt(const h_expr<E>& operand) { return h_make_unary(operand.self(), "sqrt"); }
+
+template<typename L, typename R>
+h_expr_binary<L, R> h_max(const h_expr<L>& left, const h_expr<R>& right) {
+    return h_make_binary(left.self(), right.self(), "fmax(", ", ", ")");
+}
+
+template<typename L, typename R>
+h_expr_binary<L, R> h_min(const h_expr<L>& left, const h_expr<R>& right) {
+    return h_make_binary(left.self(), right.self(), "fmin(", ", ", ")");
+}
+
+template<typename C, typename T, typename F>
+h_expr_select<C, T, F> h_where(const h_expr<C>& condition, const h_expr<T>& if_true, const h_expr<F>& if_false) {
+    h_expr_select<C, T, F> node;
+    node.condition=condition.self();
+    node.if_true=if_true.self();
+    node.if_false=if_false.self();
+    return node;
+}
+
+// The expression where mask is non-zero, and zero elsewhere
+template<typename E, typename M>
+h_expr_select<M, E, h_expr_scalar> h_mask(const h_expr<E>& expr, const h_expr<M>& mask) {
+    return h_where(mask, expr, h_make_scalar(0.0f));
+}
+
+// Function to allocate a device matrix, copying from host_data if it is not NULL
+h_device_matrix h_create_device_matrix(cl_context context, size_t nrows, size_t ncols, const float* host_data=NULL) {
+    h_device_matrix matrix;
+    matrix.nrows=nrows;
+    matrix.ncols=ncols;
+    cl_int errcode;
+    cl_mem_flags flags=(host_data!=NULL) ? (CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR) : CL_MEM_READ_WRITE;
+    matrix.buffer=clCreateBuffer(context, flags, nrows*ncols*sizeof(cl_float), (void*)host_data, &errcode);
+    h_errchk(errcode, "Creating a device matrix");
+    return matrix;
+}
+
+// Function to release the buffer of a device matrix
+void h_release_device_matrix(h_device_matrix* matrix) {
+    h_errchk(clReleaseMemObject(matrix->buffer), "Releasing a device matrix");
+}
+
+// Kernels built for one device, keyed by their source
+typedef struct {
+    cl_context context;
+    cl_device_id device;
+    std::map<std::string, cl_program> programs;
+    std::map<std::string, cl_kernel> kernels;
+    size_t nbuilds;
+    size_t nhits;
+} h_expr_cache;
+
+// Function to make an empty kernel cache for a device
+h_expr_cache h_create_expr_cache(cl_context context, cl_device_id device) {
+    h_expr_cache cache;
+    cache.context=context;
+    cache.device=device;
+    cache.nbuilds=0;
+    cache.nhits=0;
+    return cache;
+}
+
+// Function to release every kernel and program in a cache
+void h_release_expr_cache(h_expr_cache* cache) {
+    for (auto& entry : cache->kernels) {
+        h_errchk(clReleaseKernel(entry.second), "Releasing an expression kernel");
+    }
+    for (auto& entry : cache->programs) {
+        h_errchk(clReleaseProgram(entry.second), "Releasing an expression program");
+    }
+    cache->kernels.clear();
+    cache->programs.clear();
+}
+
+// Function to get the kernel for an expression from the cache, building it if needed
+cl_kernel h_expr_kernel(h_expr_cache* cache, const std::string& body, const h_expr_args* args) {
+    std::string source="\n__kernel void expr_eval(ulong n, __global float* dest";
+    for (size_t k=0; k<args->buffers.size(); k++) source+=", __global float* m"+std::to_string(k);
+    for (size_t k=0; k<args->scalars.size(); k++) source+=", float s"+std::to_string(k);
+    source+=") {\n    size_t i=get_global_id(0);\n    if (i<n) dest[i]="+body+";\n}\n";
+
+    auto found=cache->kernels.find(source);
+    if (found!=cache->kernels.end()) {
+        cache->nhits++;
+        return found->second;
+    }
+
+    cl_program program=h_build_program(source.c_str(), cache->context, cache->device);
+    cl_int errcode;
+    cl_kernel kernel=clCreateKernel(program, "expr_eval", &errcode);
+    h_errchk(errcode, "Creating Kernel expr_eval");
+    cache->programs[source]=program;
+    cache->kernels[source]=kernel;
+    cache->nbuilds++;
+    return kernel;
+}
+
+// Function to enqueue dest=expr in one kernel. dest may also appear in expr, since
+// each element only depends on the same element of the inputs.
+// Returns the event of the kernel
+template<typename E>
+cl_event h_enqueue_eval(
+        cl_command_queue command_queue,
+        h_expr_cache* cache,
+        h_device_matrix* dest,
+        const h_expr<E>& expr,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    h_expr_args args;
+    args.nrows=dest->nrows;
+    args.ncols=dest->ncols;
+    std::string body=expr.self().source(&args);
+    cl_kernel kernel=h_expr_kernel(cache, body, &args);
+
+    cl_ulong n=dest->nrows*dest->ncols;
+    cl_uint arg=0;
+    h_errchk(clSetKernelArg(kernel, arg++, sizeof(cl_ulong), &n), "setting expr_eval argument n");
+    h_errchk(clSetKernelArg(kernel, arg++, sizeof(cl_mem), &dest->buffer), "setting expr_eval argument dest");
+    for (size_t k=0; k<args.buffers.size(); k++) {
+        h_errchk(clSetKernelArg(kernel, arg++, sizeof(cl_mem), &args.buffers[k]), "setting expr_eval matrix argument");
+    }
+    for (size_t k=0; k<args.scalars.size(); k++) {
+        h_errchk(clSetKernelArg(kernel, arg++, sizeof(cl_float), &args.scalars[k]), "setting expr_eval scalar argument");
+    }
+
+    size_t global_size[]={ (size_t)n };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    NULL,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running expr_eval");
+    return event;
+}
+
+#endif
@@ -0,0 +1,1091 @@
+#ifndef CL_GEMM_HPP
+#define CL_GEMM_HPP
+
+#include <limits.h>
+#include <float.h>
+#include <string.h>
+
+#include "cl_helper.hpp"
+
+// General matrix multiply C=alpha*op(A)*op(B)+beta*C on device buffers, with BLAS-style
+// transpose flags, leading dimensions and offsets, and a choice of column-major (Fortran) 
+// or row-major ordering.
+// The kernel transposes operands while it loads them into local memory,
+// so no separate transpose pass or transposed copy of an operand is needed.
+// h_enqueue_sgemm_checked also verifies C with row and column checksums (ABFT).
+
+// Storage order of all three matrices
+typedef enum {
+    H_COL_MAJOR=0,
+    H_ROW_MAJOR=1
+} h_order;
+
+// Whether an operand is used as stored or transposed
+typedef enum {
+    H_NO_TRANS=0,
+    H_TRANS=1
+} h_trans;
+
+// Which operand of C=op(A)*op(B) a matrix is
+typedef enum {
+    H_OPERAND_A=0,
+    H_OPERAND_B=1
+} h_operand;
+
+// Bias added to C=alpha*op(A)*op(B)+beta*C by the epilogue, 
+// one value for each row of C or one for each column
+typedef enum {
+    H_BIAS_NONE=0,
+    H_BIAS_ROW=1,
+    H_BIAS_COL=2
+} h_bias;
+
+// Activation applied by the epilogue after the bias
+typedef enum {
+    H_ACTIVATION_NONE=0,
+    H_ACTIVATION_RELU=1,
+    H_ACTIVATION_SIGMOID=2,
+    H_ACTIVATION_CLAMP=3
+} h_activation;
+
+// Tile size for the kernel, shrunk if the device can't fit a tile in a work-group
+#define GEMM_TILE_DIM 16
+
+// Multiple of the rounding error bound (number of terms summed times machine epsilon)
+// that a checksum of C may differ by before the multiply is flagged as faulty
+#define GEMM_CHECK_TOL_FACTOR 1.0f
+
+// Kernel source for gemm_tiled, gemm_pack and the checksum kernels
+const char* gemm_kernel_source="\n\
+    // Tile size, set with -DTILE_DIM at build time \n\
+    #ifndef TILE_DIM \n\
+    #define TILE_DIM 16 \n\
+    #endif \n\
+    // Epilogue of gemm_tiled when built with -DEPILOGUE, as in h_bias and h_activation \n\
+    #ifndef BIAS \n\
+    #define BIAS 0 \n\
+    #endif \n\
+    #ifndef ACTIVATION \n\
+    #define ACTIVATION 0 \n\
+    #endif \n\
+    \n\
+    // C=alpha*op(A)*op(B)+beta*C for column-major matrices, where op(A) is M x K and op(B) is K x N. \n\
+    // Each matrix starts offset elements into its buffer and has its own leading dimension, \n\
+    // so sub-matrices of larger matrices are used in place. \n\
+    // Each work-group computes a TILE_DIM x TILE_DIM tile of C, stepping through K \n\
+    // one pair of tiles at a time. Tiles are always read along the stored columns, \n\
+    // so the reads are coalesced whether or not an operand is transposed, \n\
+    // and the transpose happens on the way into local memory. \n\
+    // Local tiles are stored as [k][i] and [k][j] and padded by one column \n\
+    // so that the transposed writes do not hit the same bank. \n\
+    // An operand packed by gemm_pack is already in tiles, \n\
+    // so its leading dimension and transpose flag are ignored. \n\
+    // Built with -DEPILOGUE, a bias for each row (BIAS=1) or column (BIAS=2) of C is \n\
+    // added and ReLU (ACTIVATION=1), the logistic sigmoid (2) or a clamp to \n\
+    // [clamp_lower, clamp_upper] (3) applied before C is stored. \n\
+    // Built with -DTOPK_EPILOGUE, C is not stored at all. Instead the topk_tile largest \n\
+    // values of alpha*op(A)*op(B) in each column of the tile and their row indices go \n\
+    // to the candidates for that column, for the topk kernel to finish \n\
+    __kernel void gemm_tiled(   int M, \n\
+                                int N, \n\
+                                int K, \n\
+                                float alpha, \n\
+                                __global float* A, \n\
+                                ulong offset_A, \n\
+                                int lda, \n\
+                                int trans_A, \n\
+                                int packed_A, \n\
+                                __global float* B, \n\
+                                ulong offset_B, \n\
+                                int ldb, \n\
+                                int trans_B, \n\
+                                int packed_B, \n\
+                                float beta, \n\
+                                __global float* C, \n\
+                                ulong offset_C, \n\
+                                int ldc \n\
+    #ifdef EPILOGUE \n\
+                                , __global float* bias, \n\
+                                float clamp_lower, \n\
+                                float clamp_upper \n\
+    #endif \n\
+    #ifdef TOPK_EPILOGUE \n\
+                                , int topk_tile, \n\
+                                __global float* candidate_values, \n\
+                                __global uint* candidate_indices \n\
+    #endif \n\
+                                ) { \n\
+        __local float tile_A[TILE_DIM][TILE_DIM+1]; \n\
+        __local float tile_B[TILE_DIM][TILE_DIM+1]; \n\
+    \n\
+        int l0=get_local_id(0); \n\
+        int l1=get_local_id(1); \n\
+        int base_i=get_group_id(0)*TILE_DIM; \n\
+        int base_j=get_group_id(1)*TILE_DIM; \n\
+        A+=offset_A; \n\
+        B+=offset_B; \n\
+        C+=offset_C; \n\
+    \n\
+        // Start of this work-group's panels in packed operands \n\
+        int nk_tiles=(K+TILE_DIM-1)/TILE_DIM; \n\
+        size_t panel_A=(size_t)get_group_id(0)*nk_tiles*TILE_DIM*TILE_DIM; \n\
+        size_t panel_B=(size_t)get_group_id(1)*nk_tiles*TILE_DIM*TILE_DIM; \n\
+    \n\
+        float temp=0.0f; \n\
+        for (int base_k=0; base_k<K; base_k+=TILE_DIM) { \n\
+            // Elements outside the matrices are filled with zeros \n\
+            if (packed_A) { \n\
+                // Packed tiles are contiguous and already zero-filled \n\
+                tile_A[l1][l0]=A[panel_A+base_k*TILE_DIM+l1*TILE_DIM+l0]; \n\
+            } else if (trans_A) { \n\
+                // op(A)[i,k] is A[k,i], read along k \n\
+                int i=base_i+l1; \n\
+                int k=base_k+l0; \n\
+                tile_A[l0][l1]=(i<M && k<K) ? A[(size_t)i*lda+k] : 0.0f; \n\
+            } else { \n\
+                int i=base_i+l0; \n\
+                int k=base_k+l1; \n\
+                tile_A[l1][l0]=(i<M && k<K) ? A[(size_t)k*lda+i] : 0.0f; \n\
+            } \n\
+            if (packed_B) { \n\
+                tile_B[l1][l0]=B[panel_B+base_k*TILE_DIM+l1*TILE_DIM+l0]; \n\
+            } else if (trans_B) { \n\
+                // op(B)[k,j] is B[j,k], read along j \n\
+                int k=base_k+l1; \n\
+                int j=base_j+l0; \n\
+                tile_B[l1][l0]=(k<K && j<N) ? B[(size_t)k*ldb+j] : 0.0f; \n\
+            } else { \n\
+                int k=base_k+l0; \n\
+                int j=base_j+l1; \n\
+                tile_B[l0][l1]=(k<K && j<N) ? B[(size_t)j*ldb+k] : 0.0f; \n\
+            } \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+            for (int k=0; k<TILE_DIM; k++) { \n\
+                temp+=tile_A[k][l0]*tile_B[k][l1]; \n\
+            } \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+    \n\
+        int i=base_i+l0; \n\
+        int j=base_j+l1; \n\
+    #ifdef TOPK_EPILOGUE \n\
+        // Rank each value within its column of the tile, rows past M rank last. \n\
+        // Candidates for column j are stored tile by tile, topk_tile per tile \n\
+        float value=(i<M) ? alpha*temp : -INFINITY; \n\
+        tile_A[l1][l0]=value; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+        if (j<N) { \n\
+            int rank=0; \n\
+            for (int r=0; r<TILE_DIM; r++) { \n\
+                float other=tile_A[l1][r]; \n\
+                if (other>value || (other==value && r<l0)) rank++; \n\
+            } \n\
+            if (rank<topk_tile) { \n\
+                size_t slot=((size_t)j*get_num_groups(0)+get_group_id(0))*topk_tile+rank; \n\
+                candidate_values[slot]=value; \n\
+                candidate_indices[slot]=(i<M) ? (uint)i : UINT_MAX; \n\
+            } \n\
+        } \n\
+    #else \n\
+        if (i<M && j<N) { \n\
+            // As in BLAS, C is not read when beta is zero, so it may hold anything \n\
+            size_t offset=(size_t)j*ldc+i; \n\
+            float value=(beta==0.0f) ? alpha*temp : alpha*temp+beta*C[offset]; \n\
+    #ifdef EPILOGUE \n\
+    #if BIAS==1 \n\
+            value+=bias[i]; \n\
+    #elif BIAS==2 \n\
+            value+=bias[j]; \n\
+    #endif \n\
+    #if ACTIVATION==1 \n\
+            value=fmax(value, 0.0f); \n\
+    #elif ACTIVATION==2 \n\
+            value=1.0f/(1.0f+exp(-value)); \n\
+    #elif ACTIVATION==3 \n\
+            value=clamp(value, clamp_lower, clamp_upper); \n\
+    #endif \n\
+    #endif \n\
+            C[offset]=value; \n\
+        } \n\
+    #endif \n\
+    } \n\
+    \n\
+    // Pack op(X) into tiles for gemm_tiled, once for an operand that is reused. \n\
+    // op(X) has n_outer rows or columns along the outer index, i for A and j for B, \n\
+    // and K along k. Tile (o/TILE_DIM, k/TILE_DIM) starts at element \n\
+    // ((o/TILE_DIM)*nk_tiles+k/TILE_DIM)*TILE_DIM*TILE_DIM, holds (o, k) at \n\
+    // (k%TILE_DIM)*TILE_DIM+o%TILE_DIM and is zero-filled past the edges of op(X). \n\
+    // outer_contiguous is set when o runs down the stored columns of X \n\
+    __kernel void gemm_pack(    __global float* src, \n\
+                                ulong offset, \n\
+                                int ld, \n\
+                                int outer_contiguous, \n\
+                                int n_outer, \n\
+                                int K, \n\
+                                __global float* dest) { \n\
+        int o=get_global_id(0); \n\
+        int k=get_global_id(1); \n\
+        int nk_tiles=(K+TILE_DIM-1)/TILE_DIM; \n\
+    \n\
+        float value=0.0f; \n\
+        if (o<n_outer && k<K) { \n\
+            value=outer_contiguous ? src[offset+(size_t)k*ld+o] : src[offset+(size_t)o*ld+k]; \n\
+        } \n\
+        size_t tile=(size_t)(o/TILE_DIM)*nk_tiles+k/TILE_DIM; \n\
+        dest[tile*TILE_DIM*TILE_DIM+(k%TILE_DIM)*TILE_DIM+o%TILE_DIM]=value; \n\
+    } \n\
+    \n\
+    // y=scale*op(X)*x+y_scale*y, with y_abs=|scale|*|op(X)|*x_abs+|y_scale|*y_abs bounding \n\
+    // the rounding error, for the checksums of h_enqueue_sgemm_checked. op(X) has n_outer \n\
+    // rows and K columns, outer_contiguous is as for gemm_pack, and x and x_abs are \n\
+    // vectors of ones when ones is set. y and y_abs are not read when y_scale is zero \n\
+    __kernel void gemm_check_vec(   __global float* X, \n\
+                                    ulong offset, \n\
+                                    int ld, \n\
+                                    int outer_contiguous, \n\
+                                    int n_outer, \n\
+                                    int K, \n\
+                                    __global float* x, \n\
+                                    __global float* x_abs, \n\
+                                    int ones, \n\
+                                    float scale, \n\
+                                    float y_scale, \n\
+                                    __global float* y, \n\
+                                    __global float* y_abs) { \n\
+        int o=get_global_id(0); \n\
+        if (o>=n_outer) return; \n\
+        X+=offset; \n\
+        float temp=0.0f; \n\
+        float temp_abs=0.0f; \n\
+        for (int k=0; k<K; k++) { \n\
+            float value=outer_contiguous ? X[(size_t)k*ld+o] : X[(size_t)o*ld+k]; \n\
+            temp+=ones ? value : value*x[k]; \n\
+            temp_abs+=ones ? fabs(value) : fabs(value)*x_abs[k]; \n\
+        } \n\
+        if (y_scale==0.0f) { \n\
+            y[o]=scale*temp; \n\
+            y_abs[o]=fabs(scale)*temp_abs; \n\
+        } else { \n\
+            y[o]=scale*temp+y_scale*y[o]; \n\
+            y_abs[o]=fabs(scale)*temp_abs+fabs(y_scale)*y_abs[o]; \n\
+        } \n\
+    } \n\
+    \n\
+    // Compare checksums of C with the expected ones. result[0] counts checksums further \n\
+    // than tol*expected_abs from the expected value, result[1] holds the largest relative \n\
+    // error as the bits of a positive float, which order the same way as the floats \n\
+    // themselves, and result[2] holds the smallest index of a failed checksum \n\
+    __kernel void gemm_check_compare(   __global float* expected, \n\
+                                        __global float* expected_abs, \n\
+                                        __global float* actual, \n\
+                                        int n, \n\
+                                        float tol, \n\
+                                        __global int* result) { \n\
+        int o=get_global_id(0); \n\
+        if (o>=n) return; \n\
+        float err=fabs(actual[o]-expected[o]); \n\
+        float scale=expected_abs[o]+FLT_MIN; \n\
+        // Written so that a NaN checksum also counts as a failure \n\
+        if (!(err<=tol*scale)) { \n\
+            atomic_inc(&result[0]); \n\
+            atomic_min(&result[2], o); \n\
+        } \n\
+        atomic_max(&result[1], as_int(err/scale)); \n\
+    } \n\
+";
+
+// A built GEMM program for one device, made once and reused for every multiply
+// A plan with an epilogue is built for one storage order, bias and activation
+typedef struct {
+    cl_program program;
+    cl_kernel kernel_gemm;
+    cl_kernel kernel_pack;
+    cl_kernel kernel_check_vec;
+    cl_kernel kernel_check_compare;
+    size_t tile_dim;
+    cl_bool epilogue;
+    h_order order;
+    h_bias bias;
+    h_activation activation;
+} h_gemm_plan;
+
+// An operand packed into tiles by h_pack_operand, resident on the device.
+// op(A) is M x K with n_outer=M, op(B) is K x N with n_outer=N
+typedef struct {
+    cl_mem buffer;
+    h_operand operand;
+    size_t n_outer;
+    size_t K;
+    size_t tile_dim;
+} h_packed_operand;
+
+// Function to build the GEMM kernels for a device, 
+// extra_opts are added to the build options for variants of the kernels
+h_gemm_plan h_create_gemm_plan(cl_context context, cl_device_id device, const char* extra_opts=NULL) {
+    h_gemm_plan plan;
+
+    // A work-group holds one tile of C
+    size_t max_work_group_size;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                sizeof(size_t),
+                                &max_work_group_size,
+                                NULL), "Getting the maximum work-group size");
+    plan.tile_dim=GEMM_TILE_DIM;
+    while (plan.tile_dim*plan.tile_dim>max_work_group_size) plan.tile_dim/=2;
+
+    char build_opts[256];
+    snprintf(build_opts, sizeof(build_opts), "-DTILE_DIM=%zu %s", plan.tile_dim, (extra_opts!=NULL) ? extra_opts : "");
+    plan.program=h_build_program(gemm_kernel_source, context, device, build_opts);
+
+    cl_int errcode;
+    plan.kernel_gemm=clCreateKernel(plan.program, "gemm_tiled", &errcode);
+    h_errchk(errcode, "Creating Kernel gemm_tiled");
+    plan.kernel_pack=clCreateKernel(plan.program, "gemm_pack", &errcode);
+    h_errchk(errcode, "Creating Kernel gemm_pack");
+    plan.kernel_check_vec=clCreateKernel(plan.program, "gemm_check_vec", &errcode);
+    h_errchk(errcode, "Creating Kernel gemm_check_vec");
+    plan.kernel_check_compare=clCreateKernel(plan.program, "gemm_check_compare", &errcode);
+    h_errchk(errcode, "Creating Kernel gemm_check_compare");
+
+    plan.epilogue=CL_FALSE;
+    plan.order=H_COL_MAJOR;
+    plan.bias=H_BIAS_NONE;
+    plan.activation=H_ACTIVATION_NONE;
+    return plan;
+}
+
+// Function to build the GEMM kernels with a bias and activation applied to C
+// before it is stored, for use with h_enqueue_sgemm_epilogue in the given order
+h_gemm_plan h_create_gemm_epilogue_plan(
+        cl_context context, 
+        cl_device_id device, 
+        h_order order, 
+        h_bias bias, 
+        h_activation activation) {
+
+    // The kernel works on column-major C, which is the transpose of row-major C
+    h_bias bias_col_major=bias;
+    if (order==H_ROW_MAJOR && bias!=H_BIAS_NONE) bias_col_major=(bias==H_BIAS_ROW) ? H_BIAS_COL : H_BIAS_ROW;
+
+    char extra_opts[64];
+    snprintf(extra_opts, sizeof(extra_opts), "-DEPILOGUE -DBIAS=%d -DACTIVATION=%d", (int)bias_col_major, (int)activation);
+    h_gemm_plan plan=h_create_gemm_plan(context, device, extra_opts);
+    plan.epilogue=CL_TRUE;
+    plan.order=order;
+    plan.bias=bias;
+    plan.activation=activation;
+    return plan;
+}
+
+// Function to release the kernels and program of a GEMM plan
+void h_release_gemm_plan(h_gemm_plan* plan) {
+    h_errchk(clReleaseKernel(plan->kernel_gemm), "Releasing kernel gemm_tiled");
+    h_errchk(clReleaseKernel(plan->kernel_pack), "Releasing kernel gemm_pack");
+    h_errchk(clReleaseKernel(plan->kernel_check_vec), "Releasing kernel gemm_check_vec");
+    h_errchk(clReleaseKernel(plan->kernel_check_compare), "Releasing kernel gemm_check_compare");
+    h_errchk(clReleaseProgram(plan->program), "Releasing the GEMM program");
+}
+
+// Function to enqueue gemm_tiled on column-major matrices, 
+// after any row-major call has been turned into a column-major one
+cl_event h_enqueue_gemm_tiled(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        h_trans trans_A,
+        cl_bool packed_A,
+        cl_mem B,
+        size_t offset_B,
+        size_t ldb,
+        h_trans trans_B,
+        cl_bool packed_B,
+        cl_float beta,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    cl_int M_arg=M, N_arg=N, K_arg=K, lda_arg=lda, ldb_arg=ldb, ldc_arg=ldc;
+    cl_int trans_A_arg=trans_A, trans_B_arg=trans_B, packed_A_arg=packed_A, packed_B_arg=packed_B;
+    cl_ulong offset_A_arg=offset_A, offset_B_arg=offset_B, offset_C_arg=offset_C;
+
+    cl_kernel kernel=plan->kernel_gemm;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_int), &M_arg), "setting gemm_tiled argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_int), &N_arg), "setting gemm_tiled argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_int), &K_arg), "setting gemm_tiled argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_float), &alpha), "setting gemm_tiled argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_mem), &A), "setting gemm_tiled argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_ulong), &offset_A_arg), "setting gemm_tiled argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_int), &lda_arg), "setting gemm_tiled argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_int), &trans_A_arg), "setting gemm_tiled argument 7");
+    h_errchk(clSetKernelArg(kernel, 8, sizeof(cl_int), &packed_A_arg), "setting gemm_tiled argument 8");
+    h_errchk(clSetKernelArg(kernel, 9, sizeof(cl_mem), &B), "setting gemm_tiled argument 9");
+    h_errchk(clSetKernelArg(kernel, 10, sizeof(cl_ulong), &offset_B_arg), "setting gemm_tiled argument 10");
+    h_errchk(clSetKernelArg(kernel, 11, sizeof(cl_int), &ldb_arg), "setting gemm_tiled argument 11");
+    h_errchk(clSetKernelArg(kernel, 12, sizeof(cl_int), &trans_B_arg), "setting gemm_tiled argument 12");
+    h_errchk(clSetKernelArg(kernel, 13, sizeof(cl_int), &packed_B_arg), "setting gemm_tiled argument 13");
+    h_errchk(clSetKernelArg(kernel, 14, sizeof(cl_float), &beta), "setting gemm_tiled argument 14");
+    h_errchk(clSetKernelArg(kernel, 15, sizeof(cl_mem), &C), "setting gemm_tiled argument 15");
+    h_errchk(clSetKernelArg(kernel, 16, sizeof(cl_ulong), &offset_C_arg), "setting gemm_tiled argument 16");
+    h_errchk(clSetKernelArg(kernel, 17, sizeof(cl_int), &ldc_arg), "setting gemm_tiled argument 17");
+
+    // Round the global size up to whole tiles
+    size_t tile_dim=plan->tile_dim;
+    const size_t local_size[]={ tile_dim, tile_dim };
+    const size_t global_size[]={    ((M+tile_dim-1)/tile_dim)*tile_dim,
+                                    ((N+tile_dim-1)/tile_dim)*tile_dim };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    2,
+                                    NULL,
+                                    global_size,
+                                    local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running gemm_tiled");
+    return event;
+}
+
+// Function to check the leading dimensions of an sgemm call against the stored
+// shapes of the matrices, caller names the function in the error message
+void h_check_sgemm_ld(  h_order order,
+                        h_trans trans_A,
+                        h_trans trans_B,
+                        size_t M,
+                        size_t N,
+                        size_t K,
+                        size_t lda,
+                        size_t ldb,
+                        size_t ldc,
+                        const char* caller) {
+
+    // Stored shapes of the matrices as column-major
+    size_t nrows_A=(trans_A==H_TRANS) ? K : M;
+    size_t nrows_B=(trans_B==H_TRANS) ? N : K;
+    size_t nrows_C=M;
+    if (order==H_ROW_MAJOR) {
+        nrows_A=(trans_A==H_TRANS) ? M : K;
+        nrows_B=(trans_B==H_TRANS) ? K : N;
+        nrows_C=N;
+    }
+    if (lda<nrows_A) h_errchk(CL_INVALID_VALUE, std::string("Checking lda in ")+caller);
+    if (ldb<nrows_B) h_errchk(CL_INVALID_VALUE, std::string("Checking ldb in ")+caller);
+    if (ldc<nrows_C) h_errchk(CL_INVALID_VALUE, std::string("Checking ldc in ")+caller);
+}
+
+// Function to enqueue C=alpha*op(A)*op(B)+beta*C, where op(A) is M x K, op(B) is K x N and C is M x N.
+// Each matrix starts offset elements into its buffer and has leading dimension ld 
+// in the given order, i.e. the distance in elements between columns for column-major 
+// and between rows for row-major, so sub-matrices are multiplied in place.
+// C is not read when beta is zero. Returns the event of the kernel
+cl_event h_enqueue_sgemm(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        h_order order,
+        h_trans trans_A,
+        h_trans trans_B,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        cl_mem B,
+        size_t offset_B,
+        size_t ldb,
+        cl_float beta,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    h_check_sgemm_ld(order, trans_A, trans_B, M, N, K, lda, ldb, ldc, "h_enqueue_sgemm");
+
+    // A row-major matrix is its transpose in column-major, 
+    // so row-major C=op(A)*op(B) is column-major C^T=op(B)^T*op(A)^T
+    if (order==H_ROW_MAJOR) {
+        return h_enqueue_gemm_tiled(command_queue, plan, N, M, K,
+                                    alpha, B, offset_B, ldb, trans_B, CL_FALSE,
+                                    A, offset_A, lda, trans_A, CL_FALSE,
+                                    beta, C, offset_C, ldc,
+                                    num_events_in_wait_list, event_wait_list);
+    }
+    return h_enqueue_gemm_tiled(command_queue, plan, M, N, K,
+                                alpha, A, offset_A, lda, trans_A, CL_FALSE,
+                                B, offset_B, ldb, trans_B, CL_FALSE,
+                                beta, C, offset_C, ldc,
+                                num_events_in_wait_list, event_wait_list);
+}
+
+// Function to enqueue C=activation(alpha*op(A)*op(B)+beta*C+bias) with a plan from 
+// h_create_gemm_epilogue_plan, in the order the plan was built for. bias has M values 
+// for H_BIAS_ROW or N for H_BIAS_COL and may be NULL without a bias. clamp_lower 
+// and clamp_upper are only used by H_ACTIVATION_CLAMP. Returns the event of the kernel
+cl_event h_enqueue_sgemm_epilogue(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        h_order order,
+        h_trans trans_A,
+        h_trans trans_B,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        cl_mem B,
+        size_t offset_B,
+        size_t ldb,
+        cl_float beta,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        cl_mem bias,
+        cl_float clamp_lower,
+        cl_float clamp_upper,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (!plan->epilogue) h_errchk(CL_INVALID_VALUE, "Checking for an epilogue plan in h_enqueue_sgemm_epilogue");
+    if (order!=plan->order) h_errchk(CL_INVALID_VALUE, "Checking the order in h_enqueue_sgemm_epilogue");
+    if (plan->bias!=H_BIAS_NONE && bias==NULL) h_errchk(CL_INVALID_VALUE, "Checking bias in h_enqueue_sgemm_epilogue");
+
+    // The epilogue arguments follow those of gemm_tiled
+    cl_kernel kernel=plan->kernel_gemm;
+    h_errchk(clSetKernelArg(kernel, 18, sizeof(cl_mem), &bias), "setting gemm_tiled argument 18");
+    h_errchk(clSetKernelArg(kernel, 19, sizeof(cl_float), &clamp_lower), "setting gemm_tiled argument 19");
+    h_errchk(clSetKernelArg(kernel, 20, sizeof(cl_float), &clamp_upper), "setting gemm_tiled argument 20");
+    return h_enqueue_sgemm( command_queue, plan, order, trans_A, trans_B, M, N, K, 
+                            alpha, A, offset_A, lda, B, offset_B, ldb, beta, C, offset_C, ldc,
+                            num_events_in_wait_list, event_wait_list);
+}
+
+// Function to pack an operand once into a device-resident tiled layout that 
+// gemm_tiled reads directly, for a matrix that is reused across many multiplies.
+// X is stored in the given order from offset with leading dimension ld, and 
+// op(X) is M x K for operand A or K x N for operand B, with n_outer being M or N.
+// The packed operand is ready when the function returns
+h_packed_operand h_pack_operand(
+        cl_command_queue command_queue,
+        cl_context context,
+        h_gemm_plan* plan,
+        h_order order,
+        h_operand operand,
+        h_trans trans,
+        size_t n_outer,
+        size_t K,
+        cl_mem X,
+        size_t offset,
+        size_t ld) {
+
+    h_packed_operand packed;
+    packed.operand=operand;
+    packed.n_outer=n_outer;
+    packed.K=K;
+    packed.tile_dim=plan->tile_dim;
+
+    // A row-major A is used as B by the column-major kernel and vice versa, 
+    // but the packed tiles are the same either way. What matters is whether
+    // the outer index of op(X) runs down the stored columns of X
+    cl_bool kernel_A=((operand==H_OPERAND_A)==(order==H_COL_MAJOR));
+    cl_int outer_contiguous=kernel_A ? (trans==H_NO_TRANS) : (trans==H_TRANS);
+    size_t nrows_X=outer_contiguous ? n_outer : K;
+    if (ld<nrows_X) h_errchk(CL_INVALID_VALUE, "Checking ld in h_pack_operand");
+
+    size_t tile_dim=plan->tile_dim;
+    size_t nouter_tiles=(n_outer+tile_dim-1)/tile_dim;
+    size_t nk_tiles=(K+tile_dim-1)/tile_dim;
+
+    cl_int errcode;
+    packed.buffer=clCreateBuffer(   context, 
+                                    CL_MEM_READ_WRITE, 
+                                    nouter_tiles*nk_tiles*tile_dim*tile_dim*sizeof(cl_float), 
+                                    NULL, 
+                                    &errcode);
+    h_errchk(errcode, "Creating the packed operand buffer");
+
+    cl_ulong offset_arg=offset;
+    cl_int ld_arg=ld, n_outer_arg=n_outer, K_arg=K;
+    cl_kernel kernel=plan->kernel_pack;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &X), "setting gemm_pack argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_ulong), &offset_arg), "setting gemm_pack argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_int), &ld_arg), "setting gemm_pack argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &outer_contiguous), "setting gemm_pack argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &n_outer_arg), "setting gemm_pack argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_int), &K_arg), "setting gemm_pack argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_mem), &packed.buffer), "setting gemm_pack argument 6");
+
+    // One work-item per packed element, including the zero fill
+    const size_t global_size[]={ nouter_tiles*tile_dim, nk_tiles*tile_dim };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    2,
+                                    NULL,
+                                    global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event), "Running gemm_pack");
+    h_errchk(clWaitForEvents(1, &event), "Waiting for gemm_pack");
+    h_errchk(clReleaseEvent(event), "Releasing the gemm_pack event");
+    return packed;
+}
+
+// Function to release the buffer of a packed operand
+void h_release_packed_operand(h_packed_operand* packed) {
+    h_errchk(clReleaseMemObject(packed->buffer), "Releasing the packed operand buffer");
+}
+
+// Function to check that a packed operand fits a multiply
+void h_check_packed_operand(const h_packed_operand* packed, h_gemm_plan* plan, 
+                            h_operand operand, size_t n_outer, size_t K) {
+    if (packed->operand!=operand || packed->n_outer!=n_outer || packed->K!=K 
+            || packed->tile_dim!=plan->tile_dim) {
+        h_errchk(CL_INVALID_VALUE, "Checking the shape of a packed operand");
+    }
+}
+
+// Function to enqueue C=alpha*op(A)*op(B)+beta*C as h_enqueue_sgemm does,
+// with B already packed by h_pack_operand, for weights that are used many times
+cl_event h_enqueue_sgemm_packed_B(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        h_order order,
+        h_trans trans_A,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        const h_packed_operand* B,
+        cl_float beta,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    h_check_packed_operand(B, plan, H_OPERAND_B, N, K);
+    size_t nrows_A=(trans_A==H_TRANS) ? K : M;
+    size_t nrows_C=M;
+    if (order==H_ROW_MAJOR) {
+        nrows_A=(trans_A==H_TRANS) ? M : K;
+        nrows_C=N;
+    }
+    if (lda<nrows_A) h_errchk(CL_INVALID_VALUE, "Checking lda in h_enqueue_sgemm_packed_B");
+    if (ldc<nrows_C) h_errchk(CL_INVALID_VALUE, "Checking ldc in h_enqueue_sgemm_packed_B");
+
+    if (order==H_ROW_MAJOR) {
+        return h_enqueue_gemm_tiled(command_queue, plan, N, M, K,
+                                    alpha, B->buffer, 0, 0, H_NO_TRANS, CL_TRUE,
+                                    A, offset_A, lda, trans_A, CL_FALSE,
+                                    beta, C, offset_C, ldc,
+                                    num_events_in_wait_list, event_wait_list);
+    }
+    return h_enqueue_gemm_tiled(command_queue, plan, M, N, K,
+                                alpha, A, offset_A, lda, trans_A, CL_FALSE,
+                                B->buffer, 0, 0, H_NO_TRANS, CL_TRUE,
+                                beta, C, offset_C, ldc,
+                                num_events_in_wait_list, event_wait_list);
+}
+
+// Function to enqueue C=alpha*op(A)*op(B)+beta*C with both operands packed
+cl_event h_enqueue_sgemm_packed(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        h_order order,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_float alpha,
+        const h_packed_operand* A,
+        const h_packed_operand* B,
+        cl_float beta,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    h_check_packed_operand(A, plan, H_OPERAND_A, M, K);
+    h_check_packed_operand(B, plan, H_OPERAND_B, N, K);
+    size_t nrows_C=(order==H_ROW_MAJOR) ? N : M;
+    if (ldc<nrows_C) h_errchk(CL_INVALID_VALUE, "Checking ldc in h_enqueue_sgemm_packed");
+
+    if (order==H_ROW_MAJOR) {
+        return h_enqueue_gemm_tiled(command_queue, plan, N, M, K,
+                                    alpha, B->buffer, 0, 0, H_NO_TRANS, CL_TRUE,
+                                    A->buffer, 0, 0, H_NO_TRANS, CL_TRUE,
+                                    beta, C, offset_C, ldc,
+                                    num_events_in_wait_list, event_wait_list);
+    }
+    return h_enqueue_gemm_tiled(command_queue, plan, M, N, K,
+                                alpha, A->buffer, 0, 0, H_NO_TRANS, CL_TRUE,
+                                B->buffer, 0, 0, H_NO_TRANS, CL_TRUE,
+                                beta, C, offset_C, ldc,
+                                num_events_in_wait_list, event_wait_list);
+}
+
+// Function to enqueue C=op(A)*op(B) on densely packed matrices in the given order,
+// so A is stored as M x K, or K x M when transposed, and likewise for B. 
+// Returns the event of the kernel
+cl_event h_enqueue_gemm(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        h_order order,
+        h_trans trans_A,
+        h_trans trans_B,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_mem A,
+        cl_mem B,
+        cl_mem C,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    // Leading dimensions of the densely packed matrices
+    size_t lda, ldb, ldc;
+    if (order==H_COL_MAJOR) {
+        lda=(trans_A==H_TRANS) ? K : M;
+        ldb=(trans_B==H_TRANS) ? N : K;
+        ldc=M;
+    } else {
+        lda=(trans_A==H_TRANS) ? M : K;
+        ldb=(trans_B==H_TRANS) ? K : N;
+        ldc=N;
+    }
+
+    return h_enqueue_sgemm( command_queue, plan, order, trans_A, trans_B,
+                            M, N, K,
+                            1.0f, A, 0, lda, B, 0, ldb,
+                            0.0f, C, 0, ldc,
+                            num_events_in_wait_list, event_wait_list);
+}
+
+// Checksum buffers for h_enqueue_sgemm_checked, for matrices up to max_dim in every
+// dimension. They keep the expected checksums of the last checked multiply, 
+// so h_verify_gemm_check can check C again later
+typedef struct {
+    size_t max_dim;
+    // op(B)*e and then e^T*op(A), with their absolute sums
+    cl_mem inner;
+    cl_mem inner_abs;
+    // Expected C*e and e^T*C for the column-major multiply the kernel does
+    cl_mem expected_rows;
+    cl_mem expected_rows_abs;
+    cl_mem expected_cols;
+    cl_mem expected_cols_abs;
+    // Checksums of the computed C
+    cl_mem sums;
+    cl_mem sums_abs;
+    // Results of gemm_check_compare for the rows and the columns
+    cl_mem result_rows;
+    cl_mem result_cols;
+    // The last checked multiply, as the column-major multiply the kernel does
+    h_order order;
+    size_t M;
+    size_t N;
+    cl_mem C;
+    size_t offset_C;
+    size_t ldc;
+    cl_float tol_rows;
+    cl_float tol_cols;
+} h_gemm_check;
+
+// Outcome of a check, with rows and columns of C in the order it was multiplied in
+typedef struct {
+    cl_int nfailed_rows;
+    cl_int nfailed_cols;
+    // Largest checksum errors relative to the sums of absolute values
+    cl_float max_err_rows;
+    cl_float max_err_cols;
+    // First failed row and column, or -1 when none failed. 
+    // A single faulty element of C is where they meet
+    cl_int first_row;
+    cl_int first_col;
+} h_gemm_check_report;
+
+// Function to make the checksum buffers for multiplies up to max_dim in every dimension
+h_gemm_check h_create_gemm_check(cl_context context, size_t max_dim) {
+    h_gemm_check check;
+    check.max_dim=max_dim;
+
+    cl_int errcode;
+    cl_mem* vectors[]={ &check.inner, &check.inner_abs,
+                        &check.expected_rows, &check.expected_rows_abs,
+                        &check.expected_cols, &check.expected_cols_abs,
+                        &check.sums, &check.sums_abs };
+    for (size_t n=0; n<sizeof(vectors)/sizeof(cl_mem*); n++) {
+        *vectors[n]=clCreateBuffer(context, CL_MEM_READ_WRITE, max_dim*sizeof(cl_float), NULL, &errcode);
+        h_errchk(errcode, "Creating a checksum buffer");
+    }
+    check.result_rows=clCreateBuffer(context, CL_MEM_READ_WRITE, 3*sizeof(cl_int), NULL, &errcode);
+    h_errchk(errcode, "Creating the row checksum result buffer");
+    check.result_cols=clCreateBuffer(context, CL_MEM_READ_WRITE, 3*sizeof(cl_int), NULL, &errcode);
+    h_errchk(errcode, "Creating the column checksum result buffer");
+
+    check.order=H_COL_MAJOR;
+    check.M=0;
+    check.N=0;
+    check.C=NULL;
+    check.offset_C=0;
+    check.ldc=0;
+    check.tol_rows=0.0f;
+    check.tol_cols=0.0f;
+    return check;
+}
+
+// Function to release the checksum buffers
+void h_release_gemm_check(h_gemm_check* check) {
+    cl_mem buffers[]={  check->inner, check->inner_abs,
+                        check->expected_rows, check->expected_rows_abs,
+                        check->expected_cols, check->expected_cols_abs,
+                        check->sums, check->sums_abs,
+                        check->result_rows, check->result_cols };
+    for (size_t n=0; n<sizeof(buffers)/sizeof(cl_mem); n++) {
+        h_errchk(clReleaseMemObject(buffers[n]), "Releasing a checksum buffer");
+    }
+}
+
+// Function to enqueue gemm_check_vec, x and x_abs are NULL for vectors of ones
+void h_enqueue_gemm_check_vec(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        cl_mem X,
+        size_t offset,
+        size_t ld,
+        cl_bool outer_contiguous,
+        size_t n_outer,
+        size_t K,
+        cl_mem x,
+        cl_mem x_abs,
+        cl_float scale,
+        cl_float y_scale,
+        cl_mem y,
+        cl_mem y_abs,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    cl_ulong offset_arg=offset;
+    cl_int ld_arg=ld, outer_contiguous_arg=outer_contiguous, n_outer_arg=n_outer, K_arg=K;
+    cl_int ones=(x==NULL);
+    cl_kernel kernel=plan->kernel_check_vec;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &X), "setting gemm_check_vec argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_ulong), &offset_arg), "setting gemm_check_vec argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_int), &ld_arg), "setting gemm_check_vec argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &outer_contiguous_arg), "setting gemm_check_vec argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &n_outer_arg), "setting gemm_check_vec argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_int), &K_arg), "setting gemm_check_vec argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_mem), &x), "setting gemm_check_vec argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_mem), &x_abs), "setting gemm_check_vec argument 7");
+    h_errchk(clSetKernelArg(kernel, 8, sizeof(cl_int), &ones), "setting gemm_check_vec argument 8");
+    h_errchk(clSetKernelArg(kernel, 9, sizeof(cl_float), &scale), "setting gemm_check_vec argument 9");
+    h_errchk(clSetKernelArg(kernel, 10, sizeof(cl_float), &y_scale), "setting gemm_check_vec argument 10");
+    h_errchk(clSetKernelArg(kernel, 11, sizeof(cl_mem), &y), "setting gemm_check_vec argument 11");
+    h_errchk(clSetKernelArg(kernel, 12, sizeof(cl_mem), &y_abs), "setting gemm_check_vec argument 12");
+
+    const size_t global_size[]={ n_outer };
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    NULL,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    NULL), "Running gemm_check_vec");
+}
+
+// Function to enqueue gemm_check_compare on n checksums
+void h_enqueue_gemm_check_compare(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        cl_mem expected,
+        cl_mem expected_abs,
+        cl_mem actual,
+        size_t n,
+        cl_float tol,
+        cl_mem result) {
+
+    cl_int n_arg=n;
+    cl_kernel kernel=plan->kernel_check_compare;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &expected), "setting gemm_check_compare argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &expected_abs), "setting gemm_check_compare argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &actual), "setting gemm_check_compare argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &n_arg), "setting gemm_check_compare argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_float), &tol), "setting gemm_check_compare argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_mem), &result), "setting gemm_check_compare argument 5");
+
+    const size_t global_size[]={ n };
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    NULL), "Running gemm_check_compare");
+}
+
+// Function to check C against the expected checksums of the last multiply from
+// h_enqueue_sgemm_checked, which can be done again later, e.g. after C has been 
+// kept on the device for a while. Only the comparison results are read back. 
+// Waits for the check and fills in report. Returns CL_TRUE if every checksum agreed
+cl_bool h_verify_gemm_check(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        h_gemm_check* check,
+        h_gemm_check_report* report) {
+
+    if (check->C==NULL) h_errchk(CL_INVALID_VALUE, "Checking for a checked multiply in h_verify_gemm_check");
+
+    cl_int result_init[]={ 0, 0, INT_MAX };
+    h_errchk(clEnqueueWriteBuffer(  command_queue, check->result_rows, CL_FALSE, 0, sizeof(result_init), result_init,
+                                    0, NULL, NULL), "Resetting the row checksum results");
+    h_errchk(clEnqueueWriteBuffer(  command_queue, check->result_cols, CL_FALSE, 0, sizeof(result_init), result_init,
+                                    0, NULL, NULL), "Resetting the column checksum results");
+
+    // C*e, then e^T*C, each compared before the sums buffer is reused
+    h_enqueue_gemm_check_vec(   command_queue, plan, check->C, check->offset_C, check->ldc, CL_TRUE, check->M, check->N,
+                                NULL, NULL, 1.0f, 0.0f, check->sums, check->sums_abs, 0, NULL);
+    h_enqueue_gemm_check_compare(   command_queue, plan, check->expected_rows, check->expected_rows_abs, check->sums,
+                                    check->M, check->tol_rows, check->result_rows);
+    h_enqueue_gemm_check_vec(   command_queue, plan, check->C, check->offset_C, check->ldc, CL_FALSE, check->N, check->M,
+                                NULL, NULL, 1.0f, 0.0f, check->sums, check->sums_abs, 0, NULL);
+    h_enqueue_gemm_check_compare(   command_queue, plan, check->expected_cols, check->expected_cols_abs, check->sums,
+                                    check->N, check->tol_cols, check->result_cols);
+
+    cl_int result_rows[3], result_cols[3];
+    h_errchk(clEnqueueReadBuffer(   command_queue, check->result_rows, CL_FALSE, 0, sizeof(result_rows), result_rows,
+                                    0, NULL, NULL), "Reading the row checksum results");
+    h_errchk(clEnqueueReadBuffer(   command_queue, check->result_cols, CL_TRUE, 0, sizeof(result_cols), result_cols,
+                                    0, NULL, NULL), "Reading the column checksum results");
+
+    // The rows of column-major C are the columns of row-major C
+    cl_int* rows=(check->order==H_ROW_MAJOR) ? result_cols : result_rows;
+    cl_int* cols=(check->order==H_ROW_MAJOR) ? result_rows : result_cols;
+    report->nfailed_rows=rows[0];
+    report->nfailed_cols=cols[0];
+    memcpy(&report->max_err_rows, &rows[1], sizeof(cl_float));
+    memcpy(&report->max_err_cols, &cols[1], sizeof(cl_float));
+    report->first_row=(rows[2]==INT_MAX) ? -1 : rows[2];
+    report->first_col=(cols[2]==INT_MAX) ? -1 : cols[2];
+    return (report->nfailed_rows==0 && report->nfailed_cols==0) ? CL_TRUE : CL_FALSE;
+}
+
+// Function to enqueue C=alpha*op(A)*op(B)+beta*C as h_enqueue_sgemm does and verify
+// the result with algorithm-based fault tolerance (ABFT). The expected row checksums 
+// alpha*op(A)*(op(B)*e) and column checksums alpha*(e^T*op(A))*op(B), plus beta times 
+// those of the old C, are worked out on the device with O(N^2) work before the multiply,
+// and compared with the checksums of the new C after it. e is a vector of ones.
+// Needs an in-order command queue, and a plan without an epilogue since the bias and
+// activation don't keep the checksums. Waits for the check, fills in report and
+// returns the event of the multiply
+cl_event h_enqueue_sgemm_checked(
+        cl_command_queue command_queue,
+        h_gemm_plan* plan,
+        h_gemm_check* check,
+        h_order order,
+        h_trans trans_A,
+        h_trans trans_B,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        cl_mem B,
+        size_t offset_B,
+        size_t ldb,
+        cl_float beta,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        h_gemm_check_report* report,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (plan->epilogue) h_errchk(CL_INVALID_VALUE, "Checking for a plan without an epilogue in h_enqueue_sgemm_checked");
+    if (M==0 || N==0 || K==0) h_errchk(CL_INVALID_VALUE, "Checking sizes in h_enqueue_sgemm_checked");
+    if (M>check->max_dim || N>check->max_dim || K>check->max_dim) {
+        h_errchk(CL_INVALID_VALUE, "Checking sizes against the checksum buffers in h_enqueue_sgemm_checked");
+    }
+    h_check_sgemm_ld(order, trans_A, trans_B, M, N, K, lda, ldb, ldc, "h_enqueue_sgemm_checked");
+
+    // The column-major multiply the kernel does, as in h_enqueue_sgemm
+    cl_mem A_col=A, B_col=B;
+    size_t offset_A_col=offset_A, offset_B_col=offset_B, lda_col=lda, ldb_col=ldb;
+    size_t M_col=M, N_col=N;
+    h_trans trans_A_col=trans_A, trans_B_col=trans_B;
+    if (order==H_ROW_MAJOR) {
+        A_col=B; offset_A_col=offset_B; lda_col=ldb; trans_A_col=trans_B;
+        B_col=A; offset_B_col=offset_A; ldb_col=lda; trans_B_col=trans_A;
+        M_col=N;
+        N_col=M;
+    }
+
+    // Checksums of the old C, which the multiply scales by beta
+    cl_float beta_sums=0.0f;
+    if (beta!=0.0f) {
+        h_enqueue_gemm_check_vec(   command_queue, plan, C, offset_C, ldc, CL_TRUE, M_col, N_col,
+                                    NULL, NULL, 1.0f, 0.0f, check->expected_rows, check->expected_rows_abs,
+                                    num_events_in_wait_list, event_wait_list);
+        h_enqueue_gemm_check_vec(   command_queue, plan, C, offset_C, ldc, CL_FALSE, N_col, M_col,
+                                    NULL, NULL, 1.0f, 0.0f, check->expected_cols, check->expected_cols_abs,
+                                    num_events_in_wait_list, event_wait_list);
+        beta_sums=beta;
+    }
+
+    // op(B)*e, then alpha*op(A)*(op(B)*e)
+    h_enqueue_gemm_check_vec(   command_queue, plan, B_col, offset_B_col, ldb_col, trans_B_col==H_NO_TRANS, K, N_col,
+                                NULL, NULL, 1.0f, 0.0f, check->inner, check->inner_abs,
+                                num_events_in_wait_list, event_wait_list);
+    h_enqueue_gemm_check_vec(   command_queue, plan, A_col, offset_A_col, lda_col, trans_A_col==H_NO_TRANS, M_col, K,
+                                check->inner, check->inner_abs, alpha, beta_sums, 
+                                check->expected_rows, check->expected_rows_abs, 0, NULL);
+
+    // e^T*op(A), then alpha*(e^T*op(A))*op(B)
+    h_enqueue_gemm_check_vec(   command_queue, plan, A_col, offset_A_col, lda_col, trans_A_col==H_TRANS, K, M_col,
+                                NULL, NULL, 1.0f, 0.0f, check->inner, check->inner_abs, 0, NULL);
+    h_enqueue_gemm_check_vec(   command_queue, plan, B_col, offset_B_col, ldb_col, trans_B_col==H_TRANS, N_col, K,
+                                check->inner, check->inner_abs, alpha, beta_sums,
+                                check->expected_cols, check->expected_cols_abs, 0, NULL);
+
+    cl_event event=h_enqueue_sgemm( command_queue, plan, order, trans_A, trans_B, M, N, K,
+                                    alpha, A, offset_A, lda, B, offset_B, ldb, beta, C, offset_C, ldc,
+                                    num_events_in_wait_list, event_wait_list);
+
+    // Rounding error bounds, each checksum sums over the inner dimension and one 
+    // dimension of C, for both the expected and the computed value, plus the old C
+    check->order=order;
+    check->M=M_col;
+    check->N=N_col;
+    check->C=C;
+    check->offset_C=offset_C;
+    check->ldc=ldc;
+    check->tol_rows=GEMM_CHECK_TOL_FACTOR*2.0f*(K+N_col+1)*FLT_EPSILON;
+    check->tol_cols=GEMM_CHECK_TOL_FACTOR*2.0f*(K+M_col+1)*FLT_EPSILON;
+    h_verify_gemm_check(command_queue, plan, check, report);
+    return event;
+}
+
+#endif
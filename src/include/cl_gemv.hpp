@@ -0,0 +1,318 @@
+#ifndef CL_GEMV_HPP
+#define CL_GEMV_HPP
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+
+// Matrix-vector products y=alpha*op(A)*x+beta*y on device buffers, for single
+// matrices or batches of equally sized matrices. Unlike a GEMM with one column,
+// every work-item does useful work, reads are vectorised, and partial sums are 
+// combined with work-group reductions in local memory.
+
+// Work-group shapes, shrunk if the device can't fit them
+#define GEMV_ROWS 16
+#define GEMV_SPLIT 16
+#define GEMV_T_LOCAL 256
+
+// Kernel source for gemv_n and gemv_t
+const char* gemv_kernel_source="\n\
+    // Work-group shapes, set with -D at build time \n\
+    #ifndef GEMV_ROWS \n\
+    #define GEMV_ROWS 16 \n\
+    #endif \n\
+    #ifndef GEMV_SPLIT \n\
+    #define GEMV_SPLIT 16 \n\
+    #endif \n\
+    #ifndef GEMV_T_LOCAL \n\
+    #define GEMV_T_LOCAL 256 \n\
+    #endif \n\
+    \n\
+    // y=alpha*A*x+beta*y for a column-major M x N matrix A, for every matrix in a batch. \n\
+    // Each work-item owns four consecutive rows and reads them with one vector load \n\
+    // per column, so a column is read by consecutive work-items in one sweep. \n\
+    // The GEMV_SPLIT work-items along dimension 1 share the columns between them \n\
+    // and their partial sums are added in local memory. Dimension 2 is the batch \n\
+    __kernel void gemv_n(   int M, \n\
+                            int N, \n\
+                            float alpha, \n\
+                            __global float* A, \n\
+                            ulong offset_A, \n\
+                            int lda, \n\
+                            ulong stride_A, \n\
+                            __global float* x, \n\
+                            ulong offset_x, \n\
+                            ulong stride_x, \n\
+                            float beta, \n\
+                            __global float* y, \n\
+                            ulong offset_y, \n\
+                            ulong stride_y) { \n\
+        __local float4 partial[GEMV_SPLIT][GEMV_ROWS]; \n\
+    \n\
+        size_t batch=get_global_id(2); \n\
+        A+=offset_A+batch*stride_A; \n\
+        x+=offset_x+batch*stride_x; \n\
+        y+=offset_y+batch*stride_y; \n\
+    \n\
+        int l0=get_local_id(0); \n\
+        int l1=get_local_id(1); \n\
+        int i=4*get_global_id(0); \n\
+    \n\
+        float4 temp=(float4)(0.0f); \n\
+        if (i+4<=M) { \n\
+            for (int j=l1; j<N; j+=GEMV_SPLIT) { \n\
+                temp+=vload4(0, A+(size_t)j*lda+i)*x[j]; \n\
+            } \n\
+        } else if (i<M) { \n\
+            // The last rows, when M is not a multiple of four \n\
+            for (int j=l1; j<N; j+=GEMV_SPLIT) { \n\
+                __global float* col=A+(size_t)j*lda; \n\
+                float xj=x[j]; \n\
+                temp.s0+=col[i]*xj; \n\
+                if (i+1<M) temp.s1+=col[i+1]*xj; \n\
+                if (i+2<M) temp.s2+=col[i+2]*xj; \n\
+            } \n\
+        } \n\
+        partial[l1][l0]=temp; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        // Tree reduction over the split, GEMV_SPLIT is a power of two \n\
+        for (int s=GEMV_SPLIT/2; s>0; s/=2) { \n\
+            if (l1<s) partial[l1][l0]+=partial[l1+s][l0]; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+    \n\
+        if (l1==0 && i<M) { \n\
+            float sums[4]={ partial[0][l0].s0, partial[0][l0].s1, partial[0][l0].s2, partial[0][l0].s3 }; \n\
+            for (int n=0; n<4 && i+n<M; n++) { \n\
+                // As in BLAS, y is not read when beta is zero \n\
+                y[i+n]=(beta==0.0f) ? alpha*sums[n] : alpha*sums[n]+beta*y[i+n]; \n\
+            } \n\
+        } \n\
+    } \n\
+    \n\
+    // y=alpha*A^T*x+beta*y for a column-major M x N matrix A, for every matrix in a batch. \n\
+    // Element j of y is the dot product of column j of A with x, so one work-group \n\
+    // walks down each column with vector loads and reduces in local memory. \n\
+    // Dimension 2 is the batch \n\
+    __kernel void gemv_t(   int M, \n\
+                            int N, \n\
+                            float alpha, \n\
+                            __global float* A, \n\
+                            ulong offset_A, \n\
+                            int lda, \n\
+                            ulong stride_A, \n\
+                            __global float* x, \n\
+                            ulong offset_x, \n\
+                            ulong stride_x, \n\
+                            float beta, \n\
+                            __global float* y, \n\
+                            ulong offset_y, \n\
+                            ulong stride_y) { \n\
+        __local float partial[GEMV_T_LOCAL]; \n\
+    \n\
+        size_t batch=get_global_id(2); \n\
+        A+=offset_A+batch*stride_A; \n\
+        x+=offset_x+batch*stride_x; \n\
+        y+=offset_y+batch*stride_y; \n\
+    \n\
+        int l0=get_local_id(0); \n\
+        int j=get_group_id(0); \n\
+        __global float* col=A+(size_t)j*lda; \n\
+    \n\
+        float4 temp4=(float4)(0.0f); \n\
+        int i=4*l0; \n\
+        for (; i+4<=M; i+=4*GEMV_T_LOCAL) { \n\
+            temp4+=vload4(0, col+i)*vload4(0, x+i); \n\
+        } \n\
+        float temp=temp4.s0+temp4.s1+temp4.s2+temp4.s3; \n\
+        // The last rows, when M is not a multiple of four \n\
+        for (int n=i; n<i+4 && n<M; n++) { \n\
+            temp+=col[n]*x[n]; \n\
+        } \n\
+        partial[l0]=temp; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        // Tree reduction, GEMV_T_LOCAL is a power of two \n\
+        for (int s=GEMV_T_LOCAL/2; s>0; s/=2) { \n\
+            if (l0<s) partial[l0]+=partial[l0+s]; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+    \n\
+        if (l0==0) { \n\
+            y[j]=(beta==0.0f) ? alpha*partial[0] : alpha*partial[0]+beta*y[j]; \n\
+        } \n\
+    } \n\
+";
+
+// A built GEMV program for one device
+typedef struct {
+    cl_program program;
+    cl_kernel kernel_gemv_n;
+    cl_kernel kernel_gemv_t;
+    size_t rows;
+    size_t split;
+    size_t t_local;
+} h_gemv_plan;
+
+// Function to build the GEMV kernels for a device
+h_gemv_plan h_create_gemv_plan(cl_context context, cl_device_id device) {
+    h_gemv_plan plan;
+
+    size_t max_work_group_size;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                sizeof(size_t),
+                                &max_work_group_size,
+                                NULL), "Getting the maximum work-group size");
+    plan.rows=GEMV_ROWS;
+    plan.split=GEMV_SPLIT;
+    while (plan.rows*plan.split>max_work_group_size && plan.split>1) plan.split/=2;
+    while (plan.rows*plan.split>max_work_group_size) plan.rows/=2;
+    plan.t_local=GEMV_T_LOCAL;
+    while (plan.t_local>max_work_group_size) plan.t_local/=2;
+
+    char build_opts[128];
+    snprintf(build_opts, sizeof(build_opts), "-DGEMV_ROWS=%zu -DGEMV_SPLIT=%zu -DGEMV_T_LOCAL=%zu", 
+            plan.rows, plan.split, plan.t_local);
+    plan.program=h_build_program(gemv_kernel_source, context, device, build_opts);
+
+    cl_int errcode;
+    plan.kernel_gemv_n=clCreateKernel(plan.program, "gemv_n", &errcode);
+    h_errchk(errcode, "Creating Kernel gemv_n");
+    plan.kernel_gemv_t=clCreateKernel(plan.program, "gemv_t", &errcode);
+    h_errchk(errcode, "Creating Kernel gemv_t");
+    return plan;
+}
+
+// Function to release the kernels and program of a GEMV plan
+void h_release_gemv_plan(h_gemv_plan* plan) {
+    h_errchk(clReleaseKernel(plan->kernel_gemv_n), "Releasing kernel gemv_n");
+    h_errchk(clReleaseKernel(plan->kernel_gemv_t), "Releasing kernel gemv_t");
+    h_errchk(clReleaseProgram(plan->program), "Releasing the GEMV program");
+}
+
+// Function to enqueue y=alpha*op(A)*x+beta*y for batch_count matrices, where A is M x N
+// in the given order with leading dimension lda. Matrix b of the batch starts 
+// offset_A+b*stride_A elements into A, and likewise for x and y, so a single
+// product is a batch of one. x and y are contiguous, and y is not read when 
+// beta is zero. Returns the event of the kernel, or of a
+// marker when M, N or batch_count is zero
+cl_event h_enqueue_sgemv_batched(
+        cl_command_queue command_queue,
+        h_gemv_plan* plan,
+        h_order order,
+        h_trans trans,
+        size_t M,
+        size_t N,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        size_t stride_A,
+        cl_mem x,
+        size_t offset_x,
+        size_t stride_x,
+        cl_float beta,
+        cl_mem y,
+        size_t offset_y,
+        size_t stride_y,
+        size_t batch_count,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    // A row-major matrix is its transpose in column-major
+    if (order==H_ROW_MAJOR) {
+        size_t temp=M;
+        M=N;
+        N=temp;
+        trans=(trans==H_TRANS) ? H_NO_TRANS : H_TRANS;
+    }
+    if (lda<M) h_errchk(CL_INVALID_VALUE, "Checking lda in h_enqueue_sgemv_batched");
+
+    // As in BLAS an empty problem leaves y untouched, a zero-size NDRange is
+    // invalid so return a marker that completes with the wait list instead
+    cl_event event;
+    if (M==0 || N==0 || batch_count==0) {
+        h_errchk(clEnqueueMarkerWithWaitList(   command_queue,
+                                                num_events_in_wait_list,
+                                                event_wait_list,
+                                                &event), "Enqueuing the empty gemv marker");
+        return event;
+    }
+
+    cl_int M_arg=M, N_arg=N, lda_arg=lda;
+    cl_ulong offset_A_arg=offset_A, offset_x_arg=offset_x, offset_y_arg=offset_y;
+    cl_ulong stride_A_arg=stride_A, stride_x_arg=stride_x, stride_y_arg=stride_y;
+    cl_kernel kernel=(trans==H_TRANS) ? plan->kernel_gemv_t : plan->kernel_gemv_n;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_int), &M_arg), "setting gemv argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_int), &N_arg), "setting gemv argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_float), &alpha), "setting gemv argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_mem), &A), "setting gemv argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_ulong), &offset_A_arg), "setting gemv argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_int), &lda_arg), "setting gemv argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_ulong), &stride_A_arg), "setting gemv argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_mem), &x), "setting gemv argument 7");
+    h_errchk(clSetKernelArg(kernel, 8, sizeof(cl_ulong), &offset_x_arg), "setting gemv argument 8");
+    h_errchk(clSetKernelArg(kernel, 9, sizeof(cl_ulong), &stride_x_arg), "setting gemv argument 9");
+    h_errchk(clSetKernelArg(kernel, 10, sizeof(cl_float), &beta), "setting gemv argument 10");
+    h_errchk(clSetKernelArg(kernel, 11, sizeof(cl_mem), &y), "setting gemv argument 11");
+    h_errchk(clSetKernelArg(kernel, 12, sizeof(cl_ulong), &offset_y_arg), "setting gemv argument 12");
+    h_errchk(clSetKernelArg(kernel, 13, sizeof(cl_ulong), &stride_y_arg), "setting gemv argument 13");
+
+    size_t local_size[3], global_size[3];
+    if (trans==H_TRANS) {
+        // One work-group for every column
+        local_size[0]=plan->t_local;
+        local_size[1]=1;
+        global_size[0]=N*plan->t_local;
+        global_size[1]=1;
+    } else {
+        // One work-item for every four rows
+        size_t nitems=(M+3)/4;
+        local_size[0]=plan->rows;
+        local_size[1]=plan->split;
+        global_size[0]=((nitems+plan->rows-1)/plan->rows)*plan->rows;
+        global_size[1]=plan->split;
+    }
+    local_size[2]=1;
+    global_size[2]=batch_count;
+
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    3,
+                                    NULL,
+                                    global_size,
+                                    local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running gemv");
+    return event;
+}
+
+// Function to enqueue y=alpha*op(A)*x+beta*y for a single matrix
+cl_event h_enqueue_sgemv(
+        cl_command_queue command_queue,
+        h_gemv_plan* plan,
+        h_order order,
+        h_trans trans,
+        size_t M,
+        size_t N,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        cl_mem x,
+        size_t offset_x,
+        cl_float beta,
+        cl_mem y,
+        size_t offset_y,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    return h_enqueue_sgemv_batched( command_queue, plan, order, trans, M, N,
+                                    alpha, A, offset_A, lda, 0, x, offset_x, 0,
+                                    beta, y, offset_y, 0, 1,
+                                    num_events_in_wait_list, event_wait_list);
+}
+
+#endif
@@ -1,5 +1,10 @@
+#ifndef CL_HELPER_HPP
+#define CL_HELPER_HPP
+
 #include <iostream>
+#include <chrono>
 #include <map>
+#include <string>
 
 #ifdef __APPLE__
     #include "OpenCL/opencl.h"
@@ -122,8 +127,34 @@ cl_command_queue* h_create_command_queues(
     return command_queues;
 }
 
-// Function to build a program from a single device and context
-cl_program h_build_program(const char* source, cl_context context, cl_device_id device) {
+// Function to print the build log of a program for a device and exit
+void h_exit_with_program_log(cl_program program, cl_device_id device, const char* message) {
+    printf("%s\n", message);
+    size_t elements;
+    h_errchk(clGetProgramBuildInfo( program,
+                                    device,
+                                    CL_PROGRAM_BUILD_LOG,
+                                    0,
+                                    NULL,
+                                    &elements),"Checking build log");
+
+    // Make up the build log string
+    char* buildlog=(char*)calloc(elements, 1);
+
+    h_errchk(clGetProgramBuildInfo( program,
+                                    device,
+                                    CL_PROGRAM_BUILD_LOG,
+                                    elements,
+                                    buildlog,
+                                    NULL), "Filling the build log");
+    printf("Build log is %s\n", buildlog);
+    free(buildlog);
+    exit(OCL_EXIT);
+}
+
+// Function to build a program from a single device and context,
+// build_opts may hold compiler options such as -D definitions
+cl_program h_build_program(const char* source, cl_context context, cl_device_id device, const char* build_opts=NULL) {
 
     cl_int ret_code;
 
@@ -139,31 +170,12 @@ cl_program h_build_program(const char* source, cl_context context, cl_device_id
     ret_code = clBuildProgram(program, 
                 1, 
                 &device,
-                NULL,
+                build_opts,
                 NULL,
                 NULL);
 
     if (ret_code!=CL_SUCCESS) {
-        size_t elements;
-        h_errchk(clGetProgramBuildInfo( program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        0,
-                                        NULL,
-                                        &elements),"Checking build log");
-
-        // Make up the build log string
-        char* buildlog=(char*)calloc(elements, 1);
-
-        h_errchk(clGetProgramBuildInfo( program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        elements,
-                                        buildlog,
-                                        NULL), "Filling the build log");
-        printf("Build log is %s\n", buildlog);
-        free(buildlog);
-        exit(OCL_EXIT);
+        h_exit_with_program_log(program, device, "Building a program failed");
     }
 
     return program;
@@ -182,6 +194,46 @@ void h_release_command_queues(cl_command_queue *command_queues, cl_uint num_comm
     free(command_queues);
 }
 
+// Function to get the elapsed time of a profiled event in milliseconds
+cl_double h_get_event_time_ms(cl_event event) {
+    cl_ulong start_counter=0, end_counter=0;
+
+    h_errchk(clGetEventProfilingInfo(   event,
+                                        CL_PROFILING_COMMAND_START,
+                                        sizeof(cl_ulong),
+                                        &start_counter,
+                                        NULL), "Getting event start time");
+    h_errchk(clGetEventProfilingInfo(   event,
+                                        CL_PROFILING_COMMAND_END,
+                                        sizeof(cl_ulong),
+                                        &end_counter,
+                                        NULL), "Getting event end time");
+
+    // Counters are in nanoseconds
+    return (cl_double)(end_counter-start_counter)*(cl_double)1.0e-6;
+}
+
+// Function to wait for a profiled event, release it and return its time in milliseconds
+cl_double h_wait_event_time_ms(cl_event event) {
+    h_errchk(clWaitForEvents(1, &event), "Waiting for the event");
+    cl_double time_ms=h_get_event_time_ms(event);
+    h_errchk(clReleaseEvent(event), "Releasing the event");
+    return time_ms;
+}
+
+// Function to wait for a profiled event, keep the smaller of its time 
+// and *time_ms, then release the event
+void h_keep_fastest(cl_event event, cl_double* time_ms) {
+    cl_double elapsed=h_wait_event_time_ms(event);
+    if (elapsed<*time_ms) *time_ms=elapsed;
+}
+
+// Function to get the host time since a point in milliseconds
+cl_double h_ms_since(std::chrono::high_resolution_clock::time_point start) {
+    using namespace std::chrono;
+    return duration_cast<duration<cl_double, std::milli>>(high_resolution_clock::now()-start).count();
+}
+
 void* h_read_file(const char* filename, const char* mode, size_t *nbytes) {
 
     FILE *fp = fopen(filename, mode);
@@ -233,6 +285,41 @@ void h_report_on_device(cl_device_id device) {
     delete [] name;
 }
 
+// Function to check whether a device supports an OpenCL extension, e.g "cl_khr_fp16"
+cl_bool h_device_has_extension(cl_device_id device, const char* extension) {
+    size_t nbytes_extensions;
+    h_errchk(clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, NULL, &nbytes_extensions),"Device extensions bytes");
+    char* extensions=new char[nbytes_extensions+1];
+    h_errchk(clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, nbytes_extensions, extensions, NULL),"Device extensions");
+    extensions[nbytes_extensions]='\0';
+
+    // Extensions are separated by spaces, match whole names only
+    std::string padded=" "+std::string(extensions)+" ";
+    std::string target=" "+std::string(extension)+" ";
+    delete [] extensions;
+
+    return (padded.find(target)!=std::string::npos) ? CL_TRUE : CL_FALSE;
+}
+
+// Function to check whether a device supports double precision,
+// CL_DEVICE_DOUBLE_FP_CONFIG is zero when it does not
+cl_bool h_device_supports_double(cl_device_id device) {
+    cl_device_fp_config fp_config=0;
+    cl_int ret_code=clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(cl_device_fp_config), &fp_config, NULL);
+    
+    // Older implementations may reject the query altogether
+    if (ret_code!=CL_SUCCESS) return CL_FALSE;
+    return (fp_config!=0) ? CL_TRUE : CL_FALSE;
+}
+
+// Function to check an error against a tolerance in a program's self-check and print
+// the outcome. A NaN error fails. Returns CL_TRUE when the check passed
+cl_bool h_check_tolerance(const char* name, cl_double error, cl_double tol) {
+    cl_bool passed=(error<=tol) ? CL_TRUE : CL_FALSE;
+    printf("%s: error %g, tolerance %g, %s\n", name, error, tol, passed ? "passed" : "FAILED");
+    return passed;
+}
+
 // Function to create lists of contexts and devices that map to available hardware
 void h_acquire_devices(
         // Input parameter
@@ -361,3 +448,52 @@ void h_release_devices(
     free(devices);
     free(platforms);
 }
+
+// Devices, contexts and command queues from h_acquire_devices and h_create_command_queues,
+// with the first device selected for use by a program that only needs one
+typedef struct {
+    cl_uint num_platforms;
+    cl_uint num_devices;
+    cl_uint num_command_queues;
+    cl_platform_id* platforms;
+    cl_device_id* devices;
+    cl_context* contexts;
+    cl_command_queue* command_queues;
+    // The selected device with its context and command queue
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue command_queue;
+} h_device_env;
+
+// Function to acquire every device of the given type with one in-order command queue 
+// each, select the first device and report on it
+h_device_env h_acquire_device_env(cl_device_type device_type, cl_bool profiling_enable) {
+    h_device_env env;
+    h_acquire_devices(  device_type,
+                        &env.platforms, &env.num_platforms,
+                        &env.devices, &env.num_devices,
+                        &env.contexts);
+
+    env.num_command_queues=env.num_devices;
+    env.command_queues=h_create_command_queues( env.devices,
+                                                env.contexts,
+                                                env.num_devices,
+                                                env.num_command_queues,
+                                                CL_FALSE,
+                                                profiling_enable);
+
+    env.device=env.devices[0];
+    env.context=env.contexts[0];
+    env.command_queue=env.command_queues[0];
+    printf("Using device:\n");
+    h_report_on_device(env.device);
+    return env;
+}
+
+// Function to release the command queues, contexts and devices of a device environment
+void h_release_device_env(h_device_env* env) {
+    h_release_command_queues(env->command_queues, env->num_command_queues);
+    h_release_devices(env->devices, env->num_devices, env->contexts, env->platforms);
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef CL_LINK_HPP
+#define CL_LINK_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+
+#include "cl_helper.hpp"
+#include "cl_embed.hpp"
+
+// Separate compilation and linking of programs, from OpenCL 1.2. Library sources
+// from kernels/ are compiled once into objects with clCompileProgram and kept in an
+// h_program_library, then clLinkProgram joins them with an application's own object,
+// so a change to the application kernels only recompiles those. With a cache
+// directory the compiled objects are also saved as binaries, keyed by a hash of
+// the source, options and device, and loaded instead of compiled by later runs.
+
+typedef struct {
+    cl_context context;
+    cl_device_id device;
+    // Empty for no cache on disk
+    std::string cache_dir;
+    // Compiled objects, keyed by name and options
+    std::map<std::string, cl_program> objects;
+    size_t ncompiled;
+    size_t nloaded;
+    size_t nhits;
+} h_program_library;
+
+// Function to compile source into an object for one device, without linking it
+cl_program h_compile_program(const char* source, cl_context context, cl_device_id device, const char* compile_opts=NULL) {
+    cl_int errcode;
+    cl_program program=clCreateProgramWithSource(context, 1, &source, NULL, &errcode);
+    h_errchk(errcode, "Creating program to compile");
+
+    errcode=clCompileProgram(program, 1, &device, compile_opts, 0, NULL, NULL, NULL, NULL);
+    if (errcode!=CL_SUCCESS) {
+        h_exit_with_program_log(program, device, "Compiling a program failed");
+    }
+    return program;
+}
+
+// Function to link compiled objects into an executable program for one device
+cl_program h_link_program(  cl_context context,
+                            cl_device_id device,
+                            cl_uint num_objects,
+                            const cl_program* objects,
+                            const char* link_opts=NULL) {
+    cl_int errcode;
+    cl_program program=clLinkProgram(   context,
+                                        1,
+                                        &device,
+                                        link_opts,
+                                        num_objects,
+                                        objects,
+                                        NULL,
+                                        NULL,
+                                        &errcode);
+    // The log is only there if the link got far enough to make a program
+    if (errcode!=CL_SUCCESS && program!=NULL) {
+        h_exit_with_program_log(program, device, "Linking a program failed");
+    }
+    h_errchk(errcode, "Linking a program");
+    return program;
+}
+
+// Function to make an empty library for a device. cache_dir may be NULL, and
+// otherwise must be an existing directory
+h_program_library h_create_program_library(cl_context context, cl_device_id device, const char* cache_dir=NULL) {
+    h_program_library library;
+    library.context=context;
+    library.device=device;
+    library.cache_dir=(cache_dir!=NULL) ? cache_dir : "";
+    library.ncompiled=0;
+    library.nloaded=0;
+    library.nhits=0;
+    return library;
+}
+
+// Function to release every object in a library
+void h_release_program_library(h_program_library* library) {
+    for (auto& entry : library->objects) {
+        h_errchk(clReleaseProgram(entry.second), "Releasing a library object");
+    }
+    library->objects.clear();
+}
+
+// Function to get the name of the cache file for an object. A different source,
+// options, device or driver gives a different file, so stale objects are never used
+std::string h_library_cache_file(h_program_library* library, const h_embedded_program* embedded, const std::string& opts) {
+    char device_name[256]="", driver_version[256]="";
+    h_errchk(clGetDeviceInfo(library->device, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL),
+            "Getting the device name");
+    h_errchk(clGetDeviceInfo(library->device, CL_DRIVER_VERSION, sizeof(driver_version), driver_version, NULL),
+            "Getting the driver version");
+    std::string key=std::string(embedded->source)+'\0'+opts+'\0'+device_name+'\0'+driver_version;
+
+    // 64-bit FNV-1a hash of the key
+    cl_ulong hash=14695981039346656037ULL;
+    for (size_t i=0; i<key.size(); i++) {
+        hash^=(unsigned char)key[i];
+        hash*=1099511628211ULL;
+    }
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%016llx.clobj", (unsigned long long)hash);
+    return library->cache_dir+"/"+embedded->name+suffix;
+}
+
+// Function to load a compiled object from the cache, returns NULL if there is none
+// or the device doesn't accept it
+cl_program h_load_library_object(h_program_library* library, const std::string& filename) {
+    FILE* fp=fopen(filename.c_str(), "rb");
+    if (fp==NULL) return NULL;
+    fclose(fp);
+
+    size_t nbytes;
+    const unsigned char* binary=(const unsigned char*)h_read_file(filename.c_str(), "rb", &nbytes);
+    cl_int binary_status, errcode;
+    cl_program program=clCreateProgramWithBinary(   library->context,
+                                                    1,
+                                                    &library->device,
+                                                    &nbytes,
+                                                    &binary,
+                                                    &binary_status,
+                                                    &errcode);
+    free((void*)binary);
+    if (errcode!=CL_SUCCESS || binary_status!=CL_SUCCESS) {
+        if (errcode==CL_SUCCESS) h_errchk(clReleaseProgram(program), "Releasing a rejected library object");
+        return NULL;
+    }
+
+    // The binary has to be a compiled object to be linked
+    cl_program_binary_type binary_type=CL_PROGRAM_BINARY_TYPE_NONE;
+    h_errchk(clGetProgramBuildInfo( program,
+                                    library->device,
+                                    CL_PROGRAM_BINARY_TYPE,
+                                    sizeof(binary_type),
+                                    &binary_type,
+                                    NULL), "Getting the binary type");
+    if (binary_type!=CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT) {
+        h_errchk(clReleaseProgram(program), "Releasing a rejected library object");
+        return NULL;
+    }
+    return program;
+}
+
+// Function to save a compiled object to the cache
+void h_save_library_object(cl_program object, const std::string& filename) {
+    size_t nbytes;
+    h_errchk(clGetProgramInfo(object, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &nbytes, NULL),
+            "Getting the object size");
+    unsigned char* binary=(unsigned char*)malloc(nbytes);
+    h_errchk(clGetProgramInfo(object, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary, NULL),
+            "Getting the object binary");
+
+    // A cache that can't be written only costs a compile next time
+    FILE* fp=fopen(filename.c_str(), "wb");
+    if (fp!=NULL) {
+        fwrite(binary, 1, nbytes, fp);
+        fclose(fp);
+    }
+    free(binary);
+}
+
+// Function to get the compiled object for an embedded library source, compiling it
+// only the first time it is asked for with these options. The library keeps the object
+cl_program h_library_object(h_program_library* library, const h_embedded_program* embedded, const char* compile_opts=NULL) {
+    std::string opts=(compile_opts!=NULL) ? compile_opts : "";
+    std::string key=std::string(embedded->name)+" "+opts;
+    auto found=library->objects.find(key);
+    if (found!=library->objects.end()) {
+        library->nhits++;
+        return found->second;
+    }
+
+    cl_program object=NULL;
+    std::string filename;
+    if (!library->cache_dir.empty()) {
+        filename=h_library_cache_file(library, embedded, opts);
+        object=h_load_library_object(library, filename);
+        if (object!=NULL) library->nloaded++;
+    }
+    if (object==NULL) {
+        object=h_compile_program(embedded->source, library->context, library->device, opts.c_str());
+        library->ncompiled++;
+        if (!library->cache_dir.empty()) h_save_library_object(object, filename);
+    }
+    library->objects[key]=object;
+    return object;
+}
+
+#endif
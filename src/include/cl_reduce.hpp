@@ -0,0 +1,427 @@
+#ifndef CL_REDUCE_HPP
+#define CL_REDUCE_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "cl_helper.hpp"
+
+// Reductions (sum, min, max) and argmin/argmax of device buffers to a single
+// value, without reading the buffer back. Each pass is a tree reduction in 
+// local memory, or in registers with sub-group functions where the device has them.
+
+// Work-group size, shrunk if the device can't fit it. Must be a power of two
+#define REDUCE_LOCAL 256
+
+// Element types for the reductions
+typedef enum {
+    H_FLOAT=0,
+    H_DOUBLE=1,
+    H_INT=2,
+    H_UINT=3
+} h_type;
+
+// Reduction operations, these match REDUCE_SUM, REDUCE_MIN and REDUCE_MAX in the kernels
+typedef enum {
+    H_REDUCE_SUM=0,
+    H_REDUCE_MIN=1,
+    H_REDUCE_MAX=2
+} h_reduce_op;
+
+// Kernel source for reduce and argreduce
+const char* reduce_kernel_source="\n\
+    // Element type, its limits and the work-group size, set with -D at build time \n\
+    #ifndef TYPE \n\
+    #define TYPE float \n\
+    #define TYPE_LOWEST -INFINITY \n\
+    #define TYPE_HIGHEST INFINITY \n\
+    #endif \n\
+    #ifndef REDUCE_LOCAL \n\
+    #define REDUCE_LOCAL 256 \n\
+    #endif \n\
+    \n\
+    #ifdef TYPE_DOUBLE \n\
+    #pragma OPENCL EXTENSION cl_khr_fp64 : enable \n\
+    #endif \n\
+    \n\
+    #if defined(USE_SUBGROUPS) && defined(cl_khr_subgroups) \n\
+    #pragma OPENCL EXTENSION cl_khr_subgroups : enable \n\
+    #endif \n\
+    \n\
+    // Operations, as in h_reduce_op \n\
+    #define REDUCE_SUM 0 \n\
+    #define REDUCE_MIN 1 \n\
+    #define REDUCE_MAX 2 \n\
+    \n\
+    TYPE identity(int op) { \n\
+        if (op==REDUCE_MIN) return TYPE_HIGHEST; \n\
+        if (op==REDUCE_MAX) return TYPE_LOWEST; \n\
+        return (TYPE)0; \n\
+    } \n\
+    \n\
+    TYPE combine(int op, TYPE a, TYPE b) { \n\
+        if (op==REDUCE_MIN) return min(a, b); \n\
+        if (op==REDUCE_MAX) return max(a, b); \n\
+        return a+b; \n\
+    } \n\
+    \n\
+    // True if (b, index_b) should replace (a, index_a), lowest index wins ties \n\
+    bool arg_better(int op, TYPE a, int index_a, TYPE b, int index_b) { \n\
+        if (b==a) return index_b<index_a; \n\
+        return (op==REDUCE_MIN) ? (b<a) : (b>a); \n\
+    } \n\
+    \n\
+    // Reduce one value per work-item to a single value for the work-group \n\
+    TYPE reduce_group(int op, TYPE value, __local TYPE* scratch) { \n\
+        size_t lid=get_local_id(0); \n\
+    #ifdef USE_SUBGROUPS \n\
+        // Reduce in registers within each sub-group, then across sub-groups \n\
+        if (op==REDUCE_MIN) value=sub_group_reduce_min(value); \n\
+        else if (op==REDUCE_MAX) value=sub_group_reduce_max(value); \n\
+        else value=sub_group_reduce_add(value); \n\
+        if (get_sub_group_local_id()==0) scratch[get_sub_group_id()]=value; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+        if (get_sub_group_id()==0) { \n\
+            value=identity(op); \n\
+            for (uint s=get_sub_group_local_id(); s<get_num_sub_groups(); s+=get_sub_group_size()) { \n\
+                value=combine(op, value, scratch[s]); \n\
+            } \n\
+            if (op==REDUCE_MIN) value=sub_group_reduce_min(value); \n\
+            else if (op==REDUCE_MAX) value=sub_group_reduce_max(value); \n\
+            else value=sub_group_reduce_add(value); \n\
+        } \n\
+    #else \n\
+        // Tree reduction in local memory \n\
+        scratch[lid]=value; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+        for (size_t stride=get_local_size(0)/2; stride>0; stride/=2) { \n\
+            if (lid<stride) scratch[lid]=combine(op, scratch[lid], scratch[lid+stride]); \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+        value=scratch[0]; \n\
+    #endif \n\
+        return value; \n\
+    } \n\
+    \n\
+    // One pass of a reduction of n elements of src, one result per work-group in dest. \n\
+    // Work-items stride over src, so any number of work-groups covers all of it \n\
+    __kernel void reduce(   int op, \n\
+                            ulong n, \n\
+                            __global TYPE* src, \n\
+                            __global TYPE* dest) { \n\
+        __local TYPE scratch[REDUCE_LOCAL]; \n\
+    \n\
+        TYPE value=identity(op); \n\
+        for (size_t i=get_global_id(0); i<n; i+=get_global_size(0)) { \n\
+            value=combine(op, value, src[i]); \n\
+        } \n\
+        value=reduce_group(op, value, scratch); \n\
+        if (get_local_id(0)==0) dest[get_group_id(0)]=value; \n\
+    } \n\
+    \n\
+    // One pass of an argmin or argmax of n elements of src. The first pass has no \n\
+    // src_indices and uses positions in src, later passes carry the indices along \n\
+    __kernel void argreduce(int op, \n\
+                            ulong n, \n\
+                            __global TYPE* src, \n\
+                            __global int* src_indices, \n\
+                            int first_pass, \n\
+                            __global TYPE* dest, \n\
+                            __global int* dest_indices) { \n\
+        __local TYPE scratch[REDUCE_LOCAL]; \n\
+        __local int scratch_indices[REDUCE_LOCAL]; \n\
+    \n\
+        TYPE value=identity(op); \n\
+        int index=INT_MAX; \n\
+        for (size_t i=get_global_id(0); i<n; i+=get_global_size(0)) { \n\
+            int index_i=first_pass ? (int)i : src_indices[i]; \n\
+            if (arg_better(op, value, index, src[i], index_i)) { \n\
+                value=src[i]; \n\
+                index=index_i; \n\
+            } \n\
+        } \n\
+    \n\
+        size_t lid=get_local_id(0); \n\
+    #ifdef USE_SUBGROUPS \n\
+        // The best value in each sub-group, then the lowest index that holds it \n\
+        TYPE best=(op==REDUCE_MIN) ? sub_group_reduce_min(value) : sub_group_reduce_max(value); \n\
+        index=sub_group_reduce_min((value==best) ? index : INT_MAX); \n\
+        if (get_sub_group_local_id()==0) { \n\
+            scratch[get_sub_group_id()]=best; \n\
+            scratch_indices[get_sub_group_id()]=index; \n\
+        } \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+        if (get_sub_group_id()==0) { \n\
+            value=identity(op); \n\
+            index=INT_MAX; \n\
+            for (uint s=get_sub_group_local_id(); s<get_num_sub_groups(); s+=get_sub_group_size()) { \n\
+                if (arg_better(op, value, index, scratch[s], scratch_indices[s])) { \n\
+                    value=scratch[s]; \n\
+                    index=scratch_indices[s]; \n\
+                } \n\
+            } \n\
+            best=(op==REDUCE_MIN) ? sub_group_reduce_min(value) : sub_group_reduce_max(value); \n\
+            index=sub_group_reduce_min((value==best) ? index : INT_MAX); \n\
+            value=best; \n\
+        } \n\
+    #else \n\
+        scratch[lid]=value; \n\
+        scratch_indices[lid]=index; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+        for (size_t stride=get_local_size(0)/2; stride>0; stride/=2) { \n\
+            if (lid<stride && arg_better(op, scratch[lid], scratch_indices[lid], \n\
+                                        scratch[lid+stride], scratch_indices[lid+stride])) { \n\
+                scratch[lid]=scratch[lid+stride]; \n\
+                scratch_indices[lid]=scratch_indices[lid+stride]; \n\
+            } \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+        value=scratch[0]; \n\
+        index=scratch_indices[0]; \n\
+    #endif \n\
+        if (lid==0) { \n\
+            dest[get_group_id(0)]=value; \n\
+            dest_indices[get_group_id(0)]=index; \n\
+        } \n\
+    } \n\
+";
+
+// Function to get the size in bytes of an element type
+size_t h_type_size(h_type type) {
+    if (type==H_DOUBLE) return sizeof(cl_double);
+    if (type==H_INT) return sizeof(cl_int);
+    if (type==H_UINT) return sizeof(cl_uint);
+    return sizeof(cl_float);
+}
+
+// Function to get the build options that define TYPE and its limits in the kernels
+const char* h_type_build_opts(h_type type) {
+    if (type==H_DOUBLE) return "-DTYPE=double -DTYPE_DOUBLE -DTYPE_LOWEST=-INFINITY -DTYPE_HIGHEST=INFINITY";
+    if (type==H_INT) return "-DTYPE=int -DTYPE_LOWEST=INT_MIN -DTYPE_HIGHEST=INT_MAX";
+    if (type==H_UINT) return "-DTYPE=uint -DTYPE_LOWEST=0 -DTYPE_HIGHEST=UINT_MAX";
+    return "-DTYPE=float -DTYPE_LOWEST=-INFINITY -DTYPE_HIGHEST=INFINITY";
+}
+
+// Function to check for sub-group functions in kernels. Intel sub-groups work 
+// with OpenCL C 1.2, cl_khr_subgroups needs the OpenCL C 2.0 or later compiler,
+// which is selected in std_opt
+cl_bool h_device_has_subgroups(cl_device_id device, char* std_opt, size_t nbytes_std_opt) {
+    std_opt[0]='\0';
+    if (h_device_has_extension(device, "cl_intel_subgroups")) return CL_TRUE;
+    if (!h_device_has_extension(device, "cl_khr_subgroups")) return CL_FALSE;
+
+    char version[128];
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_OPENCL_C_VERSION,
+                                sizeof(version),
+                                version,
+                                NULL), "Getting the OpenCL C version");
+    // The version string is "OpenCL C <major>.<minor> <vendor information>"
+    int major=0, minor=0;
+    if (sscanf(version, "OpenCL C %d.%d", &major, &minor)!=2 || major<2) return CL_FALSE;
+    snprintf(std_opt, nbytes_std_opt, "-cl-std=CL%d.%d", major, minor);
+    return CL_TRUE;
+}
+
+// Everything needed to run reductions of one element type on a device. 
+// The scratch buffers hold the partial results between passes,
+// so a plan should only be used by one command queue at a time
+typedef struct {
+    cl_program program;
+    cl_kernel kernel_reduce;
+    cl_kernel kernel_argreduce;
+    h_type type;
+    size_t local;
+    cl_bool subgroups;
+    cl_mem scratch;
+    cl_mem scratch_indices;
+} h_reduce_plan;
+
+// Function to build the reduction kernels for one element type on a device
+h_reduce_plan h_create_reduce_plan(cl_context context, cl_device_id device, h_type type) {
+    h_reduce_plan plan;
+    plan.type=type;
+
+    if (type==H_DOUBLE && !h_device_supports_double(device)) {
+        h_errchk(CL_INVALID_DEVICE, "Checking double support in h_create_reduce_plan");
+    }
+
+    size_t max_work_group_size;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                sizeof(size_t),
+                                &max_work_group_size,
+                                NULL), "Getting the maximum work-group size");
+    plan.local=REDUCE_LOCAL;
+    while (plan.local>max_work_group_size) plan.local/=2;
+
+    char std_opt[32];
+    plan.subgroups=h_device_has_subgroups(device, std_opt, sizeof(std_opt));
+
+    char build_opts[256];
+    snprintf(build_opts, sizeof(build_opts), "%s -DREDUCE_LOCAL=%zu %s %s", 
+            h_type_build_opts(type), plan.local, plan.subgroups ? "-DUSE_SUBGROUPS" : "", std_opt);
+    plan.program=h_build_program(reduce_kernel_source, context, device, build_opts);
+
+    cl_int errcode;
+    plan.kernel_reduce=clCreateKernel(plan.program, "reduce", &errcode);
+    h_errchk(errcode, "Creating Kernel reduce");
+    plan.kernel_argreduce=clCreateKernel(plan.program, "argreduce", &errcode);
+    h_errchk(errcode, "Creating Kernel argreduce");
+
+    // The first pass leaves at most one partial result per work-item of the second
+    plan.scratch=clCreateBuffer(context, CL_MEM_READ_WRITE, plan.local*h_type_size(type), NULL, &errcode);
+    h_errchk(errcode, "Creating the reduction scratch buffer");
+    plan.scratch_indices=clCreateBuffer(context, CL_MEM_READ_WRITE, plan.local*sizeof(cl_int), NULL, &errcode);
+    h_errchk(errcode, "Creating the reduction scratch indices");
+    return plan;
+}
+
+// Function to release the kernels, program and buffers of a reduction plan
+void h_release_reduce_plan(h_reduce_plan* plan) {
+    h_errchk(clReleaseKernel(plan->kernel_reduce), "Releasing kernel reduce");
+    h_errchk(clReleaseKernel(plan->kernel_argreduce), "Releasing kernel argreduce");
+    h_errchk(clReleaseProgram(plan->program), "Releasing the reduction program");
+    h_errchk(clReleaseMemObject(plan->scratch), "Releasing the reduction scratch buffer");
+    h_errchk(clReleaseMemObject(plan->scratch_indices), "Releasing the reduction scratch indices");
+}
+
+// Function to enqueue one pass of reduce over n elements with ngroups work-groups
+cl_event h_enqueue_reduce_pass(
+        cl_command_queue command_queue,
+        h_reduce_plan* plan,
+        h_reduce_op op,
+        size_t n,
+        cl_mem src,
+        cl_mem dest,
+        size_t ngroups,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    cl_kernel kernel=plan->kernel_reduce;
+    cl_int op_arg=op;
+    cl_ulong n_arg=n;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_int), &op_arg), "setting reduce argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_ulong), &n_arg), "setting reduce argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &src), "setting reduce argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_mem), &dest), "setting reduce argument 3");
+
+    size_t local_size[]={ plan->local };
+    size_t global_size[]={ ngroups*plan->local };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running reduce");
+    return event;
+}
+
+// Function to enqueue a reduction of the first n elements of src into element 0 
+// of result. Large inputs take two passes, the first leaves one partial result 
+// per work-group in the plan's scratch buffer. Returns the event of the last pass
+cl_event h_enqueue_reduce(
+        cl_command_queue command_queue,
+        h_reduce_plan* plan,
+        h_reduce_op op,
+        size_t n,
+        cl_mem src,
+        cl_mem result,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (n==0) h_errchk(CL_INVALID_VALUE, "Checking n in h_enqueue_reduce");
+
+    size_t ngroups=std::min((n+plan->local-1)/plan->local, plan->local);
+    if (ngroups==1) {
+        return h_enqueue_reduce_pass(   command_queue, plan, op, n, src, result, 1, 
+                                        num_events_in_wait_list, event_wait_list);
+    }
+
+    cl_event event_first=h_enqueue_reduce_pass( command_queue, plan, op, n, src, plan->scratch, ngroups, 
+                                                num_events_in_wait_list, event_wait_list);
+    cl_event event=h_enqueue_reduce_pass(command_queue, plan, op, ngroups, plan->scratch, result, 1, 1, &event_first);
+    h_errchk(clReleaseEvent(event_first), "Releasing the first reduction pass");
+    return event;
+}
+
+// Function to enqueue one pass of argreduce over n elements with ngroups work-groups,
+// src_indices is NULL for the first pass
+cl_event h_enqueue_argreduce_pass(
+        cl_command_queue command_queue,
+        h_reduce_plan* plan,
+        h_reduce_op op,
+        size_t n,
+        cl_mem src,
+        cl_mem src_indices,
+        cl_mem dest,
+        cl_mem dest_indices,
+        size_t ngroups,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    cl_kernel kernel=plan->kernel_argreduce;
+    cl_int op_arg=op;
+    cl_ulong n_arg=n;
+    cl_int first_pass=(src_indices==NULL) ? 1 : 0;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_int), &op_arg), "setting argreduce argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_ulong), &n_arg), "setting argreduce argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &src), "setting argreduce argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_mem), &src_indices), "setting argreduce argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &first_pass), "setting argreduce argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_mem), &dest), "setting argreduce argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_mem), &dest_indices), "setting argreduce argument 6");
+
+    size_t local_size[]={ plan->local };
+    size_t global_size[]={ ngroups*plan->local };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running argreduce");
+    return event;
+}
+
+// Function to enqueue an argmin (op is H_REDUCE_MIN) or argmax (H_REDUCE_MAX) of 
+// the first n elements of src. The extreme value goes to element 0 of result 
+// and its position, the lowest one on ties, to element 0 of result_index as a cl_int
+cl_event h_enqueue_argreduce(
+        cl_command_queue command_queue,
+        h_reduce_plan* plan,
+        h_reduce_op op,
+        size_t n,
+        cl_mem src,
+        cl_mem result,
+        cl_mem result_index,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (op==H_REDUCE_SUM) h_errchk(CL_INVALID_VALUE, "Checking op in h_enqueue_argreduce");
+    if (n==0 || n>CL_INT_MAX) h_errchk(CL_INVALID_VALUE, "Checking n in h_enqueue_argreduce");
+
+    size_t ngroups=std::min((n+plan->local-1)/plan->local, plan->local);
+    if (ngroups==1) {
+        return h_enqueue_argreduce_pass(command_queue, plan, op, n, src, NULL, result, result_index, 1,
+                                        num_events_in_wait_list, event_wait_list);
+    }
+
+    cl_event event_first=h_enqueue_argreduce_pass(  command_queue, plan, op, n, src, NULL, 
+                                                    plan->scratch, plan->scratch_indices, ngroups,
+                                                    num_events_in_wait_list, event_wait_list);
+    cl_event event=h_enqueue_argreduce_pass(command_queue, plan, op, ngroups, plan->scratch, plan->scratch_indices,
+                                            result, result_index, 1, 1, &event_first);
+    h_errchk(clReleaseEvent(event_first), "Releasing the first argreduce pass");
+    return event;
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef CL_SCAN_HPP
+#define CL_SCAN_HPP
+
+#include <stdlib.h>
+
+#include "cl_helper.hpp"
+#include "cl_reduce.hpp"
+
+// Exclusive and inclusive prefix sums (scans) of device buffers, and stream 
+// compaction built on them, so that the entries of a matrix above a threshold 
+// can be gathered on the device and only those read back. The scan works in 
+// three phases: scan each block and keep its total, scan the block totals 
+// (recursively, with the same kernels) and add them back to the blocks.
+
+// Work-group size, shrunk if the device can't fit it. Must be a power of two
+#define SCAN_LOCAL 256
+// Elements scanned serially by each work-item
+#define SCAN_ITEMS 8
+
+// Kernel source for scan_blocks, scan_add, compact_flags and compact_scatter
+const char* scan_kernel_source="\n\
+    // Element type, work-group size and elements per work-item, set with -D at build time \n\
+    #ifndef TYPE \n\
+    #define TYPE float \n\
+    #endif \n\
+    #ifndef SCAN_LOCAL \n\
+    #define SCAN_LOCAL 256 \n\
+    #endif \n\
+    #ifndef SCAN_ITEMS \n\
+    #define SCAN_ITEMS 8 \n\
+    #endif \n\
+    #define SCAN_BLOCK (SCAN_LOCAL*SCAN_ITEMS) \n\
+    \n\
+    #ifdef TYPE_DOUBLE \n\
+    #pragma OPENCL EXTENSION cl_khr_fp64 : enable \n\
+    #endif \n\
+    \n\
+    // Phase 1 of the scan, each work-group scans one block of SCAN_BLOCK elements \n\
+    // and writes the block total to block_sums. The block is staged in local memory \n\
+    // so that loads and stores are coalesced, then each work-item scans SCAN_ITEMS \n\
+    // consecutive elements serially and the work-item totals are scanned in local memory. \n\
+    // src and dest may be the same buffer \n\
+    __kernel void scan_blocks(  ulong n, \n\
+                                __global TYPE* src, \n\
+                                __global TYPE* dest, \n\
+                                __global TYPE* block_sums, \n\
+                                int inclusive) { \n\
+        __local TYPE block[SCAN_BLOCK]; \n\
+        __local TYPE totals[SCAN_LOCAL]; \n\
+    \n\
+        size_t lid=get_local_id(0); \n\
+        size_t start=get_group_id(0)*SCAN_BLOCK; \n\
+        for (size_t i=lid; i<SCAN_BLOCK; i+=SCAN_LOCAL) { \n\
+            block[i]=(start+i<n) ? src[start+i] : (TYPE)0; \n\
+        } \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        TYPE total=(TYPE)0; \n\
+        for (int k=0; k<SCAN_ITEMS; k++) total+=block[lid*SCAN_ITEMS+k]; \n\
+        totals[lid]=total; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        // Inclusive Hillis-Steele scan of the work-item totals \n\
+        for (size_t offset=1; offset<SCAN_LOCAL; offset*=2) { \n\
+            TYPE temp=(lid>=offset) ? totals[lid-offset] : (TYPE)0; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+            totals[lid]+=temp; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+    \n\
+        // Scan this work-item's elements, starting from the total of the ones before \n\
+        TYPE running=totals[lid]-total; \n\
+        for (int k=0; k<SCAN_ITEMS; k++) { \n\
+            TYPE value=block[lid*SCAN_ITEMS+k]; \n\
+            block[lid*SCAN_ITEMS+k]=inclusive ? running+value : running; \n\
+            running+=value; \n\
+        } \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        for (size_t i=lid; i<SCAN_BLOCK; i+=SCAN_LOCAL) { \n\
+            if (start+i<n) dest[start+i]=block[i]; \n\
+        } \n\
+        if (lid==SCAN_LOCAL-1) block_sums[get_group_id(0)]=totals[lid]; \n\
+    } \n\
+    \n\
+    // Phase 3 of the scan, adds the exclusive scan of the block totals to every block \n\
+    __kernel void scan_add( ulong n, \n\
+                            __global TYPE* dest, \n\
+                            __global TYPE* block_offsets) { \n\
+        size_t i=get_global_id(0); \n\
+        if (i<n) dest[i]+=block_offsets[i/SCAN_BLOCK]; \n\
+    } \n\
+    \n\
+    // True if an element survives compaction \n\
+    int keep(TYPE value, TYPE threshold, int magnitude) { \n\
+        if (magnitude && value<(TYPE)0) value=-value; \n\
+        return value>threshold; \n\
+    } \n\
+    \n\
+    // Stream compaction, first marks the elements to keep with 1 in flags \n\
+    __kernel void compact_flags(ulong n, \n\
+                                __global TYPE* src, \n\
+                                TYPE threshold, \n\
+                                int magnitude, \n\
+                                __global uint* flags) { \n\
+        size_t i=get_global_id(0); \n\
+        if (i<n) flags[i]=keep(src[i], threshold, magnitude) ? 1 : 0; \n\
+    } \n\
+    \n\
+    // Stream compaction, then writes every kept element and its position in src to \n\
+    // the place given by the exclusive scan of the flags. The last work-item writes the count \n\
+    __kernel void compact_scatter(  ulong n, \n\
+                                    __global TYPE* src, \n\
+                                    TYPE threshold, \n\
+                                    int magnitude, \n\
+                                    __global uint* positions, \n\
+                                    __global TYPE* dest, \n\
+                                    __global uint* dest_indices, \n\
+                                    __global uint* count) { \n\
+        size_t i=get_global_id(0); \n\
+        if (i>=n) return; \n\
+        int kept=keep(src[i], threshold, magnitude); \n\
+        if (kept) { \n\
+            dest[positions[i]]=src[i]; \n\
+            dest_indices[positions[i]]=(uint)i; \n\
+        } \n\
+        if (i==n-1) count[0]=positions[i]+kept; \n\
+    } \n\
+";
+
+// Everything needed to scan and compact buffers of one element type on a device
+typedef struct {
+    cl_program program;
+    cl_kernel kernel_scan_blocks;
+    cl_kernel kernel_scan_add;
+    cl_kernel kernel_compact_flags;
+    cl_kernel kernel_compact_scatter;
+    h_type type;
+    size_t local;
+    size_t block;
+} h_scan_plan;
+
+// Function to build the scan and compaction kernels for one element type on a device
+h_scan_plan h_create_scan_plan(cl_context context, cl_device_id device, h_type type) {
+    h_scan_plan plan;
+    plan.type=type;
+
+    if (type==H_DOUBLE && !h_device_supports_double(device)) {
+        h_errchk(CL_INVALID_DEVICE, "Checking double support in h_create_scan_plan");
+    }
+
+    size_t max_work_group_size;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                sizeof(size_t),
+                                &max_work_group_size,
+                                NULL), "Getting the maximum work-group size");
+    plan.local=SCAN_LOCAL;
+    while (plan.local>max_work_group_size) plan.local/=2;
+    plan.block=plan.local*SCAN_ITEMS;
+
+    char build_opts[256];
+    snprintf(build_opts, sizeof(build_opts), "%s -DSCAN_LOCAL=%zu -DSCAN_ITEMS=%d", 
+            h_type_build_opts(type), plan.local, SCAN_ITEMS);
+    plan.program=h_build_program(scan_kernel_source, context, device, build_opts);
+
+    cl_int errcode;
+    plan.kernel_scan_blocks=clCreateKernel(plan.program, "scan_blocks", &errcode);
+    h_errchk(errcode, "Creating Kernel scan_blocks");
+    plan.kernel_scan_add=clCreateKernel(plan.program, "scan_add", &errcode);
+    h_errchk(errcode, "Creating Kernel scan_add");
+    plan.kernel_compact_flags=clCreateKernel(plan.program, "compact_flags", &errcode);
+    h_errchk(errcode, "Creating Kernel compact_flags");
+    plan.kernel_compact_scatter=clCreateKernel(plan.program, "compact_scatter", &errcode);
+    h_errchk(errcode, "Creating Kernel compact_scatter");
+    return plan;
+}
+
+// Function to release the kernels and program of a scan plan
+void h_release_scan_plan(h_scan_plan* plan) {
+    h_errchk(clReleaseKernel(plan->kernel_scan_blocks), "Releasing kernel scan_blocks");
+    h_errchk(clReleaseKernel(plan->kernel_scan_add), "Releasing kernel scan_add");
+    h_errchk(clReleaseKernel(plan->kernel_compact_flags), "Releasing kernel compact_flags");
+    h_errchk(clReleaseKernel(plan->kernel_compact_scatter), "Releasing kernel compact_scatter");
+    h_errchk(clReleaseProgram(plan->program), "Releasing the scan program");
+}
+
+// Function to enqueue a 1D kernel over n work-items, rounded up to whole work-groups
+cl_event h_enqueue_scan_kernel(
+        cl_command_queue command_queue,
+        cl_kernel kernel,
+        size_t n,
+        size_t local,
+        const char* message,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    size_t local_size[]={ local };
+    size_t global_size[]={ ((n+local-1)/local)*local };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), message);
+    return event;
+}
+
+// Function to enqueue a scan of the first n elements of src into dest, which may 
+// be the same buffer. Element i of dest is the sum of elements 0 to i-1 of src for
+// an exclusive scan, or 0 to i for an inclusive one. Returns the event of the last kernel
+cl_event h_enqueue_scan(
+        cl_command_queue command_queue,
+        h_scan_plan* plan,
+        cl_bool inclusive,
+        size_t n,
+        cl_mem src,
+        cl_mem dest,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (n==0) h_errchk(CL_INVALID_VALUE, "Checking n in h_enqueue_scan");
+
+    cl_context context;
+    h_errchk(clGetCommandQueueInfo( command_queue,
+                                    CL_QUEUE_CONTEXT,
+                                    sizeof(cl_context),
+                                    &context,
+                                    NULL), "Getting the context of the command queue");
+
+    // Totals of each block, released once the kernels that use them have finished
+    size_t nblocks=(n+plan->block-1)/plan->block;
+    cl_int errcode;
+    cl_mem block_sums=clCreateBuffer(context, CL_MEM_READ_WRITE, nblocks*h_type_size(plan->type), NULL, &errcode);
+    h_errchk(errcode, "Creating the block sums");
+
+    // Phase 1, scan each block
+    cl_kernel kernel=plan->kernel_scan_blocks;
+    cl_ulong n_arg=n;
+    cl_int inclusive_arg=inclusive ? 1 : 0;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &n_arg), "setting scan_blocks argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &src), "setting scan_blocks argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &dest), "setting scan_blocks argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_mem), &block_sums), "setting scan_blocks argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &inclusive_arg), "setting scan_blocks argument 4");
+    cl_event event_blocks=h_enqueue_scan_kernel(command_queue, kernel, nblocks*plan->local, plan->local,
+                                                "Running scan_blocks", num_events_in_wait_list, event_wait_list);
+    if (nblocks==1) {
+        h_errchk(clReleaseMemObject(block_sums), "Releasing the block sums");
+        return event_blocks;
+    }
+
+    // Phase 2, exclusive scan of the block totals in place
+    cl_event event_sums=h_enqueue_scan(command_queue, plan, CL_FALSE, nblocks, block_sums, block_sums, 1, &event_blocks);
+
+    // Phase 3, add the scanned totals to the blocks
+    kernel=plan->kernel_scan_add;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &n_arg), "setting scan_add argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &dest), "setting scan_add argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &block_sums), "setting scan_add argument 2");
+    cl_event event=h_enqueue_scan_kernel(   command_queue, kernel, n, plan->local,
+                                            "Running scan_add", 1, &event_sums);
+
+    h_errchk(clReleaseEvent(event_blocks), "Releasing the scan_blocks event");
+    h_errchk(clReleaseEvent(event_sums), "Releasing the block sums event");
+    h_errchk(clReleaseMemObject(block_sums), "Releasing the block sums");
+    return event;
+}
+
+// Function to enqueue a stream compaction of the first n elements of src. Elements 
+// greater than threshold, or with magnitude greater than threshold if magnitude is 
+// CL_TRUE, are written in order to dest and their positions in src to dest_indices
+// as cl_uint. The number kept goes to element 0 of count. threshold points to one 
+// element of the plan's type. plan_positions must be a H_UINT plan, which scans the 
+// flags; it may be plan itself. Returns the event of the last kernel
+cl_event h_enqueue_compact(
+        cl_command_queue command_queue,
+        h_scan_plan* plan,
+        h_scan_plan* plan_positions,
+        size_t n,
+        cl_mem src,
+        const void* threshold,
+        cl_bool magnitude,
+        cl_mem dest,
+        cl_mem dest_indices,
+        cl_mem count,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (plan_positions->type!=H_UINT) h_errchk(CL_INVALID_VALUE, "Checking plan_positions in h_enqueue_compact");
+    if (n==0 || n>CL_UINT_MAX) h_errchk(CL_INVALID_VALUE, "Checking n in h_enqueue_compact");
+
+    cl_context context;
+    h_errchk(clGetCommandQueueInfo( command_queue,
+                                    CL_QUEUE_CONTEXT,
+                                    sizeof(cl_context),
+                                    &context,
+                                    NULL), "Getting the context of the command queue");
+    cl_int errcode;
+    cl_mem positions=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating the compaction positions");
+
+    cl_kernel kernel=plan->kernel_compact_flags;
+    size_t type_size=h_type_size(plan->type);
+    cl_ulong n_arg=n;
+    cl_int magnitude_arg=magnitude ? 1 : 0;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &n_arg), "setting compact_flags argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &src), "setting compact_flags argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, type_size, threshold), "setting compact_flags argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &magnitude_arg), "setting compact_flags argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_mem), &positions), "setting compact_flags argument 4");
+    cl_event event_flags=h_enqueue_scan_kernel( command_queue, kernel, n, plan->local, "Running compact_flags",
+                                                num_events_in_wait_list, event_wait_list);
+
+    // The exclusive scan of the flags is where each kept element goes
+    cl_event event_scan=h_enqueue_scan(command_queue, plan_positions, CL_FALSE, n, positions, positions, 1, &event_flags);
+
+    kernel=plan->kernel_compact_scatter;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &n_arg), "setting compact_scatter argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &src), "setting compact_scatter argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, type_size, threshold), "setting compact_scatter argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &magnitude_arg), "setting compact_scatter argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_mem), &positions), "setting compact_scatter argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_mem), &dest), "setting compact_scatter argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_mem), &dest_indices), "setting compact_scatter argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_mem), &count), "setting compact_scatter argument 7");
+    cl_event event=h_enqueue_scan_kernel(   command_queue, kernel, n, plan->local, "Running compact_scatter",
+                                            1, &event_scan);
+
+    h_errchk(clReleaseEvent(event_flags), "Releasing the compact_flags event");
+    h_errchk(clReleaseEvent(event_scan), "Releasing the compaction scan event");
+    h_errchk(clReleaseMemObject(positions), "Releasing the compaction positions");
+    return event;
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef CL_SORT_HPP
+#define CL_SORT_HPP
+
+#include <algorithm>
+
+#include "cl_helper.hpp"
+#include "cl_reduce.hpp"
+#include "cl_scan.hpp"
+
+// Least significant digit (LSD) radix sort of 32-bit keys, optionally carrying 
+// a 32-bit value with each key, entirely on the device. Each pass sorts on 
+// RADIX_BITS bits: count the digits of each block in local memory, scan the 
+// counts with the scan kernels and scatter the keys stably to their places.
+
+// Work-group size, shrunk if the device can't fit it. Must be a power of two
+#define SORT_LOCAL 256
+// Keys handled by each work-item
+#define SORT_ITEMS 4
+// Bits sorted per pass, this matches RADIX_BITS in the kernels
+#define SORT_RADIX_BITS 4
+
+// Kernel source for radix_histogram and radix_scatter
+const char* sort_kernel_source="\n\
+    // Work-group size and keys per work-item, set with -D at build time \n\
+    #ifndef SORT_LOCAL \n\
+    #define SORT_LOCAL 256 \n\
+    #endif \n\
+    #ifndef SORT_ITEMS \n\
+    #define SORT_ITEMS 4 \n\
+    #endif \n\
+    #define SORT_BLOCK (SORT_LOCAL*SORT_ITEMS) \n\
+    // Bits sorted per pass and the number of buckets \n\
+    #define RADIX_BITS 4 \n\
+    #define RADIX (1<<RADIX_BITS) \n\
+    \n\
+    // Key types, as in h_type \n\
+    #define KEY_FLOAT 0 \n\
+    #define KEY_INT 2 \n\
+    #define KEY_UINT 3 \n\
+    \n\
+    // The digit of a key for this pass. Keys are mapped to unsigned integers \n\
+    // that sort in the same order, flipping the sign bit of ints and all the bits \n\
+    // of negative floats. Descending sorts reverse the digits \n\
+    uint digit(uint key, int key_type, int descending, int shift) { \n\
+        if (key_type==KEY_INT) key^=0x80000000u; \n\
+        if (key_type==KEY_FLOAT) key^=(key>>31) ? 0xffffffffu : 0x80000000u; \n\
+        uint d=(key>>shift)&(RADIX-1); \n\
+        return descending ? (RADIX-1)-d : d; \n\
+    } \n\
+    \n\
+    // Counts the digits in each block of SORT_BLOCK keys. Counts are stored digit by \n\
+    // digit, counts[d*ngroups+group], so that their exclusive scan is where the keys \n\
+    // with digit d from each block start in the output \n\
+    __kernel void radix_histogram(  ulong n, \n\
+                                    __global uint* keys, \n\
+                                    int key_type, \n\
+                                    int descending, \n\
+                                    int shift, \n\
+                                    __global uint* counts) { \n\
+        __local uint histogram[RADIX]; \n\
+    \n\
+        size_t lid=get_local_id(0); \n\
+        if (lid<RADIX) histogram[lid]=0; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        size_t start=get_group_id(0)*SORT_BLOCK; \n\
+        for (size_t i=start+lid; i<start+SORT_BLOCK && i<n; i+=SORT_LOCAL) { \n\
+            atomic_inc(&histogram[digit(keys[i], key_type, descending, shift)]); \n\
+        } \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        if (lid<RADIX) counts[lid*get_num_groups(0)+get_group_id(0)]=histogram[lid]; \n\
+    } \n\
+    \n\
+    // Moves each key, and its value if has_values, to its place for this pass. \n\
+    // Each work-item takes SORT_ITEMS consecutive keys, and a scan of the digit counts \n\
+    // across the work-group keeps keys with the same digit in order, so the sort is stable \n\
+    __kernel void radix_scatter(ulong n, \n\
+                                __global uint* keys, \n\
+                                __global uint* values, \n\
+                                int has_values, \n\
+                                int key_type, \n\
+                                int descending, \n\
+                                int shift, \n\
+                                __global uint* offsets, \n\
+                                __global uint* dest_keys, \n\
+                                __global uint* dest_values) { \n\
+        __local uint prefix[RADIX][SORT_LOCAL]; \n\
+        __local uint base[RADIX]; \n\
+    \n\
+        size_t lid=get_local_id(0); \n\
+        size_t first=get_group_id(0)*SORT_BLOCK+lid*SORT_ITEMS; \n\
+    \n\
+        uint counts[RADIX]; \n\
+        for (int d=0; d<RADIX; d++) counts[d]=0; \n\
+        for (int k=0; k<SORT_ITEMS; k++) { \n\
+            if (first+k<n) counts[digit(keys[first+k], key_type, descending, shift)]++; \n\
+        } \n\
+        for (int d=0; d<RADIX; d++) prefix[d][lid]=counts[d]; \n\
+        if (lid<RADIX) base[lid]=offsets[lid*get_num_groups(0)+get_group_id(0)]; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        // Inclusive Hillis-Steele scan of the counts of every digit \n\
+        for (size_t offset=1; offset<SORT_LOCAL; offset*=2) { \n\
+            uint temp[RADIX]; \n\
+            for (int d=0; d<RADIX; d++) temp[d]=(lid>=offset) ? prefix[d][lid-offset] : 0; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+            for (int d=0; d<RADIX; d++) prefix[d][lid]+=temp[d]; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+    \n\
+        // The keys with each digit from earlier work-items come first \n\
+        for (int d=0; d<RADIX; d++) counts[d]=base[d]+prefix[d][lid]-counts[d]; \n\
+        for (int k=0; k<SORT_ITEMS; k++) { \n\
+            if (first+k<n) { \n\
+                uint key=keys[first+k]; \n\
+                uint pos=counts[digit(key, key_type, descending, shift)]++; \n\
+                dest_keys[pos]=key; \n\
+                if (has_values) dest_values[pos]=values[first+k]; \n\
+            } \n\
+        } \n\
+    } \n\
+";
+
+// Everything needed to sort on a device, including a H_UINT scan plan for the counts
+typedef struct {
+    cl_program program;
+    cl_kernel kernel_histogram;
+    cl_kernel kernel_scatter;
+    h_scan_plan plan_scan;
+    size_t local;
+    size_t block;
+} h_sort_plan;
+
+// Function to build the sort kernels for a device
+h_sort_plan h_create_sort_plan(cl_context context, cl_device_id device) {
+    h_sort_plan plan;
+
+    size_t max_work_group_size;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                sizeof(size_t),
+                                &max_work_group_size,
+                                NULL), "Getting the maximum work-group size");
+    // The histogram needs a work-item for every digit
+    plan.local=SORT_LOCAL;
+    while (plan.local>max_work_group_size) plan.local/=2;
+    if (plan.local<(1<<SORT_RADIX_BITS)) h_errchk(CL_INVALID_DEVICE, "Checking the work-group size in h_create_sort_plan");
+    plan.block=plan.local*SORT_ITEMS;
+
+    char build_opts[64];
+    snprintf(build_opts, sizeof(build_opts), "-DSORT_LOCAL=%zu -DSORT_ITEMS=%d", plan.local, SORT_ITEMS);
+    plan.program=h_build_program(sort_kernel_source, context, device, build_opts);
+
+    cl_int errcode;
+    plan.kernel_histogram=clCreateKernel(plan.program, "radix_histogram", &errcode);
+    h_errchk(errcode, "Creating Kernel radix_histogram");
+    plan.kernel_scatter=clCreateKernel(plan.program, "radix_scatter", &errcode);
+    h_errchk(errcode, "Creating Kernel radix_scatter");
+
+    plan.plan_scan=h_create_scan_plan(context, device, H_UINT);
+    return plan;
+}
+
+// Function to release the kernels and program of a sort plan
+void h_release_sort_plan(h_sort_plan* plan) {
+    h_errchk(clReleaseKernel(plan->kernel_histogram), "Releasing kernel radix_histogram");
+    h_errchk(clReleaseKernel(plan->kernel_scatter), "Releasing kernel radix_scatter");
+    h_errchk(clReleaseProgram(plan->program), "Releasing the sort program");
+    h_release_scan_plan(&plan->plan_scan);
+}
+
+// Function to enqueue a sort of the first n keys in place, in ascending order or 
+// descending if descending is CL_TRUE. key_type is H_UINT, H_INT or H_FLOAT and 
+// sets how the 32 bits of each key are ordered. If values is not NULL each value 
+// moves with its key, and keys that compare equal keep their order. 
+// Returns the event of the last kernel
+cl_event h_enqueue_sort(
+        cl_command_queue command_queue,
+        h_sort_plan* plan,
+        h_type key_type,
+        cl_bool descending,
+        size_t n,
+        cl_mem keys,
+        cl_mem values,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (key_type==H_DOUBLE) h_errchk(CL_INVALID_VALUE, "Checking key_type in h_enqueue_sort");
+    if (n==0 || n>CL_UINT_MAX) h_errchk(CL_INVALID_VALUE, "Checking n in h_enqueue_sort");
+
+    cl_context context;
+    h_errchk(clGetCommandQueueInfo( command_queue,
+                                    CL_QUEUE_CONTEXT,
+                                    sizeof(cl_context),
+                                    &context,
+                                    NULL), "Getting the context of the command queue");
+
+    // Passes go back and forth between the inputs and these buffers, 
+    // there is an even number of passes so the result ends up in the inputs
+    size_t ngroups=(n+plan->block-1)/plan->block;
+    size_t ncounts=ngroups<<SORT_RADIX_BITS;
+    cl_int errcode;
+    cl_mem temp_keys=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating the temporary keys");
+    cl_mem temp_values=NULL;
+    if (values!=NULL) {
+        temp_values=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &errcode);
+        h_errchk(errcode, "Creating the temporary values");
+    }
+    cl_mem counts=clCreateBuffer(context, CL_MEM_READ_WRITE, ncounts*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating the digit counts");
+
+    cl_ulong n_arg=n;
+    cl_int key_type_arg=key_type, descending_arg=descending ? 1 : 0, has_values=(values!=NULL) ? 1 : 0;
+    cl_mem src_keys=keys, src_values=values, dest_keys=temp_keys, dest_values=temp_values;
+    size_t local_size[]={ plan->local };
+    size_t global_size[]={ ngroups*plan->local };
+
+    cl_event event=NULL;
+    for (cl_int shift=0; shift<32; shift+=SORT_RADIX_BITS) {
+        cl_kernel kernel=plan->kernel_histogram;
+        h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &n_arg), "setting radix_histogram argument 0");
+        h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &src_keys), "setting radix_histogram argument 1");
+        h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_int), &key_type_arg), "setting radix_histogram argument 2");
+        h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &descending_arg), "setting radix_histogram argument 3");
+        h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &shift), "setting radix_histogram argument 4");
+        h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_mem), &counts), "setting radix_histogram argument 5");
+
+        // The first pass waits on the caller's events, later ones on the pass before
+        cl_event event_histogram;
+        h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                        kernel,
+                                        1,
+                                        NULL,
+                                        global_size,
+                                        local_size,
+                                        (event==NULL) ? num_events_in_wait_list : 1,
+                                        (event==NULL) ? event_wait_list : &event,
+                                        &event_histogram), "Running radix_histogram");
+        if (event!=NULL) h_errchk(clReleaseEvent(event), "Releasing the radix_scatter event");
+
+        cl_event event_scan=h_enqueue_scan( command_queue, &plan->plan_scan, CL_FALSE, ncounts, 
+                                            counts, counts, 1, &event_histogram);
+
+        kernel=plan->kernel_scatter;
+        h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &n_arg), "setting radix_scatter argument 0");
+        h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &src_keys), "setting radix_scatter argument 1");
+        h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &src_values), "setting radix_scatter argument 2");
+        h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &has_values), "setting radix_scatter argument 3");
+        h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &key_type_arg), "setting radix_scatter argument 4");
+        h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_int), &descending_arg), "setting radix_scatter argument 5");
+        h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_int), &shift), "setting radix_scatter argument 6");
+        h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_mem), &counts), "setting radix_scatter argument 7");
+        h_errchk(clSetKernelArg(kernel, 8, sizeof(cl_mem), &dest_keys), "setting radix_scatter argument 8");
+        h_errchk(clSetKernelArg(kernel, 9, sizeof(cl_mem), &dest_values), "setting radix_scatter argument 9");
+        h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                        kernel,
+                                        1,
+                                        NULL,
+                                        global_size,
+                                        local_size,
+                                        1,
+                                        &event_scan,
+                                        &event), "Running radix_scatter");
+        h_errchk(clReleaseEvent(event_histogram), "Releasing the radix_histogram event");
+        h_errchk(clReleaseEvent(event_scan), "Releasing the digit count scan event");
+
+        std::swap(src_keys, dest_keys);
+        std::swap(src_values, dest_values);
+    }
+
+    h_errchk(clReleaseMemObject(temp_keys), "Releasing the temporary keys");
+    if (temp_values!=NULL) h_errchk(clReleaseMemObject(temp_values), "Releasing the temporary values");
+    h_errchk(clReleaseMemObject(counts), "Releasing the digit counts");
+    return event;
+}
+
+#endif
@@ -0,0 +1,598 @@
+#ifndef CL_SPARSE_HPP
+#define CL_SPARSE_HPP
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "cl_helper.hpp"
+#include "philox.hpp"
+
+// Sparse matrices in compressed sparse row (CSR) and SELL-C-sigma formats,
+// converted from the dense Fortran (column-major) matrices used elsewhere,
+// with sparse matrix-vector product (SpMV) kernels for each format and a
+// sparse times dense matrix product (SpMM) for CSR.
+
+// Lanes per row for spmv_csr_vector and the work-group size, shrunk if the device can't fit them
+#define SPMV_LANES 32
+#define SPMV_LOCAL 128
+// Columns of B per work-item in spmm_csr
+#define SPMM_COLS 8
+
+// Kernel source for spmv_csr_scalar, spmv_csr_vector, spmv_sell and spmm_csr
+const char* sparse_kernel_source="\n\
+    // Lanes that share a row in spmv_csr_vector and rows per work-group, set with -D at build time \n\
+    #ifndef SPMV_LANES \n\
+    #define SPMV_LANES 32 \n\
+    #endif \n\
+    #ifndef SPMV_LOCAL \n\
+    #define SPMV_LOCAL 128 \n\
+    #endif \n\
+    // Columns of B per work-item in spmm_csr \n\
+    #ifndef SPMM_COLS \n\
+    #define SPMM_COLS 8 \n\
+    #endif \n\
+    \n\
+    // y=A*x for A in compressed sparse row (CSR) format, one work-item per row. \n\
+    // Simple, but neighbouring work-items read values far apart when rows are long \n\
+    __kernel void spmv_csr_scalar(  int nrows, \n\
+                                    __global int* row_ptr, \n\
+                                    __global int* col_idx, \n\
+                                    __global float* values, \n\
+                                    __global float* x, \n\
+                                    __global float* y) { \n\
+        int row=get_global_id(0); \n\
+        if (row<nrows) { \n\
+            float temp=0.0f; \n\
+            for (int n=row_ptr[row]; n<row_ptr[row+1]; n++) { \n\
+                temp+=values[n]*x[col_idx[n]]; \n\
+            } \n\
+            y[row]=temp; \n\
+        } \n\
+    } \n\
+    \n\
+    // y=A*x for A in CSR format, SPMV_LANES work-items per row. \n\
+    // The lanes of a row read its values together, then add their partial sums \n\
+    // in local memory. SPMV_LANES is a power of two that divides SPMV_LOCAL \n\
+    __kernel void spmv_csr_vector(  int nrows, \n\
+                                    __global int* row_ptr, \n\
+                                    __global int* col_idx, \n\
+                                    __global float* values, \n\
+                                    __global float* x, \n\
+                                    __global float* y) { \n\
+        __local float partial[SPMV_LOCAL]; \n\
+    \n\
+        int l0=get_local_id(0); \n\
+        int lane=l0%SPMV_LANES; \n\
+        int row=get_group_id(0)*(SPMV_LOCAL/SPMV_LANES)+l0/SPMV_LANES; \n\
+    \n\
+        float temp=0.0f; \n\
+        if (row<nrows) { \n\
+            for (int n=row_ptr[row]+lane; n<row_ptr[row+1]; n+=SPMV_LANES) { \n\
+                temp+=values[n]*x[col_idx[n]]; \n\
+            } \n\
+        } \n\
+        partial[l0]=temp; \n\
+        barrier(CLK_LOCAL_MEM_FENCE); \n\
+    \n\
+        // Tree reduction within the lanes of each row \n\
+        for (int s=SPMV_LANES/2; s>0; s/=2) { \n\
+            if (lane<s) partial[l0]+=partial[l0+s]; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+    \n\
+        if (lane==0 && row<nrows) { \n\
+            y[row]=partial[l0]; \n\
+        } \n\
+    } \n\
+    \n\
+    // y=A*x for A in SELL-C-sigma format. Rows are sorted by length within windows \n\
+    // of sigma rows and grouped into slices of C rows, each slice padded to its longest row \n\
+    // and stored column by column. Work-item r of a slice handles row r, so C neighbouring \n\
+    // work-items always read C consecutive values, which maps onto SIMD lanes on a CPU. \n\
+    // perm maps a sorted row back to its row in A \n\
+    __kernel void spmv_sell(    int nrows, \n\
+                                int C, \n\
+                                __global int* slice_ptr, \n\
+                                __global int* col_idx, \n\
+                                __global float* values, \n\
+                                __global int* perm, \n\
+                                __global float* x, \n\
+                                __global float* y) { \n\
+        int row=get_global_id(0); \n\
+        if (row<nrows) { \n\
+            int slice=row/C; \n\
+            int r=row%C; \n\
+            int start=slice_ptr[slice]; \n\
+            int width=(slice_ptr[slice+1]-start)/C; \n\
+            float temp=0.0f; \n\
+            for (int k=0; k<width; k++) { \n\
+                // Padding has value zero and column zero \n\
+                int n=start+k*C+r; \n\
+                temp+=values[n]*x[col_idx[n]]; \n\
+            } \n\
+            y[perm[row]]=temp; \n\
+        } \n\
+    } \n\
+    \n\
+    // C=A*B for A in CSR format and dense B and C in Fortran ordering, as mat_mult. \n\
+    // Each work-item multiplies one row of A with SPMM_COLS columns of B, so every \n\
+    // entry of the row is read once and used SPMM_COLS times from registers \n\
+    __kernel void spmm_csr( int nrows, \n\
+                            int ncols_B, \n\
+                            __global int* row_ptr, \n\
+                            __global int* col_idx, \n\
+                            __global float* values, \n\
+                            __global float* B, \n\
+                            int ldb, \n\
+                            __global float* C, \n\
+                            int ldc) { \n\
+        int row=get_global_id(0); \n\
+        int j0=get_global_id(1)*SPMM_COLS; \n\
+        if (row>=nrows) return; \n\
+    \n\
+        int ncols=min(SPMM_COLS, ncols_B-j0); \n\
+        float temp[SPMM_COLS]; \n\
+        for (int q=0; q<SPMM_COLS; q++) temp[q]=0.0f; \n\
+    \n\
+        for (int n=row_ptr[row]; n<row_ptr[row+1]; n++) { \n\
+            float value=values[n]; \n\
+            __global float* B_row=B+(size_t)j0*ldb+col_idx[n]; \n\
+            // Every loop over temp has the fixed trip count SPMM_COLS, so it unrolls \n\
+            // and temp stays in registers. The last block of columns is guarded \n\
+            if (ncols==SPMM_COLS) { \n\
+                for (int q=0; q<SPMM_COLS; q++) temp[q]+=value*B_row[(size_t)q*ldb]; \n\
+            } else { \n\
+                for (int q=0; q<SPMM_COLS; q++) { \n\
+                    if (q<ncols) temp[q]+=value*B_row[(size_t)q*ldb]; \n\
+                } \n\
+            } \n\
+        } \n\
+    \n\
+        for (int q=0; q<SPMM_COLS; q++) { \n\
+            if (q<ncols) C[(size_t)(j0+q)*ldc+row]=temp[q]; \n\
+        } \n\
+    } \n\
+";
+
+// A sparse matrix on the host in CSR format. The entries of row i are 
+// values[row_ptr[i]] to values[row_ptr[i+1]-1], in order of column
+typedef struct {
+    size_t nrows;
+    size_t ncols;
+    size_t nnz;
+    cl_int* row_ptr;
+    cl_int* col_idx;
+    cl_float* values;
+} h_csr_matrix;
+
+// A sparse matrix on the host in SELL-C-sigma format, see spmv_sell
+typedef struct {
+    size_t nrows;
+    size_t ncols;
+    size_t C;
+    size_t sigma;
+    size_t nslices;
+    size_t nelements;
+    cl_int* slice_ptr;
+    cl_int* col_idx;
+    cl_float* values;
+    cl_int* perm;
+} h_sell_matrix;
+
+// Function to fill dest with a sparse copy of the dense n x n matrix A in Fortran ordering, 
+// where row i keeps each element with probability 2*density*(i+0.5)/n from the given 
+// Philox stream. The average density is as given and rows get longer down the matrix, 
+// so that row lengths vary as they do in real sparse matrices
+void h_fill_graded_sparse(float* dest, const float* A, size_t n, cl_double density, cl_ulong seed, cl_uint stream) {
+    h_fill_uniform_philox(dest, n, n, n, seed, stream, 0.0f, 1.0f);
+    for (size_t i1=0; i1<n; i1++) {
+        for (size_t i0=0; i0<n; i0++) {
+            cl_double p=2.0*density*((cl_double)i0+0.5)/(cl_double)n;
+            if (dest[i1*n+i0]>=p) dest[i1*n+i0]=0.0f;
+            else dest[i1*n+i0]=A[i1*n+i0];
+        }
+    }
+}
+
+// Function to convert a dense nrows x ncols matrix in Fortran ordering with 
+// leading dimension ld to CSR format, keeping only the non-zero elements
+h_csr_matrix h_dense_to_csr(const float* A, size_t nrows, size_t ncols, size_t ld) {
+    h_csr_matrix csr;
+    csr.nrows=nrows;
+    csr.ncols=ncols;
+    csr.row_ptr=(cl_int*)calloc(nrows+1, sizeof(cl_int));
+
+    // Count the entries in each row, then turn the counts into row starts
+    for (size_t j=0; j<ncols; j++) {
+        for (size_t i=0; i<nrows; i++) {
+            if (A[j*ld+i]!=0.0f) csr.row_ptr[i+1]++;
+        }
+    }
+    for (size_t i=0; i<nrows; i++) {
+        csr.row_ptr[i+1]+=csr.row_ptr[i];
+    }
+    csr.nnz=csr.row_ptr[nrows];
+
+    // Walking down the columns in order leaves every row sorted by column.
+    // At least one element is kept so that device buffers are never empty
+    csr.col_idx=(cl_int*)calloc(csr.nnz>0 ? csr.nnz : 1, sizeof(cl_int));
+    csr.values=(cl_float*)calloc(csr.nnz>0 ? csr.nnz : 1, sizeof(cl_float));
+    cl_int* next=(cl_int*)malloc(nrows*sizeof(cl_int));
+    memcpy(next, csr.row_ptr, nrows*sizeof(cl_int));
+    for (size_t j=0; j<ncols; j++) {
+        for (size_t i=0; i<nrows; i++) {
+            float value=A[j*ld+i];
+            if (value!=0.0f) {
+                csr.col_idx[next[i]]=j;
+                csr.values[next[i]]=value;
+                next[i]++;
+            }
+        }
+    }
+    free(next);
+    return csr;
+}
+
+// Function to free the arrays of a CSR matrix
+void h_free_csr(h_csr_matrix* csr) {
+    free(csr->row_ptr);
+    free(csr->col_idx);
+    free(csr->values);
+}
+
+// Function to compute the reference C=A*B in double precision on the host, for A in 
+// CSR format and dense B and C in Fortran ordering with leading dimensions A->ncols 
+// and A->nrows. Returns the largest magnitude in C
+double h_csr_multiply_host(const h_csr_matrix* A, const float* B, size_t ncols_B, double* C) {
+    double max_C=0.0;
+    for (size_t j=0; j<ncols_B; j++) {
+        for (size_t i=0; i<A->nrows; i++) {
+            double temp=0.0;
+            for (cl_int k=A->row_ptr[i]; k<A->row_ptr[i+1]; k++) {
+                temp+=(double)A->values[k]*(double)B[j*A->ncols+A->col_idx[k]];
+            }
+            C[j*A->nrows+i]=temp;
+            max_C=fmax(max_C, fabs(temp));
+        }
+    }
+    return max_C;
+}
+
+// Function to convert a CSR matrix to SELL-C-sigma format. Within each window 
+// of sigma rows the rows are sorted by decreasing length, so the C rows of a 
+// slice have similar lengths and little padding is needed. sigma is a multiple of C
+h_sell_matrix h_csr_to_sell(const h_csr_matrix* csr, size_t C, size_t sigma) {
+    h_sell_matrix sell;
+    sell.nrows=csr->nrows;
+    sell.ncols=csr->ncols;
+    sell.C=C;
+    sell.sigma=sigma;
+    sell.nslices=(csr->nrows+C-1)/C;
+
+    // Sort rows by length within each window, keeping the original order for ties
+    const cl_int* row_ptr=csr->row_ptr;
+    sell.perm=(cl_int*)malloc((csr->nrows>0 ? csr->nrows : 1)*sizeof(cl_int));
+    for (size_t i=0; i<csr->nrows; i++) sell.perm[i]=i;
+    for (size_t start=0; start<csr->nrows; start+=sigma) {
+        size_t end=std::min(start+sigma, csr->nrows);
+        std::stable_sort(sell.perm+start, sell.perm+end, [row_ptr](cl_int a, cl_int b) {
+            return (row_ptr[a+1]-row_ptr[a])>(row_ptr[b+1]-row_ptr[b]);
+        });
+    }
+
+    // Each slice is as wide as its longest row
+    sell.slice_ptr=(cl_int*)calloc(sell.nslices+1, sizeof(cl_int));
+    for (size_t s=0; s<sell.nslices; s++) {
+        cl_int width=0;
+        for (size_t r=0; r<C && s*C+r<csr->nrows; r++) {
+            cl_int row=sell.perm[s*C+r];
+            width=std::max(width, row_ptr[row+1]-row_ptr[row]);
+        }
+        sell.slice_ptr[s+1]=sell.slice_ptr[s]+width*(cl_int)C;
+    }
+    sell.nelements=sell.slice_ptr[sell.nslices];
+
+    // Fill the slices column by column, padding has value zero in column zero
+    sell.col_idx=(cl_int*)calloc(sell.nelements>0 ? sell.nelements : 1, sizeof(cl_int));
+    sell.values=(cl_float*)calloc(sell.nelements>0 ? sell.nelements : 1, sizeof(cl_float));
+    for (size_t s=0; s<sell.nslices; s++) {
+        for (size_t r=0; r<C && s*C+r<csr->nrows; r++) {
+            cl_int row=sell.perm[s*C+r];
+            for (cl_int k=0; k<row_ptr[row+1]-row_ptr[row]; k++) {
+                size_t n=sell.slice_ptr[s]+k*C+r;
+                sell.col_idx[n]=csr->col_idx[row_ptr[row]+k];
+                sell.values[n]=csr->values[row_ptr[row]+k];
+            }
+        }
+    }
+    return sell;
+}
+
+// Function to free the arrays of a SELL-C-sigma matrix
+void h_free_sell(h_sell_matrix* sell) {
+    free(sell->slice_ptr);
+    free(sell->col_idx);
+    free(sell->values);
+    free(sell->perm);
+}
+
+// Function to choose the slice height C for SELL-C-sigma on a device,
+// the preferred float vector width on a CPU so a slice fills the SIMD lanes,
+// and a typical warp or wavefront size otherwise
+size_t h_sell_chunk_size(cl_device_id device) {
+    cl_device_type device_type;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_TYPE,
+                                sizeof(cl_device_type),
+                                &device_type,
+                                NULL), "Getting the device type");
+    if (device_type & CL_DEVICE_TYPE_CPU) {
+        cl_uint width;
+        h_errchk(clGetDeviceInfo(   device,
+                                    CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT,
+                                    sizeof(cl_uint),
+                                    &width,
+                                    NULL), "Getting the preferred float vector width");
+        return (width>0) ? width : 1;
+    }
+    return 32;
+}
+
+// A CSR matrix in device buffers
+typedef struct {
+    size_t nrows;
+    size_t ncols;
+    size_t nnz;
+    cl_mem row_ptr;
+    cl_mem col_idx;
+    cl_mem values;
+} h_csr_buffers;
+
+// A SELL-C-sigma matrix in device buffers
+typedef struct {
+    size_t nrows;
+    size_t ncols;
+    size_t C;
+    cl_mem slice_ptr;
+    cl_mem col_idx;
+    cl_mem values;
+    cl_mem perm;
+} h_sell_buffers;
+
+// Function to copy a CSR matrix to the device
+h_csr_buffers h_create_csr_buffers(cl_context context, const h_csr_matrix* csr) {
+    h_csr_buffers buffers;
+    buffers.nrows=csr->nrows;
+    buffers.ncols=csr->ncols;
+    buffers.nnz=csr->nnz;
+
+    size_t nnz=(csr->nnz>0) ? csr->nnz : 1;
+    cl_int errcode;
+    buffers.row_ptr=clCreateBuffer( context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    (csr->nrows+1)*sizeof(cl_int), csr->row_ptr, &errcode);
+    h_errchk(errcode, "Creating the CSR row_ptr buffer");
+    buffers.col_idx=clCreateBuffer( context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nnz*sizeof(cl_int), csr->col_idx, &errcode);
+    h_errchk(errcode, "Creating the CSR col_idx buffer");
+    buffers.values=clCreateBuffer(  context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nnz*sizeof(cl_float), csr->values, &errcode);
+    h_errchk(errcode, "Creating the CSR values buffer");
+    return buffers;
+}
+
+// Function to release the device buffers of a CSR matrix
+void h_release_csr_buffers(h_csr_buffers* buffers) {
+    h_errchk(clReleaseMemObject(buffers->row_ptr), "Releasing the CSR row_ptr buffer");
+    h_errchk(clReleaseMemObject(buffers->col_idx), "Releasing the CSR col_idx buffer");
+    h_errchk(clReleaseMemObject(buffers->values), "Releasing the CSR values buffer");
+}
+
+// Function to copy a SELL-C-sigma matrix to the device
+h_sell_buffers h_create_sell_buffers(cl_context context, const h_sell_matrix* sell) {
+    h_sell_buffers buffers;
+    buffers.nrows=sell->nrows;
+    buffers.ncols=sell->ncols;
+    buffers.C=sell->C;
+
+    size_t nelements=(sell->nelements>0) ? sell->nelements : 1;
+    size_t nrows=(sell->nrows>0) ? sell->nrows : 1;
+    cl_int errcode;
+    buffers.slice_ptr=clCreateBuffer(   context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        (sell->nslices+1)*sizeof(cl_int), sell->slice_ptr, &errcode);
+    h_errchk(errcode, "Creating the SELL slice_ptr buffer");
+    buffers.col_idx=clCreateBuffer( context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nelements*sizeof(cl_int), sell->col_idx, &errcode);
+    h_errchk(errcode, "Creating the SELL col_idx buffer");
+    buffers.values=clCreateBuffer(  context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nelements*sizeof(cl_float), sell->values, &errcode);
+    h_errchk(errcode, "Creating the SELL values buffer");
+    buffers.perm=clCreateBuffer(    context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nrows*sizeof(cl_int), sell->perm, &errcode);
+    h_errchk(errcode, "Creating the SELL perm buffer");
+    return buffers;
+}
+
+// Function to release the device buffers of a SELL-C-sigma matrix
+void h_release_sell_buffers(h_sell_buffers* buffers) {
+    h_errchk(clReleaseMemObject(buffers->slice_ptr), "Releasing the SELL slice_ptr buffer");
+    h_errchk(clReleaseMemObject(buffers->col_idx), "Releasing the SELL col_idx buffer");
+    h_errchk(clReleaseMemObject(buffers->values), "Releasing the SELL values buffer");
+    h_errchk(clReleaseMemObject(buffers->perm), "Releasing the SELL perm buffer");
+}
+
+// A built sparse program for one device
+typedef struct {
+    cl_program program;
+    cl_kernel kernel_spmv_csr_scalar;
+    cl_kernel kernel_spmv_csr_vector;
+    cl_kernel kernel_spmv_sell;
+    cl_kernel kernel_spmm_csr;
+    size_t lanes;
+    size_t local;
+} h_sparse_plan;
+
+// Function to build the sparse kernels for a device
+h_sparse_plan h_create_sparse_plan(cl_context context, cl_device_id device) {
+    h_sparse_plan plan;
+
+    size_t max_work_group_size;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                sizeof(size_t),
+                                &max_work_group_size,
+                                NULL), "Getting the maximum work-group size");
+    plan.local=SPMV_LOCAL;
+    while (plan.local>max_work_group_size) plan.local/=2;
+    plan.lanes=std::min((size_t)SPMV_LANES, plan.local);
+
+    char build_opts[128];
+    snprintf(build_opts, sizeof(build_opts), "-DSPMV_LANES=%zu -DSPMV_LOCAL=%zu -DSPMM_COLS=%d", 
+            plan.lanes, plan.local, SPMM_COLS);
+    plan.program=h_build_program(sparse_kernel_source, context, device, build_opts);
+
+    cl_int errcode;
+    plan.kernel_spmv_csr_scalar=clCreateKernel(plan.program, "spmv_csr_scalar", &errcode);
+    h_errchk(errcode, "Creating Kernel spmv_csr_scalar");
+    plan.kernel_spmv_csr_vector=clCreateKernel(plan.program, "spmv_csr_vector", &errcode);
+    h_errchk(errcode, "Creating Kernel spmv_csr_vector");
+    plan.kernel_spmv_sell=clCreateKernel(plan.program, "spmv_sell", &errcode);
+    h_errchk(errcode, "Creating Kernel spmv_sell");
+    plan.kernel_spmm_csr=clCreateKernel(plan.program, "spmm_csr", &errcode);
+    h_errchk(errcode, "Creating Kernel spmm_csr");
+    return plan;
+}
+
+// Function to release the kernels and program of a sparse plan
+void h_release_sparse_plan(h_sparse_plan* plan) {
+    h_errchk(clReleaseKernel(plan->kernel_spmv_csr_scalar), "Releasing kernel spmv_csr_scalar");
+    h_errchk(clReleaseKernel(plan->kernel_spmv_csr_vector), "Releasing kernel spmv_csr_vector");
+    h_errchk(clReleaseKernel(plan->kernel_spmv_sell), "Releasing kernel spmv_sell");
+    h_errchk(clReleaseKernel(plan->kernel_spmm_csr), "Releasing kernel spmm_csr");
+    h_errchk(clReleaseProgram(plan->program), "Releasing the sparse program");
+}
+
+// Function to enqueue y=A*x for a CSR matrix, with one work-item per row,
+// or a group of lanes per row when vector is true. Returns the event of the kernel
+cl_event h_enqueue_spmv_csr(
+        cl_command_queue command_queue,
+        h_sparse_plan* plan,
+        const h_csr_buffers* A,
+        cl_bool vector,
+        cl_mem x,
+        cl_mem y,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    cl_kernel kernel=vector ? plan->kernel_spmv_csr_vector : plan->kernel_spmv_csr_scalar;
+    cl_int nrows_arg=A->nrows;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_int), &nrows_arg), "setting spmv_csr argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &A->row_ptr), "setting spmv_csr argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &A->col_idx), "setting spmv_csr argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_mem), &A->values), "setting spmv_csr argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_mem), &x), "setting spmv_csr argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_mem), &y), "setting spmv_csr argument 5");
+
+    size_t local_size=plan->local;
+    size_t nitems=vector ? A->nrows*plan->lanes : A->nrows;
+    size_t global_size=((nitems+local_size-1)/local_size)*local_size;
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    &global_size,
+                                    &local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running spmv_csr");
+    return event;
+}
+
+// Function to enqueue y=A*x for a SELL-C-sigma matrix. Returns the event of the kernel
+cl_event h_enqueue_spmv_sell(
+        cl_command_queue command_queue,
+        h_sparse_plan* plan,
+        const h_sell_buffers* A,
+        cl_mem x,
+        cl_mem y,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    cl_kernel kernel=plan->kernel_spmv_sell;
+    cl_int nrows_arg=A->nrows, C_arg=A->C;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_int), &nrows_arg), "setting spmv_sell argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_int), &C_arg), "setting spmv_sell argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &A->slice_ptr), "setting spmv_sell argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_mem), &A->col_idx), "setting spmv_sell argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_mem), &A->values), "setting spmv_sell argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_mem), &A->perm), "setting spmv_sell argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_mem), &x), "setting spmv_sell argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_mem), &y), "setting spmv_sell argument 7");
+
+    // Whole slices per work-group where the slice height allows
+    size_t local_size=(A->C<=plan->local) ? (plan->local/A->C)*A->C : plan->local;
+    size_t global_size=((A->nrows+local_size-1)/local_size)*local_size;
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    &global_size,
+                                    &local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running spmv_sell");
+    return event;
+}
+
+// Function to enqueue C=A*B for a CSR matrix A and dense B and C in Fortran ordering,
+// with the same conventions as mat_mult, so a sparse A can stand in for a dense one.
+// B has A->ncols rows and ncols_B columns with leading dimension ldb, 
+// C has A->nrows rows with leading dimension ldc. Returns the event of the kernel
+cl_event h_enqueue_spmm_csr(
+        cl_command_queue command_queue,
+        h_sparse_plan* plan,
+        const h_csr_buffers* A,
+        size_t ncols_B,
+        cl_mem B,
+        size_t ldb,
+        cl_mem C,
+        size_t ldc,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (ldb<A->ncols) h_errchk(CL_INVALID_VALUE, "Checking ldb in h_enqueue_spmm_csr");
+    if (ldc<A->nrows) h_errchk(CL_INVALID_VALUE, "Checking ldc in h_enqueue_spmm_csr");
+
+    cl_kernel kernel=plan->kernel_spmm_csr;
+    cl_int nrows_arg=A->nrows, ncols_B_arg=ncols_B, ldb_arg=ldb, ldc_arg=ldc;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_int), &nrows_arg), "setting spmm_csr argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_int), &ncols_B_arg), "setting spmm_csr argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &A->row_ptr), "setting spmm_csr argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_mem), &A->col_idx), "setting spmm_csr argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_mem), &A->values), "setting spmm_csr argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_mem), &B), "setting spmm_csr argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_int), &ldb_arg), "setting spmm_csr argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_mem), &C), "setting spmm_csr argument 7");
+    h_errchk(clSetKernelArg(kernel, 8, sizeof(cl_int), &ldc_arg), "setting spmm_csr argument 8");
+
+    // One work-item for every row and block of SPMM_COLS columns
+    size_t local_size[]={ plan->local, 1 };
+    size_t global_size[]={  ((A->nrows+plan->local-1)/plan->local)*plan->local,
+                            (ncols_B+SPMM_COLS-1)/SPMM_COLS };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    2,
+                                    NULL,
+                                    global_size,
+                                    local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running spmm_csr");
+    return event;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef CL_SPECIALIZE_HPP
+#define CL_SPECIALIZE_HPP
+
+#include <stdio.h>
+#include <map>
+#include <string>
+
+#include "cl_helper.hpp"
+
+// Specialized builds of a kernel, with sizes, vector widths or tile shapes baked
+// in as -D constants so the compiler can unroll and strength-reduce around them.
+// The kernel keeps the same arguments in every build and uses a constant in place
+// of an argument when the matching macro is defined, e.g.
+//
+//     #ifdef NROWS_B
+//         const int n_B=NROWS_B;
+//     #else
+//         const int n_B=nrows_B;
+//     #endif
+//
+// so callers set the arguments the same way whichever build they get. A shape is
+// specialized once it has been asked for threshold times, up to max_specializations
+// programs, and until then, or once the cache is full, the generic build is used.
+
+typedef struct {
+    cl_context context;
+    cl_device_id device;
+    const char* source;
+    std::string kernel_name;
+    std::string base_opts;
+    cl_program generic_program;
+    cl_kernel generic_kernel;
+    std::map<std::string, cl_program> programs;
+    std::map<std::string, cl_kernel> kernels;
+    std::map<std::string, size_t> requests;
+    size_t threshold;
+    size_t max_specializations;
+} h_spec_cache;
+
+// Function to append -DNAME=value to a set of build options
+void h_spec_define(std::string* opts, const char* name, long value) {
+    char define[128];
+    snprintf(define, sizeof(define), " -D%s=%ld", name, value);
+    *opts+=define;
+}
+
+// Function to build the generic kernel and make an empty cache of specializations.
+// base_opts go into every build and may be NULL
+h_spec_cache h_create_spec_cache(
+        cl_context context,
+        cl_device_id device,
+        const char* source,
+        const char* kernel_name,
+        const char* base_opts,
+        size_t threshold,
+        size_t max_specializations) {
+
+    h_spec_cache cache;
+    cache.context=context;
+    cache.device=device;
+    cache.source=source;
+    cache.kernel_name=kernel_name;
+    cache.base_opts=(base_opts!=NULL) ? base_opts : "";
+    cache.threshold=threshold;
+    cache.max_specializations=max_specializations;
+
+    cache.generic_program=h_build_program(source, context, device, cache.base_opts.c_str());
+    cl_int errcode;
+    cache.generic_kernel=clCreateKernel(cache.generic_program, kernel_name, &errcode);
+    h_errchk(errcode, "Creating the generic kernel");
+    return cache;
+}
+
+// Function to release the generic kernel and every specialization
+void h_release_spec_cache(h_spec_cache* cache) {
+    for (auto& entry : cache->kernels) {
+        h_errchk(clReleaseKernel(entry.second), "Releasing a specialized kernel");
+    }
+    for (auto& entry : cache->programs) {
+        h_errchk(clReleaseProgram(entry.second), "Releasing a specialized program");
+    }
+    cache->kernels.clear();
+    cache->programs.clear();
+    h_errchk(clReleaseKernel(cache->generic_kernel), "Releasing the generic kernel");
+    h_errchk(clReleaseProgram(cache->generic_program), "Releasing the generic program");
+}
+
+// Function to get the kernel for the specialization given by spec_opts, from
+// h_spec_define. Builds the specialization when it has been asked for often
+// enough and there is room, otherwise returns the generic kernel.
+// If specialized is not NULL it is set to whether the kernel is a specialization
+cl_kernel h_spec_kernel(h_spec_cache* cache, const std::string& spec_opts, cl_bool* specialized=NULL) {
+    auto found=cache->kernels.find(spec_opts);
+    if (found!=cache->kernels.end()) {
+        if (specialized!=NULL) *specialized=CL_TRUE;
+        return found->second;
+    }
+
+    size_t nrequests=++cache->requests[spec_opts];
+    if (nrequests<cache->threshold || cache->kernels.size()>=cache->max_specializations) {
+        if (specialized!=NULL) *specialized=CL_FALSE;
+        return cache->generic_kernel;
+    }
+
+    std::string build_opts=cache->base_opts+spec_opts;
+    cl_program program=h_build_program(cache->source, cache->context, cache->device, build_opts.c_str());
+    cl_int errcode;
+    cl_kernel kernel=clCreateKernel(program, cache->kernel_name.c_str(), &errcode);
+    h_errchk(errcode, "Creating a specialized kernel");
+    cache->programs[spec_opts]=program;
+    cache->kernels[spec_opts]=kernel;
+    if (specialized!=NULL) *specialized=CL_TRUE;
+    return kernel;
+}
+
+#endif
@@ -0,0 +1,356 @@
+#ifndef CL_TOPK_HPP
+#define CL_TOPK_HPP
+
+#include <algorithm>
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+
+// Selection of the k largest entries of each column of a matrix, or of the whole 
+// matrix, on the device, so only k values and indices per column are read back.
+// The per-column selection can also be fused into the GEMM that makes the matrix, 
+// in which case the matrix is never stored.
+
+// Work-group size, shrunk if the device can't fit it. Must be a power of two
+#define TOPK_LOCAL 256
+// The largest k, each work-item keeps this many candidates in registers
+#define TOPK_MAX 32
+
+// Kernel source for topk
+const char* topk_kernel_source="\n\
+    // Work-group size and the largest k, set with -D at build time \n\
+    #ifndef TOPK_LOCAL \n\
+    #define TOPK_LOCAL 256 \n\
+    #endif \n\
+    #ifndef TOPK_MAX \n\
+    #define TOPK_MAX 32 \n\
+    #endif \n\
+    \n\
+    // True if (a, index_a) ranks above (b, index_b), the lower index wins ties \n\
+    int topk_better(float a, uint index_a, float b, uint index_b) { \n\
+        return a>b || (a==b && index_a<index_b); \n\
+    } \n\
+    \n\
+    // The k largest elements in each of a set of groups of elements, in descending order. \n\
+    // Work-group g takes elements g*n_per_group up to (g+1)*n_per_group of the first n and \n\
+    // writes its values and indices to k places starting at g*k of dest_values and dest_indices. \n\
+    // On the first pass element f is at (f/rows)*ld+f%rows in src, with index f, or f%rows \n\
+    // if row_indices is set. Later passes read the indices from src_indices. \n\
+    // Each work-item keeps the k best of its own elements in registers, then k rounds \n\
+    // of a local memory reduction pick the best head of the work-items' lists. \n\
+    // Places past the end of a short group get -INFINITY and index UINT_MAX \n\
+    __kernel void topk( ulong n, \n\
+                        ulong n_per_group, \n\
+                        ulong rows, \n\
+                        ulong ld, \n\
+                        __global float* src, \n\
+                        ulong offset, \n\
+                        __global uint* src_indices, \n\
+                        int first_pass, \n\
+                        int row_indices, \n\
+                        int k, \n\
+                        __global float* dest_values, \n\
+                        __global uint* dest_indices) { \n\
+        __local float scratch[TOPK_LOCAL]; \n\
+        __local uint scratch_indices[TOPK_LOCAL]; \n\
+        __local uint scratch_lids[TOPK_LOCAL]; \n\
+    \n\
+        size_t lid=get_local_id(0); \n\
+        size_t group=get_group_id(0); \n\
+        ulong start=group*n_per_group; \n\
+        ulong end=min(start+n_per_group, n); \n\
+        src+=offset; \n\
+    \n\
+        // This work-item's best k elements, sorted in descending order \n\
+        float values[TOPK_MAX]; \n\
+        uint indices[TOPK_MAX]; \n\
+        int count=0; \n\
+        for (ulong f=start+lid; f<end; f+=TOPK_LOCAL) { \n\
+            float value; \n\
+            uint index; \n\
+            if (first_pass) { \n\
+                value=src[(f/rows)*ld+f%rows]; \n\
+                index=row_indices ? (uint)(f%rows) : (uint)f; \n\
+            } else { \n\
+                value=src[f]; \n\
+                index=src_indices[f]; \n\
+            } \n\
+            if (count==k && !topk_better(value, index, values[k-1], indices[k-1])) continue; \n\
+    \n\
+            // Insertion into the sorted list \n\
+            int pos=(count<k) ? count++ : k-1; \n\
+            while (pos>0 && topk_better(value, index, values[pos-1], indices[pos-1])) { \n\
+                values[pos]=values[pos-1]; \n\
+                indices[pos]=indices[pos-1]; \n\
+                pos--; \n\
+            } \n\
+            values[pos]=value; \n\
+            indices[pos]=index; \n\
+        } \n\
+    \n\
+        // Each round finds the best head among the work-items, and that work-item moves on \n\
+        int head=0; \n\
+        for (int r=0; r<k; r++) { \n\
+            scratch[lid]=(head<count) ? values[head] : -INFINITY; \n\
+            scratch_indices[lid]=(head<count) ? indices[head] : UINT_MAX; \n\
+            scratch_lids[lid]=lid; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+            for (size_t stride=TOPK_LOCAL/2; stride>0; stride/=2) { \n\
+                if (lid<stride && topk_better( scratch[lid+stride], scratch_indices[lid+stride], \n\
+                                                scratch[lid], scratch_indices[lid])) { \n\
+                    scratch[lid]=scratch[lid+stride]; \n\
+                    scratch_indices[lid]=scratch_indices[lid+stride]; \n\
+                    scratch_lids[lid]=scratch_lids[lid+stride]; \n\
+                } \n\
+                barrier(CLK_LOCAL_MEM_FENCE); \n\
+            } \n\
+            if (lid==0) { \n\
+                dest_values[group*k+r]=scratch[0]; \n\
+                dest_indices[group*k+r]=scratch_indices[0]; \n\
+            } \n\
+            if (lid==scratch_lids[0] && head<count) head++; \n\
+            barrier(CLK_LOCAL_MEM_FENCE); \n\
+        } \n\
+    } \n\
+";
+
+// Everything needed for top-k on a device, including a build of gemm_tiled 
+// with -DTOPK_EPILOGUE for the fused version
+typedef struct {
+    cl_program program;
+    cl_kernel kernel_topk;
+    h_gemm_plan plan_gemm;
+    size_t local;
+} h_topk_plan;
+
+// Function to build the top-k kernels for a device
+h_topk_plan h_create_topk_plan(cl_context context, cl_device_id device) {
+    h_topk_plan plan;
+
+    size_t max_work_group_size;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                sizeof(size_t),
+                                &max_work_group_size,
+                                NULL), "Getting the maximum work-group size");
+    plan.local=TOPK_LOCAL;
+    while (plan.local>max_work_group_size) plan.local/=2;
+
+    char build_opts[64];
+    snprintf(build_opts, sizeof(build_opts), "-DTOPK_LOCAL=%zu -DTOPK_MAX=%d", plan.local, TOPK_MAX);
+    plan.program=h_build_program(topk_kernel_source, context, device, build_opts);
+
+    cl_int errcode;
+    plan.kernel_topk=clCreateKernel(plan.program, "topk", &errcode);
+    h_errchk(errcode, "Creating Kernel topk");
+
+    plan.plan_gemm=h_create_gemm_plan(context, device, "-DTOPK_EPILOGUE");
+    return plan;
+}
+
+// Function to release the kernels and programs of a top-k plan
+void h_release_topk_plan(h_topk_plan* plan) {
+    h_errchk(clReleaseKernel(plan->kernel_topk), "Releasing kernel topk");
+    h_errchk(clReleaseProgram(plan->program), "Releasing the top-k program");
+    h_release_gemm_plan(&plan->plan_gemm);
+}
+
+// Function to enqueue one pass of topk with ngroups work-groups, 
+// src_indices is NULL for the first pass
+cl_event h_enqueue_topk_pass(
+        cl_command_queue command_queue,
+        h_topk_plan* plan,
+        size_t n,
+        size_t n_per_group,
+        size_t rows,
+        size_t ld,
+        cl_mem src,
+        size_t offset,
+        cl_mem src_indices,
+        cl_bool row_indices,
+        size_t k,
+        cl_mem dest_values,
+        cl_mem dest_indices,
+        size_t ngroups,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    cl_kernel kernel=plan->kernel_topk;
+    cl_ulong n_arg=n, n_per_group_arg=n_per_group, rows_arg=rows, ld_arg=ld, offset_arg=offset;
+    cl_int first_pass=(src_indices==NULL) ? 1 : 0, row_indices_arg=row_indices ? 1 : 0, k_arg=k;
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &n_arg), "setting topk argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_ulong), &n_per_group_arg), "setting topk argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_ulong), &rows_arg), "setting topk argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_ulong), &ld_arg), "setting topk argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_mem), &src), "setting topk argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_ulong), &offset_arg), "setting topk argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_mem), &src_indices), "setting topk argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_int), &first_pass), "setting topk argument 7");
+    h_errchk(clSetKernelArg(kernel, 8, sizeof(cl_int), &row_indices_arg), "setting topk argument 8");
+    h_errchk(clSetKernelArg(kernel, 9, sizeof(cl_int), &k_arg), "setting topk argument 9");
+    h_errchk(clSetKernelArg(kernel, 10, sizeof(cl_mem), &dest_values), "setting topk argument 10");
+    h_errchk(clSetKernelArg(kernel, 11, sizeof(cl_mem), &dest_indices), "setting topk argument 11");
+
+    size_t local_size[]={ plan->local };
+    size_t global_size[]={ ngroups*plan->local };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    local_size,
+                                    num_events_in_wait_list,
+                                    event_wait_list,
+                                    &event), "Running topk");
+    return event;
+}
+
+// Function to enqueue a selection of the k largest entries in each column of the 
+// M x N column-major matrix C. Column j's values go to elements j*k to j*k+k-1 of 
+// values in descending order, and their row indices to the same places in 
+// indices as cl_uint. Lower rows win ties. Returns the event of the kernel
+cl_event h_enqueue_topk_columns(
+        cl_command_queue command_queue,
+        h_topk_plan* plan,
+        size_t M,
+        size_t N,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        size_t k,
+        cl_mem values,
+        cl_mem indices,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (k==0 || k>TOPK_MAX || k>M) h_errchk(CL_INVALID_VALUE, "Checking k in h_enqueue_topk_columns");
+    if (ldc<M) h_errchk(CL_INVALID_VALUE, "Checking ldc in h_enqueue_topk_columns");
+    if (M>CL_UINT_MAX) h_errchk(CL_INVALID_VALUE, "Checking M in h_enqueue_topk_columns");
+
+    // One work-group per column
+    return h_enqueue_topk_pass( command_queue, plan, M*N, M, M, ldc, C, offset_C, NULL, CL_TRUE, 
+                                k, values, indices, N, num_events_in_wait_list, event_wait_list);
+}
+
+// Function to enqueue a selection of the k largest entries of the whole M x N 
+// column-major matrix C. The values go to elements 0 to k-1 of values in descending 
+// order, and their positions j*M+i to indices as cl_uint. 
+// Work-groups first pick k candidates each from their share of C, then one 
+// work-group picks from the candidates. Returns the event of the last pass
+cl_event h_enqueue_topk(
+        cl_command_queue command_queue,
+        h_topk_plan* plan,
+        size_t M,
+        size_t N,
+        cl_mem C,
+        size_t offset_C,
+        size_t ldc,
+        size_t k,
+        cl_mem values,
+        cl_mem indices,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    size_t n=M*N;
+    if (k==0 || k>TOPK_MAX || k>n) h_errchk(CL_INVALID_VALUE, "Checking k in h_enqueue_topk");
+    if (ldc<M) h_errchk(CL_INVALID_VALUE, "Checking ldc in h_enqueue_topk");
+    if (n>CL_UINT_MAX) h_errchk(CL_INVALID_VALUE, "Checking the size of C in h_enqueue_topk");
+
+    cl_context context;
+    h_errchk(clGetCommandQueueInfo( command_queue,
+                                    CL_QUEUE_CONTEXT,
+                                    sizeof(cl_context),
+                                    &context,
+                                    NULL), "Getting the context of the command queue");
+
+    // Enough work-groups for every work-item to have plan->local elements
+    size_t ngroups=std::max(std::min(n/(plan->local*plan->local), plan->local), (size_t)1);
+    size_t n_per_group=(n+ngroups-1)/ngroups;
+    cl_int errcode;
+    cl_mem candidate_values=clCreateBuffer(context, CL_MEM_READ_WRITE, ngroups*k*sizeof(cl_float), NULL, &errcode);
+    h_errchk(errcode, "Creating the top-k candidate values");
+    cl_mem candidate_indices=clCreateBuffer(context, CL_MEM_READ_WRITE, ngroups*k*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating the top-k candidate indices");
+
+    cl_event event_first=h_enqueue_topk_pass(   command_queue, plan, n, n_per_group, M, ldc, C, offset_C, NULL, CL_FALSE,
+                                                k, candidate_values, candidate_indices, ngroups, 
+                                                num_events_in_wait_list, event_wait_list);
+    cl_event event=h_enqueue_topk_pass( command_queue, plan, ngroups*k, ngroups*k, ngroups*k, ngroups*k, 
+                                        candidate_values, 0, candidate_indices, CL_FALSE, 
+                                        k, values, indices, 1, 1, &event_first);
+
+    h_errchk(clReleaseEvent(event_first), "Releasing the first top-k pass");
+    h_errchk(clReleaseMemObject(candidate_values), "Releasing the top-k candidate values");
+    h_errchk(clReleaseMemObject(candidate_indices), "Releasing the top-k candidate indices");
+    return event;
+}
+
+// Function to enqueue C=alpha*op(A)*op(B) for column-major matrices with the per-column 
+// top-k fused into the GEMM, with results as in h_enqueue_topk_columns. C is never 
+// stored, each tile of the GEMM leaves its best min(k, tile_dim) entries per column 
+// as candidates and topk picks the k best of those. Returns the event of the last kernel
+cl_event h_enqueue_sgemm_topk_columns(
+        cl_command_queue command_queue,
+        h_topk_plan* plan,
+        h_trans trans_A,
+        h_trans trans_B,
+        size_t M,
+        size_t N,
+        size_t K,
+        cl_float alpha,
+        cl_mem A,
+        size_t offset_A,
+        size_t lda,
+        cl_mem B,
+        size_t offset_B,
+        size_t ldb,
+        size_t k,
+        cl_mem values,
+        cl_mem indices,
+        cl_uint num_events_in_wait_list,
+        const cl_event* event_wait_list) {
+
+    if (k==0 || k>TOPK_MAX || k>M) h_errchk(CL_INVALID_VALUE, "Checking k in h_enqueue_sgemm_topk_columns");
+    if (lda<((trans_A==H_NO_TRANS) ? M : K)) h_errchk(CL_INVALID_VALUE, "Checking lda in h_enqueue_sgemm_topk_columns");
+    if (ldb<((trans_B==H_NO_TRANS) ? K : N)) h_errchk(CL_INVALID_VALUE, "Checking ldb in h_enqueue_sgemm_topk_columns");
+
+    cl_context context;
+    h_errchk(clGetCommandQueueInfo( command_queue,
+                                    CL_QUEUE_CONTEXT,
+                                    sizeof(cl_context),
+                                    &context,
+                                    NULL), "Getting the context of the command queue");
+
+    // Candidates for each column, topk_tile from each of the row tiles
+    size_t tile_dim=plan->plan_gemm.tile_dim;
+    size_t n_row_tiles=(M+tile_dim-1)/tile_dim;
+    cl_int topk_tile=std::min(k, tile_dim);
+    size_t n_candidates=n_row_tiles*topk_tile;
+    cl_int errcode;
+    cl_mem candidate_values=clCreateBuffer(context, CL_MEM_READ_WRITE, N*n_candidates*sizeof(cl_float), NULL, &errcode);
+    h_errchk(errcode, "Creating the top-k candidate values");
+    cl_mem candidate_indices=clCreateBuffer(context, CL_MEM_READ_WRITE, N*n_candidates*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating the top-k candidate indices");
+
+    // The epilogue arguments follow those of gemm_tiled, and C is unused
+    cl_kernel kernel=plan->plan_gemm.kernel_gemm;
+    h_errchk(clSetKernelArg(kernel, 18, sizeof(cl_int), &topk_tile), "setting gemm_tiled argument 18");
+    h_errchk(clSetKernelArg(kernel, 19, sizeof(cl_mem), &candidate_values), "setting gemm_tiled argument 19");
+    h_errchk(clSetKernelArg(kernel, 20, sizeof(cl_mem), &candidate_indices), "setting gemm_tiled argument 20");
+    cl_event event_gemm=h_enqueue_gemm_tiled(   command_queue, &plan->plan_gemm, M, N, K, alpha, 
+                                                A, offset_A, lda, trans_A, CL_FALSE, 
+                                                B, offset_B, ldb, trans_B, CL_FALSE, 
+                                                0.0f, NULL, 0, M, num_events_in_wait_list, event_wait_list);
+
+    cl_event event=h_enqueue_topk_pass( command_queue, plan, N*n_candidates, n_candidates, n_candidates, n_candidates,
+                                        candidate_values, 0, candidate_indices, CL_FALSE, 
+                                        k, values, indices, N, 1, &event_gemm);
+
+    h_errchk(clReleaseEvent(event_gemm), "Releasing the GEMM event");
+    h_errchk(clReleaseMemObject(candidate_values), "Releasing the top-k candidate values");
+    h_errchk(clReleaseMemObject(candidate_indices), "Releasing the top-k candidate indices");
+    return event;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef CL_VECTOR_HPP
+#define CL_VECTOR_HPP
+
+#include <stdio.h>
+#include <string>
+
+#include "cl_helper.hpp"
+
+// Kernel source for one element type and vector width, written from a single
+// definition. The kernel is written against a few names, storage_type for elements
+// in memory, acc_type and accn_type for the scalar and vector types arithmetic is
+// done in, and the macros LOAD_VECTOR(n, p), LOAD_SCALAR(n, p), SUM_VECTOR(v) and
+// VECTOR_WIDTH. h_vector_source<T>(source, width) puts their definitions for the
+// host type T (cl_half, cl_float, cl_double or cl_char) in front of the source.
+// Halves are read with vload_half, so they don't need cl_khr_fp16, and are added
+// up in float. 8-bit integers are added up in int.
+
+// How the generator writes one element type
+typedef struct {
+    // Type in memory and type to accumulate in
+    const char* storage;
+    const char* accumulate;
+    // Vector load, which returns accumulate types for vload_half
+    const char* load;
+    cl_bool load_converts;
+    // Extension needed to use the type, or NULL
+    const char* extension;
+    // Query for the preferred vector width
+    cl_device_info preferred_width;
+} h_vector_type;
+
+template<typename T> h_vector_type h_vector_type_of();
+
+// cl_half is a 16-bit integer on the host, so cl_ushort also gets this
+template<> h_vector_type h_vector_type_of<cl_half>() {
+    h_vector_type type={ "half", "float", "vload_half", CL_TRUE, NULL, CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF };
+    return type;
+}
+
+template<> h_vector_type h_vector_type_of<cl_float>() {
+    h_vector_type type={ "float", "float", "vload", CL_FALSE, NULL, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT };
+    return type;
+}
+
+template<> h_vector_type h_vector_type_of<cl_double>() {
+    h_vector_type type={ "double", "double", "vload", CL_FALSE, "cl_khr_fp64", CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE };
+    return type;
+}
+
+template<> h_vector_type h_vector_type_of<cl_char>() {
+    h_vector_type type={ "char", "int", "vload", CL_FALSE, NULL, CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR };
+    return type;
+}
+
+// Function to check for a vector width OpenCL supports in every type
+cl_bool h_valid_vector_width(cl_uint width) {
+    return (width==1 || width==2 || width==4 || width==8 || width==16) ? CL_TRUE : CL_FALSE;
+}
+
+// Function to get the preferred vector width for T on a device, rounded down to a
+// valid width. Returns 0 when the device doesn't support T. Devices without
+// cl_khr_fp16 report 0 for half, but vload_half still works, so they get the float width
+template<typename T>
+cl_uint h_preferred_vector_width(cl_device_id device) {
+    h_vector_type type=h_vector_type_of<T>();
+    cl_uint width=0;
+    h_errchk(clGetDeviceInfo(device, type.preferred_width, sizeof(cl_uint), &width, NULL), 
+            "Getting the preferred vector width");
+    if (width==0 && type.preferred_width==CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF) {
+        return h_preferred_vector_width<cl_float>(device);
+    }
+    if (width==0) return 0;
+
+    cl_uint valid_width=16;
+    while (valid_width>width) valid_width/=2;
+    return valid_width;
+}
+
+// Function to write the type and macro definitions for T at a vector width
+template<typename T>
+std::string h_vector_defines(cl_uint width) {
+    if (!h_valid_vector_width(width)) {
+        h_errchk(CL_INVALID_VALUE, "Checking width in h_vector_defines");
+    }
+    h_vector_type type=h_vector_type_of<T>();
+    // Width 1 uses the scalar type and functions
+    std::string suffix=(width>1) ? std::to_string(width) : "";
+    std::string accn=std::string(type.accumulate)+suffix;
+
+    std::string defines="\n";
+    if (type.extension!=NULL) {
+        defines+="#pragma OPENCL EXTENSION "+std::string(type.extension)+" : enable\n";
+    }
+    defines+="#define VECTOR_WIDTH "+std::to_string(width)+"\n";
+    defines+="typedef "+std::string(type.storage)+" storage_type;\n";
+    defines+="typedef "+std::string(type.accumulate)+" acc_type;\n";
+    defines+="typedef "+accn+" accn_type;\n";
+
+    // Loads of element n, or of vector n, from a storage_type pointer p
+    std::string load_scalar, load_vector;
+    if (type.load_converts) {
+        load_scalar=std::string(type.load)+"(n, p)";
+        load_vector=std::string(type.load)+suffix+"(n, p)";
+    } else {
+        load_scalar="convert_"+std::string(type.accumulate)+"((p)[n])";
+        load_vector=(width>1) ? "convert_"+accn+"("+type.load+suffix+"(n, p))" : load_scalar;
+    }
+    defines+="#define LOAD_SCALAR(n, p) "+load_scalar+"\n";
+    defines+="#define LOAD_VECTOR(n, p) "+load_vector+"\n";
+
+    // Sum of the components of a vector
+    std::string sum="(v)";
+    if (width>1) {
+        const char* components="0123456789abcdef";
+        sum="(";
+        for (cl_uint k=0; k<width; k++) {
+            if (k>0) sum+="+";
+            sum+="(v).s"+std::string(1, components[k]);
+        }
+        sum+=")";
+    }
+    defines+="#define SUM_VECTOR(v) "+sum+"\n";
+    return defines;
+}
+
+// Function to get source ready to build for T at a vector width
+template<typename T>
+std::string h_vector_source(const char* source, cl_uint width) {
+    return h_vector_defines<T>(width)+source;
+}
+
+// Kernel source for mat_mult_transp_vector, for use with h_vector_source
+const char* mat_mult_transp_vector_kernel_source="\n\
+    // Matrix multiply with a pre-transposed A, reading VECTOR_WIDTH elements of A and B \n\
+    // at a time. The types and loads come from the defines written by h_vector_source \n\
+    __kernel void mat_mult_transp_vector (  __global storage_type* A_transp, \n\
+                                            __global storage_type* B, \n\
+                                            __global acc_type* C, \n\
+                                            int nrows_A_transp, \n\
+                                            int nrows_B, \n\
+                                            int nrows_C) { \n\
+        // i0 and i1 represent the coordinates in C \n\
+        // We assume Fortran ordering for the matrices \n\
+        size_t i0=get_global_id(0); \n\
+        size_t i1=get_global_id(1); \n\
+        __global storage_type* A_col=A_transp+i0*nrows_A_transp; \n\
+        __global storage_type* B_col=B+i1*nrows_B; \n\
+        accn_type temp_vector=(accn_type)(0); \n\
+        int nvectors=nrows_B/VECTOR_WIDTH; \n\
+        for (int n=0; n<nvectors; n++) { \n\
+            temp_vector+=LOAD_VECTOR(n, A_col)*LOAD_VECTOR(n, B_col); \n\
+        } \n\
+        acc_type temp=SUM_VECTOR(temp_vector); \n\
+        // Remainder when nrows_B is not a multiple of VECTOR_WIDTH \n\
+        for (int n=nvectors*VECTOR_WIDTH; n<nrows_B; n++) { \n\
+            temp+=LOAD_SCALAR(n, A_col)*LOAD_SCALAR(n, B_col); \n\
+        } \n\
+        C[i1*nrows_C+i0]=temp; \n\
+    } \n\
+";
+
+#endif
@@ -0,0 +1,480 @@
+#ifndef MAT_HELPER_HPP
+#define MAT_HELPER_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <random>
+
+#include "cl_helper.hpp"
+
+// Host-side helpers for matrices stored in Fortran (column-major) order
+
+// Statistics from a sampled verification of a matrix product
+typedef struct {
+    // Number of sampled coordinates
+    size_t nsamples;
+    // Mean and largest absolute difference over the samples
+    cl_double mean_abs_err;
+    cl_double max_abs_err;
+    // Estimate of the RMS difference over the whole matrix
+    cl_double rms_err;
+    // Confidence bounds on the RMS difference over the whole matrix
+    cl_double rms_lower;
+    cl_double rms_upper;
+    // RMS of the sampled reference values, for relative errors
+    cl_double rms_ref;
+} h_sample_stats;
+
+// Function to choose a reproducible random sample of coordinates in a matrix,
+// the same seed always yields the same coordinates on every platform
+void h_sample_coords(
+        size_t nrows,
+        size_t ncols,
+        size_t nsamples,
+        cl_ulong seed,
+        // Output parameters, arrays of length nsamples
+        size_t *rows,
+        size_t *cols) {
+
+    // The output of mt19937_64 is fixed by the C++ standard, 
+    // unlike the standard distributions
+    std::mt19937_64 generator(seed);
+    for (size_t n=0; n<nsamples; n++) {
+        rows[n]=(size_t)(generator()%nrows);
+        cols[n]=(size_t)(generator()%ncols);
+    }
+}
+
+// Kernel source to gather sampled elements of 2, 4 or 8 bytes into one buffer
+const char* sample_gather_kernel_source="\n\
+    #define SAMPLE_GATHER(NAME, T) \\\n\
+    __kernel void NAME( __global const T* src, \\\n\
+                        __global const ulong* offsets, \\\n\
+                        __global T* dest) { \\\n\
+        size_t n=get_global_id(0); \\\n\
+        dest[n]=src[offsets[n]]; \\\n\
+    } \n\
+    SAMPLE_GATHER(sample_gather_2, ushort) \n\
+    SAMPLE_GATHER(sample_gather_4, uint) \n\
+    SAMPLE_GATHER(sample_gather_8, ulong) \n\
+";
+
+// Sampled coordinates of matrices on one device. The element offsets live on the 
+// device, and a kernel gathers the sampled elements into one buffer, 
+// so reading them back is a single transfer rather than one per sample
+typedef struct {
+    cl_program program;
+    // Gather kernels for elements of 2, 4 and 8 bytes
+    cl_kernel kernel_gather_2;
+    cl_kernel kernel_gather_4;
+    cl_kernel kernel_gather_8;
+    cl_mem offsets;
+    cl_mem gathered;
+    size_t nsamples;
+} h_sample_reader;
+
+// Function to make a reader for the coordinates (rows[n], cols[n]) of matrices 
+// with leading dimension ld, e.g. from h_sample_coords
+h_sample_reader h_create_sample_reader(
+        cl_context context,
+        cl_device_id device,
+        size_t ld,
+        size_t nsamples,
+        const size_t *rows,
+        const size_t *cols) {
+
+    h_sample_reader reader;
+    reader.nsamples=nsamples;
+    reader.program=h_build_program(sample_gather_kernel_source, context, device);
+
+    cl_int errcode;
+    reader.kernel_gather_2=clCreateKernel(reader.program, "sample_gather_2", &errcode);
+    h_errchk(errcode, "Creating Kernel sample_gather_2");
+    reader.kernel_gather_4=clCreateKernel(reader.program, "sample_gather_4", &errcode);
+    h_errchk(errcode, "Creating Kernel sample_gather_4");
+    reader.kernel_gather_8=clCreateKernel(reader.program, "sample_gather_8", &errcode);
+    h_errchk(errcode, "Creating Kernel sample_gather_8");
+
+    cl_ulong* offsets=(cl_ulong*)malloc(nsamples*sizeof(cl_ulong));
+    for (size_t n=0; n<nsamples; n++) offsets[n]=(cl_ulong)cols[n]*ld+rows[n];
+    reader.offsets=clCreateBuffer(  context, 
+                                    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nsamples*sizeof(cl_ulong), 
+                                    offsets, 
+                                    &errcode);
+    h_errchk(errcode, "Creating the sample offsets buffer");
+    free(offsets);
+
+    // Room for the largest elements
+    reader.gathered=clCreateBuffer(context, CL_MEM_WRITE_ONLY, nsamples*sizeof(cl_ulong), NULL, &errcode);
+    h_errchk(errcode, "Creating the gathered samples buffer");
+    return reader;
+}
+
+// Function to release a sample reader
+void h_release_sample_reader(h_sample_reader* reader) {
+    h_errchk(clReleaseMemObject(reader->offsets), "Releasing the sample offsets buffer");
+    h_errchk(clReleaseMemObject(reader->gathered), "Releasing the gathered samples buffer");
+    h_errchk(clReleaseKernel(reader->kernel_gather_2), "Releasing kernel sample_gather_2");
+    h_errchk(clReleaseKernel(reader->kernel_gather_4), "Releasing kernel sample_gather_4");
+    h_errchk(clReleaseKernel(reader->kernel_gather_8), "Releasing kernel sample_gather_8");
+    h_errchk(clReleaseProgram(reader->program), "Releasing the sample gather program");
+}
+
+// Function to read only the sampled elements of a matrix from a device buffer,
+// element_size is 2, 4 or 8 bytes. Waits for the read
+void h_read_samples(
+        cl_command_queue command_queue,
+        h_sample_reader* reader,
+        cl_mem buffer,
+        size_t element_size,
+        // Output parameter, an array of nsamples elements
+        void *values) {
+
+    cl_kernel kernel=NULL;
+    if (element_size==2) {
+        kernel=reader->kernel_gather_2;
+    } else if (element_size==4) {
+        kernel=reader->kernel_gather_4;
+    } else if (element_size==8) {
+        kernel=reader->kernel_gather_8;
+    } else {
+        h_errchk(CL_INVALID_VALUE, "Checking element_size in h_read_samples");
+    }
+
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer), "setting sample_gather argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &reader->offsets), "setting sample_gather argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &reader->gathered), "setting sample_gather argument 2");
+
+    const size_t global_size[]={ reader->nsamples };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event), "Running sample_gather");
+    h_errchk(clEnqueueReadBuffer(   command_queue,
+                                    reader->gathered,
+                                    CL_TRUE,
+                                    0,
+                                    reader->nsamples*element_size,
+                                    values,
+                                    1,
+                                    &event,
+                                    NULL), "Reading the gathered samples");
+    h_errchk(clReleaseEvent(event), "Releasing the sample_gather event");
+}
+
+// Function to verify sampled elements of C=A*B, where A is nrows_A x ncols_A
+// and C_samples[n] holds the device result at (rows[n], cols[n]). Each sampled
+// dot product is recomputed on the host in double precision. 
+// z_score sets the width of the confidence bounds, 1.96 for 95%
+template<typename T>
+h_sample_stats h_verify_samples(
+        const T *A,
+        const T *B,
+        size_t nrows_A,
+        size_t ncols_A,
+        size_t nsamples,
+        const size_t *rows,
+        const size_t *cols,
+        const T *C_samples,
+        cl_double z_score) {
+
+    // B has as many rows as A has columns
+    size_t nrows_B=ncols_A;
+
+    cl_double sum_abs=0.0, sum_sq=0.0, sum_sq_sq=0.0, max_abs=0.0, sum_ref=0.0;
+
+    for (size_t n=0; n<nsamples; n++) {
+        cl_double temp=0.0;
+        for (size_t k=0; k<ncols_A; k++) {
+            temp+=(cl_double)A[k*nrows_A+rows[n]]*(cl_double)B[cols[n]*nrows_B+k];
+        }
+        cl_double err=fabs((cl_double)C_samples[n]-temp);
+        sum_ref+=temp*temp;
+        sum_abs+=err;
+        sum_sq+=err*err;
+        sum_sq_sq+=err*err*err*err;
+        if (err>max_abs) max_abs=err;
+    }
+
+    h_sample_stats stats;
+    stats.nsamples=nsamples;
+    stats.mean_abs_err=sum_abs/nsamples;
+    stats.max_abs_err=max_abs;
+    stats.rms_ref=sqrt(sum_ref/nsamples);
+
+    // The mean squared error over the samples estimates the mean squared error 
+    // over the whole matrix, with a standard error from the sample variance
+    cl_double mse=sum_sq/nsamples;
+    cl_double var=0.0;
+    if (nsamples>1) {
+        var=(sum_sq_sq-nsamples*mse*mse)/(nsamples-1);
+        if (var<0.0) var=0.0;
+    }
+    cl_double std_err=sqrt(var/nsamples);
+
+    stats.rms_err=sqrt(mse);
+    stats.rms_lower=sqrt(fmax(mse-z_score*std_err, 0.0));
+    stats.rms_upper=sqrt(mse+z_score*std_err);
+    return stats;
+}
+
+// Function to convert a float to a half with round to nearest even,
+// as the device does with vstore_half_rte
+cl_half h_float_to_half(float value) {
+    cl_uint x;
+    memcpy(&x, &value, sizeof(cl_uint));
+    cl_uint sign=(x>>16)&0x8000;
+    cl_uint absx=x&0x7FFFFFFF;
+
+    // Infinity and NaN, keeping NaNs quiet
+    if (absx>=0x7F800000) {
+        return (cl_half)(sign|0x7C00|(absx>0x7F800000 ? 0x200 : 0));
+    }
+
+    // Overflow, 65520 and above round to infinity
+    if (absx>=0x477FF000) {
+        return (cl_half)(sign|0x7C00);
+    }
+
+    // Below the smallest normal half, 2^-14, the result is subnormal
+    if (absx<0x38800000) {
+        // Anything up to 2^-25 rounds to zero
+        if (absx<=0x33000000) return (cl_half)sign;
+        cl_uint e=absx>>23;
+        cl_uint m=(absx&0x7FFFFF)|0x800000;
+        // Subnormal halves count in units of 2^-24
+        cl_uint shift=126-e;
+        cl_uint h=m>>shift;
+        cl_uint rem=m&((1u<<shift)-1);
+        cl_uint halfway=1u<<(shift-1);
+        if (rem>halfway || (rem==halfway && (h&1))) h++;
+        return (cl_half)(sign|h);
+    }
+
+    // Normal numbers, rebias the exponent from 127 to 15 and round the mantissa
+    cl_uint h=(absx-0x38000000)>>13;
+    cl_uint rem=absx&0x1FFF;
+    if (rem>0x1000 || (rem==0x1000 && (h&1))) h++;
+    return (cl_half)(sign|h);
+}
+
+// Function to convert a half to a float, which is always exact
+float h_half_to_float(cl_half value) {
+    cl_uint sign=((cl_uint)value&0x8000)<<16;
+    cl_uint e=((cl_uint)value>>10)&0x1F;
+    cl_uint m=(cl_uint)value&0x3FF;
+    cl_uint x;
+
+    if (e==0x1F) {
+        // Infinity and NaN
+        x=sign|0x7F800000|(m<<13);
+    } else if (e==0) {
+        if (m==0) {
+            x=sign;
+        } else {
+            // Subnormal half, normalise it for the float
+            e=113;
+            while ((m&0x400)==0) {
+                m<<=1;
+                e--;
+            }
+            x=sign|(e<<23)|((m&0x3FF)<<13);
+        }
+    } else {
+        x=sign|((e+112)<<23)|(m<<13);
+    }
+
+    float result;
+    memcpy(&result, &x, sizeof(float));
+    return result;
+}
+
+// Functions to convert whole arrays between float and half
+void h_float_to_half_array(const float *src, cl_half *dest, size_t nelements) {
+    for (size_t n=0; n<nelements; n++) dest[n]=h_float_to_half(src[n]);
+}
+
+void h_half_to_float_array(const cl_half *src, float *dest, size_t nelements) {
+    for (size_t n=0; n<nelements; n++) dest[n]=h_half_to_float(src[n]);
+}
+
+// Function to quantize a matrix in Fortran ordering to signed 8-bit integers
+// with one scale and zero point per channel, where a channel is a row if per_row 
+// is true and a column otherwise. Each value is recovered as
+// scales[c]*(dest[i]-zero_points[c]). sums[c] receives the sum of the 
+// quantized values in each channel, which the quantized multiply needs
+void h_quantize_int8(
+        const float *src,
+        size_t nrows,
+        size_t ncols,
+        cl_bool per_row,
+        // Output parameters
+        cl_char *dest,
+        cl_float *scales,
+        cl_int *zero_points,
+        cl_int *sums) {
+
+    size_t nchannels=per_row ? nrows : ncols;
+    size_t nvalues=per_row ? ncols : nrows;
+
+    for (size_t c=0; c<nchannels; c++) {
+        // Stride through a row, or walk down a column
+        size_t start=per_row ? c : c*nrows;
+        size_t stride=per_row ? nrows : 1;
+
+        // The range always includes zero so that zero is exactly representable
+        float min_value=0.0f, max_value=0.0f;
+        for (size_t n=0; n<nvalues; n++) {
+            float value=src[start+n*stride];
+            if (value<min_value) min_value=value;
+            if (value>max_value) max_value=value;
+        }
+
+        float scale=(max_value-min_value)/255.0f;
+        if (scale==0.0f) scale=1.0f;
+        cl_int zero_point=(cl_int)lrintf(-128.0f-min_value/scale);
+        if (zero_point<-128) zero_point=-128;
+        if (zero_point>127) zero_point=127;
+
+        cl_int sum=0;
+        for (size_t n=0; n<nvalues; n++) {
+            long q=lrintf(src[start+n*stride]/scale)+zero_point;
+            if (q<-128) q=-128;
+            if (q>127) q=127;
+            dest[start+n*stride]=(cl_char)q;
+            sum+=(cl_int)q;
+        }
+
+        scales[c]=scale;
+        zero_points[c]=zero_point;
+        sums[c]=sum;
+    }
+}
+
+// Function to recover floats from a matrix quantized with h_quantize_int8
+void h_dequantize_int8(
+        const cl_char *src,
+        size_t nrows,
+        size_t ncols,
+        cl_bool per_row,
+        const cl_float *scales,
+        const cl_int *zero_points,
+        // Output parameter
+        float *dest) {
+
+    for (size_t i1=0; i1<ncols; i1++) {
+        for (size_t i0=0; i0<nrows; i0++) {
+            size_t c=per_row ? i0 : i1;
+            size_t offset=i1*nrows+i0;
+            dest[offset]=scales[c]*(float)((cl_int)src[offset]-zero_points[c]);
+        }
+    }
+}
+
+// Strides that are a multiple of this many bytes map successive columns
+// onto the same cache sets and memory channels, h_padded_ld avoids them
+#define LD_CONFLICT_BYTES 1024
+
+// Function to choose a padded leading dimension, in elements, for a matrix 
+// in Fortran ordering with nrows rows on a device. Every column starts on a 
+// cache line and base address boundary of the device, and a stride that is a 
+// multiple of LD_CONFLICT_BYTES is bumped by one boundary. A boundary that is itself
+// a multiple of LD_CONFLICT_BYTES can't break the multiple, so the bump is halved
+// until it does and the columns keep to that smaller boundary
+size_t h_padded_ld(cl_device_id device, size_t nrows, size_t element_size) {
+    cl_uint cacheline_bytes, base_align_bits;
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE,
+                                sizeof(cl_uint),
+                                &cacheline_bytes,
+                                NULL), "Getting the cache line size");
+    h_errchk(clGetDeviceInfo(   device,
+                                CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                                sizeof(cl_uint),
+                                &base_align_bits,
+                                NULL), "Getting the base address alignment");
+
+    // Some devices report no cache line, and the boundary must hold whole elements
+    size_t align_bytes=cacheline_bytes;
+    if (base_align_bits/8>align_bytes) align_bytes=base_align_bits/8;
+    if (align_bytes<element_size || align_bytes%element_size!=0) align_bytes=element_size;
+    size_t align=align_bytes/element_size;
+
+    size_t ld=((nrows+align-1)/align)*align;
+    if ((ld*element_size)%LD_CONFLICT_BYTES==0) {
+        size_t step=align;
+        while ((step*element_size)%LD_CONFLICT_BYTES==0 && step%2==0) step/=2;
+        ld+=step;
+    }
+    return ld;
+}
+
+// Function to write a densely packed matrix in Fortran ordering from the host 
+// into a device buffer with leading dimension ld
+void h_write_padded(
+        cl_command_queue command_queue,
+        cl_mem buffer,
+        size_t ld,
+        const void* src,
+        size_t nrows,
+        size_t ncols,
+        size_t element_size) {
+
+    // Origins and region are (nbytes, ncolumns, nslices)
+    size_t origin[3]={0, 0, 0};
+    size_t region[3]={nrows*element_size, ncols, 1};
+    h_errchk(clEnqueueWriteBufferRect(  command_queue,
+                                        buffer,
+                                        CL_TRUE,
+                                        origin,
+                                        origin,
+                                        region,
+                                        ld*element_size,
+                                        0,
+                                        nrows*element_size,
+                                        0,
+                                        src,
+                                        0,
+                                        NULL,
+                                        NULL), "Writing a padded matrix");
+}
+
+// Function to read a matrix with leading dimension ld from a device buffer 
+// into densely packed host memory
+void h_read_padded(
+        cl_command_queue command_queue,
+        cl_mem buffer,
+        size_t ld,
+        void* dest,
+        size_t nrows,
+        size_t ncols,
+        size_t element_size) {
+
+    size_t origin[3]={0, 0, 0};
+    size_t region[3]={nrows*element_size, ncols, 1};
+    h_errchk(clEnqueueReadBufferRect(   command_queue,
+                                        buffer,
+                                        CL_TRUE,
+                                        origin,
+                                        origin,
+                                        region,
+                                        ld*element_size,
+                                        0,
+                                        nrows*element_size,
+                                        0,
+                                        dest,
+                                        0,
+                                        NULL,
+                                        NULL), "Reading a padded matrix");
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef PHILOX_HPP
+#define PHILOX_HPP
+
+#include <math.h>
+
+#include "cl_helper.hpp"
+
+// Deterministic matrix generation with the Philox4x32-10 counter-based 
+// random number generator. The kernel fills device buffers of any shape
+// directly, and the host functions reproduce the same values bit for bit 
+// for verification, so no input files are needed.
+
+// Seed the example programs generate their matrices from, so every run sees the same data
+#ifndef SEED
+#define SEED 2018
+#endif
+
+// Kernel source for fill_uniform_philox, to be prepended to a program's own source
+const char* philox_kernel_source="\n\
+    // Philox4x32-10 counter-based random number generator, Salmon et al. (2011). \n\
+    // Every (counter, key) pair maps to four independent random integers, \n\
+    // so any element can be generated without reference to any other \n\
+    #define PHILOX_M0 0xD2511F53u \n\
+    #define PHILOX_M1 0xCD9E8D57u \n\
+    #define PHILOX_W0 0x9E3779B9u \n\
+    #define PHILOX_W1 0xBB67AE85u \n\
+    \n\
+    uint4 philox4x32_10(uint4 ctr, uint2 key) { \n\
+        for (int r=0; r<10; r++) { \n\
+            if (r>0) { \n\
+                // Bump the key between rounds \n\
+                key.x+=PHILOX_W0; \n\
+                key.y+=PHILOX_W1; \n\
+            } \n\
+            uint hi0=mul_hi(PHILOX_M0, ctr.x); \n\
+            uint lo0=PHILOX_M0*ctr.x; \n\
+            uint hi1=mul_hi(PHILOX_M1, ctr.z); \n\
+            uint lo1=PHILOX_M1*ctr.z; \n\
+            ctr=(uint4)(hi1^ctr.y^key.x, lo1, hi0^ctr.w^key.y, lo0); \n\
+        } \n\
+        return ctr; \n\
+    } \n\
+    \n\
+    // Fill a matrix in Fortran ordering with uniform random numbers in [lower, upper). \n\
+    // Each work-item makes four consecutive elements of the densely packed matrix, \n\
+    // element idx=i1*nrows+i0 comes from counter (idx/4, stream, 0, 0), so the values \n\
+    // depend only on the seed, the stream and the shape, never on the leading dimension \n\
+    __kernel void fill_uniform_philox ( __global float* dest, \n\
+                                        uint nrows, \n\
+                                        uint ncols, \n\
+                                        uint ld, \n\
+                                        uint seed_lo, \n\
+                                        uint seed_hi, \n\
+                                        uint stream, \n\
+                                        float lower, \n\
+                                        float upper) { \n\
+        size_t i=get_global_id(0); \n\
+        ulong nelements=(ulong)nrows*(ulong)ncols; \n\
+        uint4 bits=philox4x32_10((uint4)((uint)i, stream, 0, 0), (uint2)(seed_lo, seed_hi)); \n\
+        uint words[4]={bits.x, bits.y, bits.z, bits.w}; \n\
+        float scale=upper-lower; \n\
+        for (int n=0; n<4; n++) { \n\
+            ulong idx=4*(ulong)i+n; \n\
+            if (idx<nelements) { \n\
+                // 24 random bits make a float in [0,1) exactly, and fma rounds once, \n\
+                // so the host can reproduce every value bit for bit \n\
+                float u=(float)(words[n]>>8)*0x1.0p-24f; \n\
+                ulong i0=idx%nrows; \n\
+                ulong i1=idx/nrows; \n\
+                dest[i1*ld+i0]=fma(u, scale, lower); \n\
+            } \n\
+        } \n\
+    } \n\
+";
+
+// Philox constants, these must match the kernel source
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// Function to run ten rounds of Philox4x32 on a counter with a key
+void h_philox4x32_10(const cl_uint ctr_in[4], const cl_uint key_in[2], cl_uint out[4]) {
+    cl_uint ctr[4]={ctr_in[0], ctr_in[1], ctr_in[2], ctr_in[3]};
+    cl_uint key[2]={key_in[0], key_in[1]};
+
+    for (int r=0; r<10; r++) {
+        if (r>0) {
+            // Bump the key between rounds
+            key[0]+=PHILOX_W0;
+            key[1]+=PHILOX_W1;
+        }
+        cl_ulong prod0=(cl_ulong)PHILOX_M0*(cl_ulong)ctr[0];
+        cl_ulong prod1=(cl_ulong)PHILOX_M1*(cl_ulong)ctr[2];
+        cl_uint hi0=(cl_uint)(prod0>>32), lo0=(cl_uint)prod0;
+        cl_uint hi1=(cl_uint)(prod1>>32), lo1=(cl_uint)prod1;
+        cl_uint next[4]={hi1^ctr[1]^key[0], lo1, hi0^ctr[3]^key[1], lo0};
+        for (int n=0; n<4; n++) ctr[n]=next[n];
+    }
+
+    for (int n=0; n<4; n++) out[n]=ctr[n];
+}
+
+// Function to fill a host matrix in Fortran ordering with the same values 
+// as the fill_uniform_philox kernel, ld is the leading dimension (>= nrows)
+void h_fill_uniform_philox(
+        float *dest,
+        size_t nrows,
+        size_t ncols,
+        size_t ld,
+        cl_ulong seed,
+        cl_uint stream,
+        float lower,
+        float upper) {
+
+    cl_uint key[2]={(cl_uint)seed, (cl_uint)(seed>>32)};
+    size_t nelements=nrows*ncols;
+    float scale=upper-lower;
+
+    for (size_t i=0; 4*i<nelements; i++) {
+        cl_uint ctr[4]={(cl_uint)i, stream, 0, 0};
+        cl_uint words[4];
+        h_philox4x32_10(ctr, key, words);
+        for (size_t n=0; n<4; n++) {
+            size_t idx=4*i+n;
+            if (idx<nelements) {
+                float u=(float)(words[n]>>8)*(1.0f/16777216.0f);
+                dest[(idx/nrows)*ld+idx%nrows]=fmaf(u, scale, lower);
+            }
+        }
+    }
+}
+
+// Function to fill a device buffer in Fortran ordering on the device, 
+// kernel must be fill_uniform_philox. Returns the event for the kernel
+cl_event h_enqueue_fill_uniform_philox(
+        cl_command_queue command_queue,
+        cl_kernel kernel,
+        cl_mem dest,
+        size_t nrows,
+        size_t ncols,
+        size_t ld,
+        cl_ulong seed,
+        cl_uint stream,
+        float lower,
+        float upper) {
+
+    cl_uint nrows_arg=(cl_uint)nrows, ncols_arg=(cl_uint)ncols, ld_arg=(cl_uint)ld;
+    cl_uint seed_lo=(cl_uint)seed, seed_hi=(cl_uint)(seed>>32);
+
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &dest), "setting fill_uniform_philox argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_uint), &nrows_arg), "setting fill_uniform_philox argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_uint), &ncols_arg), "setting fill_uniform_philox argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_uint), &ld_arg), "setting fill_uniform_philox argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_uint), &seed_lo), "setting fill_uniform_philox argument 4");
+    h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_uint), &seed_hi), "setting fill_uniform_philox argument 5");
+    h_errchk(clSetKernelArg(kernel, 6, sizeof(cl_uint), &stream), "setting fill_uniform_philox argument 6");
+    h_errchk(clSetKernelArg(kernel, 7, sizeof(cl_float), &lower), "setting fill_uniform_philox argument 7");
+    h_errchk(clSetKernelArg(kernel, 8, sizeof(cl_float), &upper), "setting fill_uniform_philox argument 8");
+
+    // One work-item for every four elements
+    size_t global_size=(nrows*ncols+3)/4;
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    1,
+                                    NULL,
+                                    &global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event), "Running fill_uniform_philox");
+    return event;
+}
+
+#endif
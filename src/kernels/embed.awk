@@ -0,0 +1,76 @@
+# Writes an OpenCL source file from the kernel library as a C++ header, with the
+# source as a string and each #include "file" replaced by the named file from the
+# kernel directory, so programs never look for kernel files at run time.
+# A device binary for the source, from "make binaries", is embedded when it exists.
+#
+# Usage: awk -v name=mat_mult -v dir=kernels -v binary=gen/mat_mult.bin -f embed.awk
+
+# Function to escape backslashes and quotes for a C string
+function escape(line,    out, i, c) {
+    out=""
+    for (i=1; i<=length(line); i++) {
+        c=substr(line, i, 1)
+        if (c=="\\" || c=="\"") out=out "\\"
+        out=out c
+    }
+    return out
+}
+
+# Function to write a file as string lines, expanding its includes
+function emit_file(file,    line, included) {
+    while ((getline line < file) > 0) {
+        sub(/\r$/, "", line)
+        if (line ~ /^[ \t]*#[ \t]*include[ \t]*"/) {
+            included=line
+            sub(/^[^"]*"/, "", included)
+            sub(/".*$/, "", included)
+            emit_file(dir "/" included)
+        } else {
+            print "\"" escape(line) "\\n\""
+        }
+    }
+    close(file)
+}
+
+BEGIN {
+    guard=toupper(name) "_CL_HPP"
+    print "// Generated from " dir "/" name ".cl by " dir "/embed.awk, do not edit"
+    print "#ifndef " guard
+    print "#define " guard
+    print ""
+    print "#include \"cl_embed.hpp\""
+    print ""
+
+    # Bytes of the binary, if there is one
+    nbytes=0
+    if (binary!="" && (getline probe < binary) >= 0) {
+        close(binary)
+        print "const unsigned char " name "_cl_binary[]={"
+        command="od -An -v -tu1 " binary
+        while ((command | getline line) > 0) {
+            n=split(line, bytes, " ")
+            if (n==0) continue
+            out="   "
+            for (i=1; i<=n; i++) {
+                out=out " " bytes[i] ","
+                nbytes++
+            }
+            print out
+        }
+        close(command)
+        print "};"
+    }
+    if (nbytes==0) {
+        print "const unsigned char " name "_cl_binary[]={ 0 };"
+    }
+    print ""
+
+    print "const h_embedded_program " name "_cl={"
+    print "    \"" name "\","
+    print "    " name "_cl_binary,"
+    print "    " nbytes ","
+    emit_file(dir "/" name ".cl")
+    print "};"
+    print ""
+    print "#endif"
+}
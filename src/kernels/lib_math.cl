@@ -0,0 +1,10 @@
+// Math functions of the shared kernel library
+#include "mat_lib.h"
+
+float mat_dot(__global const float* a, __global const float* b, int n) {
+    float temp=0.0f;
+    for (int k=0; k<n; k++) {
+        temp+=a[k]*b[k];
+    }
+    return temp;
+}
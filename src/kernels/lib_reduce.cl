@@ -0,0 +1,21 @@
+// Reductions of the shared kernel library
+#include "mat_lib.h"
+
+float mat_work_group_sum(float value, __local float* scratch) {
+    size_t lid=get_local_id(0);
+    scratch[lid]=value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Fold the upper part of the active range onto the lower part,
+    // which also handles work-group sizes that are not a power of two
+    for (size_t active=get_local_size(0); active>1; ) {
+        size_t half=(active+1)/2;
+        if (lid+half<active) scratch[lid]+=scratch[lid+half];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        active=half;
+    }
+    float sum=scratch[0];
+    // scratch may be reused as soon as this returns
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return sum;
+}
@@ -0,0 +1,14 @@
+// Definitions shared by the kernel library
+#ifndef MAT_COMMON_H
+#define MAT_COMMON_H
+
+// We assume Fortran ordering for the matrices, so element (row, col)
+// of a matrix with leading dimension ld is at offset col*ld+row
+#define COL_MAJOR(row, col, ld) ((col)*(ld)+(row))
+
+// Tile size for the local memory transposes, set with -DTILE_DIM at build time
+#ifndef TILE_DIM
+#define TILE_DIM 16
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+// Optional epilogue for the matrix multiply kernels, as in gemm_tiled.
+// Built with -DEPILOGUE, a bias for each row (BIAS=1) or column (BIAS=2) of C 
+// is added and ReLU (ACTIVATION=1), the logistic sigmoid (2) or a clamp to 
+// [clamp_lower, clamp_upper] (3) applied before C is stored
+#ifndef MAT_EPILOGUE_H
+#define MAT_EPILOGUE_H
+
+#ifndef BIAS
+#define BIAS 0
+#endif
+#ifndef ACTIVATION
+#define ACTIVATION 0
+#endif
+
+// Apply the epilogue to value, the element (i, j) of C
+float mat_epilogue(float value, size_t i, size_t j, __global float* bias, float clamp_lower, float clamp_upper) {
+#if BIAS==1
+    value+=bias[i];
+#elif BIAS==2
+    value+=bias[j];
+#endif
+#if ACTIVATION==1
+    value=fmax(value, 0.0f);
+#elif ACTIVATION==2
+    value=1.0f/(1.0f+exp(-value));
+#elif ACTIVATION==3
+    value=clamp(value, clamp_lower, clamp_upper);
+#endif
+    return value;
+}
+
+#endif
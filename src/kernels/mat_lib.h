@@ -0,0 +1,13 @@
+// Functions in the shared kernel library. Each group is compiled once on its own
+// with clCompileProgram and linked into programs that include this header
+#ifndef MAT_LIB_H
+#define MAT_LIB_H
+
+// From lib_math.cl, dot product of n contiguous elements of a and b
+float mat_dot(__global const float* a, __global const float* b, int n);
+
+// From lib_reduce.cl, sum of value over a one-dimensional work-group.
+// Every work-item must call it, scratch holds one float per work-item
+float mat_work_group_sum(float value, __local float* scratch);
+
+#endif
@@ -0,0 +1,23 @@
+#include "mat_common.h"
+
+// standard matrix multiply kernel
+__kernel void mat_mult (    __global float* A,
+                            __global float* B,
+                            __global float* C,
+                            int nrows_A,
+                            int nrows_B) {
+
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    float temp=0.0f;
+    // Loop over columns of A and rows of B
+    for (int n=0; n<nrows_B; n++) {
+        // C has the same number of rows as A, and the same number of columns as B
+        // i0 is the row index of A
+        // i1 is the column index of B
+        temp+=A[COL_MAJOR(i0, n, nrows_A)]*B[COL_MAJOR(n, i1, nrows_B)];
+    }
+    // Number of rows in C is same as number of rows in A
+    C[COL_MAJOR(i0, i1, nrows_A)]=temp;
+}
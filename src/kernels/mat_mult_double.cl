@@ -0,0 +1,110 @@
+// The transpose and multiply kernels with the element type chosen at build time,
+// so single and double precision run the same code. -DUSE_DOUBLE selects double
+#ifdef USE_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double4 real4;
+typedef double8 real8;
+#else
+typedef float real;
+typedef float4 real4;
+typedef float8 real8;
+#endif
+
+#include "mat_common.h"
+
+// kernel to do a matrix transpose
+__kernel void mat_transpose(    __global real* src,
+                                __global real* dest,
+                                int nrows_src,
+                                int nrows_dest) {
+    // i0, and i1 represent the coordinates of src
+    // coordinates are reversed for dest
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    dest[COL_MAJOR(i1, i0, nrows_dest)]=src[COL_MAJOR(i0, i1, nrows_src)];
+}
+
+// standard matrix multiply kernel
+__kernel void mat_mult (    __global real* A,
+                            __global real* B,
+                            __global real* C,
+                            int nrows_A,
+                            int nrows_B) {
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    real temp=0.0;
+    // Loop over columns of A and rows of B
+    for (int n=0; n<nrows_B; n++) {
+        temp+=A[COL_MAJOR(i0, n, nrows_A)]*B[COL_MAJOR(n, i1, nrows_B)];
+    }
+    // Number of rows in C is same as number of rows in A
+    C[COL_MAJOR(i0, i1, nrows_A)]=temp;
+}
+
+// special matrix multiply kernel that uses a pre-transposed matrix A
+__kernel void mat_mult_transp ( __global real* A_transp,
+                                __global real* B,
+                                __global real* C,
+                                int nrows_A_transp,
+                                int nrows_B,
+                                int nrows_C) {
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    size_t offset_A=COL_MAJOR(0, i0, nrows_A_transp);
+    size_t offset_B=COL_MAJOR(0, i1, nrows_B);
+    real temp=0.0;
+    for (int n=0; n<nrows_B; n++) {
+        temp+=A_transp[offset_A+n]*B[offset_B+n];
+    }
+    C[COL_MAJOR(i0, i1, nrows_C)]=temp;
+}
+
+// pre-transposed matrix multiply kernel using vectors of four elements,
+// vload4 only needs element alignment and a scalar loop handles the remainder
+__kernel void mat_mult_transp_vector4 ( __global real* A_transp,
+                                        __global real* B,
+                                        __global real* C,
+                                        int nrows_A_transp,
+                                        int nrows_B,
+                                        int nrows_C) {
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    __global real* A_col=A_transp+COL_MAJOR(0, i0, nrows_A_transp);
+    __global real* B_col=B+COL_MAJOR(0, i1, nrows_B);
+    real4 temp4=(real4)0.0;
+    int n=0;
+    for (; n+4<=nrows_B; n+=4) {
+        temp4+=vload4(0, A_col+n)*vload4(0, B_col+n);
+    }
+    real temp=temp4.s0+temp4.s1+temp4.s2+temp4.s3;
+    for (; n<nrows_B; n++) {
+        temp+=A_col[n]*B_col[n];
+    }
+    C[COL_MAJOR(i0, i1, nrows_C)]=temp;
+}
+
+// pre-transposed matrix multiply kernel using vectors of eight elements
+__kernel void mat_mult_transp_vector8 ( __global real* A_transp,
+                                        __global real* B,
+                                        __global real* C,
+                                        int nrows_A_transp,
+                                        int nrows_B,
+                                        int nrows_C) {
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    __global real* A_col=A_transp+COL_MAJOR(0, i0, nrows_A_transp);
+    __global real* B_col=B+COL_MAJOR(0, i1, nrows_B);
+    real8 temp8=(real8)0.0;
+    int n=0;
+    for (; n+8<=nrows_B; n+=8) {
+        temp8+=vload8(0, A_col+n)*vload8(0, B_col+n);
+    }
+    real temp=temp8.s0+temp8.s1+temp8.s2+temp8.s3+temp8.s4+temp8.s5+temp8.s6+temp8.s7;
+    for (; n<nrows_B; n++) {
+        temp+=A_col[n]*B_col[n];
+    }
+    C[COL_MAJOR(i0, i1, nrows_C)]=temp;
+}
@@ -0,0 +1,49 @@
+// Matrix multiplies with A and B stored as half and accumulated in float,
+// next to the float mat_mult_transp they are compared against.
+// vload_half and vstore_half are core OpenCL, the cl_khr_fp16 extension
+// is only needed to use half as an arithmetic type (-DHAVE_FP16)
+#ifdef HAVE_FP16
+#pragma OPENCL EXTENSION cl_khr_fp16 : enable
+#endif
+
+#include "mat_common.h"
+#include "mat_mult_transp.cl"
+
+// Output type, C is written as half when built with -DHALF_OUTPUT
+#ifdef HALF_OUTPUT
+#define STORE_C(value, offset, C) vstore_half_rte(value, offset, C)
+typedef half c_type;
+#else
+#define STORE_C(value, offset, C) C[offset]=value
+typedef float c_type;
+#endif
+
+// matrix multiply kernel with half storage that uses a pre-transposed matrix A
+__kernel void mat_mult_transp_half (    __global half* A_transp,
+                                        __global half* B,
+                                        __global c_type* C,
+                                        int nrows_A_transp,
+                                        int nrows_B,
+                                        int nrows_C) {
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    __global half* A_col=A_transp+COL_MAJOR(0, i0, nrows_A_transp);
+    __global half* B_col=B+COL_MAJOR(0, i1, nrows_B);
+    float8 temp8=(float8)0.0f;
+    int n=0;
+    // Load eight halves at a time, each converted to float
+    for (; n+8<=nrows_B; n+=8) {
+#ifdef HAVE_FP16
+        temp8+=convert_float8(vload8(0, A_col+n))*convert_float8(vload8(0, B_col+n));
+#else
+        temp8+=vload_half8(0, A_col+n)*vload_half8(0, B_col+n);
+#endif
+    }
+    float temp=temp8.s0+temp8.s1+temp8.s2+temp8.s3+temp8.s4+temp8.s5+temp8.s6+temp8.s7;
+    // Remainder when nrows_B is not a multiple of eight
+    for (; n<nrows_B; n++) {
+        temp+=vload_half(n, A_col)*vload_half(n, B_col);
+    }
+    STORE_C(temp, COL_MAJOR(i0, i1, nrows_C), C);
+}
@@ -0,0 +1,64 @@
+// Quantized matrix multiply, next to the float mat_mult_transp it is compared against.
+// A is quantized per row and B per column, so that A[i,k]=scales_A[i]*(A_q[i,k]-zeros_A[i])
+// and B[k,j]=scales_B[j]*(B_q[k,j]-zeros_B[j]). Then
+// C[i,j]=scales_A[i]*scales_B[j]*(sum_k A_q[i,k]*B_q[k,j]-zeros_B[j]*sums_A[i]
+//                                 -zeros_A[i]*sums_B[j]+K*zeros_A[i]*zeros_B[j]),
+// where sums_A and sums_B are the sums of the quantized rows of A and columns of B.
+// The integer sum is accumulated exactly in int, the rest is the epilogue
+#include "mat_common.h"
+#include "mat_mult_transp.cl"
+
+// Use the packed 8-bit dot product when the compiler provides it
+#if defined(cl_khr_integer_dot_product) && defined(__opencl_c_integer_dot_product_input_4x8bit)
+#define HAVE_INTEGER_DOT
+#endif
+
+__kernel void mat_mult_transp_int8 (    __global char* A_transp,
+                                        __global char* B,
+                                        __global float* C,
+                                        __global float* scales_A,
+                                        __global int* zeros_A,
+                                        __global int* sums_A,
+                                        __global float* scales_B,
+                                        __global int* zeros_B,
+                                        __global int* sums_B,
+                                        int nrows_A_transp,
+                                        int nrows_B,
+                                        int nrows_C) {
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    __global char* A_col=A_transp+COL_MAJOR(0, i0, nrows_A_transp);
+    __global char* B_col=B+COL_MAJOR(0, i1, nrows_B);
+
+    int temp=0;
+    int n=0;
+#ifdef HAVE_INTEGER_DOT
+    for (; n+16<=nrows_B; n+=16) {
+        char16 a=vload16(0, A_col+n);
+        char16 b=vload16(0, B_col+n);
+        temp+=dot(a.s0123, b.s0123)+dot(a.s4567, b.s4567)
+             +dot(a.s89ab, b.s89ab)+dot(a.scdef, b.scdef);
+    }
+#else
+    // Sixteen products at a time, a product of two chars always fits in a short
+    int16 temp16=(int16)0;
+    for (; n+16<=nrows_B; n+=16) {
+        short16 prod=convert_short16(vload16(0, A_col+n))*convert_short16(vload16(0, B_col+n));
+        temp16+=convert_int16(prod);
+    }
+    int8 temp8=temp16.lo+temp16.hi;
+    int4 temp4=temp8.lo+temp8.hi;
+    temp=temp4.s0+temp4.s1+temp4.s2+temp4.s3;
+#endif
+    // Remainder when nrows_B is not a multiple of sixteen
+    for (; n<nrows_B; n++) {
+        temp+=(int)A_col[n]*(int)B_col[n];
+    }
+
+    // Dequantize in the epilogue
+    int za=zeros_A[i0];
+    int zb=zeros_B[i1];
+    int offset=temp-zb*sums_A[i0]-za*sums_B[i1]+nrows_B*za*zb;
+    C[COL_MAJOR(i0, i1, nrows_C)]=scales_A[i0]*scales_B[i1]*(float)offset;
+}
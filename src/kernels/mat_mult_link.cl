@@ -0,0 +1,33 @@
+// Application kernels, linked against the library objects for
+// lib_math.cl, lib_reduce.cl and mat_transpose.cl
+#include "mat_common.h"
+#include "mat_lib.h"
+
+// matrix multiply with a pre-transposed matrix A, using the library dot product
+__kernel void mat_mult_transp_lib ( __global float* A_transp,
+                                    __global float* B,
+                                    __global float* C,
+                                    int nrows_A_transp,
+                                    int nrows_B,
+                                    int nrows_C) {
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    C[COL_MAJOR(i0, i1, nrows_C)]=mat_dot( A_transp+COL_MAJOR(0, i0, nrows_A_transp),
+                                            B+COL_MAJOR(0, i1, nrows_B),
+                                            nrows_B);
+}
+
+// sums of the columns of C, one work-group per column
+__kernel void col_sums( __global float* C,
+                        __global float* sums,
+                        int nrows_C,
+                        __local float* scratch) {
+    size_t col=get_group_id(0);
+    float temp=0.0f;
+    for (size_t row=get_local_id(0); row<nrows_C; row+=get_local_size(0)) {
+        temp+=C[COL_MAJOR(row, col, nrows_C)];
+    }
+    float sum=mat_work_group_sum(temp, scratch);
+    if (get_local_id(0)==0) sums[col]=sum;
+}
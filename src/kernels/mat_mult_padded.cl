@@ -0,0 +1,24 @@
+// The transpose and a standard matrix multiply for padded matrices, whose
+// leading dimensions are larger than their number of rows.
+// mat_transpose already takes the leading dimensions as nrows_src and nrows_dest
+#include "mat_common.h"
+#include "mat_transpose.cl"
+
+// standard matrix multiply kernel, with leading dimensions
+__kernel void mat_mult_ld ( __global float* A,
+                            __global float* B,
+                            __global float* C,
+                            int nrows_B,
+                            int lda,
+                            int ldb,
+                            int ldc) {
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    float temp=0.0f;
+    // Successive n step through A with stride lda
+    for (int n=0; n<nrows_B; n++) {
+        temp+=A[COL_MAJOR(i0, n, lda)]*B[COL_MAJOR(n, i1, ldb)];
+    }
+    C[COL_MAJOR(i0, i1, ldc)]=temp;
+}
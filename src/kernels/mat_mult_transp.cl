@@ -0,0 +1,37 @@
+#include "mat_common.h"
+#include "mat_epilogue.h"
+
+// special matrix multiply kernel that uses a pre-transposed matrix A
+// Built with -DEPILOGUE it takes the bias and clamp bounds of mat_epilogue as well
+__kernel void mat_mult_transp ( __global float* A_transp,
+                                __global float* B,
+                                __global float* C,
+                                int nrows_A_transp,
+                                int nrows_B,
+#ifdef EPILOGUE
+                                int nrows_C,
+                                __global float* bias,
+                                float clamp_lower,
+                                float clamp_upper) {
+#else
+                                int nrows_C) {
+#endif
+    // i0 and i1 represent the coordinates in C
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    size_t offset_A=COL_MAJOR(0, i0, nrows_A_transp);
+    size_t offset_B=COL_MAJOR(0, i1, nrows_B);
+    float temp=0.0f;
+    // For every coordinate in C, loop over the related rows of A_transp and B
+    for (int n=0; n<nrows_B; n++) {
+        // Every column of A_transp corresponds to a row of C
+        // Every column of B corresponds to a column of C
+        // i0 is the column index of A_transp
+        // i1 is the column index of B
+        temp+=A_transp[offset_A+n]*B[offset_B+n];
+    }
+#ifdef EPILOGUE
+    temp=mat_epilogue(temp, i0, i1, bias, clamp_lower, clamp_upper);
+#endif
+    C[COL_MAJOR(i0, i1, nrows_C)]=temp;
+}
@@ -0,0 +1,5 @@
+// The transposes with the standard and pre-transposed matrix multiplies,
+// for comparing the two approaches in one program
+#include "mat_transpose.cl"
+#include "mat_mult.cl"
+#include "mat_mult_transp.cl"
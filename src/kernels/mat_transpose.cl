@@ -0,0 +1,76 @@
+#include "mat_common.h"
+
+// kernel to do a matrix transpose
+__kernel void mat_transpose(    __global float* src,
+                                __global float* dest,
+                                int nrows_src,
+                                int nrows_dest) {
+    // i0, and i1 represent the coordinates of src
+    // coordinates are reversed for dest
+    size_t i0=get_global_id(0);
+    size_t i1=get_global_id(1);
+    dest[COL_MAJOR(i1, i0, nrows_dest)]=src[COL_MAJOR(i0, i1, nrows_src)];
+}
+
+// kernel to do a matrix transpose through local memory
+// Each work-group reads a tile of src with coalesced reads,
+// and writes the transposed tile to dest with coalesced writes.
+// Tiles are padded by one column so that reading a tile
+// along its rows does not hit the same local memory bank
+__kernel void mat_transpose_tiled(  __global float* src,
+                                    __global float* dest,
+                                    int nrows_src,
+                                    int nrows_dest) {
+    __local float tile[TILE_DIM][TILE_DIM+1];
+    // The number of columns in src is nrows_dest
+    size_t l0=get_local_id(0);
+    size_t l1=get_local_id(1);
+    size_t base0=get_group_id(0)*TILE_DIM;
+    size_t base1=get_group_id(1)*TILE_DIM;
+
+    // Read the tile, the global size may overhang src
+    if (base0+l0<nrows_src && base1+l1<nrows_dest) {
+        tile[l1][l0]=src[COL_MAJOR(base0+l0, base1+l1, nrows_src)];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Write the tile, now l0 runs down the rows of dest
+    if (base1+l0<nrows_dest && base0+l1<nrows_src) {
+        dest[COL_MAJOR(base1+l0, base0+l1, nrows_dest)]=tile[l0][l1];
+    }
+}
+
+// kernel to transpose a square matrix in place
+// The work-group for tile (g0, g1) above the diagonal swaps it with
+// tile (g1, g0), work-groups below the diagonal have nothing to do
+__kernel void mat_transpose_inplace(    __global float* A,
+                                        int nrows_A) {
+    __local float tile_a[TILE_DIM][TILE_DIM+1];
+    __local float tile_b[TILE_DIM][TILE_DIM+1];
+    size_t g0=get_group_id(0);
+    size_t g1=get_group_id(1);
+    // The whole work-group leaves together, so the barrier below is safe
+    if (g0>g1) return;
+
+    size_t l0=get_local_id(0);
+    size_t l1=get_local_id(1);
+    size_t base0=g0*TILE_DIM;
+    size_t base1=g1*TILE_DIM;
+
+    // Read both tiles before anything is written
+    if (base0+l0<nrows_A && base1+l1<nrows_A) {
+        tile_a[l1][l0]=A[COL_MAJOR(base0+l0, base1+l1, nrows_A)];
+    }
+    if (g0!=g1 && base1+l0<nrows_A && base0+l1<nrows_A) {
+        tile_b[l1][l0]=A[COL_MAJOR(base1+l0, base0+l1, nrows_A)];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Tile (g0, g1) transposed goes to (g1, g0) and vice versa
+    if (base1+l0<nrows_A && base0+l1<nrows_A) {
+        A[COL_MAJOR(base1+l0, base0+l1, nrows_A)]=tile_a[l0][l1];
+    }
+    if (g0!=g1 && base0+l0<nrows_A && base1+l1<nrows_A) {
+        A[COL_MAJOR(base0+l0, base1+l1, nrows_A)]=tile_b[l0][l1];
+    }
+}
@@ -0,0 +1,170 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_expr.hpp"
+#include "philox.hpp"
+
+// A chain of element-wise operations on matrices, D=mask(exp(alpha*A+B)-C, M),
+// run as one kernel per operation against one fused kernel for the whole expression.
+// Usage: mat_expr_fusion [nrows ncols]
+
+// Each path runs this many times and the fastest run is kept
+#define NREPEATS 5
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t nrows=4096, ncols=4096;
+    if (argc>=3) {
+        nrows=(size_t)atol(argv[1]);
+        ncols=(size_t)atol(argv[2]);
+    }
+    assert(nrows>0 && ncols>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    size_t n=nrows*ncols;
+    float* array_A_1D=(float*)malloc(n*sizeof(float));
+    float* array_B_1D=(float*)malloc(n*sizeof(float));
+    float* array_C_1D=(float*)malloc(n*sizeof(float));
+    float* array_M_1D=(float*)malloc(n*sizeof(float));
+    float* array_separate_1D=(float*)malloc(n*sizeof(float));
+    float* array_fused_1D=(float*)malloc(n*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, nrows, ncols, nrows, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows, ncols, nrows, SEED, 1, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_C_1D, nrows, ncols, nrows, SEED, 2, -1.0f, 1.0f);
+    // A mask that keeps about half of the entries
+    h_fill_uniform_philox(array_M_1D, nrows, ncols, nrows, SEED, 3, 0.0f, 1.0f);
+    for (size_t i=0; i<n; i++) array_M_1D[i]=(array_M_1D[i]<0.5f) ? 1.0f : 0.0f;
+
+    h_device_matrix A=h_create_device_matrix(context, nrows, ncols, array_A_1D);
+    h_device_matrix B=h_create_device_matrix(context, nrows, ncols, array_B_1D);
+    h_device_matrix C=h_create_device_matrix(context, nrows, ncols, array_C_1D);
+    h_device_matrix M=h_create_device_matrix(context, nrows, ncols, array_M_1D);
+    h_device_matrix T=h_create_device_matrix(context, nrows, ncols);
+    h_device_matrix D=h_create_device_matrix(context, nrows, ncols);
+
+    h_expr_cache cache=h_create_expr_cache(context, device);
+    cl_float alpha=0.5f;
+
+    // One kernel, and one pass over memory, per operation
+    cl_double time_separate=INFINITY;
+    for (int r=0; r<NREPEATS; r++) {
+        cl_double time=h_wait_event_time_ms(h_enqueue_eval(command_queue, &cache, &T, alpha*A, 0, NULL));
+        time+=h_wait_event_time_ms(h_enqueue_eval(command_queue, &cache, &T, T+B, 0, NULL));
+        time+=h_wait_event_time_ms(h_enqueue_eval(command_queue, &cache, &T, h_exp(T), 0, NULL));
+        time+=h_wait_event_time_ms(h_enqueue_eval(command_queue, &cache, &T, T-C, 0, NULL));
+        time+=h_wait_event_time_ms(h_enqueue_eval(command_queue, &cache, &D, h_mask(T, M), 0, NULL));
+        time_separate=fmin(time_separate, time);
+    }
+    h_errchk(clEnqueueReadBuffer(   command_queue, D.buffer, CL_TRUE, 0, n*sizeof(float), 
+                                    array_separate_1D, 0, NULL, NULL), "Reading D");
+    size_t nbuilds_separate=cache.nbuilds;
+
+    // The whole expression in one kernel, a new alpha each time reuses the same kernel
+    cl_double time_fused=INFINITY;
+    for (int r=0; r<NREPEATS; r++) {
+        cl_float alpha_r=(r==NREPEATS-1) ? alpha : alpha+(cl_float)r;
+        time_fused=fmin(time_fused, h_wait_event_time_ms(h_enqueue_eval(  command_queue, &cache, &D, 
+                                                                          h_mask(h_exp(alpha_r*A+B)-C, M), 0, NULL)));
+    }
+    h_errchk(clEnqueueReadBuffer(   command_queue, D.buffer, CL_TRUE, 0, n*sizeof(float), 
+                                    array_fused_1D, 0, NULL, NULL), "Reading D");
+
+    // Both paths against the expression in double precision on the host, relative to 
+    // its largest magnitude. exp is accurate to 3 ulp in OpenCL and the compiler may 
+    // contract alpha*A+B into a fused multiply-add, so a few epsilon separate the results
+    cl_double tol=16.0*FLT_EPSILON;
+    double max_diff_separate=0.0, max_diff_fused=0.0, max_value=0.0;
+    for (size_t i=0; i<n; i++) {
+        double answer=(array_M_1D[i]!=0.0f) ? exp((double)alpha*array_A_1D[i]+array_B_1D[i])-array_C_1D[i] : 0.0;
+        max_diff_separate=fmax(max_diff_separate, fabs(array_separate_1D[i]-answer));
+        max_diff_fused=fmax(max_diff_fused, fabs(array_fused_1D[i]-answer));
+        max_value=fmax(max_value, fabs(answer));
+    }
+    if (max_value==0.0) max_value=1.0;
+
+    int nfailed=0;
+    cl_double err_separate=max_diff_separate/max_value, err_fused=max_diff_fused/max_value;
+    printf("%12s %14s %10s %14s %8s\n", "path", "time (ms)", "kernels", "relative error", "check");
+    printf("%12s %14f %10d %14g %8s\n", "separate", time_separate, 5, err_separate, (err_separate<=tol) ? "passed" : "FAILED");
+    printf("%12s %14f %10d %14g %8s\n", "fused", time_fused, 1, err_fused, (err_fused<=tol) ? "passed" : "FAILED");
+    if (!(err_separate<=tol)) nfailed++;
+    if (!(err_fused<=tol)) nfailed++;
+    printf("Tolerance %g, %zu kernels built for the separate operations, %zu for the fused expression, %zu cache hits\n",
+            tol, nbuilds_separate, cache.nbuilds-nbuilds_separate, cache.nhits);
+
+    h_release_expr_cache(&cache);
+    h_release_device_matrix(&A);
+    h_release_device_matrix(&B);
+    h_release_device_matrix(&C);
+    h_release_device_matrix(&M);
+    h_release_device_matrix(&T);
+    h_release_device_matrix(&D);
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_C_1D);
+    free(array_M_1D);
+    free(array_separate_1D);
+    free(array_fused_1D);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d paths FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
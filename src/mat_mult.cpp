@@ -45,6 +45,8 @@ SOFTWARE.
 #endif
 
 #include "helper_functions.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_cl.hpp"
 
 int main(int argc, char**argv) {
 
@@ -271,71 +273,9 @@ int main(int argc, char**argv) {
     cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes, NULL, &errcode);
     errchk(errcode, "Creating buffer_C");
 
-    // Now specify the kernel source
-    const char* kernel_source="\n\
-        // standard matrix multiply kernel \n\
-        __kernel void mat_mult (    __global float* A, \n\
-                                    __global float* B, \n\
-                                    __global float* C, \n\
-                                    int nrows_A, \n\
-                                    int nrows_B) { \n\
-            \n\
-            // i0 and i1 represent the coordinates in C \n\
-            // We assume Fortran ordering for the matrices \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            float temp=0.0; \n\
-            // Loop over columns of A and rows of B \n\
-            for (int n=0; n<nrows_B; n++) { \
-                // C has the same number of rows as A, and the same number of columns as B \n\
-                // i0 is the row index of A \n\
-                // i1 is the column index of B \n\
-                temp+=A[n*nrows_A+i0]*B[i1*nrows_B+n]; \n\
-            } \n\
-            // Number of rows in C is same as number of rows in A \n\
-            C[i1*nrows_A+i0]=temp; \n\
-        } \n\
-    ";
-
-    // Turn this source code into a program
-    cl_program program=clCreateProgramWithSource(   context, 
-                                                    1, 
-                                                    &kernel_source,
-                                                    NULL,
-                                                    &errcode);
-    errchk(errcode, "Creating program from source");
-
-    // Build the program
-    const char* build_opts="";
-    errcode=clBuildProgram( program,
-                            1,
-                            &device,
-                            build_opts,
-                            NULL,
-                            NULL);
-
-    // Check the program build
-    if (errcode!=CL_SUCCESS) {
-        size_t elements;
-        errchk(clGetProgramBuildInfo(   program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        0,
-                                        NULL,
-                                        &elements),"Checking build log");
-
-        // Make up the build log string
-        char* buildlog=(char*)calloc(elements, 1);
-
-        errchk(clGetProgramBuildInfo(   program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        elements,
-                                        buildlog,
-                                        NULL), "Filling the build log");
-        printf("Build log is %s\n", buildlog);
-        exit(OCL_EXIT);
-    }
+    // Build the program from kernels/mat_mult.cl, which the Makefile
+    // embeds in the executable as mat_mult_cl
+    cl_program program=h_build_embedded_program(&mat_mult_cl, context, device);
 
     // Create a kernel from the built program
     cl_kernel kernel=clCreateKernel(program,"mat_mult",&errcode);
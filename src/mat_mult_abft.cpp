@@ -0,0 +1,199 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "philox.hpp"
+
+// Algorithm-based fault tolerance (ABFT) for the matrix multiply C=A*B.
+//
+// Rather than reading C back and comparing it to a full answer, every multiply
+// is checked on the device with O(N^2) work by h_enqueue_sgemm_checked. The row 
+// checksums C*e are compared with A*(B*e) and the column checksums e^T*C are compared 
+// with (e^T*A)*B, where e is a vector of ones. Only a handful of integers per check 
+// cross back to the host. A fault is then injected into C to show it being caught.
+// The inputs come from the Philox generator, so no input files are needed.
+// Usage: mat_mult_abft [nrows_A ncols_A ncols_B]
+
+// Function to print the outcome of a check
+void print_report(const h_gemm_check_report* report) {
+    printf("Largest relative checksum error is %g for rows and %g for columns\n", 
+            report->max_err_rows, report->max_err_cols);
+    if (report->nfailed_rows==0 && report->nfailed_cols==0) {
+        printf("ABFT check passed\n");
+    } else {
+        printf("ABFT check FAILED, %d row and %d column checksums diverged", 
+                report->nfailed_rows, report->nfailed_cols);
+        if (report->nfailed_rows>0 && report->nfailed_cols>0) {
+            // A single fault is located where the failed row and column meet
+            printf(", first at row %d, column %d", report->first_row, report->first_col);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // Matrix sizes, deliberately not square by default
+    size_t nrows_A=1000;
+    size_t ncols_A=1500;
+    size_t ncols_B=700;
+    if (argc==4) {
+        nrows_A=(size_t)atol(argv[1]);
+        ncols_A=(size_t)atol(argv[2]);
+        ncols_B=(size_t)atol(argv[3]);
+    }
+    assert(nrows_A>0 && ncols_A>0 && ncols_B>0);
+
+    size_t nrows_B=ncols_A;
+    size_t nrows_C=nrows_A;
+    size_t ncols_C=ncols_B;
+
+    size_t element_size=sizeof(float);
+    size_t nelements_A=nrows_A*ncols_A;
+    size_t nelements_B=nrows_B*ncols_B;
+    size_t nelements_C=nrows_C*ncols_C;
+
+    // Number of bytes in each matrix
+    size_t nbytes_A=nelements_A*element_size;
+    size_t nbytes_B=nelements_B*element_size;
+    size_t nbytes_C=nelements_C*element_size;
+
+    // Allocate memory for the input arrays
+    float* array_A_1D=(float*)malloc(nbytes_A);
+    float* array_B_1D=(float*)malloc(nbytes_B);
+
+    // Generate the inputs. No answer is needed, the checksums verify the result
+    h_fill_uniform_philox(array_A_1D, nrows_A, ncols_A, nrows_A, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows_B, ncols_B, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    // Make buffers for the matrices
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nbytes_A, array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nbytes_B, array_B_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_C, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    // The GEMM kernels and the checksum buffers
+    h_gemm_plan plan=h_create_gemm_plan(context, device);
+    size_t max_dim=nrows_A;
+    if (ncols_A>max_dim) max_dim=ncols_A;
+    if (ncols_B>max_dim) max_dim=ncols_B;
+    h_gemm_check check=h_create_gemm_check(context, max_dim);
+
+    // The multiply on its own, for the cost of checking it
+    cl_event event_plain=h_enqueue_sgemm(   command_queue, &plan, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                            nrows_C, ncols_C, ncols_A, 
+                                            1.0f, buffer_A, 0, nrows_A, buffer_B, 0, nrows_B,
+                                            0.0f, buffer_C, 0, nrows_C, 0, NULL);
+    h_errchk(clWaitForEvents(1, &event_plain), "Waiting for the multiply");
+    cl_double time_plain=h_get_event_time_ms(event_plain);
+    h_errchk(clReleaseEvent(event_plain), "Releasing event_plain");
+
+    // The same multiply with its checksums
+    h_gemm_check_report report;
+    high_resolution_clock::time_point start_checked=high_resolution_clock::now();
+    cl_event event_checked=h_enqueue_sgemm_checked( command_queue, &plan, &check, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                                    nrows_C, ncols_C, ncols_A, 
+                                                    1.0f, buffer_A, 0, nrows_A, buffer_B, 0, nrows_B,
+                                                    0.0f, buffer_C, 0, nrows_C, &report, 0, NULL);
+    duration<cl_double, std::milli> time_checked=high_resolution_clock::now()-start_checked;
+    cl_double time_mult=h_get_event_time_ms(event_checked);
+    h_errchk(clReleaseEvent(event_checked), "Releasing event_checked");
+
+    printf("Matrix multiply took %f ms on its own\n", time_plain);
+    printf("Checked multiply took %f ms, of which the multiply took %f ms\n", time_checked.count(), time_mult);
+    print_report(&report);
+    cl_bool clean_passed=(report.nfailed_rows==0 && report.nfailed_cols==0) ? CL_TRUE : CL_FALSE;
+
+    // Corrupt a single element of C on the device and check it again
+    size_t i0_fault=nrows_C/3, i1_fault=ncols_C/5;
+    size_t offset_fault=(i1_fault*nrows_C+i0_fault)*element_size;
+    cl_float value;
+    h_errchk(clEnqueueReadBuffer(command_queue, buffer_C, CL_TRUE, offset_fault, element_size, &value,
+                                0, NULL, NULL), "Reading an element of C");
+    value+=1.0f+fabsf(value);
+    h_errchk(clEnqueueWriteBuffer(command_queue, buffer_C, CL_TRUE, offset_fault, element_size, &value,
+                                0, NULL, NULL), "Corrupting an element of C");
+    printf("Injected a fault into C at row %zu, column %zu\n", i0_fault, i1_fault);
+
+    h_verify_gemm_check(command_queue, &plan, &check, &report);
+    print_report(&report);
+    cl_bool fault_found=(report.first_row==(cl_int)i0_fault && report.first_col==(cl_int)i1_fault) ? CL_TRUE : CL_FALSE;
+
+    // Release buffers, checksums and kernels
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_release_gemm_check(&check);
+    h_release_gemm_plan(&plan);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_A_1D);
+    free(array_B_1D);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    // The clean multiply has to pass and the fault has to be found where it was put
+    if (!clean_passed || !fault_found) {
+        printf("ABFT demonstration FAILED\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
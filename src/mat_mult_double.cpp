@@ -0,0 +1,271 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_double_cl.hpp"
+
+// Single and double precision versions of the transpose and multiply kernels, 
+// built from the same source in kernels/mat_mult_double.cl. The double precision 
+// path only runs when the device reports support through CL_DEVICE_DOUBLE_FP_CONFIG.
+// Usage: mat_mult_double [nrows_A ncols_A ncols_B]
+
+#define NSAMPLES 1024
+
+// Kernels to benchmark, in the order they appear in the results
+#define NKERNELS 5
+const char* kernel_names[NKERNELS]={   "mat_transpose", 
+                                        "mat_mult", 
+                                        "mat_mult_transp", 
+                                        "mat_mult_transp_vector4", 
+                                        "mat_mult_transp_vector8" };
+
+// Function to run every kernel in one precision, T is float or double. 
+// Fills times with the time of each kernel in milliseconds and returns 
+// the number of multiplies that failed their check
+template<typename T>
+int run_precision( cl_command_queue command_queue,
+                    cl_context context,
+                    cl_device_id device,
+                    const char* build_opts,
+                    size_t nrows_A,
+                    size_t ncols_A,
+                    size_t ncols_B,
+                    cl_double *times) {
+
+    cl_int errcode;
+
+    size_t nrows_B=ncols_A;
+    size_t nrows_C=nrows_A;
+    size_t ncols_C=ncols_B;
+    size_t nrows_A_transp=ncols_A;
+
+    size_t element_size=sizeof(T);
+    size_t nbytes_A=nrows_A*ncols_A*element_size;
+    size_t nbytes_B=nrows_B*ncols_B*element_size;
+    size_t nbytes_C=nrows_C*ncols_C*element_size;
+
+    // Generate the inputs in single precision and widen them if need be,
+    // so both precisions multiply exactly the same matrices
+    float* array_A_float=(float*)malloc(nrows_A*ncols_A*sizeof(float));
+    float* array_B_float=(float*)malloc(nrows_B*ncols_B*sizeof(float));
+    h_fill_uniform_philox(array_A_float, nrows_A, ncols_A, nrows_A, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_float, nrows_B, ncols_B, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    T* array_A_1D=(T*)malloc(nbytes_A);
+    T* array_B_1D=(T*)malloc(nbytes_B);
+    for (size_t n=0; n<nrows_A*ncols_A; n++) array_A_1D[n]=(T)array_A_float[n];
+    for (size_t n=0; n<nrows_B*ncols_B; n++) array_B_1D[n]=(T)array_B_float[n];
+
+    // Make buffers and upload the inputs
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_A, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_A, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_B, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_C, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    h_errchk(clEnqueueWriteBuffer(command_queue, buffer_A, CL_TRUE, 0, nbytes_A, array_A_1D,
+                                0, NULL, NULL), "Writing to buffer_A from host");
+    h_errchk(clEnqueueWriteBuffer(command_queue, buffer_B, CL_TRUE, 0, nbytes_B, array_B_1D,
+                                0, NULL, NULL), "Writing to buffer_B from host");
+
+    cl_program program=h_build_embedded_program(&mat_mult_double_cl, context, device, build_opts);
+
+    cl_int nrows_A_arg=nrows_A, nrows_A_transp_arg=nrows_A_transp;
+    cl_int nrows_B_arg=nrows_B, nrows_C_arg=nrows_C;
+
+    size_t* sample_rows=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    size_t* sample_cols=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    T* sample_C=(T*)calloc(NSAMPLES, sizeof(T));
+    h_sample_coords(nrows_C, ncols_C, NSAMPLES, SEED, sample_rows, sample_cols);
+    h_sample_reader sample_reader=h_create_sample_reader(context, device, nrows_C, NSAMPLES, sample_rows, sample_cols);
+
+    // Relative RMS difference allowed from the double precision reference. Rounding 
+    // errors in a dot product of ncols_A terms usually grow as sqrt(ncols_A)*epsilon, 
+    // so ncols_A*epsilon of the element type leaves room while catching real errors
+    cl_double tol=(cl_double)ncols_A*std::numeric_limits<T>::epsilon();
+    int nfailed=0;
+
+    cl_uint work_dim=2;
+    const size_t global_size_mat_transpose[]={ nrows_A, ncols_A };
+    const size_t global_size_mat_mult[]={ nrows_C, ncols_C };
+
+    for (int k=0; k<NKERNELS; k++) {
+        cl_kernel kernel=clCreateKernel(program, kernel_names[k], &errcode);
+        h_errchk(errcode, "Creating kernel");
+
+        const size_t* global_size=global_size_mat_mult;
+
+        if (k==0) {
+            // The transpose makes A_transp for the kernels that follow
+            h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_A ),"setting mat_transpose argument 0");
+            h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer_A_transp ),"setting mat_transpose argument 1");
+            h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_int), &nrows_A_arg ),"setting mat_transpose argument 2");
+            h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &nrows_A_transp_arg ),"setting mat_transpose argument 3");
+            global_size=global_size_mat_transpose;
+        } else if (k==1) {
+            h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_A ),"setting mat_mult argument 0");
+            h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer_B ),"setting mat_mult argument 1");
+            h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &buffer_C ),"setting mat_mult argument 2");
+            h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &nrows_A_arg ),"setting mat_mult argument 3");
+            h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &nrows_B_arg ),"setting mat_mult argument 4");
+        } else {
+            // All of the pre-transposed kernels share the same arguments
+            h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_A_transp ),"setting kernel argument 0");
+            h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer_B ),"setting kernel argument 1");
+            h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &buffer_C ),"setting kernel argument 2");
+            h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &nrows_A_transp_arg ),"setting kernel argument 3");
+            h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &nrows_B_arg ),"setting kernel argument 4");
+            h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_int), &nrows_C_arg ),"setting kernel argument 5");
+        }
+
+        cl_event event;
+        h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                        kernel,
+                                        work_dim,
+                                        NULL,
+                                        global_size,
+                                        NULL,
+                                        0,
+                                        NULL,
+                                        &event), "Running the kernel");
+        h_errchk(clWaitForEvents(1, &event), "Waiting for the kernel");
+        times[k]=h_get_event_time_ms(event);
+        h_errchk(clReleaseEvent(event), "Releasing the event");
+        h_errchk(clReleaseKernel(kernel), "Releasing the kernel");
+
+        // Check every multiply with a sample of C
+        if (k>0) {
+            h_read_samples(command_queue, &sample_reader, buffer_C, element_size, sample_C);
+            h_sample_stats stats=h_verify_samples(  array_A_1D, array_B_1D, 
+                                                    nrows_A, ncols_A,
+                                                    NSAMPLES, sample_rows, sample_cols, sample_C,
+                                                    1.96);
+            std::string name=std::string("\t")+kernel_names[k]+" relative RMS difference";
+            if (!h_check_tolerance(name.c_str(), stats.rms_err/stats.rms_ref, tol)) nfailed++;
+        }
+    }
+
+    // Release resources
+    h_errchk(clReleaseProgram(program), "Releasing the program");
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_A_transp), "Releasing buffer_A_transp");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    free(array_A_float);
+    free(array_B_float);
+    free(array_A_1D);
+    free(array_B_1D);
+    h_release_sample_reader(&sample_reader);
+    free(sample_rows);
+    free(sample_cols);
+    free(sample_C);
+    return nfailed;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    // Matrix sizes
+    size_t nrows_A=1024;
+    size_t ncols_A=1024;
+    size_t ncols_B=1024;
+    if (argc==4) {
+        nrows_A=(size_t)atol(argv[1]);
+        ncols_A=(size_t)atol(argv[2]);
+        ncols_B=(size_t)atol(argv[3]);
+    }
+    assert(nrows_A>0 && ncols_A>0 && ncols_B>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    cl_double times_float[NKERNELS];
+    cl_double times_double[NKERNELS];
+
+    printf("Single precision:\n");
+    int nfailed=run_precision<cl_float>(command_queue, context, device, "", nrows_A, ncols_A, ncols_B, times_float);
+
+    // Select the double precision path at runtime
+    cl_bool have_double=h_device_supports_double(device);
+    if (have_double) {
+        printf("Double precision:\n");
+        nfailed+=run_precision<cl_double>(command_queue, context, device, "-DUSE_DOUBLE", nrows_A, ncols_A, ncols_B, times_double);
+    } else {
+        printf("Device does not support double precision, skipping the double precision kernels\n");
+    }
+
+    // Report the timings side by side
+    printf("%-24s %14s %14s %10s\n", "kernel", "float (ms)", "double (ms)", "ratio");
+    for (int k=0; k<NKERNELS; k++) {
+        if (have_double) {
+            printf("%-24s %14f %14f %10f\n", kernel_names[k], times_float[k], times_double[k], times_double[k]/times_float[k]);
+        } else {
+            printf("%-24s %14f %14s %10s\n", kernel_names[k], times_float[k], "-", "-");
+        }
+    }
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d multiplies FAILED their check\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,319 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "cl_embed.hpp"
+#include "philox.hpp"
+#include "mat_mult_transpose_cl.hpp"
+
+// Matrix multiply followed by a bias and an activation, as separate passes over C 
+// after the GEMM, against the same bias and activation fused into the epilogue of
+// the GEMM, in both orders, and of mat_mult_transp from the kernel library.
+// Usage: mat_mult_epilogue [nrows_A ncols_A ncols_B]
+
+// Each path runs this many times and the fastest run is kept
+#define NREPEATS 5
+
+// Function to run a 2D kernel over every element of the M x N matrix C and return its time in ms
+cl_double run_pass(cl_command_queue command_queue, cl_kernel kernel, size_t M, size_t N) {
+    size_t global_size[]={ M, N };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    2,
+                                    NULL,
+                                    global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event), "Running a pass over C");
+    return h_wait_event_time_ms(event);
+}
+
+// Function to find the largest difference between two M x N results, 
+// relative to the largest magnitude in the reference
+cl_double max_rel_diff(const float* result, const float* reference, size_t M, size_t N) {
+    double max_diff=0.0, max_ref=0.0;
+    for (size_t i=0; i<M*N; i++) {
+        max_diff=fmax(max_diff, fabs(result[i]-reference[i]));
+        max_ref=fmax(max_ref, fabs(reference[i]));
+    }
+    return (max_ref>0.0) ? max_diff/max_ref : max_diff;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t M=1024, K=1024, N=1024;
+    if (argc>=4) {
+        M=(size_t)atol(argv[1]);
+        K=(size_t)atol(argv[2]);
+        N=(size_t)atol(argv[3]);
+    }
+    assert(M>0 && K>0 && N>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // The separate passes over column-major C, with the same arithmetic as the epilogue
+    const char* kernel_source="\n\
+        // Add a bias for each row (per_row=1) or each column of C \n\
+        __kernel void add_bias( __global float* C, \n\
+                                int ldc, \n\
+                                __global float* bias, \n\
+                                int per_row) { \n\
+            size_t i=get_global_id(0); \n\
+            size_t j=get_global_id(1); \n\
+            C[j*ldc+i]+=per_row ? bias[i] : bias[j]; \n\
+        } \n\
+        \n\
+        // Apply ReLU (activation=1), the logistic sigmoid (2) or a clamp (3) to C \n\
+        __kernel void activate( __global float* C, \n\
+                                int ldc, \n\
+                                int activation, \n\
+                                float clamp_lower, \n\
+                                float clamp_upper) { \n\
+            size_t i=get_global_id(0); \n\
+            size_t j=get_global_id(1); \n\
+            float value=C[j*ldc+i]; \n\
+            if (activation==1) value=fmax(value, 0.0f); \n\
+            else if (activation==2) value=1.0f/(1.0f+exp(-value)); \n\
+            else if (activation==3) value=clamp(value, clamp_lower, clamp_upper); \n\
+            C[j*ldc+i]=value; \n\
+        } \n\
+    ";
+
+    cl_program program=h_build_program(kernel_source, context, device);
+    cl_int errcode;
+    cl_kernel kernel_add_bias=clCreateKernel(program, "add_bias", &errcode);
+    h_errchk(errcode, "Creating Kernel add_bias");
+    cl_kernel kernel_activate=clCreateKernel(program, "activate", &errcode);
+    h_errchk(errcode, "Creating Kernel activate");
+
+    h_gemm_plan plan=h_create_gemm_plan(context, device);
+
+    float* array_A_1D=(float*)malloc(M*K*sizeof(float));
+    float* array_B_1D=(float*)malloc(K*N*sizeof(float));
+    float* array_bias_row_1D=(float*)malloc(M*sizeof(float));
+    float* array_bias_col_1D=(float*)malloc(N*sizeof(float));
+    float* array_separate_1D=(float*)malloc(M*N*sizeof(float));
+    float* array_fused_1D=(float*)malloc(M*N*sizeof(float));
+    float* array_row_major_1D=(float*)malloc(M*N*sizeof(float));
+    float* array_transp_1D=(float*)malloc(M*N*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, M, K, M, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, K, N, K, SEED, 1, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_bias_row_1D, M, 1, M, SEED, 2, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_bias_col_1D, N, 1, N, SEED, 3, -1.0f, 1.0f);
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, M*K*sizeof(float), array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, K*N*sizeof(float), array_B_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_bias_row=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, M*sizeof(float), array_bias_row_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_bias_row");
+    cl_mem buffer_bias_col=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N*sizeof(float), array_bias_col_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_bias_col");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, M*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_WRITE, K*M*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+
+    // mat_mult_transp reads A pre-transposed, which is done once outside the timing
+    cl_program program_transpose=h_build_embedded_program(&mat_mult_transpose_cl, context, device);
+    cl_kernel kernel_transpose=clCreateKernel(program_transpose, "mat_transpose", &errcode);
+    h_errchk(errcode, "Creating Kernel mat_transpose");
+    cl_int nrows_A_arg=M, ncols_A_arg=K;
+    h_errchk(clSetKernelArg(kernel_transpose, 0, sizeof(cl_mem), &buffer_A), "setting mat_transpose argument 0");
+    h_errchk(clSetKernelArg(kernel_transpose, 1, sizeof(cl_mem), &buffer_A_transp), "setting mat_transpose argument 1");
+    h_errchk(clSetKernelArg(kernel_transpose, 2, sizeof(cl_int), &nrows_A_arg), "setting mat_transpose argument 2");
+    h_errchk(clSetKernelArg(kernel_transpose, 3, sizeof(cl_int), &ncols_A_arg), "setting mat_transpose argument 3");
+    size_t global_size_A[]={ M, K };
+    h_errchk(clEnqueueNDRangeKernel(command_queue, kernel_transpose, 2, NULL, global_size_A, NULL, 
+                                    0, NULL, NULL), "Running mat_transpose");
+
+    // Bias and activation pairs to try, the first shows the cost of an empty epilogue
+    h_bias biases[]={ H_BIAS_NONE, H_BIAS_ROW, H_BIAS_COL, H_BIAS_ROW };
+    h_activation activations[]={ H_ACTIVATION_NONE, H_ACTIVATION_RELU, H_ACTIVATION_SIGMOID, H_ACTIVATION_CLAMP };
+    const char* bias_names[]={ "none", "row", "column" };
+    const char* activation_names[]={ "none", "relu", "sigmoid", "clamp" };
+    cl_float clamp_lower=-0.5f, clamp_upper=0.5f;
+    cl_int ldc=M;
+
+    // The fused results are compared with the separate passes, relative to the largest
+    // magnitude. mat_mult_transp sums K terms in a different order, and K*epsilon leaves 
+    // room for the usual sqrt(K)*epsilon growth in that difference
+    cl_double tol=(cl_double)K*FLT_EPSILON;
+    int nfailed=0;
+
+    printf("%8s %10s %14s %14s %14s %14s %10s %8s\n", "bias", "activation", "separate (ms)", "fused (ms)", 
+            "transp (ms)", "relative diff", "tolerance", "check");
+    for (size_t c=0; c<sizeof(biases)/sizeof(h_bias); c++) {
+        h_bias bias=biases[c];
+        h_activation activation=activations[c];
+        h_bias bias_transp=(bias==H_BIAS_ROW) ? H_BIAS_COL : ((bias==H_BIAS_COL) ? H_BIAS_ROW : H_BIAS_NONE);
+        cl_mem buffer_bias=(bias==H_BIAS_ROW) ? buffer_bias_row : buffer_bias_col;
+        h_gemm_plan plan_epilogue=h_create_gemm_epilogue_plan(context, device, H_COL_MAJOR, bias, activation);
+        h_gemm_plan plan_row_major=h_create_gemm_epilogue_plan(context, device, H_ROW_MAJOR, bias_transp, activation);
+
+        cl_int per_row=(bias==H_BIAS_ROW) ? 1 : 0, activation_arg=activation;
+        h_errchk(clSetKernelArg(kernel_add_bias, 0, sizeof(cl_mem), &buffer_C), "setting add_bias argument 0");
+        h_errchk(clSetKernelArg(kernel_add_bias, 1, sizeof(cl_int), &ldc), "setting add_bias argument 1");
+        h_errchk(clSetKernelArg(kernel_add_bias, 2, sizeof(cl_mem), &buffer_bias), "setting add_bias argument 2");
+        h_errchk(clSetKernelArg(kernel_add_bias, 3, sizeof(cl_int), &per_row), "setting add_bias argument 3");
+        h_errchk(clSetKernelArg(kernel_activate, 0, sizeof(cl_mem), &buffer_C), "setting activate argument 0");
+        h_errchk(clSetKernelArg(kernel_activate, 1, sizeof(cl_int), &ldc), "setting activate argument 1");
+        h_errchk(clSetKernelArg(kernel_activate, 2, sizeof(cl_int), &activation_arg), "setting activate argument 2");
+        h_errchk(clSetKernelArg(kernel_activate, 3, sizeof(cl_float), &clamp_lower), "setting activate argument 3");
+        h_errchk(clSetKernelArg(kernel_activate, 4, sizeof(cl_float), &clamp_upper), "setting activate argument 4");
+
+        // The GEMM, then one pass over C for the bias and one for the activation
+        cl_double time_separate=INFINITY;
+        for (int r=0; r<NREPEATS; r++) {
+            cl_double time=h_wait_event_time_ms(h_enqueue_sgemm(   command_queue, &plan, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                                                    M, N, K, 1.0f, buffer_A, 0, M, buffer_B, 0, K, 
+                                                                    0.0f, buffer_C, 0, M, 0, NULL));
+            if (bias!=H_BIAS_NONE) time+=run_pass(command_queue, kernel_add_bias, M, N);
+            if (activation!=H_ACTIVATION_NONE) time+=run_pass(command_queue, kernel_activate, M, N);
+            time_separate=fmin(time_separate, time);
+        }
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, M*N*sizeof(float), 
+                                        array_separate_1D, 0, NULL, NULL), "Reading buffer_C");
+
+        // Everything in the GEMM's epilogue
+        cl_double time_fused=INFINITY;
+        for (int r=0; r<NREPEATS; r++) {
+            h_keep_fastest(h_enqueue_sgemm_epilogue(   command_queue, &plan_epilogue, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                                        M, N, K, 1.0f, buffer_A, 0, M, buffer_B, 0, K, 0.0f, buffer_C, 0, M, 
+                                                        (bias==H_BIAS_NONE) ? NULL : buffer_bias, clamp_lower, clamp_upper,
+                                                        0, NULL), &time_fused);
+        }
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, M*N*sizeof(float), 
+                                        array_fused_1D, 0, NULL, NULL), "Reading buffer_C");
+
+        // Column-major C is row-major C^T=B^T*A^T, where the column-major B and A are
+        // row-major B^T and A^T. A row bias of C^T is the column bias of C, so this
+        // checks that the row-major plan swaps the bias
+        cl_event event_row_major=h_enqueue_sgemm_epilogue(  command_queue, &plan_row_major, H_ROW_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                                            N, M, K, 1.0f, buffer_B, 0, K, buffer_A, 0, M, 0.0f, buffer_C, 0, M, 
+                                                            (bias==H_BIAS_NONE) ? NULL : buffer_bias, clamp_lower, clamp_upper,
+                                                            0, NULL);
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, M*N*sizeof(float), 
+                                        array_row_major_1D, 1, &event_row_major, NULL), "Reading buffer_C");
+        h_errchk(clReleaseEvent(event_row_major), "Releasing event_row_major");
+
+        // The same epilogue in mat_mult_transp from the kernel library
+        char build_opts[64];
+        snprintf(build_opts, sizeof(build_opts), "-DEPILOGUE -DBIAS=%d -DACTIVATION=%d", (int)bias, (int)activation);
+        cl_program program_transp=h_build_embedded_program(&mat_mult_transpose_cl, context, device, build_opts);
+        cl_kernel kernel_transp=clCreateKernel(program_transp, "mat_mult_transp", &errcode);
+        h_errchk(errcode, "Creating Kernel mat_mult_transp");
+        h_errchk(clSetKernelArg(kernel_transp, 0, sizeof(cl_mem), &buffer_A_transp), "setting mat_mult_transp argument 0");
+        h_errchk(clSetKernelArg(kernel_transp, 1, sizeof(cl_mem), &buffer_B), "setting mat_mult_transp argument 1");
+        h_errchk(clSetKernelArg(kernel_transp, 2, sizeof(cl_mem), &buffer_C), "setting mat_mult_transp argument 2");
+        h_errchk(clSetKernelArg(kernel_transp, 3, sizeof(cl_int), &ncols_A_arg), "setting mat_mult_transp argument 3");
+        h_errchk(clSetKernelArg(kernel_transp, 4, sizeof(cl_int), &ncols_A_arg), "setting mat_mult_transp argument 4");
+        h_errchk(clSetKernelArg(kernel_transp, 5, sizeof(cl_int), &ldc), "setting mat_mult_transp argument 5");
+        h_errchk(clSetKernelArg(kernel_transp, 6, sizeof(cl_mem), &buffer_bias), "setting mat_mult_transp argument 6");
+        h_errchk(clSetKernelArg(kernel_transp, 7, sizeof(cl_float), &clamp_lower), "setting mat_mult_transp argument 7");
+        h_errchk(clSetKernelArg(kernel_transp, 8, sizeof(cl_float), &clamp_upper), "setting mat_mult_transp argument 8");
+        cl_double time_transp=INFINITY;
+        for (int r=0; r<NREPEATS; r++) {
+            time_transp=fmin(time_transp, run_pass(command_queue, kernel_transp, M, N));
+        }
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, M*N*sizeof(float), 
+                                        array_transp_1D, 0, NULL, NULL), "Reading buffer_C");
+        h_errchk(clReleaseKernel(kernel_transp), "Releasing kernel mat_mult_transp");
+        h_errchk(clReleaseProgram(program_transp), "Releasing program_transp");
+
+        cl_double err=fmax(max_rel_diff(array_fused_1D, array_separate_1D, M, N), 
+                            max_rel_diff(array_row_major_1D, array_separate_1D, M, N));
+        err=fmax(err, max_rel_diff(array_transp_1D, array_separate_1D, M, N));
+        cl_bool passed=(err<=tol) ? CL_TRUE : CL_FALSE;
+        if (!passed) nfailed++;
+        printf("%8s %10s %14f %14f %14f %14g %10g %8s\n", bias_names[bias], activation_names[activation], 
+                time_separate, time_fused, time_transp, err, tol, passed ? "passed" : "FAILED");
+
+        h_release_gemm_plan(&plan_epilogue);
+        h_release_gemm_plan(&plan_row_major);
+    }
+
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_bias_row), "Releasing buffer_bias_row");
+    h_errchk(clReleaseMemObject(buffer_bias_col), "Releasing buffer_bias_col");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseMemObject(buffer_A_transp), "Releasing buffer_A_transp");
+    h_errchk(clReleaseKernel(kernel_transpose), "Releasing kernel mat_transpose");
+    h_errchk(clReleaseProgram(program_transpose), "Releasing program_transpose");
+    h_errchk(clReleaseKernel(kernel_add_bias), "Releasing kernel add_bias");
+    h_errchk(clReleaseKernel(kernel_activate), "Releasing kernel activate");
+    h_errchk(clReleaseProgram(program), "Releasing the program");
+    h_release_gemm_plan(&plan);
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_bias_row_1D);
+    free(array_bias_col_1D);
+    free(array_separate_1D);
+    free(array_fused_1D);
+    free(array_row_major_1D);
+    free(array_transp_1D);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d combinations FAILED, tolerance %g\n", nfailed, tol);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
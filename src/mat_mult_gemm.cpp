@@ -0,0 +1,197 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+
+// Matrix multiply with BLAS-style transpose flags, in column-major and row-major order.
+// Every combination reads the operands as they are stored, with no transpose pass.
+// Usage: mat_mult_gemm [nrows_A ncols_A ncols_B]
+
+#define NSAMPLES 1024
+
+// Function to lay out the column-major nrows x ncols matrix src as it would be stored
+// for op(src) in the given order, i.e. as src, or src^T when transposed
+void store_operand(const float* src, size_t nrows, size_t ncols, h_order order, h_trans trans, float* dest) {
+    for (size_t i1=0; i1<ncols; i1++) {
+        for (size_t i0=0; i0<nrows; i0++) {
+            // Column-major transposed and row-major as stored share a layout
+            if ((order==H_COL_MAJOR)==(trans==H_NO_TRANS)) {
+                dest[i1*nrows+i0]=src[i1*nrows+i0];
+            } else {
+                dest[i0*ncols+i1]=src[i1*nrows+i0];
+            }
+        }
+    }
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // C=op(A)*op(B) with op(A) M x K and op(B) K x N
+    size_t M=1000;
+    size_t K=1500;
+    size_t N=700;
+    if (argc==4) {
+        M=(size_t)atol(argv[1]);
+        K=(size_t)atol(argv[2]);
+        N=(size_t)atol(argv[3]);
+    }
+    assert(M>0 && K>0 && N>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_gemm_plan plan=h_create_gemm_plan(context, device);
+
+    // The operands as column-major matrices, before any transposition
+    float* array_A_1D=(float*)malloc(M*K*sizeof(float));
+    float* array_B_1D=(float*)malloc(K*N*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, M, K, M, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, K, N, K, SEED, 1, -1.0f, 1.0f);
+
+    // Storage for the operands in each layout
+    float* array_A_stored_1D=(float*)malloc(M*K*sizeof(float));
+    float* array_B_stored_1D=(float*)malloc(K*N*sizeof(float));
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY, M*K*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY, K*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, M*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    // The same samples of C are checked for every combination
+    size_t* sample_rows=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    size_t* sample_cols=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    float* sample_C=(float*)calloc(NSAMPLES, sizeof(float));
+    h_sample_coords(M, N, NSAMPLES, SEED, sample_rows, sample_cols);
+    // A row-major C is a column-major N x M matrix, so it is sampled with the coordinates swapped
+    h_sample_reader sample_reader_col=h_create_sample_reader(context, device, M, NSAMPLES, sample_rows, sample_cols);
+    h_sample_reader sample_reader_row=h_create_sample_reader(context, device, N, NSAMPLES, sample_cols, sample_rows);
+
+    const char* order_names[]={"column-major", "row-major"};
+    const char* trans_names[]={"N", "T"};
+    cl_double gflop=2.0e-9*(cl_double)M*(cl_double)N*(cl_double)K;
+
+    // Relative RMS difference allowed for each combination. The transposes only change
+    // how the operands are read, so every combination rounds the same K-term dot products,
+    // and K*epsilon leaves room for their usual sqrt(K)*epsilon growth in error
+    cl_double tol=(cl_double)K*FLT_EPSILON;
+    int nfailed=0;
+
+    printf("%14s %7s %7s %12s %10s %14s %8s\n", "order", "trans_A", "trans_B", "time (ms)", "GFLOP/s", "relative RMS", "check");
+    for (int order=H_COL_MAJOR; order<=H_ROW_MAJOR; order++) {
+        for (int trans_A=H_NO_TRANS; trans_A<=H_TRANS; trans_A++) {
+            for (int trans_B=H_NO_TRANS; trans_B<=H_TRANS; trans_B++) {
+                store_operand(array_A_1D, M, K, (h_order)order, (h_trans)trans_A, array_A_stored_1D);
+                store_operand(array_B_1D, K, N, (h_order)order, (h_trans)trans_B, array_B_stored_1D);
+                h_errchk(clEnqueueWriteBuffer(  command_queue, buffer_A, CL_TRUE, 0, M*K*sizeof(float), 
+                                                array_A_stored_1D, 0, NULL, NULL), "Writing to buffer_A from host");
+                h_errchk(clEnqueueWriteBuffer(  command_queue, buffer_B, CL_TRUE, 0, K*N*sizeof(float), 
+                                                array_B_stored_1D, 0, NULL, NULL), "Writing to buffer_B from host");
+
+                cl_event event_gemm=h_enqueue_gemm( command_queue, &plan,
+                                                    (h_order)order, (h_trans)trans_A, (h_trans)trans_B,
+                                                    M, N, K,
+                                                    buffer_A, buffer_B, buffer_C,
+                                                    0, NULL);
+                h_errchk(clWaitForEvents(1, &event_gemm), "Waiting for the multiply");
+                cl_double time_gemm=h_get_event_time_ms(event_gemm);
+                h_errchk(clReleaseEvent(event_gemm), "Releasing event_gemm");
+
+                h_sample_reader* sample_reader=(order==H_COL_MAJOR) ? &sample_reader_col : &sample_reader_row;
+                h_read_samples(command_queue, sample_reader, buffer_C, sizeof(float), sample_C);
+                h_sample_stats stats=h_verify_samples(  array_A_1D, array_B_1D, M, K,
+                                                        NSAMPLES, sample_rows, sample_cols, sample_C,
+                                                        1.96);
+
+                cl_double err=stats.rms_err/stats.rms_ref;
+                cl_bool passed=(err<=tol) ? CL_TRUE : CL_FALSE;
+                if (!passed) nfailed++;
+                printf("%14s %7s %7s %12f %10.2f %14g %8s\n", 
+                        order_names[order], trans_names[trans_A], trans_names[trans_B],
+                        time_gemm, gflop/(time_gemm*1.0e-3), err, passed ? "passed" : "FAILED");
+            }
+        }
+    }
+
+    // Release buffers and the GEMM plan
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_release_gemm_plan(&plan);
+    h_release_sample_reader(&sample_reader_col);
+    h_release_sample_reader(&sample_reader_row);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_A_stored_1D);
+    free(array_B_stored_1D);
+    free(sample_rows);
+    free(sample_cols);
+    free(sample_C);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d of 8 combinations FAILED, tolerance %g\n", nfailed, tol);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
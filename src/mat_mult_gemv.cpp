@@ -0,0 +1,279 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "cl_gemv.hpp"
+#include "philox.hpp"
+
+// Matrix-vector products with the GEMV kernels, against the GEMM path with one column,
+// in both orders, and batches of small products in one launch against one launch per product.
+// Empty problems must leave y untouched. Usage: mat_mult_gemv [M N]
+
+// Each kernel runs this many times and the fastest run is kept
+#define NREPEATS 5
+// Batch of small products
+#define NBATCH 64
+#define NBATCH_ROWS 256
+
+// Function to find the largest error of a device result for op(A)*x relative 
+// to the largest magnitude in the host result, where A is M x N in the given order
+cl_double check_gemv(   h_order order, h_trans trans, size_t M, size_t N, 
+                        const float* A, size_t lda, const float* x, const float* y) {
+    size_t ny=(trans==H_TRANS) ? N : M;
+    double* answer=(double*)calloc(ny, sizeof(double));
+    for (size_t j=0; j<N; j++) {
+        for (size_t i=0; i<M; i++) {
+            double a=(order==H_COL_MAJOR) ? (double)A[j*lda+i] : (double)A[i*lda+j];
+            if (trans==H_TRANS) {
+                answer[j]+=a*(double)x[i];
+            } else {
+                answer[i]+=a*(double)x[j];
+            }
+        }
+    }
+    double max_err=0.0, max_answer=0.0;
+    for (size_t n=0; n<ny; n++) {
+        max_err=fmax(max_err, fabs(y[n]-answer[n]));
+        max_answer=fmax(max_answer, fabs(answer[n]));
+    }
+    free(answer);
+    return max_err/max_answer;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // A is M x N
+    size_t M=4096;
+    size_t N=4096;
+    if (argc==3) {
+        M=(size_t)atol(argv[1]);
+        N=(size_t)atol(argv[2]);
+    }
+    assert(M>0 && N>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_gemm_plan plan_gemm=h_create_gemm_plan(context, device);
+    h_gemv_plan plan_gemv=h_create_gemv_plan(context, device);
+
+    // x multiplies A and x_transp multiplies A^T
+    size_t ny_max=(M>N) ? M : N;
+    float* array_A_1D=(float*)malloc(M*N*sizeof(float));
+    float* array_x_1D=(float*)malloc(N*sizeof(float));
+    float* array_x_transp_1D=(float*)malloc(M*sizeof(float));
+    float* array_y_1D=(float*)malloc(ny_max*sizeof(float));
+    float* array_y_before_1D=(float*)malloc(ny_max*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, M, N, M, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_x_1D, N, 1, N, SEED, 1, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_x_transp_1D, M, 1, M, SEED, 2, -1.0f, 1.0f);
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, M*N*sizeof(float), array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_x=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N*sizeof(float), array_x_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_x");
+    cl_mem buffer_x_transp=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, M*sizeof(float), array_x_transp_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_x_transp");
+    cl_mem buffer_y=clCreateBuffer(context, CL_MEM_READ_WRITE, ny_max*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_y");
+
+    // Reading A dominates, so report the bandwidth achieved on it
+    cl_double gbytes=1.0e-9*(cl_double)M*(cl_double)N*sizeof(float);
+    int nfailed=0;
+
+    // The column-major M x N array is also the row-major N x M matrix A^T,
+    // so the row-major products reuse the same buffer with lda=M
+    const char* order_names[]={"column-major", "row-major"};
+    printf("%14s %8s %8s %12s %10s %14s %10s %8s\n", 
+            "order", "op(A)", "path", "time (ms)", "GB/s", "relative error", "tolerance", "check");
+    for (int order=H_COL_MAJOR; order<=H_ROW_MAJOR; order++) {
+        size_t M_order=(order==H_COL_MAJOR) ? M : N;
+        size_t N_order=(order==H_COL_MAJOR) ? N : M;
+
+        for (int trans=H_NO_TRANS; trans<=H_TRANS; trans++) {
+            size_t ny=(trans==H_TRANS) ? N_order : M_order;
+            size_t K=(trans==H_TRANS) ? M_order : N_order;
+            cl_mem buffer_in=(K==N) ? buffer_x : buffer_x_transp;
+            const float* array_in_1D=(K==N) ? array_x_1D : array_x_transp_1D;
+
+            // Every output is a K-term dot product, and K*epsilon leaves 
+            // room for the usual sqrt(K)*epsilon growth in its error
+            cl_double tol=(cl_double)K*FLT_EPSILON;
+
+            for (int path=0; path<2; path++) {
+                cl_double time=INFINITY;
+                for (int r=0; r<NREPEATS; r++) {
+                    if (path==0) {
+                        h_keep_fastest(h_enqueue_sgemv( command_queue, &plan_gemv, (h_order)order, (h_trans)trans, 
+                                                        M_order, N_order,
+                                                        1.0f, buffer_A, 0, M, buffer_in, 0,
+                                                        0.0f, buffer_y, 0,
+                                                        0, NULL), &time);
+                    } else {
+                        // The same product as a GEMM with one column in B and C
+                        size_t ldb=(order==H_COL_MAJOR) ? K : 1;
+                        size_t ldc=(order==H_COL_MAJOR) ? ny : 1;
+                        h_keep_fastest(h_enqueue_sgemm( command_queue, &plan_gemm, (h_order)order, (h_trans)trans, H_NO_TRANS,
+                                                        ny, 1, K,
+                                                        1.0f, buffer_A, 0, M, buffer_in, 0, ldb,
+                                                        0.0f, buffer_y, 0, ldc,
+                                                        0, NULL), &time);
+                    }
+                }
+
+                h_errchk(clEnqueueReadBuffer(   command_queue, buffer_y, CL_TRUE, 0, ny*sizeof(float), 
+                                                array_y_1D, 0, NULL, NULL), "Reading buffer_y to host");
+                cl_double err=check_gemv(   (h_order)order, (h_trans)trans, M_order, N_order, 
+                                            array_A_1D, M, array_in_1D, array_y_1D);
+                cl_bool passed=(err<=tol) ? CL_TRUE : CL_FALSE;
+                if (!passed) nfailed++;
+                printf("%14s %8s %8s %12f %10.2f %14g %10g %8s\n", 
+                        order_names[order], (trans==H_TRANS) ? "A^T" : "A", (path==0) ? "gemv" : "gemm", 
+                        time, gbytes/(time*1.0e-3), err, tol, passed ? "passed" : "FAILED");
+            }
+        }
+    }
+
+    // Batches of small products, taken from the start of A, x and y
+    size_t nrows_batch=NBATCH_ROWS;
+    size_t stride_A=nrows_batch*nrows_batch;
+    if (NBATCH*stride_A<=M*N && NBATCH*nrows_batch<=N && NBATCH*nrows_batch<=ny_max) {
+        cl_double tol=(cl_double)nrows_batch*FLT_EPSILON;
+        for (int trans=H_NO_TRANS; trans<=H_TRANS; trans++) {
+            cl_double time_batched=INFINITY, time_single=0.0;
+            for (int r=0; r<NREPEATS; r++) {
+                h_keep_fastest(h_enqueue_sgemv_batched( command_queue, &plan_gemv, H_COL_MAJOR, (h_trans)trans,
+                                                        nrows_batch, nrows_batch,
+                                                        1.0f, buffer_A, 0, nrows_batch, stride_A,
+                                                        buffer_x, 0, nrows_batch,
+                                                        0.0f, buffer_y, 0, nrows_batch, NBATCH,
+                                                        0, NULL), &time_batched);
+            }
+
+            // Check every product of the batch before the single launches overwrite y
+            h_errchk(clEnqueueReadBuffer(   command_queue, buffer_y, CL_TRUE, 0, NBATCH*nrows_batch*sizeof(float), 
+                                            array_y_1D, 0, NULL, NULL), "Reading buffer_y to host");
+            cl_double err=0.0;
+            for (size_t b=0; b<NBATCH; b++) {
+                err=fmax(err, check_gemv(   H_COL_MAJOR, (h_trans)trans, nrows_batch, nrows_batch, 
+                                            array_A_1D+b*stride_A, nrows_batch, 
+                                            array_x_1D+b*nrows_batch, array_y_1D+b*nrows_batch));
+            }
+
+            for (size_t b=0; b<NBATCH; b++) {
+                cl_double time=INFINITY;
+                h_keep_fastest(h_enqueue_sgemv( command_queue, &plan_gemv, H_COL_MAJOR, (h_trans)trans,
+                                                nrows_batch, nrows_batch,
+                                                1.0f, buffer_A, b*stride_A, nrows_batch,
+                                                buffer_x, b*nrows_batch,
+                                                0.0f, buffer_y, b*nrows_batch,
+                                                0, NULL), &time);
+                time_single+=time;
+            }
+
+            printf("Batch of %d products with %s of size %zu took %f ms in one launch and %f ms in %d launches\n",
+                    NBATCH, (trans==H_TRANS) ? "A^T" : "A", nrows_batch, time_batched, time_single, NBATCH);
+            if (!h_check_tolerance("Batched relative error", err, tol)) nfailed++;
+        }
+    }
+
+    // Empty problems must not launch a kernel or touch y. A kernel that ran
+    // with N=0 would write zeros to y, and a batch of none has no NDRange
+    h_errchk(clEnqueueReadBuffer(   command_queue, buffer_y, CL_TRUE, 0, ny_max*sizeof(float), 
+                                    array_y_before_1D, 0, NULL, NULL), "Reading buffer_y to host");
+    cl_event events_empty[3];
+    events_empty[0]=h_enqueue_sgemv(command_queue, &plan_gemv, H_COL_MAJOR, H_NO_TRANS, M, 0,
+                                    1.0f, buffer_A, 0, M, buffer_x, 0, 0.0f, buffer_y, 0, 0, NULL);
+    events_empty[1]=h_enqueue_sgemv(command_queue, &plan_gemv, H_ROW_MAJOR, H_TRANS, 0, M,
+                                    1.0f, buffer_A, 0, M, buffer_x_transp, 0, 0.0f, buffer_y, 0, 0, NULL);
+    events_empty[2]=h_enqueue_sgemv_batched(command_queue, &plan_gemv, H_COL_MAJOR, H_TRANS, M, N,
+                                            1.0f, buffer_A, 0, M, 0, buffer_x_transp, 0, 0,
+                                            0.0f, buffer_y, 0, 0, 0, 0, NULL);
+    h_errchk(clWaitForEvents(3, events_empty), "Waiting for the empty problems");
+    for (int n=0; n<3; n++) {
+        h_errchk(clReleaseEvent(events_empty[n]), "Releasing an empty problem event");
+    }
+    h_errchk(clEnqueueReadBuffer(   command_queue, buffer_y, CL_TRUE, 0, ny_max*sizeof(float), 
+                                    array_y_1D, 0, NULL, NULL), "Reading buffer_y to host");
+    cl_bool unchanged=(memcmp(array_y_before_1D, array_y_1D, ny_max*sizeof(float))==0) ? CL_TRUE : CL_FALSE;
+    if (!unchanged) nfailed++;
+    printf("Empty problems left y unchanged: %s\n", unchanged ? "passed" : "FAILED");
+
+    // Release buffers and plans
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_x), "Releasing buffer_x");
+    h_errchk(clReleaseMemObject(buffer_x_transp), "Releasing buffer_x_transp");
+    h_errchk(clReleaseMemObject(buffer_y), "Releasing buffer_y");
+    h_release_gemm_plan(&plan_gemm);
+    h_release_gemv_plan(&plan_gemv);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_A_1D);
+    free(array_x_1D);
+    free(array_x_transp_1D);
+    free(array_y_1D);
+    free(array_y_before_1D);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d checks FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_half_cl.hpp"
+
+// Matrix multiply with A and B stored as half precision and accumulated in float,
+// halving the memory traffic of mat_mult_transp. C is written either as float or half.
+// Usage: mat_mult_half [nrows_A ncols_A ncols_B]
+
+#define NSAMPLES 1024
+
+// Largest acceptable relative RMS difference for a half-precision C,
+// the unit roundoff of half precision
+#define HALF_OUTPUT_TOL 4.8828125e-4
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // Matrix sizes
+    size_t nrows_A=1024;
+    size_t ncols_A=1024;
+    size_t ncols_B=1024;
+    if (argc==4) {
+        nrows_A=(size_t)atol(argv[1]);
+        ncols_A=(size_t)atol(argv[2]);
+        ncols_B=(size_t)atol(argv[3]);
+    }
+    assert(nrows_A>0 && ncols_A>0 && ncols_B>0);
+
+    size_t nrows_B=ncols_A;
+    size_t nrows_C=nrows_A;
+    size_t ncols_C=ncols_B;
+    size_t nrows_A_transp=ncols_A;
+
+    size_t nelements_A=nrows_A*ncols_A;
+    size_t nelements_B=nrows_B*ncols_B;
+    size_t nelements_C=nrows_C*ncols_C;
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // Half arithmetic needs cl_khr_fp16, half storage does not
+    cl_bool have_fp16=h_device_has_extension(device, "cl_khr_fp16");
+    printf("cl_khr_fp16 is %s\n", have_fp16 ? "supported" : "not supported, using vload_half");
+
+    // Make the inputs on the host, rounded to half. 
+    // The reference uses the rounded values so only the multiply is being checked
+    float* array_A_1D=(float*)malloc(nelements_A*sizeof(float));
+    float* array_A_transp_1D=(float*)malloc(nelements_A*sizeof(float));
+    float* array_B_1D=(float*)malloc(nelements_B*sizeof(float));
+    cl_half* array_A_transp_half_1D=(cl_half*)malloc(nelements_A*sizeof(cl_half));
+    cl_half* array_B_half_1D=(cl_half*)malloc(nelements_B*sizeof(cl_half));
+
+    h_fill_uniform_philox(array_A_1D, nrows_A, ncols_A, nrows_A, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows_B, ncols_B, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    // Round A and B to half, then back to float for the reference
+    for (size_t i1=0; i1<ncols_A; i1++) {
+        for (size_t i0=0; i0<nrows_A; i0++) {
+            cl_half value=h_float_to_half(array_A_1D[i1*nrows_A+i0]);
+            array_A_transp_half_1D[i0*nrows_A_transp+i1]=value;
+            array_A_1D[i1*nrows_A+i0]=h_half_to_float(value);
+            array_A_transp_1D[i0*nrows_A_transp+i1]=array_A_1D[i1*nrows_A+i0];
+        }
+    }
+    h_float_to_half_array(array_B_1D, array_B_half_1D, nelements_B);
+    h_half_to_float_array(array_B_half_1D, array_B_1D, nelements_B);
+
+    // Make buffers, A is uploaded already transposed
+    cl_mem buffer_A_transp_half=clCreateBuffer(context, CL_MEM_READ_ONLY, nelements_A*sizeof(cl_half), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp_half");
+    cl_mem buffer_B_half=clCreateBuffer(context, CL_MEM_READ_ONLY, nelements_B*sizeof(cl_half), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_B_half");
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_ONLY, nelements_A*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY, nelements_B*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nelements_C*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+    cl_mem buffer_C_half=clCreateBuffer(context, CL_MEM_READ_WRITE, nelements_C*sizeof(cl_half), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C_half");
+
+    h_errchk(clEnqueueWriteBuffer(command_queue, buffer_A_transp_half, CL_TRUE, 0, nelements_A*sizeof(cl_half),
+                                array_A_transp_half_1D, 0, NULL, NULL), "Writing to buffer_A_transp_half");
+    h_errchk(clEnqueueWriteBuffer(command_queue, buffer_B_half, CL_TRUE, 0, nelements_B*sizeof(cl_half),
+                                array_B_half_1D, 0, NULL, NULL), "Writing to buffer_B_half");
+    h_errchk(clEnqueueWriteBuffer(command_queue, buffer_A_transp, CL_TRUE, 0, nelements_A*sizeof(float),
+                                array_A_transp_1D, 0, NULL, NULL), "Writing to buffer_A_transp");
+    h_errchk(clEnqueueWriteBuffer(command_queue, buffer_B, CL_TRUE, 0, nelements_B*sizeof(float),
+                                array_B_1D, 0, NULL, NULL), "Writing to buffer_B");
+
+    // Build one program that writes C as float and one that writes C as half
+    std::string build_opts=have_fp16 ? "-DHAVE_FP16" : "";
+    cl_program program=h_build_embedded_program(&mat_mult_half_cl, context, device, build_opts.c_str());
+    std::string build_opts_half_output=build_opts+" -DHALF_OUTPUT";
+    cl_program program_half_output=h_build_embedded_program(&mat_mult_half_cl, context, device, build_opts_half_output.c_str());
+
+    cl_kernel kernel_mat_mult_transp=clCreateKernel(program,"mat_mult_transp",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_transp");
+    cl_kernel kernel_mat_mult_transp_half=clCreateKernel(program,"mat_mult_transp_half",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_transp_half");
+    cl_kernel kernel_mat_mult_transp_half_output=clCreateKernel(program_half_output,"mat_mult_transp_half",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_transp_half with half output");
+
+    // All three kernels share the same argument layout
+    cl_int nrows_A_transp_arg=nrows_A_transp, nrows_B_arg=nrows_B, nrows_C_arg=nrows_C;
+    cl_kernel kernels[]={ kernel_mat_mult_transp, kernel_mat_mult_transp_half, kernel_mat_mult_transp_half_output };
+    cl_mem A_buffers[]={ buffer_A_transp, buffer_A_transp_half, buffer_A_transp_half };
+    cl_mem B_buffers[]={ buffer_B, buffer_B_half, buffer_B_half };
+    cl_mem C_buffers[]={ buffer_C, buffer_C, buffer_C_half };
+    const char* names[]={ "float storage", "half storage, float C", "half storage, half C" };
+    const int nkernels=3;
+    cl_double times[nkernels];
+
+    cl_uint work_dim=2;
+    const size_t global_size_mat_mult[]={ nrows_C, ncols_C };
+
+    size_t* sample_rows=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    size_t* sample_cols=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    float* sample_C=(float*)calloc(NSAMPLES, sizeof(float));
+    cl_half* sample_C_half=(cl_half*)calloc(NSAMPLES, sizeof(cl_half));
+    h_sample_coords(nrows_C, ncols_C, NSAMPLES, SEED, sample_rows, sample_cols);
+    h_sample_reader sample_reader=h_create_sample_reader(context, device, nrows_C, NSAMPLES, sample_rows, sample_cols);
+
+    // Largest acceptable relative RMS difference for a float C, allowing for
+    // rounding in a sum of ncols_A products
+    cl_double float_output_tol=16.0*FLT_EPSILON*sqrt((cl_double)ncols_A);
+    int nfailed=0;
+
+    for (int k=0; k<nkernels; k++) {
+        h_errchk(clSetKernelArg(kernels[k], 0, sizeof(cl_mem), &A_buffers[k] ),"setting kernel argument 0");
+        h_errchk(clSetKernelArg(kernels[k], 1, sizeof(cl_mem), &B_buffers[k] ),"setting kernel argument 1");
+        h_errchk(clSetKernelArg(kernels[k], 2, sizeof(cl_mem), &C_buffers[k] ),"setting kernel argument 2");
+        h_errchk(clSetKernelArg(kernels[k], 3, sizeof(cl_int), &nrows_A_transp_arg ),"setting kernel argument 3");
+        h_errchk(clSetKernelArg(kernels[k], 4, sizeof(cl_int), &nrows_B_arg ),"setting kernel argument 4");
+        h_errchk(clSetKernelArg(kernels[k], 5, sizeof(cl_int), &nrows_C_arg ),"setting kernel argument 5");
+
+        cl_event event;
+        h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                        kernels[k],
+                                        work_dim,
+                                        NULL,
+                                        global_size_mat_mult,
+                                        NULL,
+                                        0,
+                                        NULL,
+                                        &event), "Running the multiply kernel");
+        h_errchk(clWaitForEvents(1, &event), "Waiting for the multiply kernel");
+        times[k]=h_get_event_time_ms(event);
+        h_errchk(clReleaseEvent(event), "Releasing the event");
+
+        // Check a sample of C against the reference from the rounded inputs
+        cl_bool half_output=(C_buffers[k]==buffer_C_half) ? CL_TRUE : CL_FALSE;
+        if (half_output) {
+            h_read_samples(command_queue, &sample_reader, C_buffers[k], sizeof(cl_half), sample_C_half);
+            h_half_to_float_array(sample_C_half, sample_C, NSAMPLES);
+        } else {
+            h_read_samples(command_queue, &sample_reader, C_buffers[k], sizeof(float), sample_C);
+        }
+        h_sample_stats stats=h_verify_samples(  array_A_1D, array_B_1D,
+                                                nrows_A, ncols_A,
+                                                NSAMPLES, sample_rows, sample_cols, sample_C,
+                                                1.96);
+
+        cl_double rel_rms=stats.rms_err/stats.rms_ref;
+        cl_double tol=half_output ? HALF_OUTPUT_TOL : float_output_tol;
+        cl_bool passed=(rel_rms<=tol) ? CL_TRUE : CL_FALSE;
+        if (!passed) nfailed++;
+
+        printf("%-24s took %f ms, speedup %fx, relative RMS difference %g (tolerance %g) %s\n",
+                names[k], times[k], times[0]/times[k], rel_rms, tol, passed ? "passed" : "FAILED");
+    }
+
+    // Release buffers, kernels and programs
+    cl_mem buffers[]={  buffer_A_transp_half, buffer_B_half, buffer_A_transp, buffer_B, buffer_C, buffer_C_half };
+    for (size_t n=0; n<sizeof(buffers)/sizeof(cl_mem); n++) {
+        h_errchk(clReleaseMemObject(buffers[n]), "Releasing buffers");
+    }
+    for (int k=0; k<nkernels; k++) {
+        h_errchk(clReleaseKernel(kernels[k]), "Releasing kernels");
+    }
+    h_errchk(clReleaseProgram(program), "Releasing program");
+    h_errchk(clReleaseProgram(program_half_output), "Releasing program_half_output");
+    h_release_sample_reader(&sample_reader);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_A_1D);
+    free(array_A_transp_1D);
+    free(array_B_1D);
+    free(array_A_transp_half_1D);
+    free(array_B_half_1D);
+    free(sample_rows);
+    free(sample_cols);
+    free(sample_C);
+    free(sample_C_half);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d multiplies FAILED their check\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
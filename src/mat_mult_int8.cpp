@@ -0,0 +1,299 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_int8_cl.hpp"
+
+// Quantized matrix multiply with 8-bit A and B, accumulated exactly in int and
+// dequantized to float in the epilogue, moving a quarter of the bytes of the
+// float mat_mult_transp. A is quantized per row and B per column.
+// Usage: mat_mult_int8 [nrows_A ncols_A ncols_B]
+
+#define NSAMPLES 1024
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // Matrix sizes
+    size_t nrows_A=1024;
+    size_t ncols_A=1024;
+    size_t ncols_B=1024;
+    if (argc==4) {
+        nrows_A=(size_t)atol(argv[1]);
+        ncols_A=(size_t)atol(argv[2]);
+        ncols_B=(size_t)atol(argv[3]);
+    }
+    assert(nrows_A>0 && ncols_A>0 && ncols_B>0);
+
+    size_t nrows_B=ncols_A;
+    size_t nrows_C=nrows_A;
+    size_t ncols_C=ncols_B;
+    size_t nrows_A_transp=ncols_A;
+
+    size_t nelements_A=nrows_A*ncols_A;
+    size_t nelements_B=nrows_B*ncols_B;
+    size_t nelements_C=nrows_C*ncols_C;
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // Make the float inputs on the host
+    float* array_A_1D=(float*)malloc(nelements_A*sizeof(float));
+    float* array_B_1D=(float*)malloc(nelements_B*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, nrows_A, ncols_A, nrows_A, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows_B, ncols_B, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    // Quantize A per row and B per column
+    cl_char* array_A_q_1D=(cl_char*)malloc(nelements_A*sizeof(cl_char));
+    cl_char* array_B_q_1D=(cl_char*)malloc(nelements_B*sizeof(cl_char));
+    cl_float* scales_A=(cl_float*)malloc(nrows_A*sizeof(cl_float));
+    cl_int* zeros_A=(cl_int*)malloc(nrows_A*sizeof(cl_int));
+    cl_int* sums_A=(cl_int*)malloc(nrows_A*sizeof(cl_int));
+    cl_float* scales_B=(cl_float*)malloc(ncols_B*sizeof(cl_float));
+    cl_int* zeros_B=(cl_int*)malloc(ncols_B*sizeof(cl_int));
+    cl_int* sums_B=(cl_int*)malloc(ncols_B*sizeof(cl_int));
+
+    h_quantize_int8(array_A_1D, nrows_A, ncols_A, CL_TRUE, array_A_q_1D, scales_A, zeros_A, sums_A);
+    h_quantize_int8(array_B_1D, nrows_B, ncols_B, CL_FALSE, array_B_q_1D, scales_B, zeros_B, sums_B);
+
+    // The kernels read rows of A as columns of A transposed
+    cl_char* array_A_q_transp_1D=(cl_char*)malloc(nelements_A*sizeof(cl_char));
+    float* array_A_transp_1D=(float*)malloc(nelements_A*sizeof(float));
+    for (size_t i1=0; i1<ncols_A; i1++) {
+        for (size_t i0=0; i0<nrows_A; i0++) {
+            array_A_q_transp_1D[i0*nrows_A_transp+i1]=array_A_q_1D[i1*nrows_A+i0];
+            array_A_transp_1D[i0*nrows_A_transp+i1]=array_A_1D[i1*nrows_A+i0];
+        }
+    }
+
+    // Dequantized copies of the inputs, to check the multiply itself
+    float* array_A_dq_1D=(float*)malloc(nelements_A*sizeof(float));
+    float* array_B_dq_1D=(float*)malloc(nelements_B*sizeof(float));
+    h_dequantize_int8(array_A_q_1D, nrows_A, ncols_A, CL_TRUE, scales_A, zeros_A, array_A_dq_1D);
+    h_dequantize_int8(array_B_q_1D, nrows_B, ncols_B, CL_FALSE, scales_B, zeros_B, array_B_dq_1D);
+
+    // Make buffers and copy the quantized data with its parameters
+    cl_mem buffer_A_q_transp=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                            nelements_A*sizeof(cl_char), array_A_q_transp_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A_q_transp");
+    cl_mem buffer_B_q=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nelements_B*sizeof(cl_char), array_B_q_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B_q");
+    cl_mem buffer_scales_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        nrows_A*sizeof(cl_float), scales_A, &errcode);
+    h_errchk(errcode, "Creating buffer_scales_A");
+    cl_mem buffer_zeros_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        nrows_A*sizeof(cl_int), zeros_A, &errcode);
+    h_errchk(errcode, "Creating buffer_zeros_A");
+    cl_mem buffer_sums_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        nrows_A*sizeof(cl_int), sums_A, &errcode);
+    h_errchk(errcode, "Creating buffer_sums_A");
+    cl_mem buffer_scales_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        ncols_B*sizeof(cl_float), scales_B, &errcode);
+    h_errchk(errcode, "Creating buffer_scales_B");
+    cl_mem buffer_zeros_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        ncols_B*sizeof(cl_int), zeros_B, &errcode);
+    h_errchk(errcode, "Creating buffer_zeros_B");
+    cl_mem buffer_sums_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        ncols_B*sizeof(cl_int), sums_B, &errcode);
+    h_errchk(errcode, "Creating buffer_sums_B");
+
+    // Float inputs for the comparison kernel
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                        nelements_A*sizeof(float), array_A_transp_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+                                    nelements_B*sizeof(float), array_B_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nelements_C*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    // The quantized and float kernels from the kernel library
+    cl_program program=h_build_embedded_program(&mat_mult_int8_cl, context, device);
+
+    cl_kernel kernel_mat_mult_transp=clCreateKernel(program,"mat_mult_transp",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_transp");
+    cl_kernel kernel_mat_mult_transp_int8=clCreateKernel(program,"mat_mult_transp_int8",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_transp_int8");
+
+    cl_int nrows_A_transp_arg=nrows_A_transp, nrows_B_arg=nrows_B, nrows_C_arg=nrows_C;
+    cl_uint work_dim=2;
+    const size_t global_size_mat_mult[]={ nrows_C, ncols_C };
+
+    // Run the float kernel first for reference
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 0, sizeof(cl_mem), &buffer_A_transp ),"setting mat_mult_transp argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 1, sizeof(cl_mem), &buffer_B ),"setting mat_mult_transp argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 2, sizeof(cl_mem), &buffer_C ),"setting mat_mult_transp argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 3, sizeof(cl_int), &nrows_A_transp_arg ),"setting mat_mult_transp argument 3");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 4, sizeof(cl_int), &nrows_B_arg ),"setting mat_mult_transp argument 4");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 5, sizeof(cl_int), &nrows_C_arg ),"setting mat_mult_transp argument 5");
+
+    cl_event event_mat_mult_transp;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel_mat_mult_transp,
+                                    work_dim,
+                                    NULL,
+                                    global_size_mat_mult,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event_mat_mult_transp), "Running the mat_mult_transp kernel");
+
+    // Now the quantized kernel, overwriting C
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 0, sizeof(cl_mem), &buffer_A_q_transp ),"setting mat_mult_transp_int8 argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 1, sizeof(cl_mem), &buffer_B_q ),"setting mat_mult_transp_int8 argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 2, sizeof(cl_mem), &buffer_C ),"setting mat_mult_transp_int8 argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 3, sizeof(cl_mem), &buffer_scales_A ),"setting mat_mult_transp_int8 argument 3");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 4, sizeof(cl_mem), &buffer_zeros_A ),"setting mat_mult_transp_int8 argument 4");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 5, sizeof(cl_mem), &buffer_sums_A ),"setting mat_mult_transp_int8 argument 5");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 6, sizeof(cl_mem), &buffer_scales_B ),"setting mat_mult_transp_int8 argument 6");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 7, sizeof(cl_mem), &buffer_zeros_B ),"setting mat_mult_transp_int8 argument 7");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 8, sizeof(cl_mem), &buffer_sums_B ),"setting mat_mult_transp_int8 argument 8");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 9, sizeof(cl_int), &nrows_A_transp_arg ),"setting mat_mult_transp_int8 argument 9");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 10, sizeof(cl_int), &nrows_B_arg ),"setting mat_mult_transp_int8 argument 10");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_int8, 11, sizeof(cl_int), &nrows_C_arg ),"setting mat_mult_transp_int8 argument 11");
+
+    cl_event event_mat_mult_transp_int8;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel_mat_mult_transp_int8,
+                                    work_dim,
+                                    NULL,
+                                    global_size_mat_mult,
+                                    NULL,
+                                    1,
+                                    &event_mat_mult_transp,
+                                    &event_mat_mult_transp_int8), "Running the mat_mult_transp_int8 kernel");
+
+    h_errchk(clFinish(command_queue), "Finishing the multiplies");
+
+    cl_double time_mat_mult_transp=h_get_event_time_ms(event_mat_mult_transp);
+    cl_double time_mat_mult_transp_int8=h_get_event_time_ms(event_mat_mult_transp_int8);
+    printf("Transposed matrix multiply took %f ms\n", time_mat_mult_transp);
+    printf("Quantized transposed matrix multiply took %f ms\n", time_mat_mult_transp_int8);
+    printf("Quantized approach resulted in a speedup of %fx\n", time_mat_mult_transp/time_mat_mult_transp_int8);
+
+    // Verify a sample of the quantized result
+    size_t* sample_rows=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    size_t* sample_cols=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    float* sample_C=(float*)calloc(NSAMPLES, sizeof(float));
+    h_sample_coords(nrows_C, ncols_C, NSAMPLES, SEED, sample_rows, sample_cols);
+    h_sample_reader sample_reader=h_create_sample_reader(context, device, nrows_C, NSAMPLES, sample_rows, sample_cols);
+    h_read_samples(command_queue, &sample_reader, buffer_C, sizeof(float), sample_C);
+
+    // Against the dequantized inputs only float rounding in the epilogue remains
+    h_sample_stats stats_dq=h_verify_samples(   array_A_dq_1D, array_B_dq_1D,
+                                                nrows_A, ncols_A,
+                                                NSAMPLES, sample_rows, sample_cols, sample_C,
+                                                1.96);
+    // Against the original inputs the quantization error shows
+    h_sample_stats stats=h_verify_samples(  array_A_1D, array_B_1D,
+                                            nrows_A, ncols_A,
+                                            NSAMPLES, sample_rows, sample_cols, sample_C,
+                                            1.96);
+
+    // The integer sum is exact, so against the dequantized product only the rounding of the
+    // dequantized inputs and of the epilogue remains, a few epsilon whatever the length
+    int nfailed=0;
+    cl_double rms_ref_dq=(stats_dq.rms_ref>0.0) ? stats_dq.rms_ref : 1.0;
+    if (!h_check_tolerance("Relative RMS difference from the dequantized product", 
+                            stats_dq.rms_err/rms_ref_dq, 16.0*FLT_EPSILON)) nfailed++;
+    printf("Relative RMS difference from the float product is %g (95%% confidence %g to %g)\n", 
+            stats.rms_err/stats.rms_ref, stats.rms_lower/stats.rms_ref, stats.rms_upper/stats.rms_ref);
+
+    // Release events, buffers, kernels and the program
+    h_errchk(clReleaseEvent(event_mat_mult_transp), "Releasing event_mat_mult_transp");
+    h_errchk(clReleaseEvent(event_mat_mult_transp_int8), "Releasing event_mat_mult_transp_int8");
+    cl_mem buffers[]={  buffer_A_q_transp, buffer_B_q, 
+                        buffer_scales_A, buffer_zeros_A, buffer_sums_A,
+                        buffer_scales_B, buffer_zeros_B, buffer_sums_B,
+                        buffer_A_transp, buffer_B, buffer_C };
+    for (size_t n=0; n<sizeof(buffers)/sizeof(cl_mem); n++) {
+        h_errchk(clReleaseMemObject(buffers[n]), "Releasing buffers");
+    }
+    h_errchk(clReleaseKernel(kernel_mat_mult_transp), "Releasing kernel_mat_mult_transp");
+    h_errchk(clReleaseKernel(kernel_mat_mult_transp_int8), "Releasing kernel_mat_mult_transp_int8");
+    h_errchk(clReleaseProgram(program), "Releasing the program");
+    h_release_sample_reader(&sample_reader);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_A_q_1D);
+    free(array_B_q_1D);
+    free(array_A_q_transp_1D);
+    free(array_A_transp_1D);
+    free(array_A_dq_1D);
+    free(array_B_dq_1D);
+    free(scales_A);
+    free(zeros_A);
+    free(sums_A);
+    free(scales_B);
+    free(zeros_B);
+    free(sums_B);
+    free(sample_rows);
+    free(sample_cols);
+    free(sample_C);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("The quantized multiply FAILED its check\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_link.hpp"
+#include "philox.hpp"
+
+// The shared kernel library and the application kernels, from kernels/
+#include "lib_math_cl.hpp"
+#include "lib_reduce_cl.hpp"
+#include "mat_transpose_cl.hpp"
+#include "mat_mult_link_cl.hpp"
+
+// Separate compilation of the kernel library and the application kernels, which are
+// then linked. The first build compiles everything, or loads the library objects from
+// the cache directory. A change to the application, stood in for by a new -D option,
+// then only recompiles the application before linking. The monolithic build of all
+// the source at once is timed for comparison, and the linked program is checked.
+// Usage: mat_mult_link [cache directory]
+
+// Matrix sizes
+#define NROWS_A 512
+#define NCOLS_A 512
+#define NCOLS_B 512
+// Work-group size for the column sums
+#define SUM_LOCAL 256
+
+// Function to compile the application kernels at a revision and link them with the
+// library, reporting the time of each step
+cl_program build_linked(h_program_library* library, int revision, const char* label) {
+    using namespace std::chrono;
+    high_resolution_clock::time_point start=high_resolution_clock::now();
+
+    const h_embedded_program* library_sources[]={ &lib_math_cl, &lib_reduce_cl, &mat_transpose_cl };
+    cl_program objects[4];
+    size_t ncompiled=library->ncompiled, nloaded=library->nloaded, nhits=library->nhits;
+    for (int k=0; k<3; k++) {
+        objects[k]=h_library_object(library, library_sources[k]);
+    }
+    cl_double time_library=h_ms_since(start);
+
+    std::string app_opts="-DAPP_REVISION="+std::to_string(revision);
+    high_resolution_clock::time_point app_start=high_resolution_clock::now();
+    objects[3]=h_compile_program(mat_mult_link_cl.source, library->context, library->device, app_opts.c_str());
+    cl_double time_app=h_ms_since(app_start);
+
+    high_resolution_clock::time_point link_start=high_resolution_clock::now();
+    cl_program program=h_link_program(library->context, library->device, 4, objects);
+    cl_double time_link=h_ms_since(link_start);
+    h_errchk(clReleaseProgram(objects[3]), "Releasing the application object");
+
+    printf("%s:\n", label);
+    printf("\t%-28s %10.3f ms (%zu compiled, %zu loaded, %zu cached)\n", "library objects", time_library,
+            library->ncompiled-ncompiled, library->nloaded-nloaded, library->nhits-nhits);
+    printf("\t%-28s %10.3f ms\n", "application compile", time_app);
+    printf("\t%-28s %10.3f ms\n", "link", time_link);
+    printf("\t%-28s %10.3f ms\n", "total", h_ms_since(start));
+    return program;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    cl_int errcode;
+
+    const char* cache_dir=(argc>1) ? argv[1] : NULL;
+
+    // Select the first device, with an in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_FALSE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // Build with the library, then again after the application changes
+    h_program_library library=h_create_program_library(context, device, cache_dir);
+    cl_program program_first=build_linked(&library, 0, "First build");
+    cl_program program=build_linked(&library, 1, "Rebuild after an application change");
+    h_errchk(clReleaseProgram(program_first), "Releasing the first program");
+
+    // Everything built as one source, as without separate compilation
+    std::string monolithic_source=std::string(lib_math_cl.source)+lib_reduce_cl.source
+                                    +mat_transpose_cl.source+mat_mult_link_cl.source;
+    high_resolution_clock::time_point monolithic_start=high_resolution_clock::now();
+    cl_program program_monolithic=h_build_program(monolithic_source.c_str(), context, device, "-DAPP_REVISION=2");
+    printf("Monolithic build:\n\t%-28s %10.3f ms\n", "total", h_ms_since(monolithic_start));
+    h_errchk(clReleaseProgram(program_monolithic), "Releasing the monolithic program");
+
+    // Run the linked program, transpose A with the library kernel, multiply, and sum the columns of C
+    size_t nrows_A=NROWS_A, ncols_A=NCOLS_A, ncols_B=NCOLS_B;
+    size_t nrows_B=ncols_A, nrows_C=nrows_A, ncols_C=ncols_B, nrows_A_transp=ncols_A;
+    size_t nelements_A=nrows_A*ncols_A, nelements_B=nrows_B*ncols_B, nelements_C=nrows_C*ncols_C;
+
+    float* array_A_1D=(float*)malloc(nelements_A*sizeof(float));
+    float* array_B_1D=(float*)malloc(nelements_B*sizeof(float));
+    float* array_C_1D=(float*)malloc(nelements_C*sizeof(float));
+    float* sums_1D=(float*)malloc(ncols_C*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, nrows_A, ncols_A, nrows_A, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows_B, ncols_B, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nelements_A*sizeof(float), array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_WRITE, nelements_A*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nelements_B*sizeof(float), array_B_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nelements_C*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+    cl_mem buffer_sums=clCreateBuffer(context, CL_MEM_WRITE_ONLY, ncols_C*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_sums");
+
+    cl_kernel kernel_mat_transpose=clCreateKernel(program, "mat_transpose", &errcode);
+    h_errchk(errcode, "Creating Kernel mat_transpose");
+    cl_kernel kernel_mat_mult_transp_lib=clCreateKernel(program, "mat_mult_transp_lib", &errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_transp_lib");
+    cl_kernel kernel_col_sums=clCreateKernel(program, "col_sums", &errcode);
+    h_errchk(errcode, "Creating Kernel col_sums");
+
+    cl_int nrows_A_arg=nrows_A, nrows_A_transp_arg=nrows_A_transp, nrows_B_arg=nrows_B, nrows_C_arg=nrows_C;
+
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 0, sizeof(cl_mem), &buffer_A), "setting mat_transpose argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 1, sizeof(cl_mem), &buffer_A_transp), "setting mat_transpose argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 2, sizeof(cl_int), &nrows_A_arg), "setting mat_transpose argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 3, sizeof(cl_int), &nrows_A_transp_arg), "setting mat_transpose argument 3");
+    const size_t global_size_transpose[]={ nrows_A, ncols_A };
+    h_errchk(clEnqueueNDRangeKernel(command_queue, kernel_mat_transpose, 2, NULL, global_size_transpose, NULL,
+                                    0, NULL, NULL), "Running mat_transpose");
+
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_lib, 0, sizeof(cl_mem), &buffer_A_transp), "setting mat_mult_transp_lib argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_lib, 1, sizeof(cl_mem), &buffer_B), "setting mat_mult_transp_lib argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_lib, 2, sizeof(cl_mem), &buffer_C), "setting mat_mult_transp_lib argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_lib, 3, sizeof(cl_int), &nrows_A_transp_arg), "setting mat_mult_transp_lib argument 3");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_lib, 4, sizeof(cl_int), &nrows_B_arg), "setting mat_mult_transp_lib argument 4");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp_lib, 5, sizeof(cl_int), &nrows_C_arg), "setting mat_mult_transp_lib argument 5");
+    const size_t global_size_mult[]={ nrows_C, ncols_C };
+    h_errchk(clEnqueueNDRangeKernel(command_queue, kernel_mat_mult_transp_lib, 2, NULL, global_size_mult, NULL,
+                                    0, NULL, NULL), "Running mat_mult_transp_lib");
+
+    // Shrink the work-group for the column sums if the kernel can't run it
+    size_t sum_local=SUM_LOCAL, max_local;
+    h_errchk(clGetKernelWorkGroupInfo(  kernel_col_sums,
+                                        device,
+                                        CL_KERNEL_WORK_GROUP_SIZE,
+                                        sizeof(size_t),
+                                        &max_local,
+                                        NULL), "Getting the col_sums work-group size");
+    while (sum_local>max_local) sum_local/=2;
+    h_errchk(clSetKernelArg(kernel_col_sums, 0, sizeof(cl_mem), &buffer_C), "setting col_sums argument 0");
+    h_errchk(clSetKernelArg(kernel_col_sums, 1, sizeof(cl_mem), &buffer_sums), "setting col_sums argument 1");
+    h_errchk(clSetKernelArg(kernel_col_sums, 2, sizeof(cl_int), &nrows_C_arg), "setting col_sums argument 2");
+    h_errchk(clSetKernelArg(kernel_col_sums, 3, sum_local*sizeof(float), NULL), "setting col_sums argument 3");
+    const size_t global_size_sums[]={ ncols_C*sum_local };
+    const size_t local_size_sums[]={ sum_local };
+    h_errchk(clEnqueueNDRangeKernel(command_queue, kernel_col_sums, 1, NULL, global_size_sums, local_size_sums,
+                                    0, NULL, NULL), "Running col_sums");
+
+    h_errchk(clEnqueueReadBuffer(command_queue, buffer_C, CL_TRUE, 0, nelements_C*sizeof(float), array_C_1D,
+                                0, NULL, NULL), "Reading buffer_C");
+    h_errchk(clEnqueueReadBuffer(command_queue, buffer_sums, CL_TRUE, 0, ncols_C*sizeof(float), sums_1D,
+                                0, NULL, NULL), "Reading buffer_sums");
+
+    // Check C, and the column sums against the sums of the C that came back,
+    // relative to the largest magnitudes
+    double max_diff_C=0.0, max_diff_sums=0.0, max_C=0.0, max_sums=0.0;
+    for (size_t i1=0; i1<ncols_C; i1++) {
+        double col_sum=0.0;
+        for (size_t i0=0; i0<nrows_C; i0++) {
+            double temp=0.0;
+            for (size_t n=0; n<nrows_B; n++) {
+                temp+=(double)array_A_1D[n*nrows_A+i0]*(double)array_B_1D[i1*nrows_B+n];
+            }
+            max_diff_C=fmax(max_diff_C, fabs(array_C_1D[i1*nrows_C+i0]-temp));
+            max_C=fmax(max_C, fabs(temp));
+            col_sum+=array_C_1D[i1*nrows_C+i0];
+        }
+        max_diff_sums=fmax(max_diff_sums, fabs(sums_1D[i1]-col_sum));
+        max_sums=fmax(max_sums, fabs(col_sum));
+    }
+    if (max_C==0.0) max_C=1.0;
+    if (max_sums==0.0) max_sums=1.0;
+
+    // Errors usually grow as sqrt(K)*epsilon over a sum of K terms, K*epsilon bounds them
+    int nfailed=0;
+    if (!h_check_tolerance("Relative difference in C", max_diff_C/max_C, nrows_B*FLT_EPSILON)) nfailed++;
+    if (!h_check_tolerance("Relative difference in the column sums", max_diff_sums/max_sums,
+                            nrows_C*FLT_EPSILON)) nfailed++;
+
+    h_errchk(clReleaseKernel(kernel_mat_transpose), "Releasing kernel_mat_transpose");
+    h_errchk(clReleaseKernel(kernel_mat_mult_transp_lib), "Releasing kernel_mat_mult_transp_lib");
+    h_errchk(clReleaseKernel(kernel_col_sums), "Releasing kernel_col_sums");
+    h_errchk(clReleaseProgram(program), "Releasing the program");
+    h_release_program_library(&library);
+
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_A_transp), "Releasing buffer_A_transp");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseMemObject(buffer_sums), "Releasing buffer_sums");
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_C_1D);
+    free(sums_1D);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d checks FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
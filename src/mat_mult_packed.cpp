@@ -0,0 +1,268 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+
+// Many multiplies C=A*op(W) against the same weights W, stored transposed as N x K.
+// The usual approach uploads W and transposes it on the fly for every multiply,
+// the packed approach packs op(W) into tiles on the device once and reuses the handle.
+// Usage: mat_mult_packed [M K N]
+
+#define NSAMPLES 1024
+// Number of multiplies, each with a fresh A
+#define NITERATIONS 20
+
+// Function to multiply by a packed W whose sizes are not multiples of the tile,
+// so the edge tiles must be zero filled, and check every element of C on the host.
+// Returns the largest difference relative to the largest magnitude in C
+cl_double packed_edge_error(  cl_command_queue command_queue,
+                              cl_context context,
+                              h_gemm_plan* plan,
+                              size_t M,
+                              size_t K,
+                              size_t N) {
+    cl_int errcode;
+    float* array_A_1D=(float*)malloc(M*K*sizeof(float));
+    float* array_W_1D=(float*)malloc(N*K*sizeof(float));
+    float* array_C_1D=(float*)malloc(M*N*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, M, K, M, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_W_1D, N, K, N, SEED, 1, -1.0f, 1.0f);
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, M*K*sizeof(float), array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_W=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N*K*sizeof(float), array_W_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_W");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, M*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    h_packed_operand W_packed=h_pack_operand(   command_queue, context, plan,
+                                                H_COL_MAJOR, H_OPERAND_B, H_TRANS,
+                                                N, K, buffer_W, 0, N);
+    cl_event event_gemm=h_enqueue_sgemm_packed_B(   command_queue, plan, H_COL_MAJOR, H_NO_TRANS,
+                                                    M, N, K,
+                                                    1.0f, buffer_A, 0, M, &W_packed,
+                                                    0.0f, buffer_C, 0, M,
+                                                    0, NULL);
+    h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, M*N*sizeof(float), array_C_1D,
+                                    1, &event_gemm, NULL), "Reading buffer_C");
+    h_errchk(clReleaseEvent(event_gemm), "Releasing event_gemm");
+
+    // C=A*W^T, where W is N x K
+    double max_diff=0.0, max_C=0.0;
+    for (size_t j=0; j<N; j++) {
+        for (size_t i=0; i<M; i++) {
+            double temp=0.0;
+            for (size_t k=0; k<K; k++) {
+                temp+=(double)array_A_1D[k*M+i]*(double)array_W_1D[k*N+j];
+            }
+            max_diff=fmax(max_diff, fabs(array_C_1D[j*M+i]-temp));
+            max_C=fmax(max_C, fabs(temp));
+        }
+    }
+
+    h_release_packed_operand(&W_packed);
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_W), "Releasing buffer_W");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    free(array_A_1D);
+    free(array_W_1D);
+    free(array_C_1D);
+    return max_diff/((max_C>0.0) ? max_C : 1.0);
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // A is M x K, W is N x K and C is M x N
+    size_t M=256;
+    size_t K=1024;
+    size_t N=1024;
+    if (argc==4) {
+        M=(size_t)atol(argv[1]);
+        K=(size_t)atol(argv[2]);
+        N=(size_t)atol(argv[3]);
+    }
+    assert(M>0 && K>0 && N>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_gemm_plan plan=h_create_gemm_plan(context, device);
+
+    // A fresh A for every multiply comes from the generator on the device
+    cl_program program_philox=h_build_program(philox_kernel_source, context, device);
+    cl_kernel kernel_fill=clCreateKernel(program_philox, "fill_uniform_philox", &errcode);
+    h_errchk(errcode, "Creating Kernel fill_uniform_philox");
+
+    // The weights on the host
+    float* array_W_1D=(float*)malloc(N*K*sizeof(float));
+    h_fill_uniform_philox(array_W_1D, N, K, N, SEED, 0, -1.0f, 1.0f);
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_WRITE, M*K*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_W=clCreateBuffer(context, CL_MEM_READ_ONLY, N*K*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_W");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, M*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    // The usual approach, upload and transpose W for every multiply
+    cl_double time_gemm=0.0;
+    high_resolution_clock::time_point time_usual1 = high_resolution_clock::now();
+    for (int n=0; n<NITERATIONS; n++) {
+        cl_event event_fill=h_enqueue_fill_uniform_philox(command_queue, kernel_fill, buffer_A, M, K, M, SEED, n+1, -1.0f, 1.0f);
+        h_errchk(clEnqueueWriteBuffer(  command_queue, buffer_W, CL_FALSE, 0, N*K*sizeof(float), 
+                                        array_W_1D, 0, NULL, NULL), "Writing to buffer_W from host");
+        cl_event event_gemm=h_enqueue_sgemm(command_queue, &plan, H_COL_MAJOR, H_NO_TRANS, H_TRANS,
+                                            M, N, K,
+                                            1.0f, buffer_A, 0, M, buffer_W, 0, N,
+                                            0.0f, buffer_C, 0, M,
+                                            1, &event_fill);
+        h_errchk(clWaitForEvents(1, &event_gemm), "Waiting for the multiply");
+        time_gemm+=h_get_event_time_ms(event_gemm);
+        h_errchk(clReleaseEvent(event_fill), "Releasing event_fill");
+        h_errchk(clReleaseEvent(event_gemm), "Releasing event_gemm");
+    }
+    high_resolution_clock::time_point time_usual2 = high_resolution_clock::now();
+
+    // The packed approach, upload and pack W once
+    cl_double time_gemm_packed=0.0;
+    high_resolution_clock::time_point time_packed1 = high_resolution_clock::now();
+    h_errchk(clEnqueueWriteBuffer(  command_queue, buffer_W, CL_TRUE, 0, N*K*sizeof(float), 
+                                    array_W_1D, 0, NULL, NULL), "Writing to buffer_W from host");
+    h_packed_operand W_packed=h_pack_operand(   command_queue, context, &plan,
+                                                H_COL_MAJOR, H_OPERAND_B, H_TRANS,
+                                                N, K, buffer_W, 0, N);
+    for (int n=0; n<NITERATIONS; n++) {
+        cl_event event_fill=h_enqueue_fill_uniform_philox(command_queue, kernel_fill, buffer_A, M, K, M, SEED, n+1, -1.0f, 1.0f);
+        cl_event event_gemm=h_enqueue_sgemm_packed_B(   command_queue, &plan, H_COL_MAJOR, H_NO_TRANS,
+                                                        M, N, K,
+                                                        1.0f, buffer_A, 0, M, &W_packed,
+                                                        0.0f, buffer_C, 0, M,
+                                                        1, &event_fill);
+        h_errchk(clWaitForEvents(1, &event_gemm), "Waiting for the multiply");
+        time_gemm_packed+=h_get_event_time_ms(event_gemm);
+        h_errchk(clReleaseEvent(event_fill), "Releasing event_fill");
+        h_errchk(clReleaseEvent(event_gemm), "Releasing event_gemm");
+    }
+    high_resolution_clock::time_point time_packed2 = high_resolution_clock::now();
+
+    cl_double time_usual=duration_cast<duration<double>>(time_usual2-time_usual1).count()*1.0e3;
+    cl_double time_packed=duration_cast<duration<double>>(time_packed2-time_packed1).count()*1.0e3;
+    printf("%d multiplies uploading W every time took %f ms, %f ms in the kernel\n", 
+            NITERATIONS, time_usual, time_gemm);
+    printf("%d multiplies with W packed once took %f ms, %f ms in the kernel\n", 
+            NITERATIONS, time_packed, time_gemm_packed);
+    printf("Packing resulted in a speedup of %fx\n", time_usual/time_packed);
+
+    // Check the last product, op(W) is W transposed
+    float* array_A_1D=(float*)malloc(M*K*sizeof(float));
+    float* array_W_transp_1D=(float*)malloc(K*N*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, M, K, M, SEED, NITERATIONS, -1.0f, 1.0f);
+    for (size_t i1=0; i1<K; i1++) {
+        for (size_t i0=0; i0<N; i0++) {
+            array_W_transp_1D[i0*K+i1]=array_W_1D[i1*N+i0];
+        }
+    }
+
+    size_t* sample_rows=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    size_t* sample_cols=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    float* sample_C=(float*)calloc(NSAMPLES, sizeof(float));
+    h_sample_coords(M, N, NSAMPLES, SEED, sample_rows, sample_cols);
+    h_sample_reader sample_reader=h_create_sample_reader(context, device, M, NSAMPLES, sample_rows, sample_cols);
+    h_read_samples(command_queue, &sample_reader, buffer_C, sizeof(float), sample_C);
+    h_sample_stats stats=h_verify_samples(  array_A_1D, array_W_transp_1D, M, K,
+                                            NSAMPLES, sample_rows, sample_cols, sample_C,
+                                            1.96);
+    // Errors usually grow as sqrt(K)*epsilon over a dot product of length K, K*epsilon bounds them
+    int nfailed=0;
+    cl_double rms_ref=(stats.rms_ref>0.0) ? stats.rms_ref : 1.0;
+    if (!h_check_tolerance("Sampled relative RMS difference", stats.rms_err/rms_ref, 
+                            (cl_double)K*FLT_EPSILON)) nfailed++;
+
+    // Sizes that leave partial tiles, which packing has to fill with zeros
+    size_t M_edge=37, K_edge=75, N_edge=53;
+    if (!h_check_tolerance("Largest relative difference with partial tiles", 
+                            packed_edge_error(command_queue, context, &plan, M_edge, K_edge, N_edge),
+                            (cl_double)K_edge*FLT_EPSILON)) nfailed++;
+
+    // Release the packed operand, buffers, kernels and programs
+    h_release_packed_operand(&W_packed);
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_W), "Releasing buffer_W");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseKernel(kernel_fill), "Releasing kernel_fill");
+    h_errchk(clReleaseProgram(program_philox), "Releasing program_philox");
+    h_release_gemm_plan(&plan);
+    h_release_sample_reader(&sample_reader);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_W_1D);
+    free(array_A_1D);
+    free(array_W_transp_1D);
+    free(sample_rows);
+    free(sample_cols);
+    free(sample_C);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d checks FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
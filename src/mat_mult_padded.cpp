@@ -0,0 +1,299 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_padded_cl.hpp"
+
+// Benchmark of densely packed against padded leading dimensions at power-of-two sizes.
+// With a stride of exactly nrows, the strided accesses of mat_transpose and mat_mult
+// keep landing on the same cache sets and memory channels. The padded layout
+// is chosen per device with h_padded_ld and uploaded with clEnqueueWriteBufferRect.
+// Usage: mat_mult_padded [n1 n2 ...] for square matrices of each size
+
+// Each kernel runs this many times and the fastest run is kept
+#define NREPEATS 3
+// Elements of C checked against dot products on the host
+#define NSAMPLES 1024
+
+// Function to time the kernels on n x n matrices with leading dimension ld and check
+// each one, the transpose exactly and the multiplies on a sample of C against the host.
+// Leaves the gemm_tiled C densely packed on the host in array_C_1D, and returns the 
+// number of kernels that failed, with passed set for each
+int run_layout(
+        cl_command_queue command_queue,
+        cl_context context,
+        cl_device_id device,
+        cl_kernel kernel_mat_transpose,
+        cl_kernel kernel_mat_mult,
+        h_gemm_plan* plan,
+        size_t n,
+        size_t ld,
+        const float* array_A_1D,
+        const float* array_B_1D,
+        const size_t* sample_rows,
+        const size_t* sample_cols,
+        float* array_C_1D,
+        cl_double* times,
+        cl_bool* passed) {
+
+    cl_int errcode;
+    size_t nbytes=ld*n*sizeof(float);
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    // Each multiply writes its own C, so both can be checked
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+    cl_mem buffer_C_gemm=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C_gemm");
+
+    // Upload the densely packed inputs into the padded layout
+    h_write_padded(command_queue, buffer_A, ld, array_A_1D, n, n, sizeof(float));
+    h_write_padded(command_queue, buffer_B, ld, array_B_1D, n, n, sizeof(float));
+
+    cl_int n_arg=n, ld_arg=ld;
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 0, sizeof(cl_mem), &buffer_A ),"setting mat_transpose argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 1, sizeof(cl_mem), &buffer_A_transp ),"setting mat_transpose argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 2, sizeof(cl_int), &ld_arg ),"setting mat_transpose argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 3, sizeof(cl_int), &ld_arg ),"setting mat_transpose argument 3");
+
+    h_errchk(clSetKernelArg(kernel_mat_mult, 0, sizeof(cl_mem), &buffer_A ),"setting mat_mult argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_mult, 1, sizeof(cl_mem), &buffer_B ),"setting mat_mult argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_mult, 2, sizeof(cl_mem), &buffer_C ),"setting mat_mult argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_mult, 3, sizeof(cl_int), &n_arg ),"setting mat_mult argument 3");
+    h_errchk(clSetKernelArg(kernel_mat_mult, 4, sizeof(cl_int), &ld_arg ),"setting mat_mult argument 4");
+    h_errchk(clSetKernelArg(kernel_mat_mult, 5, sizeof(cl_int), &ld_arg ),"setting mat_mult argument 5");
+    h_errchk(clSetKernelArg(kernel_mat_mult, 6, sizeof(cl_int), &ld_arg ),"setting mat_mult argument 6");
+
+    const size_t global_size[]={ n, n };
+    for (int k=0; k<3; k++) times[k]=INFINITY;
+
+    for (int r=0; r<NREPEATS; r++) {
+        cl_event events[3];
+        h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                        kernel_mat_transpose,
+                                        2,
+                                        NULL,
+                                        global_size,
+                                        NULL,
+                                        0,
+                                        NULL,
+                                        &events[0]), "Running the transpose kernel");
+        h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                        kernel_mat_mult,
+                                        2,
+                                        NULL,
+                                        global_size,
+                                        NULL,
+                                        0,
+                                        NULL,
+                                        &events[1]), "Running the mat_mult kernel");
+        events[2]=h_enqueue_sgemm(  command_queue, plan, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                    n, n, n,
+                                    1.0f, buffer_A, 0, ld, buffer_B, 0, ld,
+                                    0.0f, buffer_C_gemm, 0, ld,
+                                    0, NULL);
+        h_errchk(clFinish(command_queue), "Finishing the kernels");
+
+        for (int k=0; k<3; k++) {
+            times[k]=fmin(times[k], h_get_event_time_ms(events[k]));
+            h_errchk(clReleaseEvent(events[k]), "Releasing events");
+        }
+    }
+
+    // The transpose only moves elements, so it must match exactly
+    float* array_A_transp_1D=(float*)malloc(n*n*sizeof(float));
+    h_read_padded(command_queue, buffer_A_transp, ld, array_A_transp_1D, n, n, sizeof(float));
+    size_t nwrong=0;
+    for (size_t i1=0; i1<n; i1++) {
+        for (size_t i0=0; i0<n; i0++) {
+            if (array_A_transp_1D[i0*n+i1]!=array_A_1D[i1*n+i0]) nwrong++;
+        }
+    }
+    passed[0]=(nwrong==0) ? CL_TRUE : CL_FALSE;
+    free(array_A_transp_1D);
+
+    // Errors usually grow as sqrt(n)*epsilon over a dot product of length n, n*epsilon bounds them
+    h_sample_reader sample_reader=h_create_sample_reader(context, device, ld, NSAMPLES, sample_rows, sample_cols);
+    float* sample_C=(float*)malloc(NSAMPLES*sizeof(float));
+    cl_mem C_buffers[]={ buffer_C, buffer_C_gemm };
+    for (int k=1; k<3; k++) {
+        h_read_samples(command_queue, &sample_reader, C_buffers[k-1], sizeof(float), sample_C);
+        h_sample_stats stats=h_verify_samples(  array_A_1D, array_B_1D, n, n,
+                                                NSAMPLES, sample_rows, sample_cols, sample_C,
+                                                1.96);
+        cl_double rms_ref=(stats.rms_ref>0.0) ? stats.rms_ref : 1.0;
+        passed[k]=(stats.rms_err/rms_ref<=(cl_double)n*FLT_EPSILON) ? CL_TRUE : CL_FALSE;
+    }
+    h_release_sample_reader(&sample_reader);
+    free(sample_C);
+
+    h_read_padded(command_queue, buffer_C_gemm, ld, array_C_1D, n, n, sizeof(float));
+
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_A_transp), "Releasing buffer_A_transp");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseMemObject(buffer_C_gemm), "Releasing buffer_C_gemm");
+
+    int nfailed=0;
+    for (int k=0; k<3; k++) {
+        if (!passed[k]) nfailed++;
+    }
+    return nfailed;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // Power-of-two sizes unless given on the command line
+    size_t default_sizes[]={ 512, 1024, 2048 };
+    size_t nsizes=sizeof(default_sizes)/sizeof(size_t);
+    size_t* sizes=default_sizes;
+    if (argc>1) {
+        nsizes=argc-1;
+        sizes=(size_t*)calloc(nsizes, sizeof(size_t));
+        for (size_t s=0; s<nsizes; s++) {
+            sizes[s]=(size_t)atol(argv[s+1]);
+            assert(sizes[s]>0);
+        }
+    }
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // The library transpose and the multiply with leading dimensions
+    cl_program program=h_build_embedded_program(&mat_mult_padded_cl, context, device);
+    cl_kernel kernel_mat_transpose=clCreateKernel(program,"mat_transpose",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_transpose");
+    cl_kernel kernel_mat_mult=clCreateKernel(program,"mat_mult_ld",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_ld");
+
+    h_gemm_plan plan=h_create_gemm_plan(context, device);
+
+    const char* kernel_names[]={ "mat_transpose", "mat_mult_ld", "gemm_tiled" };
+    int nfailed=0;
+    printf("%6s %6s %14s %12s %12s %8s %8s\n", "n", "ld", "kernel", "dense (ms)", "padded (ms)", "speedup", "check");
+
+    for (size_t s=0; s<nsizes; s++) {
+        size_t n=sizes[s];
+        size_t ld=h_padded_ld(device, n, sizeof(float));
+
+        float* array_A_1D=(float*)malloc(n*n*sizeof(float));
+        float* array_B_1D=(float*)malloc(n*n*sizeof(float));
+        float* array_C_dense_1D=(float*)malloc(n*n*sizeof(float));
+        float* array_C_padded_1D=(float*)malloc(n*n*sizeof(float));
+        h_fill_uniform_philox(array_A_1D, n, n, n, SEED, 0, -1.0f, 1.0f);
+        h_fill_uniform_philox(array_B_1D, n, n, n, SEED, 1, -1.0f, 1.0f);
+        size_t* sample_rows=(size_t*)malloc(NSAMPLES*sizeof(size_t));
+        size_t* sample_cols=(size_t*)malloc(NSAMPLES*sizeof(size_t));
+        h_sample_coords(n, n, NSAMPLES, SEED, sample_rows, sample_cols);
+
+        cl_double times_dense[3], times_padded[3];
+        cl_bool passed_dense[3], passed_padded[3];
+        nfailed+=run_layout(command_queue, context, device, kernel_mat_transpose, kernel_mat_mult, &plan,
+                            n, n, array_A_1D, array_B_1D, sample_rows, sample_cols, 
+                            array_C_dense_1D, times_dense, passed_dense);
+        nfailed+=run_layout(command_queue, context, device, kernel_mat_transpose, kernel_mat_mult, &plan,
+                            n, ld, array_A_1D, array_B_1D, sample_rows, sample_cols, 
+                            array_C_padded_1D, times_padded, passed_padded);
+
+        for (int k=0; k<3; k++) {
+            printf("%6zu %6zu %14s %12f %12f %7.2fx %8s\n", 
+                    n, ld, kernel_names[k], times_dense[k], times_padded[k], times_dense[k]/times_padded[k],
+                    (passed_dense[k] && passed_padded[k]) ? "passed" : "FAILED");
+        }
+
+        // Padding changes where elements live, not how they are summed, so the two must agree exactly
+        size_t ndiffer=0;
+        for (size_t i=0; i<n*n; i++) {
+            if (array_C_dense_1D[i]!=array_C_padded_1D[i]) ndiffer++;
+        }
+        if (ndiffer>0) {
+            printf("Dense and padded gemm_tiled C differ in %zu elements, FAILED\n", ndiffer);
+            nfailed++;
+        }
+
+        free(sample_rows);
+        free(sample_cols);
+        free(array_A_1D);
+        free(array_B_1D);
+        free(array_C_dense_1D);
+        free(array_C_padded_1D);
+    }
+
+    // Release the kernels, program and GEMM plan
+    h_errchk(clReleaseKernel(kernel_mat_transpose), "Releasing kernel_mat_transpose");
+    h_errchk(clReleaseKernel(kernel_mat_mult), "Releasing kernel_mat_mult");
+    h_errchk(clReleaseProgram(program), "Releasing the program");
+    h_release_gemm_plan(&plan);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    if (sizes!=default_sizes) free(sizes);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d checks FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
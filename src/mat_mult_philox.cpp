@@ -0,0 +1,250 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_transpose_cl.hpp"
+
+// Matrix multiply at any size with inputs generated on the device by the 
+// Philox counter-based generator, so no input or answer files are needed.
+// Usage: mat_mult_philox [nrows_A ncols_A ncols_B]
+
+#define NSAMPLES 1024
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // Matrix sizes, deliberately not square by default
+    size_t nrows_A=1000;
+    size_t ncols_A=1500;
+    size_t ncols_B=700;
+    if (argc==4) {
+        nrows_A=(size_t)atol(argv[1]);
+        ncols_A=(size_t)atol(argv[2]);
+        ncols_B=(size_t)atol(argv[3]);
+    }
+    assert(nrows_A>0 && ncols_A>0 && ncols_B>0);
+
+    size_t nrows_B=ncols_A;
+    size_t nrows_C=nrows_A;
+    size_t ncols_C=ncols_B;
+
+    // Dimensions of A transposed
+    size_t nrows_A_transp=ncols_A;
+
+    size_t element_size=sizeof(float);
+    size_t nbytes_A=nrows_A*ncols_A*element_size;
+    size_t nbytes_B=nrows_B*ncols_B*element_size;
+    size_t nbytes_C=nrows_C*ncols_C*element_size;
+
+    printf("Multiplying A (%zu x %zu) by B (%zu x %zu)\n", nrows_A, ncols_A, nrows_B, ncols_B);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // Make buffers for the matrices
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_A, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_A, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_B, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_C, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    // The generator is built on its own, the transpose and multiply
+    // kernels come from the kernel library
+    cl_program program_philox=h_build_program(philox_kernel_source, context, device);
+    cl_program program=h_build_embedded_program(&mat_mult_transpose_cl, context, device);
+
+    // Create kernels from the built program
+    cl_kernel kernel_fill=clCreateKernel(program_philox,"fill_uniform_philox",&errcode);
+    h_errchk(errcode, "Creating Kernel fill_uniform_philox");
+    cl_kernel kernel_mat_transpose=clCreateKernel(program,"mat_transpose",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_transpose");
+    cl_kernel kernel_mat_mult_transp=clCreateKernel(program,"mat_mult_transp",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mult_transp");
+
+    // Generate A and B directly on the device
+    cl_event event_fill_A=h_enqueue_fill_uniform_philox(command_queue, kernel_fill, buffer_A,
+                                                        nrows_A, ncols_A, nrows_A, SEED, 0, -1.0f, 1.0f);
+    cl_event event_fill_B=h_enqueue_fill_uniform_philox(command_queue, kernel_fill, buffer_B,
+                                                        nrows_B, ncols_B, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    // Set arguments to the transpose kernel
+    cl_int nrows_A_arg=nrows_A, nrows_A_transp_arg=nrows_A_transp;
+    cl_int nrows_B_arg=nrows_B, nrows_C_arg=nrows_C;
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 0, sizeof(cl_mem), &buffer_A ),"setting mat_transpose argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 1, sizeof(cl_mem), &buffer_A_transp ),"setting mat_transpose argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 2, sizeof(cl_int), &nrows_A_arg ),"setting mat_transpose argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_transpose, 3, sizeof(cl_int), &nrows_A_transp_arg ),"setting mat_transpose argument 3");
+
+    cl_uint work_dim=2;
+    const size_t global_size_mat_transpose[]={ nrows_A, ncols_A };
+    cl_event event_mat_transpose;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel_mat_transpose,
+                                    work_dim,
+                                    NULL,
+                                    global_size_mat_transpose,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event_mat_transpose), "Running the transpose kernel");
+
+    // Set arguments for the multiply kernel with transpose
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 0, sizeof(cl_mem), &buffer_A_transp ),"setting mat_mult_transp argument 0");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 1, sizeof(cl_mem), &buffer_B ),"setting mat_mult_transp argument 1");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 2, sizeof(cl_mem), &buffer_C ),"setting mat_mult_transp argument 2");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 3, sizeof(cl_int), &nrows_A_transp_arg ),"setting mat_mult_transp argument 3");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 4, sizeof(cl_int), &nrows_B_arg ),"setting mat_mult_transp argument 4");
+    h_errchk(clSetKernelArg(kernel_mat_mult_transp, 5, sizeof(cl_int), &nrows_C_arg ),"setting mat_mult_transp argument 5");
+
+    const size_t global_size_mat_mult[]={ nrows_C, ncols_C };
+    cl_event event_mat_mult_transp;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel_mat_mult_transp,
+                                    work_dim,
+                                    NULL,
+                                    global_size_mat_mult,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event_mat_mult_transp), "Running the mat_mult_transp kernel");
+
+    h_errchk(clFinish(command_queue), "Finishing the multiply");
+
+    printf("Generating A took %f ms\n", h_get_event_time_ms(event_fill_A));
+    printf("Generating B took %f ms\n", h_get_event_time_ms(event_fill_B));
+    printf("Matrix transpose took %f ms\n", h_get_event_time_ms(event_mat_transpose));
+    printf("Transposed matrix multiply took %f ms\n", h_get_event_time_ms(event_mat_mult_transp));
+
+    // Make the same matrices on the host for verification
+    float* array_A_1D=(float*)malloc(nbytes_A);
+    float* array_B_1D=(float*)malloc(nbytes_B);
+    float* array_check_1D=(float*)malloc(nbytes_A>nbytes_B ? nbytes_A : nbytes_B);
+    h_fill_uniform_philox(array_A_1D, nrows_A, ncols_A, nrows_A, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows_B, ncols_B, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    // The device and host generators must agree bit for bit
+    h_errchk(clEnqueueReadBuffer(command_queue, buffer_A, CL_TRUE, 0, nbytes_A, array_check_1D,
+                                0, NULL, NULL), "Reading buffer_A");
+    int mismatch_A=memcmp(array_check_1D, array_A_1D, nbytes_A);
+    h_errchk(clEnqueueReadBuffer(command_queue, buffer_B, CL_TRUE, 0, nbytes_B, array_check_1D,
+                                0, NULL, NULL), "Reading buffer_B");
+    int mismatch_B=memcmp(array_check_1D, array_B_1D, nbytes_B);
+    printf("Device generated A %s the host, B %s the host\n", 
+            mismatch_A==0 ? "matches" : "DIFFERS FROM", 
+            mismatch_B==0 ? "matches" : "DIFFERS FROM");
+    int nfailed=0;
+    if (mismatch_A!=0) nfailed++;
+    if (mismatch_B!=0) nfailed++;
+
+    // Verify a sample of C against dot products computed on the host
+    size_t* sample_rows=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    size_t* sample_cols=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    float* sample_C=(float*)calloc(NSAMPLES, sizeof(float));
+
+    h_sample_coords(nrows_C, ncols_C, NSAMPLES, SEED, sample_rows, sample_cols);
+    h_sample_reader sample_reader=h_create_sample_reader(context, device, nrows_C, NSAMPLES, sample_rows, sample_cols);
+    h_read_samples(command_queue, &sample_reader, buffer_C, element_size, sample_C);
+    h_sample_stats stats=h_verify_samples(  array_A_1D, array_B_1D, 
+                                            nrows_A, ncols_A,
+                                            NSAMPLES, sample_rows, sample_cols, sample_C,
+                                            1.96);
+
+    printf("Sampled RMS difference is %g (95%% confidence %g to %g) from %zu samples, largest %g\n",
+            stats.rms_err, stats.rms_lower, stats.rms_upper, stats.nsamples, stats.max_abs_err);
+
+    // Errors usually grow as sqrt(K)*epsilon over a dot product of length K, K*epsilon bounds them
+    cl_double rms_ref=(stats.rms_ref>0.0) ? stats.rms_ref : 1.0;
+    if (!h_check_tolerance("Sampled relative RMS difference", stats.rms_err/rms_ref, 
+                            (cl_double)ncols_A*FLT_EPSILON)) nfailed++;
+
+    // Release events, buffers, kernels and the program
+    h_errchk(clReleaseEvent(event_fill_A), "Releasing event_fill_A");
+    h_errchk(clReleaseEvent(event_fill_B), "Releasing event_fill_B");
+    h_errchk(clReleaseEvent(event_mat_transpose), "Releasing event_mat_transpose");
+    h_errchk(clReleaseEvent(event_mat_mult_transp), "Releasing event_mat_mult_transp");
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_A_transp), "Releasing buffer_A_transp");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseKernel(kernel_fill), "Releasing kernel_fill");
+    h_errchk(clReleaseKernel(kernel_mat_transpose), "Releasing kernel_mat_transpose");
+    h_errchk(clReleaseKernel(kernel_mat_mult_transp), "Releasing kernel_mat_mult_transp");
+    h_errchk(clReleaseProgram(program_philox), "Releasing program_philox");
+    h_errchk(clReleaseProgram(program), "Releasing the program");
+    h_release_sample_reader(&sample_reader);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_check_1D);
+    free(sample_rows);
+    free(sample_cols);
+    free(sample_C);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d checks FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,258 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "philox.hpp"
+
+// Multiply sub-matrices of larger matrices in place with h_enqueue_sgemm, 
+// C_sub=alpha*A_sub*B_sub+beta*C_sub, and compare with copying the sub-matrices 
+// out with clEnqueueCopyBufferRect, multiplying, and copying the result back.
+
+// Function to copy a rectangular region between column-major matrices on the device
+cl_event copy_rect(   cl_command_queue command_queue,
+                        cl_mem src, size_t ld_src, size_t row_src, size_t col_src,
+                        cl_mem dest, size_t ld_dest, size_t row_dest, size_t col_dest,
+                        size_t nrows, size_t ncols,
+                        cl_uint num_events_in_wait_list, const cl_event* event_wait_list) {
+    // Origins and region are (nbytes, ncolumns, nslices)
+    size_t src_origin[3]={row_src*sizeof(float), col_src, 0};
+    size_t dest_origin[3]={row_dest*sizeof(float), col_dest, 0};
+    size_t region[3]={nrows*sizeof(float), ncols, 1};
+    cl_event event;
+    h_errchk(clEnqueueCopyBufferRect(   command_queue,
+                                        src,
+                                        dest,
+                                        src_origin,
+                                        dest_origin,
+                                        region,
+                                        ld_src*sizeof(float),
+                                        0,
+                                        ld_dest*sizeof(float),
+                                        0,
+                                        num_events_in_wait_list,
+                                        event_wait_list,
+                                        &event), "Copying a rectangular region");
+    return event;
+}
+
+int main() {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+    // Useful for checking OpenCL errors
+    cl_int errcode;
+
+    // Size of the large matrices that hold the sub-matrices
+    size_t nrows_big=1024;
+    size_t ncols_big=1024;
+    size_t nelements_big=nrows_big*ncols_big;
+    size_t nbytes_big=nelements_big*sizeof(float);
+
+    // Sizes of the sub-matrices, A_sub is M x K, B_sub is K x N and C_sub is M x N
+    size_t M=500;
+    size_t K=600;
+    size_t N=400;
+
+    // Arbitrary positions of the sub-matrices
+    size_t row_A=10, col_A=64;
+    size_t row_B=32, col_B=5;
+    size_t row_C=100, col_C=200;
+
+    cl_float alpha=2.0f;
+    cl_float beta=0.5f;
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_gemm_plan plan=h_create_gemm_plan(context, device);
+
+    // Fill the large matrices
+    float* array_A_1D=(float*)malloc(nbytes_big);
+    float* array_B_1D=(float*)malloc(nbytes_big);
+    float* array_C_1D=(float*)malloc(nbytes_big);
+    float* array_C_out_1D=(float*)malloc(nbytes_big);
+    h_fill_uniform_philox(array_A_1D, nrows_big, ncols_big, nrows_big, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows_big, ncols_big, nrows_big, SEED, 1, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_C_1D, nrows_big, ncols_big, nrows_big, SEED, 2, -1.0f, 1.0f);
+
+    // The answer for C_sub, computed in double precision
+    double* array_C_answer_1D=(double*)calloc(M*N, sizeof(double));
+    for (size_t j=0; j<N; j++) {
+        for (size_t i=0; i<M; i++) {
+            double temp=0.0;
+            for (size_t k=0; k<K; k++) {
+                temp+=(double)array_A_1D[(col_A+k)*nrows_big+row_A+i]
+                     *(double)array_B_1D[(col_B+j)*nrows_big+row_B+k];
+            }
+            array_C_answer_1D[j*M+i]=alpha*temp+beta*(double)array_C_1D[(col_C+j)*nrows_big+row_C+i];
+        }
+    }
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nbytes_big, array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nbytes_big, array_B_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_big, NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    // Densely packed buffers for the copy approach
+    cl_mem buffer_A_sub=clCreateBuffer(context, CL_MEM_READ_WRITE, M*K*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_A_sub");
+    cl_mem buffer_B_sub=clCreateBuffer(context, CL_MEM_READ_WRITE, K*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_B_sub");
+    cl_mem buffer_C_sub=clCreateBuffer(context, CL_MEM_READ_WRITE, M*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C_sub");
+
+    // Positions of the sub-matrices as element offsets into the large buffers
+    size_t offset_A=col_A*nrows_big+row_A;
+    size_t offset_B=col_B*nrows_big+row_B;
+    size_t offset_C=col_C*nrows_big+row_C;
+
+    // Errors usually grow as sqrt(K)*epsilon over a dot product of length K, K*epsilon bounds them
+    cl_double tol=(cl_double)K*FLT_EPSILON;
+    int nfailed=0;
+
+    const char* approach_names[]={"rect copies then multiply", "in-place sgemm"};
+    for (int approach=0; approach<2; approach++) {
+
+        // Start from the original C
+        h_errchk(clEnqueueWriteBuffer(  command_queue, buffer_C, CL_TRUE, 0, nbytes_big, 
+                                        array_C_1D, 0, NULL, NULL), "Writing to buffer_C from host");
+
+        cl_double time_total=0.0;
+        if (approach==0) {
+            // Copy the sub-matrices out, multiply the dense copies and copy C_sub back
+            cl_event events_copy[3];
+            events_copy[0]=copy_rect(   command_queue, buffer_A, nrows_big, row_A, col_A, 
+                                        buffer_A_sub, M, 0, 0, M, K, 0, NULL);
+            events_copy[1]=copy_rect(   command_queue, buffer_B, nrows_big, row_B, col_B, 
+                                        buffer_B_sub, K, 0, 0, K, N, 0, NULL);
+            events_copy[2]=copy_rect(   command_queue, buffer_C, nrows_big, row_C, col_C, 
+                                        buffer_C_sub, M, 0, 0, M, N, 0, NULL);
+            cl_event event_gemm=h_enqueue_sgemm(command_queue, &plan, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                                M, N, K,
+                                                alpha, buffer_A_sub, 0, M, buffer_B_sub, 0, K,
+                                                beta, buffer_C_sub, 0, M,
+                                                3, events_copy);
+            cl_event event_copy_back=copy_rect( command_queue, buffer_C_sub, M, 0, 0,
+                                                buffer_C, nrows_big, row_C, col_C, M, N, 1, &event_gemm);
+            h_errchk(clFinish(command_queue), "Finishing the rect copy approach");
+
+            for (int n=0; n<3; n++) {
+                time_total+=h_get_event_time_ms(events_copy[n]);
+                h_errchk(clReleaseEvent(events_copy[n]), "Releasing events_copy");
+            }
+            time_total+=h_get_event_time_ms(event_gemm);
+            time_total+=h_get_event_time_ms(event_copy_back);
+            h_errchk(clReleaseEvent(event_gemm), "Releasing event_gemm");
+            h_errchk(clReleaseEvent(event_copy_back), "Releasing event_copy_back");
+        } else {
+            // Multiply the sub-matrices where they are
+            cl_event event_gemm=h_enqueue_sgemm(command_queue, &plan, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                                M, N, K,
+                                                alpha, buffer_A, offset_A, nrows_big, buffer_B, offset_B, nrows_big,
+                                                beta, buffer_C, offset_C, nrows_big,
+                                                0, NULL);
+            h_errchk(clFinish(command_queue), "Finishing the in-place approach");
+            time_total=h_get_event_time_ms(event_gemm);
+            h_errchk(clReleaseEvent(event_gemm), "Releasing event_gemm");
+        }
+
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, nbytes_big, 
+                                        array_C_out_1D, 0, NULL, NULL), "Reading buffer_C to host");
+
+        // Check C_sub, and that nothing outside of it changed
+        double max_rel_err=0.0;
+        size_t nchanged=0;
+        for (size_t i1=0; i1<ncols_big; i1++) {
+            for (size_t i0=0; i0<nrows_big; i0++) {
+                size_t offset=i1*nrows_big+i0;
+                if (i0>=row_C && i0<row_C+M && i1>=col_C && i1<col_C+N) {
+                    double answer=array_C_answer_1D[(i1-col_C)*M+i0-row_C];
+                    double rel_err=fabs(array_C_out_1D[offset]-answer)/fmax(fabs(answer), 1.0);
+                    max_rel_err=fmax(max_rel_err, rel_err);
+                } else if (array_C_out_1D[offset]!=array_C_1D[offset]) {
+                    nchanged++;
+                }
+            }
+        }
+
+        // Both approaches must leave everything outside C_sub exactly as it was
+        cl_bool passed=(max_rel_err<=tol && nchanged==0) ? CL_TRUE : CL_FALSE;
+        if (!passed) nfailed++;
+        printf("%s took %f ms, largest relative error %g (tolerance %g), %zu elements changed outside C_sub, %s\n", 
+                approach_names[approach], time_total, max_rel_err, tol, nchanged, passed ? "passed" : "FAILED");
+    }
+
+    // Release buffers and the GEMM plan
+    cl_mem buffers[]={ buffer_A, buffer_B, buffer_C, buffer_A_sub, buffer_B_sub, buffer_C_sub };
+    for (size_t n=0; n<sizeof(buffers)/sizeof(cl_mem); n++) {
+        h_errchk(clReleaseMemObject(buffers[n]), "Releasing buffers");
+    }
+    h_release_gemm_plan(&plan);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Clean up memory
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_C_1D);
+    free(array_C_out_1D);
+    free(array_C_answer_1D);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d approaches FAILED their check\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,244 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_specialize.hpp"
+#include "philox.hpp"
+
+// The standard matrix multiply with the matrix sizes baked into specialized builds
+// as -D constants, against the generic build that takes them as arguments. A second
+// specialization also fixes the tile width, the columns of C that each work-item
+// computes while reusing its element of A from a register.
+// Each variant is asked for several times, the first request uses the generic kernel
+// and later ones the specialization, which is built on the second request.
+// Usage: mat_mult_specialize [n1 n2 ...] for square matrices of these sizes
+
+// Requests for each size, and requests before a size is specialized
+#define NREQUESTS 4
+#define SPEC_THRESHOLD 2
+// Most specialized programs to keep
+#define MAX_SPECIALIZATIONS 8
+// Widest tile to specialize for, sizes take the widest power of two that divides them
+#define MAX_WIDTH 4
+
+// Function to run mat_mult for n x n matrices, with width columns of C
+// for every work-item, and return the kernel time in ms
+cl_double run_mat_mult( cl_command_queue command_queue,
+                        cl_kernel kernel,
+                        cl_mem buffer_A,
+                        cl_mem buffer_B,
+                        cl_mem buffer_C,
+                        cl_int n,
+                        cl_int width) {
+    h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_A), "setting kernel argument 0");
+    h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer_B), "setting kernel argument 1");
+    h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &buffer_C), "setting kernel argument 2");
+    h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &n), "setting kernel argument 3");
+    h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &n), "setting kernel argument 4");
+
+    size_t global_size[]={ (size_t)n, (size_t)(n/width) };
+    cl_event event;
+    h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                    kernel,
+                                    2,
+                                    NULL,
+                                    global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &event), "Running the kernel");
+    return h_wait_event_time_ms(event);
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    std::vector<cl_int> sizes={ 256, 512, 1024 };
+    if (argc>1) {
+        sizes.clear();
+        for (int i=1; i<argc; i++) sizes.push_back(atoi(argv[i]));
+    }
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // The standard matrix multiply, where NROWS_A and NROWS_B replace the arguments when defined.
+    // Each work-item computes WIDTH columns of C, one unless the build specializes it
+    const char* kernel_source="\n\
+        // standard matrix multiply kernel \n\
+        __kernel void mat_mult (    __global float* A, \n\
+                                    __global float* B, \n\
+                                    __global float* C, \n\
+                                    int nrows_A, \n\
+                                    int nrows_B) { \n\
+        #ifdef NROWS_A \n\
+            const int n_A=NROWS_A; \n\
+        #else \n\
+            const int n_A=nrows_A; \n\
+        #endif \n\
+        #ifdef NROWS_B \n\
+            const int n_B=NROWS_B; \n\
+        #else \n\
+            const int n_B=nrows_B; \n\
+        #endif \n\
+        #ifndef WIDTH \n\
+            #define WIDTH 1 \n\
+        #endif \n\
+            \n\
+            // i0 and i1 represent the coordinates in C, \n\
+            // of the first of WIDTH columns for i1 \n\
+            // We assume Fortran ordering for the matrices \n\
+            size_t i0=get_global_id(0); \n\
+            size_t i1=get_global_id(1)*WIDTH; \n\
+            // WIDTH is a constant, so the loops over w unroll and temp stays in registers \n\
+            float temp[WIDTH]; \n\
+            for (int w=0; w<WIDTH; w++) temp[w]=0.0f; \n\
+            // With n_B known at build time this loop can be unrolled \n\
+            for (int n=0; n<n_B; n++) { \n\
+                float a=A[n*n_A+i0]; \n\
+                for (int w=0; w<WIDTH; w++) temp[w]+=a*B[(i1+w)*n_B+n]; \n\
+            } \n\
+            for (int w=0; w<WIDTH; w++) C[(i1+w)*n_A+i0]=temp[w]; \n\
+        } \n\
+    ";
+
+    h_spec_cache cache=h_create_spec_cache( context, device, kernel_source, "mat_mult", NULL,
+                                            SPEC_THRESHOLD, MAX_SPECIALIZATIONS);
+
+    // Every build sums the same terms in the same order, but the compiler may contract
+    // them into fused multiply-adds differently, so allow n*epsilon relative to the
+    // largest magnitude for the usual sqrt(n)*epsilon growth in that difference
+    int nfailed=0;
+    printf("%8s %8s %18s %14s %14s %10s %8s\n", "size", "request", "build", "time (ms)", "relative diff", "tolerance", "check");
+    cl_int errcode;
+    for (size_t s=0; s<sizes.size(); s++) {
+        cl_int n=sizes[s];
+        assert(n>0);
+        size_t nelements=(size_t)n*(size_t)n;
+        float* array_A_1D=(float*)malloc(nelements*sizeof(float));
+        float* array_B_1D=(float*)malloc(nelements*sizeof(float));
+        float* array_generic_1D=(float*)malloc(nelements*sizeof(float));
+        float* array_C_1D=(float*)malloc(nelements*sizeof(float));
+        h_fill_uniform_philox(array_A_1D, n, n, n, SEED, 0, -1.0f, 1.0f);
+        h_fill_uniform_philox(array_B_1D, n, n, n, SEED, 1, -1.0f, 1.0f);
+
+        cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nelements*sizeof(float), array_A_1D, &errcode);
+        h_errchk(errcode, "Creating buffer_A");
+        cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nelements*sizeof(float), array_B_1D, &errcode);
+        h_errchk(errcode, "Creating buffer_B");
+        cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nelements*sizeof(float), NULL, &errcode);
+        h_errchk(errcode, "Creating buffer_C");
+
+        // The generic kernel's answer to compare against
+        run_mat_mult(command_queue, cache.generic_kernel, buffer_A, buffer_B, buffer_C, n, 1);
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, nelements*sizeof(float),
+                                        array_generic_1D, 0, NULL, NULL), "Reading buffer_C");
+        double max_generic=0.0;
+        for (size_t i=0; i<nelements; i++) max_generic=fmax(max_generic, fabs(array_generic_1D[i]));
+        if (max_generic==0.0) max_generic=1.0;
+        cl_double tol=(cl_double)n*FLT_EPSILON;
+
+        // The sizes alone, then the sizes and the widest tile that divides n
+        cl_int width=MAX_WIDTH;
+        while (n%width!=0) width/=2;
+        for (int variant=0; variant<2; variant++) {
+            cl_int spec_width=(variant==0) ? 1 : width;
+            std::string spec_opts;
+            h_spec_define(&spec_opts, "NROWS_A", n);
+            h_spec_define(&spec_opts, "NROWS_B", n);
+            if (variant==1) h_spec_define(&spec_opts, "WIDTH", spec_width);
+            char spec_name[32];
+            snprintf(spec_name, sizeof(spec_name), "sizes, %d wide", spec_width);
+
+            for (int r=0; r<NREQUESTS; r++) {
+                cl_bool specialized;
+                cl_kernel kernel=h_spec_kernel(&cache, spec_opts, &specialized);
+                // The generic kernel is always one column wide
+                cl_double time=run_mat_mult(command_queue, kernel, buffer_A, buffer_B, buffer_C, n,
+                                            specialized ? spec_width : 1);
+                h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, nelements*sizeof(float),
+                                                array_C_1D, 0, NULL, NULL), "Reading buffer_C");
+                double max_diff=0.0;
+                for (size_t i=0; i<nelements; i++) {
+                    max_diff=fmax(max_diff, fabs(array_C_1D[i]-array_generic_1D[i]));
+                }
+                cl_double err=max_diff/max_generic;
+                cl_bool passed=(err<=tol) ? CL_TRUE : CL_FALSE;
+                if (!passed) nfailed++;
+                printf("%8d %8d %18s %14f %14g %10g %8s\n", n, r, specialized ? spec_name : "generic",
+                        time, err, tol, passed ? "passed" : "FAILED");
+            }
+        }
+
+        h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+        h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+        h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+        free(array_A_1D);
+        free(array_B_1D);
+        free(array_generic_1D);
+        free(array_C_1D);
+    }
+    printf("%zu specialized programs built\n", cache.programs.size());
+
+    h_release_spec_cache(&cache);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d requests FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
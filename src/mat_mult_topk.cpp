@@ -0,0 +1,216 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "cl_topk.hpp"
+#include "philox.hpp"
+
+// The k largest entries in each column of C=A*B, found by reading C back and 
+// selecting on the host, by a top-k kernel after the GEMM, and by the GEMM with 
+// top-k fused into its epilogue. Then the k largest entries of the whole of C.
+// Usage: mat_mult_topk [nrows_A ncols_A ncols_B [k]]
+
+// Each path runs this many times and the fastest run is kept
+#define NREPEATS 5
+
+// Function to select the k largest of n values from src with stride 1 on the host,
+// with the lower index winning ties, as the kernels do
+void host_topk(const float* src, size_t n, size_t k, float* values, cl_uint* indices, cl_uint* scratch) {
+    for (size_t i=0; i<n; i++) scratch[i]=(cl_uint)i;
+    std::partial_sort(scratch, scratch+k, scratch+n, [src](cl_uint a, cl_uint b) {
+        return src[a]>src[b] || (src[a]==src[b] && a<b);
+    });
+    for (size_t r=0; r<k; r++) {
+        values[r]=src[scratch[r]];
+        indices[r]=scratch[r];
+    }
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t M=1024, K=1024, N=1024, k=10;
+    if (argc>=4) {
+        M=(size_t)atol(argv[1]);
+        K=(size_t)atol(argv[2]);
+        N=(size_t)atol(argv[3]);
+    }
+    if (argc>=5) k=(size_t)atol(argv[4]);
+    assert(M>0 && K>0 && N>0 && k>0 && k<=TOPK_MAX && k<=M);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_gemm_plan plan_gemm=h_create_gemm_plan(context, device);
+    h_topk_plan plan_topk=h_create_topk_plan(context, device);
+
+    cl_int errcode;
+    float* array_A_1D=(float*)malloc(M*K*sizeof(float));
+    float* array_B_1D=(float*)malloc(K*N*sizeof(float));
+    float* array_C_1D=(float*)malloc(M*N*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, M, K, M, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, K, N, K, SEED, 1, -1.0f, 1.0f);
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, M*K*sizeof(float), array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, K*N*sizeof(float), array_B_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, M*N*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+    cl_mem buffer_values=clCreateBuffer(context, CL_MEM_WRITE_ONLY, N*k*sizeof(cl_float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_values");
+    cl_mem buffer_indices=clCreateBuffer(context, CL_MEM_WRITE_ONLY, N*k*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_indices");
+
+    // Answers from the host, and the results of each device path
+    float* host_values=(float*)malloc(N*k*sizeof(float));
+    cl_uint* host_indices=(cl_uint*)malloc(N*k*sizeof(cl_uint));
+    float* device_values=(float*)malloc(N*k*sizeof(float));
+    cl_uint* device_indices=(cl_uint*)malloc(N*k*sizeof(cl_uint));
+    cl_uint* scratch=(cl_uint*)malloc(M*N*sizeof(cl_uint));
+
+    printf("C is %zu x %zu, selecting the top %zu in each column\n", M, N, k);
+    // Selections are exact, so any error fails
+    int nfailed=0;
+    printf("%20s %14s %12s %10s %8s\n", "path", "time (ms)", "bytes read", "errors", "check");
+
+    const char* path_names[]={ "gemm, read back C", "gemm then topk", "gemm with topk" };
+    for (int path=0; path<3; path++) {
+        cl_double time=INFINITY;
+        size_t nbytes_read=(path==0) ? M*N*sizeof(float) : N*k*(sizeof(cl_float)+sizeof(cl_uint));
+        for (int r=0; r<NREPEATS; r++) {
+            high_resolution_clock::time_point start=high_resolution_clock::now();
+            cl_event event;
+            if (path<2) {
+                event=h_enqueue_sgemm(  command_queue, &plan_gemm, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                        M, N, K, 1.0f, buffer_A, 0, M, buffer_B, 0, K, 0.0f, buffer_C, 0, M, 0, NULL);
+            } else {
+                event=h_enqueue_sgemm_topk_columns( command_queue, &plan_topk, H_NO_TRANS, H_NO_TRANS, M, N, K, 1.0f,
+                                                    buffer_A, 0, M, buffer_B, 0, K, k, buffer_values, buffer_indices, 0, NULL);
+            }
+            if (path==0) {
+                h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, M*N*sizeof(float), 
+                                                array_C_1D, 1, &event, NULL), "Reading buffer_C");
+                for (size_t j=0; j<N; j++) {
+                    host_topk(array_C_1D+j*M, M, k, host_values+j*k, host_indices+j*k, scratch);
+                }
+            } else {
+                if (path==1) {
+                    cl_event event_gemm=event;
+                    event=h_enqueue_topk_columns(   command_queue, &plan_topk, M, N, buffer_C, 0, M, k, 
+                                                    buffer_values, buffer_indices, 1, &event_gemm);
+                    h_errchk(clReleaseEvent(event_gemm), "Releasing the GEMM event");
+                }
+                h_errchk(clEnqueueReadBuffer(   command_queue, buffer_values, CL_FALSE, 0, N*k*sizeof(cl_float), 
+                                                device_values, 1, &event, NULL), "Reading buffer_values");
+                h_errchk(clEnqueueReadBuffer(   command_queue, buffer_indices, CL_TRUE, 0, N*k*sizeof(cl_uint), 
+                                                device_indices, 1, &event, NULL), "Reading buffer_indices");
+            }
+            h_errchk(clReleaseEvent(event), "Releasing the event");
+            time=fmin(time, h_ms_since(start));
+        }
+
+        // The fused and unfused GEMMs sum in the same order, so the values match exactly
+        size_t nerrors=0;
+        if (path>0) {
+            for (size_t i=0; i<N*k; i++) {
+                if (device_values[i]!=host_values[i] || device_indices[i]!=host_indices[i]) nerrors++;
+            }
+        }
+        if (nerrors>0) nfailed++;
+        printf("%20s %14f %12zu %10zu %8s\n", path_names[path], time, nbytes_read, nerrors, 
+                (path==0) ? "-" : ((nerrors==0) ? "passed" : "FAILED"));
+    }
+
+    // The top k of the whole of C, which still holds the product
+    cl_event event=h_enqueue_topk(command_queue, &plan_topk, M, N, buffer_C, 0, M, k, buffer_values, buffer_indices, 0, NULL);
+    h_errchk(clEnqueueReadBuffer(   command_queue, buffer_values, CL_FALSE, 0, k*sizeof(cl_float), 
+                                    device_values, 1, &event, NULL), "Reading buffer_values");
+    h_errchk(clEnqueueReadBuffer(   command_queue, buffer_indices, CL_TRUE, 0, k*sizeof(cl_uint), 
+                                    device_indices, 1, &event, NULL), "Reading buffer_indices");
+    h_errchk(clReleaseEvent(event), "Releasing the event");
+    host_topk(array_C_1D, M*N, k, host_values, host_indices, scratch);
+    size_t nerrors=0;
+    for (size_t r=0; r<k; r++) {
+        if (device_values[r]!=host_values[r] || device_indices[r]!=host_indices[r]) nerrors++;
+    }
+    if (nerrors>0) nfailed++;
+    printf("Largest entry of C is %g at row %u, column %u, top %zu of C has %zu errors, %s\n", 
+            device_values[0], device_indices[0]%(cl_uint)M, device_indices[0]/(cl_uint)M, k, nerrors,
+            (nerrors==0) ? "passed" : "FAILED");
+
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseMemObject(buffer_values), "Releasing buffer_values");
+    h_errchk(clReleaseMemObject(buffer_indices), "Releasing buffer_indices");
+    h_release_gemm_plan(&plan_gemm);
+    h_release_topk_plan(&plan_topk);
+    free(array_A_1D);
+    free(array_B_1D);
+    free(array_C_1D);
+    free(host_values);
+    free(host_indices);
+    free(device_values);
+    free(device_indices);
+    free(scratch);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d selections FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -43,6 +43,17 @@ SOFTWARE.
 #endif
 
 #include "helper_functions.hpp"
+#include "mat_helper.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_transpose_cl.hpp"
+
+// Number of sampled coordinates and the seed for the sampled verification
+#define NSAMPLES 1024
+#define SAMPLE_SEED 2018
+
+// Tile size for the local memory transposes, 
+// a smaller tile is used if the device can't fit this many work-items in a work-group
+#define TILE_DIM 16
 
 int main(int argc, char**argv) {
 
@@ -289,119 +300,33 @@ int main(int argc, char**argv) {
     cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_C, NULL, &errcode);
     errchk(errcode, "Creating buffer_C");
 
-    // Now specify the source code for all the kernels in use
-    
-    const char* kernel_source="\n\
-        // kernel to do a matrix transpose \n\
-        __kernel void mat_transpose(    __global float* src, \n\
-                                        __global float* dest, \n\
-                                        int nrows_src, \n\
-                                        int nrows_dest) { \n\
-            // We assume Fortran ordering for the matrices \n\
-            // i0, and i1 represent the coordinates of src \n\
-            // coordinates are reversed for dest \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            size_t offset_src=i1*nrows_src+i0; \n\
-            size_t offset_dest=i0*nrows_dest+i1; \n\
-            dest[offset_dest]=src[offset_src]; \n\
-        } \n\
-        \n\
-        // standard matrix multiply kernel \n\
-        __kernel void mat_mult (    __global float* A, \n\
-                                    __global float* B, \n\
-                                    __global float* C, \n\
-                                    int nrows_A, \n\
-                                    int nrows_B) { \n\
-            \n\
-            // i0 and i1 represent the coordinates in C \n\
-            // We assume Fortran ordering for the matrices \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            size_t offset_B=i1*nrows_B; \n\
-            float temp=0.0; \n\
-            // Loop over columns of A and rows of B \n\
-            for (int n=0; n<nrows_B; n++) { \
-                // C has the same number of rows as A, and the same number of columns as B \n\
-                // i0 is the row index of A \n\
-                // i1 is the column index of B \n\
-                temp+=A[n*nrows_A+i0]*B[offset_B+n]; \n\
-            } \n\
-            // Number of rows in C is same as number of rows in A \n\
-            C[i1*nrows_A+i0]=temp; \n\
-        } \n\
-        \n\
-        // special matrix multiply kernel that uses a pre-transposed matrix A\n\
-        __kernel void mat_mult_transp ( __global float* A_transp, \n\
-                                        __global float* B, \n\
-                                        __global float* C, \n\
-                                        int nrows_A_transp, \n\
-                                        int nrows_B, \n\
-                                        int nrows_C) { \n\
-            // i0 and i1 represent the coordinates in C \n\
-            // We assume Fortran ordering for the matrices \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            size_t offset_A=i0*nrows_A_transp; \n\
-            size_t offset_B=i1*nrows_B; \n\
-            float temp=0.0; \n\
-            // For every coordinate in C, loop over the related rows of A_transp and B \n\
-            for (int n=0; n<nrows_B; n++) { \
-                // Every column of A_transp corresponds to a row of C \n\
-                // Every column of B corresponds to a column of C \n\
-                // C has the same number of rows as A_transp, and the same number of columns as B \n\
-                // i0 is the column index of A_transp \n\
-                // i1 is the column index of B \n\
-                temp+=A_transp[offset_A+n]*B[offset_B+n]; \n\
-            } \n\
-            C[i1*nrows_C+i0]=temp; \n\
-        } \n\
-    ";
-
-    // Turn the source code into a program
-    cl_program program=clCreateProgramWithSource(   context, 
-                                                    1, 
-                                                    &kernel_source,
-                                                    NULL,
-                                                    &errcode);
-    errchk(errcode, "Creating program from source");
-
-    // Build the program
-    const char* build_opts="";
-    errcode=clBuildProgram( program,
-                            1,
-                            &device,
-                            build_opts,
-                            NULL,
-                            NULL);
-
-    // Check the program build
-    if (errcode!=CL_SUCCESS) {
-        size_t elements;
-        errchk(clGetProgramBuildInfo(   program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        0,
-                                        NULL,
-                                        &elements),"Checking build log");
-
-        // Make up the build log string
-        char* buildlog=(char*)calloc(elements, 1);
-
-        errchk(clGetProgramBuildInfo(   program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        elements,
-                                        buildlog,
-                                        NULL), "Filling the build log");
-        printf("Build log is %s\n", buildlog);
-        exit(OCL_EXIT);
-    }
+    // Pick the tile size for the local memory transposes
+    size_t max_work_group_size;
+    errchk(clGetDeviceInfo( device,
+                            CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                            sizeof(size_t),
+                            &max_work_group_size,
+                            NULL), "Getting the maximum work-group size");
+    size_t tile_dim=TILE_DIM;
+    while (tile_dim*tile_dim>max_work_group_size) tile_dim/=2;
+
+    // Build the program from kernels/mat_mult_transpose.cl, embedded in the executable.
+    // TILE_DIM is only passed when it is smaller than the kernel default,
+    // so that an embedded binary can be used otherwise
+    char build_opts[MAXCHAR]="";
+    if (tile_dim!=TILE_DIM) snprintf(build_opts, MAXCHAR, "-DTILE_DIM=%zu", tile_dim);
+    cl_program program=h_build_embedded_program(&mat_mult_transpose_cl, context, device, build_opts);
 
     // Create kernels from the built program
     cl_kernel kernel_mat_transpose=clCreateKernel(program,"mat_transpose",&errcode);
     errchk(errcode, "Creating Kernel mat_transpose");
 
+    cl_kernel kernel_mat_transpose_tiled=clCreateKernel(program,"mat_transpose_tiled",&errcode);
+    errchk(errcode, "Creating Kernel mat_transpose_tiled");
+
+    cl_kernel kernel_mat_transpose_inplace=clCreateKernel(program,"mat_transpose_inplace",&errcode);
+    errchk(errcode, "Creating Kernel mat_transpose_inplace");
+
     cl_kernel kernel_mat_mult=clCreateKernel(program,"mat_mult",&errcode);
     errchk(errcode, "Creating Kernel mat_mult");
 
@@ -456,6 +381,28 @@ int main(int argc, char**argv) {
                                         NULL,
                                         &event_mat_transpose), "Running the transpose kernel");
 
+        // Now the same transpose through local memory, overwriting A_transp.
+        // The global size is rounded up to a whole number of tiles
+        errchk(clSetKernelArg(kernel_mat_transpose_tiled, 0, sizeof(cl_mem), &buffer_A ),"setting mat_transpose_tiled argument 0");
+        errchk(clSetKernelArg(kernel_mat_transpose_tiled, 1, sizeof(cl_mem), &buffer_A_transp ),"setting mat_transpose_tiled argument 1");
+        errchk(clSetKernelArg(kernel_mat_transpose_tiled, 2, sizeof(int), &nrows_A ),"setting mat_transpose_tiled argument 2");
+        errchk(clSetKernelArg(kernel_mat_transpose_tiled, 3, sizeof(int), &nrows_A_transp ),"setting mat_transpose_tiled argument 3");
+
+        const size_t local_size_tiled[]={ tile_dim, tile_dim };
+        const size_t global_size_tiled[]={  ((nrows_A+tile_dim-1)/tile_dim)*tile_dim, 
+                                            ((ncols_A+tile_dim-1)/tile_dim)*tile_dim };
+        cl_event event_mat_transpose_tiled;
+
+        errchk(clEnqueueNDRangeKernel(  command_queue,
+                                        kernel_mat_transpose_tiled,
+                                        work_dim,
+                                        NULL,
+                                        global_size_tiled,
+                                        local_size_tiled,
+                                        1,
+                                        &event_mat_transpose,
+                                        &event_mat_transpose_tiled), "Running the tiled transpose kernel");
+
         // Set arguments for the multiply kernel
         errchk(clSetKernelArg(kernel_mat_mult, 0, sizeof(cl_mem), &buffer_A ),"setting mat_mult argument 0");
         errchk(clSetKernelArg(kernel_mat_mult, 1, sizeof(cl_mem), &buffer_B ),"setting mat_mult argument 1");
@@ -475,7 +422,7 @@ int main(int argc, char**argv) {
                                         global_size_mat_mult,
                                         NULL,
                                         1,
-                                        &event_mat_transpose,
+                                        &event_mat_transpose_tiled,
                                         &event_mat_mult), "Running the kernel");
 
         // Set arguments for the multiply kernel with transpose
@@ -547,15 +494,89 @@ int main(int argc, char**argv) {
         // This should give the time in milliseconds
         cl_double time_mat_mult_transp=(cl_double)(end_counter-start_counter)*(cl_double)1.0e-6;
 
+        cl_double time_mat_transpose_tiled=h_get_event_time_ms(event_mat_transpose_tiled);
+
         printf("Matrix transpose took %f ms\n", time_mat_transpose);
+        printf("Tiled matrix transpose took %f ms\n", time_mat_transpose_tiled);
         printf("Standard matrix multiply took %f ms\n", time_mat_mult);
         printf("Transposed matrix multiply took %f ms\n", time_mat_mult_transp);
         printf("Transposed approach resulted in a speedup of %fx\n", time_mat_mult/(time_mat_transpose+time_mat_mult_transp));
+        printf("Transposed approach with the tiled transpose resulted in a speedup of %fx\n", 
+                time_mat_mult/(time_mat_transpose_tiled+time_mat_mult_transp));
+
+        errchk(clReleaseEvent(event_mat_transpose), "Releasing event_mat_transpose");
+        errchk(clReleaseEvent(event_mat_transpose_tiled), "Releasing event_mat_transpose_tiled");
+        errchk(clReleaseEvent(event_mat_mult), "Releasing event_mat_mult");
+        errchk(clReleaseEvent(event_mat_mult_transp), "Releasing event_mat_mult_transp");
     }
     
     // Make sure all transfers are complete
     clFinish(command_queue);
 
+    // Check the tiled transpose against a host transpose of A
+    float* array_A_transp_1D=(float*)malloc(nbytes_A);
+    float* array_A_transp_answer_1D=(float*)malloc(nbytes_A);
+    for (size_t i1=0; i1<ncols_A; i1++) {
+        for (size_t i0=0; i0<nrows_A; i0++) {
+            array_A_transp_answer_1D[i0*nrows_A_transp+i1]=array_A_1D[i1*nrows_A+i0];
+        }
+    }
+    errchk(clEnqueueReadBuffer(   command_queue,
+                            buffer_A_transp,
+                            CL_TRUE,
+                            0,
+                            nbytes_A,
+                            array_A_transp_1D,
+                            0,
+                            NULL,
+                            NULL), "Copying matrix A_transp from device to host");
+    // The transposes only move elements, so they must match exactly
+    int nfailed=0;
+    cl_bool tiled_correct=(memcmp(array_A_transp_1D, array_A_transp_answer_1D, nbytes_A)==0) ? CL_TRUE : CL_FALSE;
+    if (!tiled_correct) nfailed++;
+    printf("Tiled transpose is %s\n", tiled_correct ? "correct" : "INCORRECT");
+
+    // A square matrix can be transposed in place, without the extra buffer_A_transp
+    if (nrows_A==ncols_A) {
+        errchk(clSetKernelArg(kernel_mat_transpose_inplace, 0, sizeof(cl_mem), &buffer_A ),"setting mat_transpose_inplace argument 0");
+        errchk(clSetKernelArg(kernel_mat_transpose_inplace, 1, sizeof(int), &nrows_A ),"setting mat_transpose_inplace argument 1");
+
+        const size_t local_size_inplace[]={ tile_dim, tile_dim };
+        const size_t global_size_inplace[]={    ((nrows_A+tile_dim-1)/tile_dim)*tile_dim, 
+                                                ((ncols_A+tile_dim-1)/tile_dim)*tile_dim };
+        cl_event event_mat_transpose_inplace;
+
+        errchk(clEnqueueNDRangeKernel(  command_queue,
+                                        kernel_mat_transpose_inplace,
+                                        2,
+                                        NULL,
+                                        global_size_inplace,
+                                        local_size_inplace,
+                                        0,
+                                        NULL,
+                                        &event_mat_transpose_inplace), "Running the in-place transpose kernel");
+
+        errchk(clEnqueueReadBuffer(   command_queue,
+                                buffer_A,
+                                CL_TRUE,
+                                0,
+                                nbytes_A,
+                                array_A_transp_1D,
+                                1,
+                                &event_mat_transpose_inplace,
+                                NULL), "Copying in-place transposed A from device to host");
+
+        cl_bool inplace_correct=(memcmp(array_A_transp_1D, array_A_transp_answer_1D, nbytes_A)==0) ? CL_TRUE : CL_FALSE;
+        if (!inplace_correct) nfailed++;
+        printf("In-place matrix transpose took %f ms and is %s\n", 
+                h_get_event_time_ms(event_mat_transpose_inplace),
+                inplace_correct ? "correct" : "INCORRECT");
+        errchk(clReleaseEvent(event_mat_transpose_inplace), "Releasing event_mat_transpose_inplace");
+    }
+
+    free(array_A_transp_1D);
+    free(array_A_transp_answer_1D);
+
     // Read memory from the buffer to the host
     errchk(clEnqueueReadBuffer(   command_queue,
                             buffer_C,
@@ -575,15 +596,47 @@ int main(int argc, char**argv) {
 
     // Check the difference between the original and the computed matrix product
     // using the Root Mean Squared indicator
+    high_resolution_clock::time_point time_check1 = high_resolution_clock::now();
     double rms=0.0;
     for (int i=0; i<nelements_C; i++ ) {
         rms+=(array_C_1D[i]-array_C_answer_1D[i])*(array_C_1D[i]-array_C_answer_1D[i]);
     }
     rms/=nelements_C;
     rms=sqrt(rms);
+    high_resolution_clock::time_point time_check2 = high_resolution_clock::now();
     
     printf("RMS difference is %g\n", rms);
 
+    // Now estimate the same thing from a reproducible random sample of C, 
+    // recomputing just those dot products from A and B on the host.
+    // Only the sampled elements are read from the device
+    size_t* sample_rows=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    size_t* sample_cols=(size_t*)calloc(NSAMPLES, sizeof(size_t));
+    float* sample_C=(float*)calloc(NSAMPLES, sizeof(float));
+
+    // The sampled offsets go to the device once, and each check gathers them into one read
+    h_sample_coords(nrows_C, ncols_C, NSAMPLES, SAMPLE_SEED, sample_rows, sample_cols);
+    h_sample_reader sample_reader=h_create_sample_reader(context, device, nrows_C, NSAMPLES, sample_rows, sample_cols);
+
+    high_resolution_clock::time_point time_sample1 = high_resolution_clock::now();
+    h_read_samples(command_queue, &sample_reader, buffer_C, element_size, sample_C);
+    h_sample_stats stats=h_verify_samples(  array_A_1D, array_B_1D, 
+                                            nrows_A, ncols_A,
+                                            NSAMPLES, sample_rows, sample_cols, sample_C,
+                                            1.96);
+    high_resolution_clock::time_point time_sample2 = high_resolution_clock::now();
+
+    printf("Sampled RMS difference is %g (95%% confidence %g to %g) from %zu samples, largest %g\n",
+            stats.rms_err, stats.rms_lower, stats.rms_upper, stats.nsamples, stats.max_abs_err);
+    printf("Full check took %f ms, sampled check took %f ms\n",
+            duration_cast<duration<double>>(time_check2-time_check1).count()*1.0e3,
+            duration_cast<duration<double>>(time_sample2-time_sample1).count()*1.0e3);
+
+    h_release_sample_reader(&sample_reader);
+    free(sample_rows);
+    free(sample_cols);
+    free(sample_C);
+
     // Wait for all command queues to finish
     // Release the command queues
     for (int i=0; i<num_command_queues; i++) {
@@ -612,5 +665,10 @@ int main(int argc, char**argv) {
     duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
     std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
 
+    if (nfailed>0) {
+        printf("%d transposes FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
 }
 
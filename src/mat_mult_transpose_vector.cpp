@@ -33,17 +33,16 @@ SOFTWARE.
 #include <chrono>
 #include <iostream>
 
-#define OCL_EXIT -20
-#define MAXCHAR 100
-#define NQUEUES_PER_DEVICE 2
-
 #ifdef __APPLE__
     #include "OpenCL/opencl.h"
 #else
     #include "CL/cl.hpp"
 #endif
 
-#include "helper_functions.hpp"
+#include "cl_helper.hpp"
+#include "cl_vector.hpp"
+#include "cl_embed.hpp"
+#include "mat_mult_transpose_cl.hpp"
 
 int main(int argc, char**argv) {
 
@@ -51,162 +50,28 @@ int main(int argc, char**argv) {
 
     // Start the clock
     high_resolution_clock::time_point time1 = high_resolution_clock::now();
-    // Useful for checking OpenCL errors
-    cl_int errcode;
-
-    // Number to hold the number of platforms
-    cl_uint num_platforms;
-    
-    // First call this to get the number of compute platforms
-    errchk(clGetPlatformIDs(0, NULL, &num_platforms),"Get number of platforms");
-    
-    // Allocate memory for the found number of platforms
-    cl_platform_id* platformIDs_1d=(cl_platform_id*)calloc(num_platforms, sizeof(cl_platform_id));
-    
-    // Now fill in the allocated platform ID's
-    errchk(clGetPlatformIDs(num_platforms, platformIDs_1d, &num_platforms),"Filling platform ID's\n");  
-
-    // Now get information on each platform that was discovered
-    for (int i=0; i<num_platforms; i++) {
-        char version[MAXCHAR];
-        char vendor[MAXCHAR];
-        char name[MAXCHAR];
-        
-        // Fill the string with platform information
-        errchk(clGetPlatformInfo(   platformIDs_1d[i], \
-                                    CL_PLATFORM_NAME, 
-                                    MAXCHAR, 
-                                    name, 
-                                    NULL),"Getting name\n");
-        // Getting vendor         
-        errchk(clGetPlatformInfo(platformIDs_1d[i], 
-                                    CL_PLATFORM_VENDOR, 
-                                    MAXCHAR, 
-                                    vendor, 
-                                    NULL),"Getting vendor\n");
-        
-        // Getting version
-        errchk(clGetPlatformInfo(   platformIDs_1d[i], 
-                                    CL_PLATFORM_VERSION,
-                                    MAXCHAR,
-                                    version,
-                                    NULL),"Getting version\n");
-                                    
-        printf("Platform %d: %s, vendor: %s, version %s\n", i, name, vendor, version);
-    }
-
-    // Select the device we are going to use 
-    cl_device_type target_device=CL_DEVICE_TYPE_ALL;
-
-    // Allocate memory to hold the total number of devices per platform 
-    cl_uint* ndevices_1d=(cl_uint*)calloc(num_platforms, sizeof(cl_uint));
-    // Number of devices per platform
-    int ndevices=0;
-    // Number of platforms with devices that match what we want
-    int num_valid_platforms=0;
-    for (int i=0; i<num_platforms; i++) {
-        cl_uint ndevice=0;
-
-        // First pass, get the number of device per platform
-        errcode=clGetDeviceIDs( platformIDs_1d[i],
-                                target_device,
-                                0,
-                                NULL,
-                                &ndevice);
-        
-        // Some OpenCL implementations yield an error if no devices of 
-        // the right type exist, we must manually check
-        if (errcode==-1) {
-            // There are no devices
-            ndevice=0;
-        } else {
-            errchk(errcode,"Getting number of devices");
-        }
-        
-        if (ndevice>0) {
-            // We have more than one device in this platform
-            ndevices_1d[i]=ndevice;
-            ndevices+=ndevice;
-            num_valid_platforms++;
-        } 
-
-        printf("Platform %d has %d devices\n", i,  ndevices_1d[i]);
-    }
-    
-    // Make sure we have at least one valid platform
-    assert(num_valid_platforms>=1);
-
-    // Create a 2D array for devices and fill it with device information for each platform
-    // that has one or more devices in it
-    cl_device_id** devices_2d=(cl_device_id**)calloc(num_valid_platforms, sizeof(cl_device_id*));
-    int platform_counter=0;
-    int device_counter=0;
-    for (int i=0; i<num_platforms; i++) {
-        // Skip over platforms with no devices in them 
-        if (ndevices_1d[i]>0) {
-            // Construct the devices array to hold the desired number of devices
-            devices_2d[platform_counter]=(cl_device_id*)calloc(ndevices_1d[i], sizeof(cl_device_id));
-        
-            // Fill the devices array
-            errchk(clGetDeviceIDs(  platformIDs_1d[i],
-                                    target_device,
-                                    ndevices_1d[i],
-                                    devices_2d[platform_counter],
-                                    NULL),"Filling device arrays");
-            
-            for (int j=0; j<ndevices_1d[i]; j++) {
-                printf("Device %d:\n", device_counter);
-                report_on_device(devices_2d[platform_counter][j]);
-                device_counter++;
-            }
-            
-            platform_counter++; 
-        }
-    }
 
-    // Now make a context for each valid platform
-    // Allocate memory to store the contexts
-    cl_context* contexts_1d=(cl_context*)calloc(num_valid_platforms, sizeof(cl_context));
-    platform_counter=0;
-    for (int i=0; i<num_platforms; i++) {
-        if (ndevices_1d[i]>0) {
-            // We have a valid platform, create a context.
-            // Handling the context properties is tricky, here is how to do it
-            const cl_context_properties prop[] = {CL_CONTEXT_PLATFORM, 
-                                                  (cl_context_properties)platformIDs_1d[i], 
-                                                  0 };
-
-            // Now create a context using the platform and devices
-            contexts_1d[platform_counter]=clCreateContext(prop, 
-                                                          ndevices_1d[i], 
-                                                          devices_2d[platform_counter], 
-                                                          NULL, 
-                                                          NULL, 
-                                                          &errcode);
-
-            errchk(errcode, "Creating contexts");
-            platform_counter++;
+    // The vectorised kernel is generated for the vector width the device prefers for floats,
+    // or the width given as the first argument, which must be a valid OpenCL vector width
+    cl_uint vector_width=0;
+    if (argc>1) {
+        char* end;
+        long width=strtol(argv[1], &end, 10);
+        if (*end!='\0' || width<1 || width>16 || !h_valid_vector_width((cl_uint)width)) {
+            printf("Usage: mat_mult_transpose_vector [width], where width is 1, 2, 4, 8 or 16\n");
+            return EXIT_FAILURE;
         }
+        vector_width=(cl_uint)width;
     }
 
-    // Now create command queues for each valid device;
-    int num_command_queues=ndevices*NQUEUES_PER_DEVICE;
-    cl_command_queue* command_queues_1d=(cl_command_queue*)calloc(num_command_queues, sizeof(cl_command_queue));
-    platform_counter=0;
-    int queue_counter=0;
-    for (int i=0; i<num_platforms; i++) {
-        for (int j=0; j<ndevices_1d[i]; j++) {
-            for (int k=0; k<NQUEUES_PER_DEVICE; k++) {
-                command_queues_1d[queue_counter]=clCreateCommandQueue(  contexts_1d[platform_counter],
-                                                                        devices_2d[platform_counter][j], 
-                                                                        CL_QUEUE_PROFILING_ENABLE, 
-                                                                        &errcode);
-                queue_counter++;
-            }
+    // Useful for checking OpenCL errors
+    cl_int errcode;
 
-        }
-        if (ndevices_1d[i]>0) platform_counter++;
-    }
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
 
     // We are going to do a simple array multiplication for this example, using raw binary files for input and output
     size_t nrows_A=1024;
@@ -260,187 +125,41 @@ int main(int argc, char**argv) {
     fread(array_C_answer_1D, element_size, nelements_C, fp);
     fclose(fp); 
 
-    // Select a command queue to use from the pool of valid command queues
-    cl_command_queue command_queue=command_queues_1d[0];
-    
-    // Get the context, device, and platform from the selected command queue
-    cl_context context;
-    cl_device_id device;
-
-    errchk(clGetCommandQueueInfo(   command_queue, 
-                                    CL_QUEUE_CONTEXT, 
-                                    sizeof(context), 
-                                    &context,
-                                    NULL), "Getting the context");
-
-    errchk(clGetCommandQueueInfo(   command_queue, 
-                                    CL_QUEUE_DEVICE, 
-                                    sizeof(device), 
-                                    &device,
-                                    NULL), "Getting the device");
-
     // Make buffers for bringing data in and out of the computation
     cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_A, NULL, &errcode);
-    errchk(errcode, "Creating buffer_A");
+    h_errchk(errcode, "Creating buffer_A");
     // Make a buffer for transposed A, then B and C
     cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_A, NULL, &errcode);
-    errchk(errcode, "Creating buffer_A_transp");
+    h_errchk(errcode, "Creating buffer_A_transp");
     cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_B, NULL, &errcode);
-    errchk(errcode, "Creating buffer_B");
+    h_errchk(errcode, "Creating buffer_B");
     cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes_C, NULL, &errcode);
-    errchk(errcode, "Creating buffer_C");
+    h_errchk(errcode, "Creating buffer_C");
 
-    // Now specify the source code for all the kernels in use
-    
-    const char* kernel_source="\n\
-        // kernel to do a matrix transpose \n\
-        __kernel void mat_transpose(    __global float* src, \n\
-                                        __global float* dest, \n\
-                                        int nrows_src, \n\
-                                        int nrows_dest) { \n\
-            // We assume Fortran ordering for the matrices \n\
-            // i0, and i1 represent the coordinates of src \n\
-            // coordinates are reversed for dest \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            size_t offset_src=i1*nrows_src+i0; \n\
-            size_t offset_dest=i0*nrows_dest+i1; \n\
-            dest[offset_dest]=src[offset_src]; \n\
-        } \n\
-        \n\
-        // standard matrix multiply kernel \n\
-        __kernel void mat_mult (    __global float* A, \n\
-                                    __global float* B, \n\
-                                    __global float* C, \n\
-                                    int nrows_A, \n\
-                                    int nrows_B) { \n\
-            \n\
-            // i0 and i1 represent the coordinates in C \n\
-            // We assume Fortran ordering for the matrices \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            size_t offset_B=i1*nrows_B; \n\
-            float temp=0.0; \n\
-            // Loop over columns of A and rows of B \n\
-            for (int n=0; n<nrows_B; n++) { \
-                // C has the same number of rows as A, and the same number of columns as B \n\
-                // i0 is the row index of A \n\
-                // i1 is the column index of B \n\
-                temp+=A[n*nrows_A+i0]*B[offset_B+n]; \n\
-            } \n\
-            // Number of rows in C is same as number of rows in A \n\
-            C[i1*nrows_A+i0]=temp; \n\
-        } \n\
-        \n\
-        // special matrix multiply kernel that uses a pre-transposed matrix A\n\
-        __kernel void mat_mult_transp ( __global float* A_transp, \n\
-                                        __global float* B, \n\
-                                        __global float* C, \n\
-                                        int nrows_A_transp, \n\
-                                        int nrows_B, \n\
-                                        int nrows_C) { \n\
-            // i0 and i1 represent the coordinates in C \n\
-            // We assume Fortran ordering for the matrices \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            size_t offset_A=i0*nrows_A_transp; \n\
-            size_t offset_B=i1*nrows_B; \n\
-            float temp=0.0; \n\
-            // For every coordinate in C, loop over the related rows of A_transp and B \n\
-            for (int n=0; n<nrows_B; n++) { \
-                // Every column of A_transp corresponds to a row of C \n\
-                // Every column of B corresponds to a column of C \n\
-                // C has the same number of rows as A_transp, and the same number of columns as B \n\
-                // i0 is the column index of A_transp \n\
-                // i1 is the column index of B \n\
-                temp+=A_transp[offset_A+n]*B[offset_B+n]; \n\
-            } \n\
-            C[i1*nrows_C+i0]=temp; \n\
-        } \n\
-\n\
-        // special matrix multiply kernel that uses a pre-transposed matrix and vectors A\n\
-        __kernel void mat_mult_transp_vector ( __global float8* A_transp, \n\
-                                        __global float8* B, \n\
-                                        __global float* C, \n\
-                                        int nrows_A_transp, \n\
-                                        int nrows_B, \n\
-                                        int nrows_C) { \n\
-            // i0 and i1 represent the coordinates in C \n\
-            // We assume Fortran ordering for the matrices \n\
-            size_t i0=get_global_id(0); \n\
-            size_t i1=get_global_id(1); \n\
-            size_t offset_A=i0*nrows_A_transp; \n\
-            size_t offset_B=i1*nrows_B; \n\
-            float8 temp=0.0; \n\
-            // For every coordinate in C, loop over the related rows of A_transp and B \n\
-            for (int n=0; n<nrows_B; n++) { \
-                // Every column of A_transp corresponds to a row of C \n\
-                // Every column of B corresponds to a column of C \n\
-                // C has the same number of rows as A_transp, and the same number of columns as B \n\
-                // i0 is the column index of A_transp \n\
-                // i1 is the column index of B \n\
-                temp+=A_transp[offset_A+n]*B[offset_B+n]; \n\
-            } \n\
-            // Access components of a vector \n\
-            C[i1*nrows_C+i0]=temp.s0+temp.s1+temp.s2+temp.s3+temp.s4+temp.s5+temp.s6+temp.s7; \n\
-        } \n\
-    ";
-
-    // Turn the source code into a program
-    cl_program program=clCreateProgramWithSource(   context, 
-                                                    1, 
-                                                    &kernel_source,
-                                                    NULL,
-                                                    &errcode);
-    errchk(errcode, "Creating program from source");
-
-    // Build the program
-    const char* build_opts="";
-    errcode=clBuildProgram( program,
-                            1,
-                            &device,
-                            build_opts,
-                            NULL,
-                            NULL);
-
-    // Check the program build
-    if (errcode!=CL_SUCCESS) {
-        size_t elements;
-        errchk(clGetProgramBuildInfo(   program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        0,
-                                        NULL,
-                                        &elements),"Checking build log");
-
-        // Make up the build log string
-        char* buildlog=(char*)calloc(elements, 1);
-
-        errchk(clGetProgramBuildInfo(   program,
-                                        device,
-                                        CL_PROGRAM_BUILD_LOG,
-                                        elements,
-                                        buildlog,
-                                        NULL), "Filling the build log");
-        printf("Build log is %s\n", buildlog);
-        exit(OCL_EXIT);
-    }
+    // Build the transposes and matrix multiplies from kernels/mat_mult_transpose.cl,
+    // embedded in the executable
+    cl_program program=h_build_embedded_program(&mat_mult_transpose_cl, context, device);
 
     // Create kernels from the built program
     cl_kernel kernel_mat_transpose=clCreateKernel(program,"mat_transpose",&errcode);
-    errchk(errcode, "Creating Kernel mat_transpose");
+    h_errchk(errcode, "Creating Kernel mat_transpose");
 
     cl_kernel kernel_mat_mult=clCreateKernel(program,"mat_mult",&errcode);
-    errchk(errcode, "Creating Kernel mat_mult");
+    h_errchk(errcode, "Creating Kernel mat_mult");
 
     cl_kernel kernel_mat_mult_transp=clCreateKernel(program,"mat_mult_transp",&errcode);
-    errchk(errcode, "Creating Kernel mat_mul_transp");
+    h_errchk(errcode, "Creating Kernel mat_mul_transp");
 
-    cl_kernel kernel_mat_mult_transp_vector=clCreateKernel(program,"mat_mult_transp_vector",&errcode);
-    errchk(errcode, "Creating Kernel mat_mul_transp_vector");
+    if (vector_width==0) vector_width=h_preferred_vector_width<cl_float>(device);
+    printf("Vector width is %u\n", vector_width);
+    std::string vector_source=h_vector_source<cl_float>(mat_mult_transp_vector_kernel_source, vector_width);
+    cl_program program_vector=h_build_program(vector_source.c_str(), context, device);
+
+    cl_kernel kernel_mat_mult_transp_vector=clCreateKernel(program_vector,"mat_mult_transp_vector",&errcode);
+    h_errchk(errcode, "Creating Kernel mat_mul_transp_vector");
 
     // Write memory to the buffer from the host device
-    errchk(clEnqueueWriteBuffer(    command_queue,
+    h_errchk(clEnqueueWriteBuffer(    command_queue,
                             buffer_A,
                             CL_TRUE,
                             0,
@@ -450,7 +169,7 @@ int main(int argc, char**argv) {
                             NULL,
                             NULL), "Writing to buffer_A from host");
 
-    errchk(clEnqueueWriteBuffer(    command_queue,
+    h_errchk(clEnqueueWriteBuffer(    command_queue,
                             buffer_B,
                             CL_TRUE,
                             0,
@@ -466,10 +185,10 @@ int main(int argc, char**argv) {
     for (int n=0; n<iterations; n++) {
 
         // Set arguments to the transpose kernel
-        errchk(clSetKernelArg(kernel_mat_transpose, 0, sizeof(cl_mem), &buffer_A ),"setting mat_transpose argument 0");
-        errchk(clSetKernelArg(kernel_mat_transpose, 1, sizeof(cl_mem), &buffer_A_transp ),"setting mat_transpose argument 1");
-        errchk(clSetKernelArg(kernel_mat_transpose, 2, sizeof(int), &nrows_A ),"setting mat_transpose argument 2");
-        errchk(clSetKernelArg(kernel_mat_transpose, 3, sizeof(int), &nrows_A_transp ),"setting mat_transpose argument 3");
+        h_errchk(clSetKernelArg(kernel_mat_transpose, 0, sizeof(cl_mem), &buffer_A ),"setting mat_transpose argument 0");
+        h_errchk(clSetKernelArg(kernel_mat_transpose, 1, sizeof(cl_mem), &buffer_A_transp ),"setting mat_transpose argument 1");
+        h_errchk(clSetKernelArg(kernel_mat_transpose, 2, sizeof(int), &nrows_A ),"setting mat_transpose argument 2");
+        h_errchk(clSetKernelArg(kernel_mat_transpose, 3, sizeof(int), &nrows_A_transp ),"setting mat_transpose argument 3");
         
         // Set work size
         cl_uint work_dim=2;
@@ -477,7 +196,7 @@ int main(int argc, char**argv) {
         cl_event event_mat_transpose;
 
         // Now enqueue the transpose kernel
-        errchk(clEnqueueNDRangeKernel(  command_queue,
+        h_errchk(clEnqueueNDRangeKernel(  command_queue,
                                         kernel_mat_transpose,
                                         work_dim,
                                         NULL,
@@ -488,18 +207,18 @@ int main(int argc, char**argv) {
                                         &event_mat_transpose), "Running the transpose kernel");
 
         // Set arguments for the multiply kernel
-        errchk(clSetKernelArg(kernel_mat_mult, 0, sizeof(cl_mem), &buffer_A ),"setting mat_mult argument 0");
-        errchk(clSetKernelArg(kernel_mat_mult, 1, sizeof(cl_mem), &buffer_B ),"setting mat_mult argument 1");
-        errchk(clSetKernelArg(kernel_mat_mult, 2, sizeof(cl_mem), &buffer_C ),"setting mat_mult argument 2");
-        errchk(clSetKernelArg(kernel_mat_mult, 3, sizeof(int), &nrows_A ),"setting mat_mult argument 3");
-        errchk(clSetKernelArg(kernel_mat_mult, 4, sizeof(int), &nrows_B ),"setting mat_mult argument 4");
+        h_errchk(clSetKernelArg(kernel_mat_mult, 0, sizeof(cl_mem), &buffer_A ),"setting mat_mult argument 0");
+        h_errchk(clSetKernelArg(kernel_mat_mult, 1, sizeof(cl_mem), &buffer_B ),"setting mat_mult argument 1");
+        h_errchk(clSetKernelArg(kernel_mat_mult, 2, sizeof(cl_mem), &buffer_C ),"setting mat_mult argument 2");
+        h_errchk(clSetKernelArg(kernel_mat_mult, 3, sizeof(int), &nrows_A ),"setting mat_mult argument 3");
+        h_errchk(clSetKernelArg(kernel_mat_mult, 4, sizeof(int), &nrows_B ),"setting mat_mult argument 4");
 
         // Number of dimensions in the kernel
         const size_t global_size_mat_mult[]={ nrows_C, ncols_C };
         cl_event event_mat_mult;
 
         // Now enqueue the standard matrix multiply kernel
-        errchk(clEnqueueNDRangeKernel(  command_queue,
+        h_errchk(clEnqueueNDRangeKernel(  command_queue,
                                         kernel_mat_mult,
                                         work_dim,
                                         NULL,
@@ -510,17 +229,17 @@ int main(int argc, char**argv) {
                                         &event_mat_mult), "Running the kernel");
 
         // Set arguments for the multiply kernel with transpose
-        errchk(clSetKernelArg(kernel_mat_mult_transp, 0, sizeof(cl_mem), &buffer_A_transp ),"setting mat_mult_transp argument 0");
-        errchk(clSetKernelArg(kernel_mat_mult_transp, 1, sizeof(cl_mem), &buffer_B ),"setting kernel mat_mult_transp argument 1");
-        errchk(clSetKernelArg(kernel_mat_mult_transp, 2, sizeof(cl_mem), &buffer_C ),"setting kernel mat_mult_transp argument 2");
-        errchk(clSetKernelArg(kernel_mat_mult_transp, 3, sizeof(int), &nrows_A_transp ),"setting mat_mult_transp argument 3");
-        errchk(clSetKernelArg(kernel_mat_mult_transp, 4, sizeof(int), &nrows_B ),"setting mat_mult_transp argument 4");
-        errchk(clSetKernelArg(kernel_mat_mult_transp, 5, sizeof(int), &nrows_C ),"setting mat_mult_transp argument 5");
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp, 0, sizeof(cl_mem), &buffer_A_transp ),"setting mat_mult_transp argument 0");
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp, 1, sizeof(cl_mem), &buffer_B ),"setting kernel mat_mult_transp argument 1");
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp, 2, sizeof(cl_mem), &buffer_C ),"setting kernel mat_mult_transp argument 2");
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp, 3, sizeof(int), &nrows_A_transp ),"setting mat_mult_transp argument 3");
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp, 4, sizeof(int), &nrows_B ),"setting mat_mult_transp argument 4");
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp, 5, sizeof(int), &nrows_C ),"setting mat_mult_transp argument 5");
 
         cl_event event_mat_mult_transp;
 
         // Now enqueue the kernel
-        errchk(clEnqueueNDRangeKernel(  command_queue,
+        h_errchk(clEnqueueNDRangeKernel(  command_queue,
                                         kernel_mat_mult_transp,
                                         work_dim,
                                         NULL,
@@ -530,29 +249,28 @@ int main(int argc, char**argv) {
                                         &event_mat_mult,
                                         &event_mat_mult_transp), "Running the kernel");
 
-        // The number of elements we are processing at a time
-        cl_int vector_length=8;
-        cl_int vectorised_nrows_A_transp=nrows_A_transp/vector_length;
-        cl_int vectorised_nrows_B=nrows_B/vector_length;
+        // The kernel reads vector_width elements at a time and handles any remainder itself
+        cl_int nrows_A_transp_arg=nrows_A_transp;
+        cl_int nrows_B_arg=nrows_B;
 
         // Set arguments for the multiply kernel with transpose
-        errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 0, sizeof(cl_mem), &buffer_A_transp ),"setting \
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 0, sizeof(cl_mem), &buffer_A_transp ),"setting \
         mat_mult_transp_vector argument 0");
-        errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 1, sizeof(cl_mem), &buffer_B ),"setting kernel \
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 1, sizeof(cl_mem), &buffer_B ),"setting kernel \
         mat_mult_transp_vector argument 1");
-        errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 2, sizeof(cl_mem), &buffer_C ),"setting kernel \
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 2, sizeof(cl_mem), &buffer_C ),"setting kernel \
         mat_mult_transp_vector argument 2");
-        errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 3, sizeof(int), &vectorised_nrows_A_transp ),"setting \
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 3, sizeof(int), &nrows_A_transp_arg ),"setting \
         mat_mult_transp_vector argument 3");
-        errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 4, sizeof(int), &vectorised_nrows_B ),"setting \
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 4, sizeof(int), &nrows_B_arg ),"setting \
         mat_mult_transp_vector argument 4");
-        errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 5, sizeof(int), &nrows_C ),"setting \
+        h_errchk(clSetKernelArg(kernel_mat_mult_transp_vector, 5, sizeof(int), &nrows_C ),"setting \
         mat_mult_transp_vector argument 5");
 
         cl_event event_mat_mult_transp_vector;
 
         // Now enqueue the transposed and vectorised kernel
-        errchk(clEnqueueNDRangeKernel(  command_queue,
+        h_errchk(clEnqueueNDRangeKernel(  command_queue,
                                         kernel_mat_mult_transp_vector,
                                         work_dim,
                                         NULL,
@@ -637,7 +355,7 @@ int main(int argc, char**argv) {
     clFinish(command_queue);
 
     // Read memory from the buffer to the host
-    errchk(clEnqueueReadBuffer(   command_queue,
+    h_errchk(clEnqueueReadBuffer(   command_queue,
                             buffer_C,
                             CL_TRUE,
                             0,
@@ -664,25 +382,10 @@ int main(int argc, char**argv) {
     
     printf("RMS difference is %g\n", rms);
 
-    // Wait for all command queues to finish
-    // Release the command queues
-    for (int i=0; i<num_command_queues; i++) {
-        errchk(clFinish(command_queues_1d[i]),"Finishing up command queues");
-        errchk(clReleaseCommandQueue(command_queues_1d[i]), "Releasing command queues");
-    }
-
-    // Release the contexts and free the devices associated with each context
-    for (int i=0; i<num_valid_platforms; i++) {
-        errchk(clReleaseContext(contexts_1d[i]),"Releasing the context");
-        free(devices_2d[i]);
-    }
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
 
-    // Clean up memory    
-    free(command_queues_1d);
-    free(ndevices_1d);
-    free(platformIDs_1d);
-    free(contexts_1d);
-    free(devices_2d);
+    // Clean up memory
     free(array_A_1D);
     free(array_B_1D);
     free(array_C_1D);
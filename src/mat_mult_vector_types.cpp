@@ -0,0 +1,253 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_vector.hpp"
+#include "mat_helper.hpp"
+#include "philox.hpp"
+
+// mat_mult_transp_vector generated for every element type and vector width from
+// the one definition in cl_vector.hpp. The width the device prefers is marked with *.
+// Usage: mat_mult_vector_types [nrows_A ncols_A ncols_B]
+
+#define NREPEATS 5
+
+// Machine epsilon of half precision, 2^-10
+#define HALF_EPSILON 9.765625e-4
+
+// Functions to convert the float inputs to each element type and back.
+// 8-bit inputs are scaled to [-127, 127]
+void to_storage(float value, cl_half* dest) { *dest=h_float_to_half(value); }
+void to_storage(float value, cl_float* dest) { *dest=value; }
+void to_storage(float value, cl_double* dest) { *dest=(cl_double)value; }
+void to_storage(float value, cl_char* dest) { *dest=(cl_char)lrintf(value*127.0f); }
+
+double from_storage(cl_half value) { return (double)h_half_to_float(value); }
+double from_storage(cl_float value) { return (double)value; }
+double from_storage(cl_double value) { return value; }
+double from_storage(cl_char value) { return (double)value; }
+
+// Function to run mat_mult_transp_vector at every vector width for storage type T,
+// with results accumulated in ACC. A_transp is nrows_A_transp x nrows_C and B is nrows_B x ncols_C.
+// Each width must be within tol of the answer, relative to its largest magnitude.
+// Returns the number of widths that failed
+template<typename T, typename ACC>
+int run_vector_widths(  cl_command_queue command_queue,
+                        cl_context context,
+                        cl_device_id device,
+                        const char* name,
+                        cl_double tol,
+                        const float* array_A_transp_1D,
+                        const float* array_B_1D,
+                        size_t nrows_A_transp,
+                        size_t nrows_B,
+                        size_t nrows_C,
+                        size_t ncols_C) {
+
+    cl_uint preferred_width=h_preferred_vector_width<T>(device);
+    if (preferred_width==0) {
+        printf("%8s not supported by the device\n", name);
+        return 0;
+    }
+
+    size_t nelements_A=nrows_A_transp*nrows_C;
+    size_t nelements_B=nrows_B*ncols_C;
+    size_t nelements_C=nrows_C*ncols_C;
+
+    // Inputs in type T, and the reference answer from them
+    T* array_A_transp_T=(T*)malloc(nelements_A*sizeof(T));
+    T* array_B_T=(T*)malloc(nelements_B*sizeof(T));
+    for (size_t i=0; i<nelements_A; i++) to_storage(array_A_transp_1D[i], &array_A_transp_T[i]);
+    for (size_t i=0; i<nelements_B; i++) to_storage(array_B_1D[i], &array_B_T[i]);
+
+    double* array_C_answer_1D=(double*)malloc(nelements_C*sizeof(double));
+    double max_answer=0.0;
+    for (size_t i1=0; i1<ncols_C; i1++) {
+        for (size_t i0=0; i0<nrows_C; i0++) {
+            double temp=0.0;
+            for (size_t n=0; n<nrows_B; n++) {
+                temp+=from_storage(array_A_transp_T[i0*nrows_A_transp+n])*from_storage(array_B_T[i1*nrows_B+n]);
+            }
+            array_C_answer_1D[i1*nrows_C+i0]=temp;
+            max_answer=fmax(max_answer, fabs(temp));
+        }
+    }
+    ACC* array_C_1D=(ACC*)malloc(nelements_C*sizeof(ACC));
+
+    cl_int errcode;
+    cl_mem buffer_A_transp=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                            nelements_A*sizeof(T), array_A_transp_T, &errcode);
+    h_errchk(errcode, "Creating buffer_A_transp");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    nelements_B*sizeof(T), array_B_T, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_WRITE_ONLY, nelements_C*sizeof(ACC), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+
+    cl_int nrows_A_transp_arg=nrows_A_transp, nrows_B_arg=nrows_B, nrows_C_arg=nrows_C;
+    const size_t global_size[]={ nrows_C, ncols_C };
+
+    int nfailed=0;
+    for (cl_uint width=1; width<=16; width*=2) {
+        std::string source=h_vector_source<T>(mat_mult_transp_vector_kernel_source, width);
+        cl_program program=h_build_program(source.c_str(), context, device);
+        cl_kernel kernel=clCreateKernel(program, "mat_mult_transp_vector", &errcode);
+        h_errchk(errcode, "Creating Kernel mat_mult_transp_vector");
+
+        h_errchk(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_A_transp), "setting mat_mult_transp_vector argument 0");
+        h_errchk(clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer_B), "setting mat_mult_transp_vector argument 1");
+        h_errchk(clSetKernelArg(kernel, 2, sizeof(cl_mem), &buffer_C), "setting mat_mult_transp_vector argument 2");
+        h_errchk(clSetKernelArg(kernel, 3, sizeof(cl_int), &nrows_A_transp_arg), "setting mat_mult_transp_vector argument 3");
+        h_errchk(clSetKernelArg(kernel, 4, sizeof(cl_int), &nrows_B_arg), "setting mat_mult_transp_vector argument 4");
+        h_errchk(clSetKernelArg(kernel, 5, sizeof(cl_int), &nrows_C_arg), "setting mat_mult_transp_vector argument 5");
+
+        cl_double time=0.0;
+        for (int r=0; r<NREPEATS; r++) {
+            cl_event event;
+            h_errchk(clEnqueueNDRangeKernel(command_queue,
+                                            kernel,
+                                            2,
+                                            NULL,
+                                            global_size,
+                                            NULL,
+                                            0,
+                                            NULL,
+                                            &event), "Running mat_mult_transp_vector");
+            h_errchk(clWaitForEvents(1, &event), "Waiting for mat_mult_transp_vector");
+            time+=h_get_event_time_ms(event);
+            h_errchk(clReleaseEvent(event), "Releasing the event");
+        }
+        time/=NREPEATS;
+
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, nelements_C*sizeof(ACC),
+                                        array_C_1D, 0, NULL, NULL), "Reading buffer_C");
+        double max_diff=0.0;
+        for (size_t i=0; i<nelements_C; i++) {
+            max_diff=fmax(max_diff, fabs((double)array_C_1D[i]-array_C_answer_1D[i]));
+        }
+
+        cl_double err=(max_answer>0.0) ? max_diff/max_answer : max_diff;
+        cl_bool passed=(err<=tol) ? CL_TRUE : CL_FALSE;
+        if (!passed) nfailed++;
+        printf("%8s %5u%c %14f %20g %10g %8s\n", name, width, (width==preferred_width) ? '*' : ' ',
+                time, err, tol, passed ? "passed" : "FAILED");
+
+        h_errchk(clReleaseKernel(kernel), "Releasing the kernel");
+        h_errchk(clReleaseProgram(program), "Releasing the program");
+    }
+
+    h_errchk(clReleaseMemObject(buffer_A_transp), "Releasing buffer_A_transp");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    free(array_A_transp_T);
+    free(array_B_T);
+    free(array_C_answer_1D);
+    free(array_C_1D);
+    return nfailed;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    // Matrix sizes
+    size_t nrows_A=512;
+    size_t ncols_A=512;
+    size_t ncols_B=512;
+    if (argc==4) {
+        nrows_A=(size_t)atol(argv[1]);
+        ncols_A=(size_t)atol(argv[2]);
+        ncols_B=(size_t)atol(argv[3]);
+    }
+    assert(nrows_A>0 && ncols_A>0 && ncols_B>0);
+
+    size_t nrows_B=ncols_A;
+    size_t nrows_C=nrows_A;
+    size_t ncols_C=ncols_B;
+    size_t nrows_A_transp=ncols_A;
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    // A is stored transposed, both in [-1, 1]
+    float* array_A_transp_1D=(float*)malloc(nrows_A_transp*nrows_C*sizeof(float));
+    float* array_B_1D=(float*)malloc(nrows_B*ncols_C*sizeof(float));
+    h_fill_uniform_philox(array_A_transp_1D, nrows_A_transp, nrows_C, nrows_A_transp, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, nrows_B, ncols_C, nrows_B, SEED, 1, -1.0f, 1.0f);
+
+    // The answer comes from the inputs already rounded to each type, so only the accumulation
+    // differs. Errors usually grow as sqrt(K)*epsilon over K terms, K*epsilon bounds them.
+    // Half accumulates in float, half epsilon is a generous bound for it, and int8 is exact
+    cl_double K=(cl_double)nrows_B;
+    int nfailed=0;
+    printf("%8s %6s %14s %20s %10s %8s\n", "type", "width", "time (ms)", "relative difference", "tolerance", "check");
+    nfailed+=run_vector_widths<cl_half, cl_float>(command_queue, context, device, "half", HALF_EPSILON,
+            array_A_transp_1D, array_B_1D, nrows_A_transp, nrows_B, nrows_C, ncols_C);
+    nfailed+=run_vector_widths<cl_float, cl_float>(command_queue, context, device, "float", K*FLT_EPSILON,
+            array_A_transp_1D, array_B_1D, nrows_A_transp, nrows_B, nrows_C, ncols_C);
+    nfailed+=run_vector_widths<cl_double, cl_double>(command_queue, context, device, "double", K*DBL_EPSILON,
+            array_A_transp_1D, array_B_1D, nrows_A_transp, nrows_B, nrows_C, ncols_C);
+    nfailed+=run_vector_widths<cl_char, cl_int>(command_queue, context, device, "int8", 0.0,
+            array_A_transp_1D, array_B_1D, nrows_A_transp, nrows_B, nrows_C, ncols_C);
+
+    free(array_A_transp_1D);
+    free(array_B_1D);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d vector widths FAILED their check\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <limits>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_reduce.hpp"
+#include "philox.hpp"
+
+// Sum, min, max and argmax of a device buffer with the reduction kernels, 
+// against reading the buffer back and reducing it on the host, for each element type.
+// Usage: reduce [n] for n elements
+
+// Each path runs this many times and the fastest run is kept
+#define NREPEATS 5
+
+// Function to run every reduction for one element type and print a row for each,
+// returns the number of reductions that failed their check
+template<typename T>
+int run_type(   cl_command_queue command_queue,
+                cl_context context,
+                cl_device_id device,
+                h_type type,
+                const char* type_name,
+                size_t n,
+                float lower,
+                float upper) {
+
+    using namespace std::chrono;
+    cl_int errcode;
+
+    // Integer types get whole numbers in [lower, upper]
+    float* array_uniform_1D=(float*)malloc(n*sizeof(float));
+    h_fill_uniform_philox(array_uniform_1D, n, 1, n, SEED, (cl_uint)type, lower, upper);
+    T* array_src_1D=(T*)malloc(n*sizeof(T));
+    for (size_t i=0; i<n; i++) {
+        array_src_1D[i]=(type==H_FLOAT || type==H_DOUBLE) ? (T)array_uniform_1D[i] : (T)floorf(array_uniform_1D[i]);
+    }
+    T* array_readback_1D=(T*)malloc(n*sizeof(T));
+
+    cl_mem buffer_src=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n*sizeof(T), array_src_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_src");
+    cl_mem buffer_result=clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(T), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_result");
+    cl_mem buffer_index=clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_index");
+
+    h_reduce_plan plan=h_create_reduce_plan(context, device, type);
+
+    // Only floating point sums round, min, max and argmax are exact. Summation in a
+    // different order usually grows the error as sqrt(n)*epsilon of the sum of magnitudes,
+    // and epsilon is zero for the integer types
+    cl_double tol_sum=sqrt((cl_double)n)*(cl_double)std::numeric_limits<T>::epsilon();
+    int nfailed=0;
+
+    const char* op_names[]={ "sum", "min", "max", "argmax" };
+    for (int op=0; op<4; op++) {
+        cl_double time_device=INFINITY, time_host=INFINITY;
+        T device_value=0, host_value=0;
+        cl_int device_index=-1, host_index=-1;
+        double sum_abs=0.0;
+
+        for (int r=0; r<NREPEATS; r++) {
+            // On the device, only the result crosses to the host
+            high_resolution_clock::time_point start=high_resolution_clock::now();
+            cl_event event;
+            if (op<3) {
+                event=h_enqueue_reduce(command_queue, &plan, (h_reduce_op)op, n, buffer_src, buffer_result, 0, NULL);
+            } else {
+                event=h_enqueue_argreduce(  command_queue, &plan, H_REDUCE_MAX, n, buffer_src, buffer_result, 
+                                            buffer_index, 0, NULL);
+            }
+            h_errchk(clEnqueueReadBuffer(   command_queue, buffer_result, CL_TRUE, 0, sizeof(T), 
+                                            &device_value, 1, &event, NULL), "Reading the result");
+            if (op==3) {
+                h_errchk(clEnqueueReadBuffer(   command_queue, buffer_index, CL_TRUE, 0, sizeof(cl_int), 
+                                                &device_index, 0, NULL, NULL), "Reading the index");
+            }
+            h_errchk(clReleaseEvent(event), "Releasing the event");
+            time_device=fmin(time_device, h_ms_since(start));
+
+            // On the host, the whole buffer is read back first
+            start=high_resolution_clock::now();
+            h_errchk(clEnqueueReadBuffer(   command_queue, buffer_src, CL_TRUE, 0, n*sizeof(T), 
+                                            array_readback_1D, 0, NULL, NULL), "Reading buffer_src");
+            host_value=(op==0) ? (T)0 : array_readback_1D[0];
+            host_index=0;
+            for (size_t i=0; i<n; i++) {
+                T value=array_readback_1D[i];
+                if (op==0) host_value+=value;
+                else if (op==1 && value<host_value) host_value=value;
+                else if (op>=2 && value>host_value) {
+                    host_value=value;
+                    host_index=(cl_int)i;
+                }
+            }
+            time_host=fmin(time_host, h_ms_since(start));
+        }
+
+        // Sums are checked against a double precision sum, relative to the sum of magnitudes
+        double reference=(double)host_value;
+        if (op==0) {
+            reference=0.0;
+            for (size_t i=0; i<n; i++) {
+                reference+=(double)array_src_1D[i];
+                sum_abs+=fabs((double)array_src_1D[i]);
+            }
+        }
+        double err=fabs((double)device_value-reference);
+        if (op==0 && sum_abs>0.0) err/=sum_abs;
+        cl_bool passed=(err<=((op==0) ? tol_sum : 0.0)) ? CL_TRUE : CL_FALSE;
+        if (op==3 && device_index!=host_index) {
+            printf("argmax index %d from the device does not match %d from the host\n", device_index, host_index);
+            passed=CL_FALSE;
+        }
+        if (!passed) nfailed++;
+
+        printf("%8s %8s %14f %14f %10.2f %14g %8s\n", type_name, op_names[op], time_device, time_host, 
+                time_host/time_device, err, passed ? "passed" : "FAILED");
+    }
+
+    h_release_reduce_plan(&plan);
+    h_errchk(clReleaseMemObject(buffer_src), "Releasing buffer_src");
+    h_errchk(clReleaseMemObject(buffer_result), "Releasing buffer_result");
+    h_errchk(clReleaseMemObject(buffer_index), "Releasing buffer_index");
+    free(array_uniform_1D);
+    free(array_src_1D);
+    free(array_readback_1D);
+    return nfailed;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t n=1<<24;
+    if (argc>1) n=(size_t)atol(argv[1]);
+    assert(n>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    char std_opt[32];
+    printf("Reducing %zu elements, %s sub-groups\n", n, 
+            h_device_has_subgroups(device, std_opt, sizeof(std_opt)) ? "with" : "without");
+    printf("%8s %8s %14s %14s %10s %14s %8s\n", "type", "op", "device (ms)", "host (ms)", "speedup", "error", "check");
+
+    // Small integers so that the sums fit in 32 bits
+    int nfailed=0;
+    nfailed+=run_type<cl_float>(command_queue, context, device, H_FLOAT, "float", n, -1.0f, 1.0f);
+    if (h_device_supports_double(device)) {
+        nfailed+=run_type<cl_double>(command_queue, context, device, H_DOUBLE, "double", n, -1.0f, 1.0f);
+    }
+    nfailed+=run_type<cl_int>(command_queue, context, device, H_INT, "int", n, -100.0f, 100.0f);
+    nfailed+=run_type<cl_uint>(command_queue, context, device, H_UINT, "uint", n, 0.0f, 100.0f);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d reductions FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_scan.hpp"
+#include "philox.hpp"
+
+// Exclusive and inclusive scans of a device buffer, checked against the host, then
+// stream compaction of a matrix on the device against reading the whole matrix 
+// back and filtering it on the host. Only the surviving entries are read back.
+// Usage: scan [n] [threshold] for n elements, keeping those with magnitude above threshold
+
+// Each path runs this many times and the fastest run is kept
+#define NREPEATS 5
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t n=1<<24;
+    cl_float threshold=0.99f;
+    if (argc>1) n=(size_t)atol(argv[1]);
+    if (argc>2) threshold=(cl_float)atof(argv[2]);
+    assert(n>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_scan_plan plan_float=h_create_scan_plan(context, device, H_FLOAT);
+    h_scan_plan plan_uint=h_create_scan_plan(context, device, H_UINT);
+
+    cl_int errcode;
+
+    // Scans of small whole numbers, so the sums are exact
+    cl_uint* array_src_1D=(cl_uint*)malloc(n*sizeof(cl_uint));
+    cl_uint* array_dest_1D=(cl_uint*)malloc(n*sizeof(cl_uint));
+    float* array_uniform_1D=(float*)malloc(n*sizeof(float));
+    h_fill_uniform_philox(array_uniform_1D, n, 1, n, SEED, 0, 0.0f, 16.0f);
+    for (size_t i=0; i<n; i++) array_src_1D[i]=(cl_uint)array_uniform_1D[i];
+
+    cl_mem buffer_src=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n*sizeof(cl_uint), array_src_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_src");
+    cl_mem buffer_dest=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_dest");
+
+    // Scans and compaction are exact, so any error fails
+    int nfailed=0;
+    printf("%12s %14s %10s %8s\n", "scan", "time (ms)", "errors", "check");
+    for (int inclusive=0; inclusive<2; inclusive++) {
+        cl_double time=INFINITY;
+        for (int r=0; r<NREPEATS; r++) {
+            high_resolution_clock::time_point start=high_resolution_clock::now();
+            cl_event event=h_enqueue_scan(command_queue, &plan_uint, inclusive ? CL_TRUE : CL_FALSE, n, 
+                                            buffer_src, buffer_dest, 0, NULL);
+            h_errchk(clWaitForEvents(1, &event), "Waiting for the scan");
+            time=fmin(time, h_ms_since(start));
+            h_errchk(clReleaseEvent(event), "Releasing the event");
+        }
+
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_dest, CL_TRUE, 0, n*sizeof(cl_uint), 
+                                        array_dest_1D, 0, NULL, NULL), "Reading buffer_dest");
+        size_t nerrors=0;
+        cl_uint running=0;
+        for (size_t i=0; i<n; i++) {
+            if (inclusive) running+=array_src_1D[i];
+            if (array_dest_1D[i]!=running) nerrors++;
+            if (!inclusive) running+=array_src_1D[i];
+        }
+        if (nerrors>0) nfailed++;
+        printf("%12s %14f %10zu %8s\n", inclusive ? "inclusive" : "exclusive", time, nerrors, 
+                (nerrors==0) ? "passed" : "FAILED");
+    }
+
+    // Compaction of a matrix with entries in [-1, 1]
+    float* array_C_1D=array_uniform_1D;
+    h_fill_uniform_philox(array_C_1D, n, 1, n, SEED, 1, -1.0f, 1.0f);
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n*sizeof(cl_float), array_C_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+    cl_mem buffer_values=clCreateBuffer(context, CL_MEM_WRITE_ONLY, n*sizeof(cl_float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_values");
+    cl_mem buffer_indices=clCreateBuffer(context, CL_MEM_WRITE_ONLY, n*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_indices");
+    cl_mem buffer_count=clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_count");
+
+    float* array_values_1D=(float*)malloc(n*sizeof(float));
+    cl_uint* array_indices_1D=array_dest_1D;
+    float* array_readback_1D=(float*)malloc(n*sizeof(float));
+    float* array_host_values_1D=(float*)malloc(n*sizeof(float));
+    cl_uint* array_host_indices_1D=array_src_1D;
+
+    cl_double time_device=INFINITY, time_host=INFINITY;
+    cl_uint count=0;
+    size_t host_count=0;
+    for (int r=0; r<NREPEATS; r++) {
+        // On the device, read the count and then only the survivors
+        high_resolution_clock::time_point start=high_resolution_clock::now();
+        cl_event event=h_enqueue_compact(   command_queue, &plan_float, &plan_uint, n, buffer_C, &threshold, CL_TRUE,
+                                            buffer_values, buffer_indices, buffer_count, 0, NULL);
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_count, CL_TRUE, 0, sizeof(cl_uint), 
+                                        &count, 1, &event, NULL), "Reading buffer_count");
+        h_errchk(clReleaseEvent(event), "Releasing the event");
+        if (count>0) {
+            h_errchk(clEnqueueReadBuffer(   command_queue, buffer_values, CL_FALSE, 0, count*sizeof(cl_float), 
+                                            array_values_1D, 0, NULL, NULL), "Reading buffer_values");
+            h_errchk(clEnqueueReadBuffer(   command_queue, buffer_indices, CL_TRUE, 0, count*sizeof(cl_uint), 
+                                            array_indices_1D, 0, NULL, NULL), "Reading buffer_indices");
+        }
+        time_device=fmin(time_device, h_ms_since(start));
+
+        // On the host, read everything back and filter it
+        start=high_resolution_clock::now();
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, n*sizeof(cl_float), 
+                                        array_readback_1D, 0, NULL, NULL), "Reading buffer_C");
+        host_count=0;
+        for (size_t i=0; i<n; i++) {
+            if (fabsf(array_readback_1D[i])>threshold) {
+                array_host_values_1D[host_count]=array_readback_1D[i];
+                array_host_indices_1D[host_count]=(cl_uint)i;
+                host_count++;
+            }
+        }
+        time_host=fmin(time_host, h_ms_since(start));
+    }
+
+    size_t nerrors=(count==host_count) ? 0 : 1;
+    for (size_t i=0; i<std::min((size_t)count, host_count); i++) {
+        if (array_values_1D[i]!=array_host_values_1D[i] || array_indices_1D[i]!=array_host_indices_1D[i]) nerrors++;
+    }
+    if (nerrors>0) nfailed++;
+    printf("Compaction kept %u of %zu entries with magnitude above %g, %zu errors, %s\n", 
+            count, n, threshold, nerrors, (nerrors==0) ? "passed" : "FAILED");
+    printf("Device compaction took %f ms, host readback and filter took %f ms\n", time_device, time_host);
+
+    h_errchk(clReleaseMemObject(buffer_src), "Releasing buffer_src");
+    h_errchk(clReleaseMemObject(buffer_dest), "Releasing buffer_dest");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseMemObject(buffer_values), "Releasing buffer_values");
+    h_errchk(clReleaseMemObject(buffer_indices), "Releasing buffer_indices");
+    h_errchk(clReleaseMemObject(buffer_count), "Releasing buffer_count");
+    h_release_scan_plan(&plan_float);
+    h_release_scan_plan(&plan_uint);
+    free(array_src_1D);
+    free(array_dest_1D);
+    free(array_uniform_1D);
+    free(array_values_1D);
+    free(array_readback_1D);
+    free(array_host_values_1D);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d checks FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
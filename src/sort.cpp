@@ -0,0 +1,217 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_sort.hpp"
+#include "philox.hpp"
+
+// Radix sort on the device of unsigned keys, unsigned keys with values, and float 
+// scores in descending order with their positions as values, against std::sort 
+// on the host. Throughput counts only the sort, the keys stay on the device.
+// Usage: sort [n] for n keys
+
+// Each sort runs this many times and the fastest run is kept
+#define NREPEATS 5
+
+// A key and its value, for sorting on the host
+typedef struct {
+    cl_uint key;
+    cl_uint value;
+} key_value;
+
+// Function to run one sort on the device and on the host and print a row for it. 
+// keys holds the bits of the keys, which are compared as key_type. Returns CL_TRUE
+// when the device order matches the host's exactly
+cl_bool run_sort(   cl_command_queue command_queue,
+                    cl_context context,
+                    h_sort_plan* plan,
+                    const char* name,
+                    h_type key_type,
+                    cl_bool descending,
+                    cl_bool with_values,
+                    const cl_uint* keys,
+                    size_t n) {
+
+    using namespace std::chrono;
+    cl_int errcode;
+
+    // Values are the original positions of the keys
+    cl_uint* array_values_1D=(cl_uint*)malloc(n*sizeof(cl_uint));
+    for (size_t i=0; i<n; i++) array_values_1D[i]=(cl_uint)i;
+
+    cl_mem buffer_keys=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_keys");
+    cl_mem buffer_values=NULL;
+    if (with_values) {
+        buffer_values=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &errcode);
+        h_errchk(errcode, "Creating buffer_values");
+    }
+
+    cl_double time_device=INFINITY;
+    for (int r=0; r<NREPEATS; r++) {
+        h_errchk(clEnqueueWriteBuffer(  command_queue, buffer_keys, CL_TRUE, 0, n*sizeof(cl_uint), 
+                                        keys, 0, NULL, NULL), "Writing buffer_keys");
+        if (with_values) {
+            h_errchk(clEnqueueWriteBuffer(  command_queue, buffer_values, CL_TRUE, 0, n*sizeof(cl_uint), 
+                                            array_values_1D, 0, NULL, NULL), "Writing buffer_values");
+        }
+        high_resolution_clock::time_point start=high_resolution_clock::now();
+        cl_event event=h_enqueue_sort(  command_queue, plan, key_type, descending, n, 
+                                        buffer_keys, buffer_values, 0, NULL);
+        h_errchk(clWaitForEvents(1, &event), "Waiting for the sort");
+        time_device=fmin(time_device, h_ms_since(start));
+        h_errchk(clReleaseEvent(event), "Releasing the event");
+    }
+
+    // The same sort on the host, std::stable_sort when values must keep their order
+    key_value* array_host_1D=(key_value*)malloc(n*sizeof(key_value));
+    auto less=[key_type, descending](const key_value& a, const key_value& b) {
+        bool result;
+        if (key_type==H_FLOAT) {
+            float fa, fb;
+            memcpy(&fa, &a.key, sizeof(float));
+            memcpy(&fb, &b.key, sizeof(float));
+            result=descending ? (fb<fa) : (fa<fb);
+        } else if (key_type==H_INT) {
+            result=descending ? ((cl_int)b.key<(cl_int)a.key) : ((cl_int)a.key<(cl_int)b.key);
+        } else {
+            result=descending ? (b.key<a.key) : (a.key<b.key);
+        }
+        return result;
+    };
+    cl_double time_host=INFINITY;
+    for (int r=0; r<NREPEATS; r++) {
+        for (size_t i=0; i<n; i++) {
+            array_host_1D[i].key=keys[i];
+            array_host_1D[i].value=(cl_uint)i;
+        }
+        high_resolution_clock::time_point start=high_resolution_clock::now();
+        if (with_values) std::stable_sort(array_host_1D, array_host_1D+n, less);
+        else std::sort(array_host_1D, array_host_1D+n, less);
+        time_host=fmin(time_host, h_ms_since(start));
+    }
+
+    // Check against the host
+    cl_uint* array_keys_1D=(cl_uint*)malloc(n*sizeof(cl_uint));
+    h_errchk(clEnqueueReadBuffer(   command_queue, buffer_keys, CL_TRUE, 0, n*sizeof(cl_uint), 
+                                    array_keys_1D, 0, NULL, NULL), "Reading buffer_keys");
+    if (with_values) {
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_values, CL_TRUE, 0, n*sizeof(cl_uint), 
+                                        array_values_1D, 0, NULL, NULL), "Reading buffer_values");
+    }
+    size_t nerrors=0;
+    for (size_t i=0; i<n; i++) {
+        if (array_keys_1D[i]!=array_host_1D[i].key) nerrors++;
+        else if (with_values && array_values_1D[i]!=array_host_1D[i].value) nerrors++;
+    }
+
+    printf("%22s %14f %14.3e %14f %14.3e %10zu %8s\n", name, 
+            time_device, (double)n/(time_device*1.0e-3), 
+            time_host, (double)n/(time_host*1.0e-3), nerrors, (nerrors==0) ? "passed" : "FAILED");
+
+    h_errchk(clReleaseMemObject(buffer_keys), "Releasing buffer_keys");
+    if (with_values) h_errchk(clReleaseMemObject(buffer_values), "Releasing buffer_values");
+    free(array_values_1D);
+    free(array_host_1D);
+    free(array_keys_1D);
+    return (nerrors==0) ? CL_TRUE : CL_FALSE;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t n=1<<24;
+    if (argc>1) n=(size_t)atol(argv[1]);
+    assert(n>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_sort_plan plan=h_create_sort_plan(context, device);
+
+    // Random 32-bit keys, and scores in [-1, 1] with plenty of ties
+    float* array_uniform_1D=(float*)malloc(n*sizeof(float));
+    cl_uint* array_keys_1D=(cl_uint*)malloc(n*sizeof(cl_uint));
+    cl_uint* array_scores_1D=(cl_uint*)malloc(n*sizeof(cl_uint));
+    h_fill_uniform_philox(array_uniform_1D, n, 1, n, SEED, 0, 0.0f, 1.0f);
+    for (size_t i=0; i<n; i++) array_keys_1D[i]=(cl_uint)(array_uniform_1D[i]*4294967040.0f);
+    h_fill_uniform_philox(array_uniform_1D, n, 1, n, SEED, 1, -1.0f, 1.0f);
+    for (size_t i=0; i<n; i++) {
+        // -0 would sort apart from 0 on the device but not on the host
+        float score=roundf(array_uniform_1D[i]*1000.0f)/1000.0f;
+        if (score==0.0f) score=0.0f;
+        memcpy(&array_scores_1D[i], &score, sizeof(float));
+    }
+
+    printf("Sorting %zu keys\n", n);
+    printf("%22s %14s %14s %14s %14s %10s %8s\n", 
+            "sort", "device (ms)", "device keys/s", "host (ms)", "host keys/s", "errors", "check");
+    int nfailed=0;
+    if (!run_sort(command_queue, context, &plan, "uint keys", H_UINT, CL_FALSE, CL_FALSE, array_keys_1D, n)) nfailed++;
+    if (!run_sort(command_queue, context, &plan, "uint keys and values", H_UINT, CL_FALSE, CL_TRUE, array_keys_1D, n)) nfailed++;
+    if (!run_sort(command_queue, context, &plan, "float scores, descending", H_FLOAT, CL_TRUE, CL_TRUE, array_scores_1D, n)) nfailed++;
+
+    h_release_sort_plan(&plan);
+    free(array_uniform_1D);
+    free(array_keys_1D);
+    free(array_scores_1D);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d sorts FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "cl_sparse.hpp"
+#include "philox.hpp"
+
+// Sparse times dense matrix products C=A*B with A in CSR format and a tall dense B, 
+// against the dense GEMM on the same matrices and against one CSR SpMV per column 
+// of B, which reads A once for every column instead of once for SPMM_COLS columns.
+// Usage: sparse_spmm [n] [ncols_B] for generated n x n matrices A
+
+// Each kernel runs this many times and the fastest run is kept
+#define NREPEATS 5
+
+// Function to run every product on one dense matrix A and print a row for each,
+// returns the number of products outside the tolerance
+int run_matrix(    cl_command_queue command_queue,
+                   cl_context context,
+                   h_gemm_plan* plan_gemm,
+                   h_sparse_plan* plan_sparse,
+                   const float* array_A_1D,
+                   size_t n,
+                   const float* array_B_1D,
+                   size_t ncols_B) {
+
+    cl_int errcode;
+
+    h_csr_matrix csr=h_dense_to_csr(array_A_1D, n, n, n);
+
+    // The answer from the CSR matrix in double precision
+    double* answer=(double*)malloc(n*ncols_B*sizeof(double));
+    double max_answer=h_csr_multiply_host(&csr, array_B_1D, ncols_B, answer);
+
+    float* array_C_1D=(float*)malloc(n*ncols_B*sizeof(float));
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n*n*sizeof(float), (void*)array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_B=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n*ncols_B*sizeof(float), (void*)array_B_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_B");
+    cl_mem buffer_C=clCreateBuffer(context, CL_MEM_READ_WRITE, n*ncols_B*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_C");
+    h_csr_buffers csr_buffers=h_create_csr_buffers(context, &csr);
+
+    // Single columns of B and C for the SpMV path
+    cl_mem buffer_x=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_x");
+    cl_mem buffer_y=clCreateBuffer(context, CL_MEM_READ_WRITE, n*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_y");
+
+    // Every path sums at most n products per element, relative to the largest
+    // answer, and n*epsilon leaves room for the usual sqrt(n)*epsilon growth
+    cl_double tol=(cl_double)n*FLT_EPSILON;
+    int nfailed=0;
+
+    const char* path_names[]={ "dense gemm", "csr spmv", "csr spmm" };
+    for (int path=0; path<3; path++) {
+        cl_double time=INFINITY;
+        for (int r=0; r<NREPEATS; r++) {
+            if (path==0) {
+                h_keep_fastest(h_enqueue_sgemm(   command_queue, plan_gemm, H_COL_MAJOR, H_NO_TRANS, H_NO_TRANS,
+                                                  n, ncols_B, n, 1.0f, buffer_A, 0, n, buffer_B, 0, n,
+                                                  0.0f, buffer_C, 0, n, 0, NULL), &time);
+            } else if (path==1) {
+                // Only the SpMV kernels are timed, not the copies of the columns
+                cl_double total=0.0;
+                for (size_t j=0; j<ncols_B; j++) {
+                    cl_double column_time=INFINITY;
+                    h_errchk(clEnqueueCopyBuffer(   command_queue, buffer_B, buffer_x, j*n*sizeof(float), 0,
+                                                    n*sizeof(float), 0, NULL, NULL), "Copying a column of B");
+                    h_keep_fastest(h_enqueue_spmv_csr(command_queue, plan_sparse, &csr_buffers, CL_TRUE,
+                                                      buffer_x, buffer_y, 0, NULL), &column_time);
+                    h_errchk(clEnqueueCopyBuffer(   command_queue, buffer_y, buffer_C, 0, j*n*sizeof(float),
+                                                    n*sizeof(float), 0, NULL, NULL), "Copying a column of C");
+                    total+=column_time;
+                }
+                time=fmin(time, total);
+            } else {
+                h_keep_fastest(h_enqueue_spmm_csr(command_queue, plan_sparse, &csr_buffers, ncols_B, 
+                                                  buffer_B, n, buffer_C, n, 0, NULL), &time);
+            }
+        }
+
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_C, CL_TRUE, 0, n*ncols_B*sizeof(float), 
+                                        array_C_1D, 0, NULL, NULL), "Reading buffer_C to host");
+        double max_err=0.0;
+        for (size_t i=0; i<n*ncols_B; i++) {
+            max_err=fmax(max_err, fabs(array_C_1D[i]-answer[i]));
+        }
+
+        // Useful work only, the dense GEMM does 2*n*n*ncols_B operations
+        cl_double err=(max_answer>0.0) ? max_err/max_answer : max_err;
+        cl_bool passed=(err<=tol) ? CL_TRUE : CL_FALSE;
+        if (!passed) nfailed++;
+        printf("%10.4f %10zu %12s %12f %10.2f %14g %8s\n", 
+                (double)csr.nnz/((double)n*(double)n), csr.nnz, path_names[path], 
+                time, 2.0e-9*(double)csr.nnz*(double)ncols_B/(time*1.0e-3), 
+                err, passed ? "passed" : "FAILED");
+    }
+
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_B), "Releasing buffer_B");
+    h_errchk(clReleaseMemObject(buffer_C), "Releasing buffer_C");
+    h_errchk(clReleaseMemObject(buffer_x), "Releasing buffer_x");
+    h_errchk(clReleaseMemObject(buffer_y), "Releasing buffer_y");
+    h_release_csr_buffers(&csr_buffers);
+    h_free_csr(&csr);
+    free(array_C_1D);
+    free(answer);
+    return nfailed;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t n=4096, ncols_B=64;
+    if (argc>1) n=(size_t)atol(argv[1]);
+    if (argc>2) ncols_B=(size_t)atol(argv[2]);
+    assert(n>0 && ncols_B>0);
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_gemm_plan plan_gemm=h_create_gemm_plan(context, device);
+    h_sparse_plan plan_sparse=h_create_sparse_plan(context, device);
+
+    printf("A is %zu x %zu, B is %zu x %zu\n", n, n, n, ncols_B);
+    int nfailed=0;
+    printf("%10s %10s %12s %12s %10s %14s %8s\n", "density", "nnz", "path", "time (ms)", "GFLOP/s", "relative error", "check");
+
+    // Generated matrices at a range of average densities
+    cl_double densities[]={ 0.001, 0.01, 0.05, 0.2 };
+    float* array_A_1D=(float*)malloc(n*n*sizeof(float));
+    float* array_keep_1D=(float*)malloc(n*n*sizeof(float));
+    float* array_B_1D=(float*)malloc(n*ncols_B*sizeof(float));
+    h_fill_uniform_philox(array_A_1D, n, n, n, SEED, 0, -1.0f, 1.0f);
+    h_fill_uniform_philox(array_B_1D, n, ncols_B, n, SEED, 2, -1.0f, 1.0f);
+    for (size_t d=0; d<sizeof(densities)/sizeof(cl_double); d++) {
+        h_fill_graded_sparse(array_keep_1D, array_A_1D, n, densities[d], SEED, 1);
+        nfailed+=run_matrix(command_queue, context, &plan_gemm, &plan_sparse, array_keep_1D, n, array_B_1D, ncols_B);
+    }
+    free(array_A_1D);
+    free(array_keep_1D);
+    free(array_B_1D);
+
+    h_release_gemm_plan(&plan_gemm);
+    h_release_sparse_plan(&plan_sparse);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d products FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+/*
+
+MIT License
+
+Copyright (c) 2018 Dr. Toby Potter and contributors from Pelagos Consulting and Education
+Contact the author at tobympotter@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef __APPLE__
+    #include "OpenCL/opencl.h"
+#else
+    #include "CL/cl.hpp"
+#endif
+
+#include "cl_helper.hpp"
+#include "cl_gemm.hpp"
+#include "cl_gemv.hpp"
+#include "cl_sparse.hpp"
+#include "philox.hpp"
+
+// Sparse matrix-vector products in CSR and SELL-C-sigma formats, against the dense
+// GEMV on the same matrix, across a range of sparsity levels. Rows get longer down 
+// the matrix, so that row lengths vary as they do in real sparse matrices.
+// Usage: sparse_spmv [n] for generated n x n matrices, 
+//        sparse_spmv file.dat nrows ncols for a dense matrix in Fortran ordering from file
+
+// Each kernel runs this many times and the fastest run is kept
+#define NREPEATS 5
+// Sorting window for SELL-C-sigma, in slices
+#define SELL_SIGMA_SLICES 32
+
+// Function to run every product on one dense matrix and print a row for each,
+// returns the number of products outside the tolerance
+int run_matrix(    cl_command_queue command_queue,
+                   cl_context context,
+                   cl_device_id device,
+                   h_gemv_plan* plan_gemv,
+                   h_sparse_plan* plan_sparse,
+                   const float* array_A_1D,
+                   size_t nrows,
+                   size_t ncols) {
+
+    cl_int errcode;
+
+    // Convert to the sparse formats
+    h_csr_matrix csr=h_dense_to_csr(array_A_1D, nrows, ncols, nrows);
+    size_t C=h_sell_chunk_size(device);
+    h_sell_matrix sell=h_csr_to_sell(&csr, C, C*SELL_SIGMA_SLICES);
+
+    float* array_x_1D=(float*)malloc(ncols*sizeof(float));
+    float* array_y_1D=(float*)malloc(nrows*sizeof(float));
+    h_fill_uniform_philox(array_x_1D, ncols, 1, ncols, SEED, 2, -1.0f, 1.0f);
+
+    // The answer from the CSR matrix in double precision
+    double* answer=(double*)malloc(nrows*sizeof(double));
+    double max_answer=h_csr_multiply_host(&csr, array_x_1D, 1, answer);
+
+    cl_mem buffer_A=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nrows*ncols*sizeof(float), (void*)array_A_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_A");
+    cl_mem buffer_x=clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ncols*sizeof(float), array_x_1D, &errcode);
+    h_errchk(errcode, "Creating buffer_x");
+    cl_mem buffer_y=clCreateBuffer(context, CL_MEM_READ_WRITE, nrows*sizeof(float), NULL, &errcode);
+    h_errchk(errcode, "Creating buffer_y");
+    h_csr_buffers csr_buffers=h_create_csr_buffers(context, &csr);
+    h_sell_buffers sell_buffers=h_create_sell_buffers(context, &sell);
+
+    // Every path sums at most ncols products per row, relative to the largest
+    // answer, and ncols*epsilon leaves room for the usual sqrt(ncols)*epsilon growth
+    cl_double tol=(cl_double)ncols*FLT_EPSILON;
+    int nfailed=0;
+
+    const char* path_names[]={ "dense gemv", "csr scalar", "csr vector", "sell" };
+    for (int path=0; path<4; path++) {
+        cl_double time=INFINITY;
+        for (int r=0; r<NREPEATS; r++) {
+            cl_event event;
+            if (path==0) {
+                event=h_enqueue_sgemv(  command_queue, plan_gemv, H_COL_MAJOR, H_NO_TRANS, nrows, ncols,
+                                        1.0f, buffer_A, 0, nrows, buffer_x, 0, 0.0f, buffer_y, 0,
+                                        0, NULL);
+            } else if (path<3) {
+                event=h_enqueue_spmv_csr(command_queue, plan_sparse, &csr_buffers, (path==2) ? CL_TRUE : CL_FALSE,
+                                        buffer_x, buffer_y, 0, NULL);
+            } else {
+                event=h_enqueue_spmv_sell(command_queue, plan_sparse, &sell_buffers, buffer_x, buffer_y, 0, NULL);
+            }
+            h_keep_fastest(event, &time);
+        }
+
+        h_errchk(clEnqueueReadBuffer(   command_queue, buffer_y, CL_TRUE, 0, nrows*sizeof(float), 
+                                        array_y_1D, 0, NULL, NULL), "Reading buffer_y to host");
+        double max_err=0.0;
+        for (size_t i=0; i<nrows; i++) {
+            max_err=fmax(max_err, fabs(array_y_1D[i]-answer[i]));
+        }
+
+        cl_double err=(max_answer>0.0) ? max_err/max_answer : max_err;
+        cl_bool passed=(err<=tol) ? CL_TRUE : CL_FALSE;
+        if (!passed) nfailed++;
+        printf("%10.4f %10zu %12s %12f %10.2f %14g %8s\n", 
+                (double)csr.nnz/((double)nrows*(double)ncols), csr.nnz, path_names[path], 
+                time, 2.0e-9*(double)csr.nnz/(time*1.0e-3), err, passed ? "passed" : "FAILED");
+    }
+    printf("SELL-C-sigma with C=%zu stores %zu elements for %zu non-zeros\n", C, sell.nelements, csr.nnz);
+
+    h_errchk(clReleaseMemObject(buffer_A), "Releasing buffer_A");
+    h_errchk(clReleaseMemObject(buffer_x), "Releasing buffer_x");
+    h_errchk(clReleaseMemObject(buffer_y), "Releasing buffer_y");
+    h_release_csr_buffers(&csr_buffers);
+    h_release_sell_buffers(&sell_buffers);
+    h_free_csr(&csr);
+    h_free_sell(&sell);
+    free(array_x_1D);
+    free(array_y_1D);
+    free(answer);
+    return nfailed;
+}
+
+int main(int argc, char**argv) {
+
+    using namespace std::chrono;
+
+    // Start the clock
+    high_resolution_clock::time_point time1 = high_resolution_clock::now();
+
+    size_t n=4096;
+    const char* filename=NULL;
+    size_t nrows_file=0, ncols_file=0;
+    if (argc==2) {
+        n=(size_t)atol(argv[1]);
+        assert(n>0);
+    } else if (argc==4) {
+        filename=argv[1];
+        nrows_file=(size_t)atol(argv[2]);
+        ncols_file=(size_t)atol(argv[3]);
+        assert(nrows_file>0 && ncols_file>0);
+    }
+
+    // Select the first device, with a profiling-enabled, in-order command queue
+    h_device_env env=h_acquire_device_env(CL_DEVICE_TYPE_ALL, CL_TRUE);
+    cl_command_queue command_queue=env.command_queue;
+    cl_context context=env.context;
+    cl_device_id device=env.device;
+
+    h_gemv_plan plan_gemv=h_create_gemv_plan(context, device);
+    h_sparse_plan plan_sparse=h_create_sparse_plan(context, device);
+
+    int nfailed=0;
+    printf("%10s %10s %12s %12s %10s %14s %8s\n", "density", "nnz", "path", "time (ms)", "GFLOP/s", "relative error", "check");
+
+    if (filename!=NULL) {
+        // A dense matrix from file, as in array_A_1D.dat
+        size_t nbytes;
+        float* array_A_1D=(float*)h_read_file(filename, "rb", &nbytes);
+        assert(nbytes==nrows_file*ncols_file*sizeof(float));
+        nfailed+=run_matrix(command_queue, context, device, &plan_gemv, &plan_sparse, array_A_1D, nrows_file, ncols_file);
+        free(array_A_1D);
+    } else {
+        // Generated matrices at a range of average densities
+        cl_double densities[]={ 0.001, 0.01, 0.05, 0.2 };
+        float* array_A_1D=(float*)malloc(n*n*sizeof(float));
+        float* array_keep_1D=(float*)malloc(n*n*sizeof(float));
+        h_fill_uniform_philox(array_A_1D, n, n, n, SEED, 0, -1.0f, 1.0f);
+        for (size_t d=0; d<sizeof(densities)/sizeof(cl_double); d++) {
+            h_fill_graded_sparse(array_keep_1D, array_A_1D, n, densities[d], SEED, 1);
+            nfailed+=run_matrix(command_queue, context, device, &plan_gemv, &plan_sparse, array_keep_1D, n, n);
+        }
+        free(array_A_1D);
+        free(array_keep_1D);
+    }
+
+    h_release_gemv_plan(&plan_gemv);
+    h_release_sparse_plan(&plan_sparse);
+
+    // Release the command queues, contexts and devices
+    h_release_device_env(&env);
+
+    // Stop the clock
+    high_resolution_clock::time_point time2 = high_resolution_clock::now();
+    duration<double> elapsed_time = duration_cast<duration<double>>(time2-time1);
+    std::cout << "Elapsed time is " << elapsed_time.count() << "seconds" << std::endl;
+
+    if (nfailed>0) {
+        printf("%d products FAILED\n", nfailed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}